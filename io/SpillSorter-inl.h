@@ -0,0 +1,291 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#include "io/SpillSorter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include "ptr/alloc.h"
+
+namespace io {
+
+using namespace std;
+
+template<typename CMP>
+inline
+bool SpillSorter<CMP>::record_order::operator()(const size_t a,
+    const size_t b) const {
+  uint32_t alen, blen;
+  const uint8_t *arec = this->sorter->at(a, alen);
+  const uint8_t *brec = this->sorter->at(b, blen);
+  return this->sorter->cmp(arec, alen, brec, blen);
+}
+
+// Reversed, so that the heap keeps the run with the least head on top.
+template<typename CMP>
+inline
+bool SpillSorter<CMP>::run_order::operator()(const size_t a,
+    const size_t b) const {
+  const vector<uint8_t> &ahead = this->sorter->heads[a];
+  const vector<uint8_t> &bhead = this->sorter->heads[b];
+  return this->sorter->cmp(bhead.empty() ? NULL : &bhead[0], bhead.size(),
+                           ahead.empty() ? NULL : &ahead[0], ahead.size());
+}
+
+template<typename CMP>
+SpillSorter<CMP>::SpillSorter(const string &prefix, const size_t budget)
+    throw()
+    : prefix(prefix), budget(budget), nextoff(0), nnamed(0), last(0),
+      held(false), merging(false) {
+  // do nothing
+}
+
+template<typename CMP>
+SpillSorter<CMP>::SpillSorter(const string &prefix, const size_t budget,
+    const CMP &cmp) throw()
+    : cmp(cmp), prefix(prefix), budget(budget), nextoff(0), nnamed(0),
+      last(0), held(false), merging(false) {
+  // do nothing
+}
+
+template<typename CMP>
+SpillSorter<CMP>::~SpillSorter() throw() {
+  this->cleanup();
+}
+
+template<typename CMP>
+inline
+const uint8_t *SpillSorter<CMP>::at(const size_t offset, uint32_t &len)
+    const throw() {
+  memcpy(&len, &this->buffer[offset], sizeof(uint32_t));
+  return &this->buffer[offset] + sizeof(uint32_t);
+}
+
+template<typename CMP>
+string SpillSorter<CMP>::name() throw() {
+  stringstream ss (stringstream::in | stringstream::out);
+  ss << this->prefix << this->nnamed++;
+  return ss.str();
+}
+
+template<typename CMP>
+void SpillSorter<CMP>::spill() throw(IOException) {
+  this->runs.push_back(this->name());
+  std::sort(this->offsets.begin(), this->offsets.end(), record_order(this));
+  ofstream out (this->runs.back().c_str(),
+                ios::out | ios::binary | ios::trunc);
+  vector<size_t>::const_iterator it = this->offsets.begin();
+  for (; out.good() && it != this->offsets.end(); ++it) {
+    uint32_t len;
+    this->at(*it, len);
+    out.write((const char *) &this->buffer[*it], sizeof(uint32_t) + len);
+  }
+  out.close();
+  if (out.fail()) {
+    THROW(IOException, "Unable to write run of sorted records to disk.");
+  }
+  this->buffer.clear();
+  this->offsets.clear();
+}
+
+// Opens runs [begin, end) and puts the ones that are not empty on the heap.
+template<typename CMP>
+void SpillSorter<CMP>::open(const size_t begin, const size_t end)
+    throw(IOException) {
+  this->inputs.resize(this->runs.size(), NULL);
+  this->heads.resize(this->runs.size());
+  this->heap.clear();
+  this->held = false;
+  size_t i;
+  for (i = begin; i < end; ++i) {
+    NEW(this->inputs[i], ifstream, this->runs[i].c_str(),
+        ios::in | ios::binary);
+    if (this->inputs[i]->fail()) {
+      THROW(IOException, "Unable to open run of sorted records.");
+    }
+    if (this->advance(i)) {
+      this->heap.push_back(i);
+    }
+  }
+  make_heap(this->heap.begin(), this->heap.end(), run_order(this));
+}
+
+template<typename CMP>
+bool SpillSorter<CMP>::advance(const size_t run) throw(IOException) {
+  ifstream *in = this->inputs[run];
+  uint32_t len;
+  in->read((char *) &len, sizeof(uint32_t));
+  if (in->eof() && in->gcount() == 0) {
+    in->close();
+    DELETE(in);
+    this->inputs[run] = NULL;
+    remove(this->runs[run].c_str());
+    vector<uint8_t> empty;
+    this->heads[run].swap(empty);
+    return false;
+  }
+  this->heads[run].resize(len);
+  if (len > 0) {
+    in->read((char *) &this->heads[run][0], len);
+  }
+  if (in->fail()) {
+    THROW(IOException, "Unable to read run of sorted records from disk.");
+  }
+  return true;
+}
+
+// Takes the least head off the heap.  It stays valid until the next call,
+// which first refills the heap from the run that it came from.
+template<typename CMP>
+bool SpillSorter<CMP>::pop(const uint8_t *&rec, uint32_t &len)
+    throw(IOException) {
+  if (this->held && this->advance(this->last)) {
+    this->heap.push_back(this->last);
+    push_heap(this->heap.begin(), this->heap.end(), run_order(this));
+  }
+  this->held = false;
+  if (this->heap.empty()) {
+    return false;
+  }
+  pop_heap(this->heap.begin(), this->heap.end(), run_order(this));
+  this->last = this->heap.back();
+  this->heap.pop_back();
+  this->held = true;
+  const vector<uint8_t> &head = this->heads[this->last];
+  rec = head.empty() ? NULL : &head[0];
+  len = head.size();
+  return true;
+}
+
+// Merges runs [begin, end) into a new run at the end of runs.
+template<typename CMP>
+void SpillSorter<CMP>::combine(const size_t begin, const size_t end)
+    throw(IOException) {
+  if (end - begin == 1) {
+    string run = this->runs[begin];
+    this->runs.push_back(run);
+    return;
+  }
+  this->runs.push_back(this->name());
+  this->open(begin, end);
+  ofstream out (this->runs.back().c_str(),
+                ios::out | ios::binary | ios::trunc);
+  const uint8_t *rec;
+  uint32_t len;
+  while (out.good() && this->pop(rec, len)) {
+    out.write((const char *) &len, sizeof(uint32_t));
+    if (len > 0) {
+      out.write((const char *) rec, len);
+    }
+  }
+  out.close();
+  if (out.fail()) {
+    THROW(IOException, "Unable to write run of sorted records to disk.");
+  }
+}
+
+template<typename CMP>
+void SpillSorter<CMP>::cleanup() throw() {
+  size_t i;
+  for (i = 0; i < this->runs.size(); ++i) {
+    if (i < this->inputs.size() && this->inputs[i] != NULL) {
+      this->inputs[i]->close();
+      DELETE(this->inputs[i]);
+      this->inputs[i] = NULL;
+    }
+    // runs already used up are gone, so this may fail
+    remove(this->runs[i].c_str());
+  }
+  this->runs.clear();
+  this->inputs.clear();
+}
+
+template<typename CMP>
+void SpillSorter<CMP>::add(const uint8_t *rec, const uint32_t len)
+    throw(IOException) {
+  if (this->merging) {
+    THROW(IOException, "Cannot add records after merging has started.");
+  }
+  if (!this->offsets.empty() &&
+      this->buffer.size() + sizeof(uint32_t) + len > this->budget) {
+    this->spill();
+  }
+  size_t offset = this->buffer.size();
+  this->buffer.resize(offset + sizeof(uint32_t) + len);
+  memcpy(&this->buffer[offset], &len, sizeof(uint32_t));
+  if (len > 0) {
+    memcpy(&this->buffer[offset] + sizeof(uint32_t), rec, len);
+  }
+  this->offsets.push_back(offset);
+}
+
+template<typename CMP>
+void SpillSorter<CMP>::merge() throw(IOException) {
+  if (this->merging) {
+    return;
+  }
+  this->merging = true;
+  if (this->runs.empty()) {
+    std::sort(this->offsets.begin(), this->offsets.end(),
+              record_order(this));
+    this->nextoff = 0;
+    return;
+  }
+  if (!this->offsets.empty()) {
+    this->spill();
+  }
+  vector<uint8_t> nobuf;
+  vector<size_t> nooff;
+  this->buffer.swap(nobuf);
+  this->offsets.swap(nooff);
+  // each pass merges groups of runs, appending the results to runs
+  while (this->runs.size() > SPILL_SORTER_FAN_IN) {
+    size_t n = this->runs.size();
+    size_t begin;
+    for (begin = 0; begin < n; begin += SPILL_SORTER_FAN_IN) {
+      this->combine(begin, min(begin + SPILL_SORTER_FAN_IN, n));
+    }
+    this->runs.erase(this->runs.begin(), this->runs.begin() + n);
+    this->inputs.clear();
+    this->heads.clear();
+  }
+  this->open(0, this->runs.size());
+}
+
+template<typename CMP>
+bool SpillSorter<CMP>::next(const uint8_t *&rec, uint32_t &len)
+    throw(IOException) {
+  if (!this->merging) {
+    THROW(IOException, "Must call merge before reading sorted records.");
+  }
+  if (this->runs.empty()) {
+    if (this->nextoff >= this->offsets.size()) {
+      return false;
+    }
+    rec = this->at(this->offsets[this->nextoff++], len);
+    return true;
+  }
+  return this->pop(rec, len);
+}
+
+template<typename CMP>
+inline
+size_t SpillSorter<CMP>::numRuns() const throw() {
+  return this->runs.size();
+}
+
+}
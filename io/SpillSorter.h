@@ -0,0 +1,104 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#ifndef __IO__SPILLSORTER_H__
+#define __IO__SPILLSORTER_H__
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include "io/IOException.h"
+#include "sys/ints.h"
+
+// Most runs that SpillSorter reads at once; must be at least 2.
+#ifndef SPILL_SORTER_FAN_IN
+#define SPILL_SORTER_FAN_IN 64
+#endif
+
+namespace io {
+
+using namespace std;
+
+/*
+ * Sorts byte records that may not fit in memory.  Records are buffered
+ * until they take up more than budget bytes, at which point the buffer
+ * is sorted and written out as a run to a file named prefix followed by
+ * the run number.  After the last add(), call merge() and then next()
+ * until it returns false to get the records back in order; run files
+ * are removed as they are used up.  At most SPILL_SORTER_FAN_IN runs
+ * are open at once, so when there are more, merge() first merges them
+ * in groups into longer runs until few enough are left.
+ * 
+ * CMP must provide
+ *   bool operator()(const uint8_t *a, const uint32_t alen,
+ *                   const uint8_t *b, const uint32_t blen) const;
+ * returning true when record a belongs before record b.  Records that
+ * compare equal come back in no particular order.
+ */
+template<typename CMP>
+class SpillSorter {
+private:
+  struct record_order {
+    const SpillSorter<CMP> *sorter;
+    record_order(const SpillSorter<CMP> *sorter) : sorter(sorter) {}
+    bool operator()(const size_t a, const size_t b) const;
+  };
+  struct run_order {
+    const SpillSorter<CMP> *sorter;
+    run_order(const SpillSorter<CMP> *sorter) : sorter(sorter) {}
+    bool operator()(const size_t a, const size_t b) const;
+  };
+  CMP cmp;
+  string prefix;
+  size_t budget;
+  // each record is a uint32_t length followed by the record
+  vector<uint8_t> buffer;
+  vector<size_t> offsets;
+  vector<string> runs;
+  vector<ifstream*> inputs;
+  vector<vector<uint8_t> > heads;
+  vector<size_t> heap;
+  size_t nextoff;
+  size_t nnamed;
+  size_t last;
+  bool held;
+  bool merging;
+
+  const uint8_t *at(const size_t offset, uint32_t &len) const throw();
+  string name() throw();
+  void spill() throw(IOException);
+  void open(const size_t begin, const size_t end) throw(IOException);
+  bool advance(const size_t run) throw(IOException);
+  bool pop(const uint8_t *&rec, uint32_t &len) throw(IOException);
+  void combine(const size_t begin, const size_t end) throw(IOException);
+  void cleanup() throw();
+public:
+  SpillSorter(const string &prefix, const size_t budget) throw();
+  SpillSorter(const string &prefix, const size_t budget, const CMP &cmp)
+      throw();
+  ~SpillSorter() throw();
+
+  void add(const uint8_t *rec, const uint32_t len) throw(IOException);
+  void merge() throw(IOException);
+  // rec is valid until the next call to next().
+  bool next(const uint8_t *&rec, uint32_t &len) throw(IOException);
+  size_t numRuns() const throw();
+};
+
+}
+
+#include "io/SpillSorter-inl.h"
+
+#endif /* __IO__SPILLSORTER_H__ */
@@ -0,0 +1,97 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+// small enough that merging takes several passes
+#ifndef SPILL_SORTER_FAN_IN
+#define SPILL_SORTER_FAN_IN 3
+#endif
+
+#include "test/unit.h"
+#include "io/SpillSorter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#define PREFIX "testSpillSorter-"
+
+using namespace io;
+using namespace ptr;
+using namespace std;
+
+struct uint32_order {
+  bool operator()(const uint8_t *a, const uint32_t alen,
+                  const uint8_t *b, const uint32_t blen) const {
+    uint32_t x, y;
+    memcpy(&x, a, sizeof(uint32_t));
+    memcpy(&y, b, sizeof(uint32_t));
+    return x < y;
+  }
+};
+
+bool exists(const size_t run) {
+  stringstream ss (stringstream::in | stringstream::out);
+  ss << PREFIX << run;
+  ifstream in (ss.str().c_str());
+  return in.is_open();
+}
+
+// Sorts n numbers, keeping at most budget bytes of them in memory, and
+// checks how many runs are left to read once merging starts.
+bool test(const size_t n, const size_t budget, const size_t runs) {
+  vector<uint32_t> values;
+  size_t i;
+  for (i = 0; i < n; ++i) {
+    values.push_back((uint32_t) ((i * 7919) % 1009));
+  }
+  SpillSorter<uint32_order> sorter (PREFIX, budget);
+  for (i = 0; i < n; ++i) {
+    sorter.add((const uint8_t *) &values[i], sizeof(uint32_t));
+  }
+  sorter.merge();
+  PROG(sorter.numRuns() == runs);
+  sort(values.begin(), values.end());
+  const uint8_t *rec;
+  uint32_t len;
+  for (i = 0; i < n && sorter.next(rec, len); ++i) {
+    uint32_t value;
+    memcpy(&value, rec, sizeof(uint32_t));
+    if (len != sizeof(uint32_t) || value != values[i]) {
+      break;
+    }
+  }
+  PROG(i == n);
+  PROG(!sorter.next(rec, len));
+  // no run file is left behind, including those of earlier passes
+  for (i = 0; i < 2*n; ++i) {
+    if (exists(i)) {
+      break;
+    }
+  }
+  PROG(i == 2*n);
+  PASS;
+}
+
+int main(int argc, char **argv) {
+  INIT;
+  // each record takes up eight bytes
+  TEST(test, 1000, 1 << 20, 0);
+  TEST(test, 1000, 3000, 3);
+  TEST(test, 1000, 2400, 2);
+  TEST(test, 1000, 64, 2);
+  FINAL;
+}
@@ -0,0 +1,122 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#ifndef __MAIN__ARRAY_H__
+#define __MAIN__ARRAY_H__
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include "main/encode.h"
+
+// A vector-like tuple of constants fixed to at most N elements, used by
+// the reasoners for tuples when compiled with -DTUPLE_SIZE=N.
+template<size_t N>
+class Array {
+private:
+  constint_t data[N];
+  size_t sz;
+  void safety_check(size_t s) {
+    if (s > N) {
+      std::stringstream ss(std::stringstream::in | std::stringstream::out);
+      ss << "[ERROR] You have requested size " << s << " but fixed to " << N << ".  You will probably see a segmentation fault or bus error soon hereafter." << std::endl;
+      std::cerr << ss.str();
+    }
+  }
+public:
+  typedef constint_t* iterator;
+  typedef const constint_t* const_iterator;
+  Array() : sz(0) {
+    std::fill_n(this->data, N, 0);
+  }
+  Array(size_t n)
+      : sz(n) {
+    safety_check(n);
+    std::fill_n(this->data, N, 0);
+  }
+  Array(size_t n, const constint_t &val)
+      : sz(n) {
+    safety_check(n);
+    std::fill_n(this->data, n, val);
+    std::fill_n(this->data + n, N - n, 0);
+  }
+  Array(const Array<N> &copy)
+      : sz(copy.sz) {
+    std::copy(copy.data, copy.data + N, this->data);
+  }
+  ~Array() {}
+  Array &operator=(const Array<N> &rhs) {
+    this->sz = rhs.sz;
+    std::copy(rhs.data, rhs.data + rhs.sz, this->data);
+    return *this;
+  }
+  iterator begin() { return this->data; }
+  const_iterator begin() const { return this->data; }
+  iterator end() { return this->data + this->sz; }
+  const_iterator end() const { return this->data + this->sz; }
+  size_t size() const { return this->sz; }
+  size_t max_size() const { return N; }
+  void resize(size_t n) {
+    safety_check(n);
+    if (n < this->sz) {
+      std::fill(this->data + n, this->data + this->sz, 0);
+    }
+    this->sz = n;
+  }
+  void resize(size_t n, constint_t val) {
+    safety_check(n);
+    if (this->sz < n) {
+      std::fill(this->data + this->sz, this->data + n, val);
+    } else if (n < this->sz) {
+      std::fill(this->data + n, this->data + this->sz, 0);
+    }
+    this->sz = n;
+  }
+  size_t capacity() const { return N; }
+  bool empty() const { return this->sz == 0; }
+  void reserve(size_t  n) {
+    safety_check(n);
+  }
+  constint_t &operator[](size_t i) { return this->data[i]; }
+  const constint_t &operator[](size_t i) const { return this->data[i]; }
+  constint_t &at(size_t i) { return this->data[i]; }
+  const constint_t &at(size_t i) const { return this->data[i]; }
+  constint_t &front() { return this->data[0]; }
+  const constint_t &front() const { return this->data[0]; }
+  constint_t &back() { return this->data[this->sz-1]; }
+  const constint_t &back() const { return this->data[this->sz-1]; }
+  void push_back(const constint_t &val) {
+    safety_check(this->sz + 1);
+    this->data[this->sz++] = val;
+  }
+  void pop_back() {
+    this->data[--this->sz] = 0;
+  }
+  void swap(Array<N> &t) {
+    size_t x = std::max(this->sz, t.sz);
+    std::swap_ranges(this->data, this->data + x, t.data);
+    std::swap(this->sz, t.sz);
+  }
+  void clear() {
+    std::fill_n(this->data, this->sz, 0);
+    this->sz = 0;
+  }
+  bool operator<(const Array<N> &t) const {
+    return std::lexicographical_compare(this->data, this->data + this->sz,
+                                        t.data, t.data + t.sz);
+  }
+};
+
+#endif /* __MAIN__ARRAY_H__ */
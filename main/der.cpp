@@ -27,12 +27,20 @@
 #include "rdf/RDFDictEncReader.h"
 #include "rdf/RDFDictEncWriter.h"
 #include "rdf/RDFDictionary.h"
+#include "rdf/RDFInlineEncoder.h"
 #include "sys/endian.h"
 #include "sys/ints.h"
 #include "util/funcs.h"
 
 #define NBYTES 8
 
+// Pack small numeric, boolean and date literals into their identifiers
+// instead of giving them dictionary entries.  Data encoded with this
+// setting must also be decoded with it.
+#ifndef INLINE_LITERALS
+#define INLINE_LITERALS 1
+#endif
+
 using namespace io;
 using namespace ptr;
 using namespace rdf;
@@ -61,7 +69,11 @@ public:
 
 RDFDictionary<ID> CustomRDFEncoder::dict = RDFDictionary<ID>();
 
+#if INLINE_LITERALS
+typedef RDFInlineEncoder<ID, CustomRDFEncoder> ENC;
+#else
 typedef CustomRDFEncoder ENC;
+#endif
 
 struct cmdargs_t {
   set<string> lookups;
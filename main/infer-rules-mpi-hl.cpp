@@ -19,6 +19,7 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <list>
 #include <map>
 #include <mpi.h>
@@ -28,7 +29,9 @@
 #include <utility>
 #include <vector>
 #include "main/encode.h"
+#include "par/BatchDistributor.h"
 #include "par/DistComputation.h"
+#include "par/MPIAlltoallDistributor.h"
 #include "par/MPIPacketDistributor.h"
 #include "ptr/DPtr.h"
 #include "ptr/MPtr.h"
@@ -36,10 +39,16 @@
 
 bool RANDOMIZE = false;
 bool COMPLETE = false;
+bool ALLTOALL = false;
+bool PIPELINE = false;
+bool COMPRESS = false;
+bool SEMI_NAIVE = false;
+bool SKEW_AWARE = false;
 int PAGESIZE = 4*1024*1024;
 int NUMREQUESTS = 100;
 int COORDEVERY = 100;
 int PACKETSIZE = 128;
+int BATCHSIZE = 8192;
 
 #ifndef NPROCS_PER_NODE
 #define NPROCS_PER_NODE 1
@@ -55,6 +64,37 @@ using namespace par;
 using namespace ptr;
 using namespace std;
 
+// Per-message MPI traffic is bound by message rate, so unless
+// --batch-size 0 is given, messages are coalesced per destination rank
+// into BATCHSIZE-byte batches.  Every caller knows all of its outgoing
+// triples up front, so with --alltoall the whole exchange is instead
+// done with one collective.  MPIPacketDistributor only carries
+// messages of exactly msgsize bytes, so the variable-sized blocks of
+// --compress always travel in batches, if need be one per batch.
+Distributor *new_distributor(MPI::Intracomm &comm, const size_t msgsize,
+                             const int tag) {
+  Distributor *dist;
+  if (ALLTOALL) {
+    NEW(dist, MPIAlltoallDistributor, comm, 1 << 30);
+    return dist;
+  }
+  size_t batchsize = BATCHSIZE <= 0 ? 0 : (size_t) BATCHSIZE;
+  if (batchsize < msgsize + (sizeof(uint32_t) << 1)) {
+    if (!COMPRESS) {
+      NEW(dist, MPIPacketDistributor, comm, msgsize, NUMREQUESTS, COORDEVERY,
+          tag);
+      return dist;
+    }
+    batchsize = msgsize + (sizeof(uint32_t) << 1);
+  }
+  Distributor *packets;
+  NEW(packets, MPIPacketDistributor, comm, batchsize, NUMREQUESTS,
+      COORDEVERY, tag);
+  NEW(dist, BatchDistributor, comm.Get_size(), batchsize, COORDEVERY,
+      packets);
+  return dist;
+}
+
 void *myalloc(size_t num_items, size_t item_size) {
 #ifdef USE_POSIX_MEMALIGN
   void *p = NULL;
@@ -1040,6 +1080,25 @@ TripleIndex idxpos (Order(1, 2, 0));
 TripleIndex idxosp (Order(2, 0, 1));
 map<constint_t, Index> atoms;
 
+// With --semi-naive, every triple added to idxpos on this rank is also
+// appended to derived, and rule r has already been evaluated against
+// everything before derived[evaluated_upto[r]] (NOT_EVALUATED if it must
+// be evaluated over all the data).  The delta indexes hold the part of
+// derived that the rule being evaluated has not seen, and delta_slot is
+// the slot of its body currently matched against them.
+const size_t NOT_EVALUATED = (size_t) -1;
+vector<Triple> derived;
+vector<size_t> evaluated_upto;
+vector<size_t> atoms_seen;
+TripleIndex dltspo (Order(0, 1, 2));
+TripleIndex dltpos (Order(1, 2, 0));
+TripleIndex dltosp (Order(2, 0, 1));
+pair<Term, Term> *delta_slot = NULL;
+
+// Triples that every node already has, so that redistribution for
+// completeness need not send them again.
+TripleIndex replicated (Order(1, 2, 0));
+
 MPI::Intracomm COMM_LOCAL;
 MPI::Intracomm COMM_REPLS;
 
@@ -1134,15 +1193,27 @@ bool join(Tuple &t1, const Tuple &t2, Tuple &r) {
   return true;
 }
 
+// Tuples whose hash is a key of heavy are not sent to a single rank:
+// if it maps to true they are spread round-robin over all ranks, and
+// otherwise each of them is copied to every rank.
 class HashTuples : public DistComputation {
 private:
   Hash hash;
   Relation::const_iterator begin, end;
   int rank, nproc;
+  map<uint32_t, bool> heavy;
+  int next_split, next_copy;
 public:
   Relation hashed;
   HashTuples(Distributor *dist, int rank, int np, const Relation &rel, Hash h) throw(BaseException<void*>)
-      : DistComputation(dist), rank(rank), nproc(np), begin(rel.begin()), end(rel.end()), hash(h) {
+      : DistComputation(dist), rank(rank), nproc(np), begin(rel.begin()), end(rel.end()), hash(h),
+        next_split(rank), next_copy(0) {
+    // do nothing
+  }
+  HashTuples(Distributor *dist, int rank, int np, const Relation &rel, Hash h,
+             const map<uint32_t, bool> &heavy) throw(BaseException<void*>)
+      : DistComputation(dist), rank(rank), nproc(np), begin(rel.begin()), end(rel.end()), hash(h),
+        heavy(heavy), next_split(rank), next_copy(0) {
     // do nothing
   }
   virtual ~HashTuples() throw(DistException) {
@@ -1158,10 +1229,29 @@ public:
     if (this->begin == this->end) {
       return -2;
     }
-    int send_to = this->hash(*this->begin) % this->nproc;
+    int send_to;
+    bool advance = true;
+    uint32_t h = this->hash(*this->begin);
+    map<uint32_t, bool>::const_iterator hv = this->heavy.find(h);
+    if (hv == this->heavy.end()) {
+      send_to = h % this->nproc;
+    } else if (hv->second) {
+      send_to = this->next_split;
+      this->next_split = (this->next_split + 1) % this->nproc;
+    } else {
+      send_to = this->next_copy++;
+      if (this->next_copy < this->nproc) {
+        advance = false;
+      } else {
+        this->next_copy = 0;
+      }
+    }
     if (send_to == this->rank) {
       this->hashed.push_back(*this->begin);
-      return (++this->begin == this->end ? -2 : -1);
+      if (advance) {
+        ++this->begin;
+      }
+      return (this->begin == this->end ? -2 : -1);
     }
     len = TUPLE_SIZE * sizeof(constint_t);
     if (buffer->size() < len) {
@@ -1171,7 +1261,9 @@ public:
       } RETHROW_BAD_ALLOC
     }
     memcpy(buffer->dptr(), this->begin->begin(), len);
-    ++this->begin;
+    if (advance) {
+      ++this->begin;
+    }
     return send_to;
   }
   void dropoff(DPtr<uint8_t> *msg) throw(TraceableException) {
@@ -1219,23 +1311,117 @@ void join(Relation &lhs, Relation &rhs, vector<size_t> &vars, Relation &result)
   DEBUG("  Result size = ", result.size());
 }
 #else
+#ifndef JOIN_SAMPLE
+#define JOIN_SAMPLE 1024
+#endif
+#ifndef HEAVY_CANDIDATES
+#define HEAVY_CANDIDATES 8
+#endif
+#ifndef HEAVY_MIN
+#define HEAVY_MIN 64
+#endif
+
+// Estimate the most frequent keys (by hash) of rel from a sample of at
+// most about JOIN_SAMPLE tuples.  Fills keys and counts with exactly
+// HEAVY_CANDIDATES entries, padded with zero counts.
+void sample_keys(const Relation &rel, const Hash &hash, uint32_t *keys,
+                 unsigned long *counts) {
+  size_t stride = max((size_t) 1, rel.size() / JOIN_SAMPLE);
+  map<uint32_t, unsigned long> freq;
+  Relation::const_iterator it = rel.begin();
+  size_t i;
+  for (i = 0; it != rel.end(); ++it, ++i) {
+    if (i % stride == 0) {
+      freq[hash(*it)] += stride;
+    }
+  }
+  multimap<unsigned long, uint32_t> top;
+  map<uint32_t, unsigned long>::const_iterator fit = freq.begin();
+  for (; fit != freq.end(); ++fit) {
+    top.insert(pair<unsigned long, uint32_t>(fit->second, fit->first));
+    if (top.size() > HEAVY_CANDIDATES) {
+      top.erase(top.begin());
+    }
+  }
+  multimap<unsigned long, uint32_t>::const_iterator tit = top.begin();
+  for (i = 0; i < HEAVY_CANDIDATES; ++i) {
+    keys[i] = tit == top.end() ? 0 : tit->second;
+    counts[i] = tit == top.end() ? 0 : tit->first;
+    if (tit != top.end()) {
+      ++tit;
+    }
+  }
+}
+
+// With --skew-aware, find the join keys that would overload the rank they
+// hash to, i.e., those that occur more often on one side than the average
+// number of tuples per rank on that side, based on samples exchanged over
+// COMM_LOCAL.  For each such key, the side with more of its tuples is
+// split over all ranks and the other side is copied to all of them.
+void find_heavy_keys(const Relation &lhs, const Relation &rhs,
+                     const Hash &hash, map<uint32_t, bool> &lhs_heavy,
+                     map<uint32_t, bool> &rhs_heavy) {
+  int local_nproc = COMM_LOCAL.Get_size();
+  uint32_t keys[HEAVY_CANDIDATES << 1];
+  unsigned long counts[HEAVY_CANDIDATES << 1];
+  sample_keys(lhs, hash, keys, counts);
+  sample_keys(rhs, hash, keys + HEAVY_CANDIDATES, counts + HEAVY_CANDIDATES);
+  vector<uint32_t> all_keys(local_nproc * (HEAVY_CANDIDATES << 1));
+  vector<unsigned long> all_counts(all_keys.size());
+  COMM_LOCAL.Allgather(keys, HEAVY_CANDIDATES << 1, MPI::UNSIGNED,
+                       &all_keys[0], HEAVY_CANDIDATES << 1, MPI::UNSIGNED);
+  COMM_LOCAL.Allgather(counts, HEAVY_CANDIDATES << 1, MPI::UNSIGNED_LONG,
+                       &all_counts[0], HEAVY_CANDIDATES << 1,
+                       MPI::UNSIGNED_LONG);
+  unsigned long sizes[2] = { lhs.size(), rhs.size() };
+  unsigned long totals[2];
+  COMM_LOCAL.Allreduce(sizes, totals, 2, MPI::UNSIGNED_LONG, MPI::SUM);
+  map<uint32_t, pair<unsigned long, unsigned long> > est;
+  size_t i;
+  for (i = 0; i < all_keys.size(); ++i) {
+    if (all_counts[i] == 0) {
+      continue;
+    }
+    pair<unsigned long, unsigned long> &e = est[all_keys[i]];
+    if (i % (HEAVY_CANDIDATES << 1) < HEAVY_CANDIDATES) {
+      e.first += all_counts[i];
+    } else {
+      e.second += all_counts[i];
+    }
+  }
+  map<uint32_t, pair<unsigned long, unsigned long> >::const_iterator it;
+  for (it = est.begin(); it != est.end(); ++it) {
+    unsigned long l = it->second.first;
+    unsigned long r = it->second.second;
+    if ((l >= HEAVY_MIN && l * local_nproc > totals[0]) ||
+        (r >= HEAVY_MIN && r * local_nproc > totals[1])) {
+      lhs_heavy[it->first] = l >= r;
+      rhs_heavy[it->first] = l < r;
+    }
+  }
+}
+
 void join(Relation &lhs, Relation &rhs, vector<size_t> &vars, Relation &result) {
 #if NPROCS_PER_NODE > 1
   int local_rank = COMM_LOCAL.Get_rank();
   int local_nproc = COMM_LOCAL.Get_size();
   Hash hash(vars, false);
+  map<uint32_t, bool> lhs_heavy, rhs_heavy;
+  if (SKEW_AWARE && local_nproc > 1) {
+    find_heavy_keys(lhs, rhs, hash, lhs_heavy, rhs_heavy);
+  }
   Distributor *dist;
   HashTuples *hash_tuples;
-  NEW(dist, MPIPacketDistributor, COMM_LOCAL, TUPLE_SIZE*sizeof(constint_t),
-      NUMREQUESTS, COORDEVERY, 789);
-  NEW(hash_tuples, HashTuples, dist, local_rank, local_nproc, lhs, hash);
-  hash_tuples->exec();
+  dist = new_distributor(COMM_LOCAL, TUPLE_SIZE*sizeof(constint_t), 789);
+  NEW(hash_tuples, HashTuples, dist, local_rank, local_nproc, lhs, hash,
+      lhs_heavy);
+  hash_tuples->exec(PIPELINE);
   lhs.swap(hash_tuples->hashed);
   DELETE(hash_tuples);
-  NEW(dist, MPIPacketDistributor, COMM_LOCAL, TUPLE_SIZE*sizeof(constint_t),
-      NUMREQUESTS, COORDEVERY, 790);
-  NEW(hash_tuples, HashTuples, dist, local_rank, local_nproc, rhs, hash);
-  hash_tuples->exec();
+  dist = new_distributor(COMM_LOCAL, TUPLE_SIZE*sizeof(constint_t), 790);
+  NEW(hash_tuples, HashTuples, dist, local_rank, local_nproc, rhs, hash,
+      rhs_heavy);
+  hash_tuples->exec(PIPELINE);
   rhs.swap(hash_tuples->hashed);
   DELETE(hash_tuples);
 #endif
@@ -1491,9 +1677,10 @@ void query_atom(Atom &atom, set<varint_t> &allvars, Relation &results) {
   results.swap(temp);
 }
 
-void scan_triples(Triple &triple_pattern, TripleIndex &results) {
-  TripleIndex::const_iterator it = idxpos.begin();
-  for (; it != idxpos.end(); ++it) {
+void scan_triples(const TripleIndex &data, Triple &triple_pattern,
+                  TripleIndex &results) {
+  TripleIndex::const_iterator it = data.begin();
+  for (; it != data.end(); ++it) {
     size_t i;
     for (i = 0; i < 3; ++i) {
       if (triple_pattern[i] != 0 && triple_pattern[i] != it->at(i)) {
@@ -1574,6 +1761,14 @@ void query(Atomic &atom, set<varint_t> &allvars, Relation &results) {
       maxvar = max(maxvar, obj.get.variable);
       newvars.insert(obj.get.variable);
     }
+    bool from_delta = slot == delta_slot;
+    const TripleIndex &pos = from_delta ? dltpos : idxpos;
+#if USE_INDEX_SPO
+    const TripleIndex &spo = from_delta ? dltspo : idxspo;
+#endif
+#if USE_INDEX_OSP
+    const TripleIndex &osp = from_delta ? dltosp : idxosp;
+#endif
     int idx = (subj.type == CONSTANT ? 0x4 : 0x0) |
               (pred.type == CONSTANT ? 0x2 : 0x0) |
               ( obj.type == CONSTANT ? 0x1 : 0x0);
@@ -1583,31 +1778,31 @@ void query(Atomic &atom, set<varint_t> &allvars, Relation &results) {
       case 0x4:
       case 0x6: // SPO
 #if USE_INDEX_SPO
-        begin = idxspo.lower_bound(mintriple);
-        end = idxspo.upper_bound(maxtriple);
+        begin = spo.lower_bound(mintriple);
+        end = spo.upper_bound(maxtriple);
 #else
-        scan_triples(mintriple, scanned);
+        scan_triples(pos, mintriple, scanned);
         begin = scanned.begin();
         end = scanned.end();
 #endif
         break;
       case 0x0:
-        begin = idxpos.begin();
-        end = idxpos.end();
+        begin = pos.begin();
+        end = pos.end();
         break;
       case 0x2:
       case 0x3:
       case 0x7: // POS
-        begin = idxpos.lower_bound(mintriple);
-        end = idxpos.upper_bound(maxtriple);
+        begin = pos.lower_bound(mintriple);
+        end = pos.upper_bound(maxtriple);
         break;
       case 0x1:
       case 0x5: // OSP
 #if USE_INDEX_OSP
-        begin = idxosp.lower_bound(mintriple);
-        end = idxosp.upper_bound(maxtriple);
+        begin = osp.lower_bound(mintriple);
+        end = osp.upper_bound(maxtriple);
 #else
-        scan_triples(mintriple, scanned);
+        scan_triples(pos, mintriple, scanned);
         begin = scanned.begin();
         end = scanned.end();
 #endif
@@ -1815,10 +2010,9 @@ void act(ActionBlock &action_block, Relation &results, TripleIndex &assertions,
   hash.hack_randomize = true;
   Distributor *dist;
   HashTuples *hash_tuples;
-  NEW(dist, MPIPacketDistributor, COMM_LOCAL, TUPLE_SIZE*sizeof(constint_t),
-      NUMREQUESTS, COORDEVERY, 833);
+  dist = new_distributor(COMM_LOCAL, TUPLE_SIZE*sizeof(constint_t), 833);
   NEW(hash_tuples, HashTuples, dist, local_rank, local_nproc, results, hash);
-  hash_tuples->exec();
+  hash_tuples->exec(PIPELINE);
   results.swap(hash_tuples->hashed);
   DELETE(hash_tuples);
 #endif
@@ -1904,6 +2098,155 @@ void infer(Rule &rule, TripleIndex &assertions, TripleIndex &retractions) {
   act(rule.action_block, results, assertions, retractions);
 }
 
+// The frame slots in the body of a rule that read triples, and whether
+// it reads atoms.
+void collect_slots(Condition &condition,
+                   vector<pair<Term*, pair<Term, Term>*> > &slots,
+                   bool &uses_atoms) {
+  switch (condition.type) {
+    case ATOMIC: {
+      Atomic &atom = condition.get.atom;
+      if (atom.type == ATOM) {
+        uses_atoms = true;
+      } else if (atom.type == FRAME) {
+        pair<Term, Term> *slot = atom.get.frame.slots.begin;
+        for (; slot != atom.get.frame.slots.end; ++slot) {
+          slots.push_back(pair<Term*, pair<Term, Term>*>(
+              &atom.get.frame.object, slot));
+        }
+      }
+      return;
+    }
+    case CONJUNCTION:
+    case EXISTENTIAL: {
+      Condition *subformula = condition.get.subformulas.begin;
+      for (; subformula != condition.get.subformulas.end; ++subformula) {
+        collect_slots(*subformula, slots, uses_atoms);
+      }
+      return;
+    }
+    default:
+      return; // negation does not read data, disjunction is unsupported
+  }
+}
+
+// Number of triples in the local delta that could match subj[slot].
+unsigned long count_delta(Term &subj, pair<Term, Term> &slot) {
+  Term *terms[3] = { &subj, &slot.first, &slot.second };
+  Triple mintriple(3);
+  Triple maxtriple(3);
+  size_t i;
+  for (i = 0; i < 3; ++i) {
+    if (terms[i]->type == CONSTANT) {
+      mintriple[i] = maxtriple[i] = terms[i]->get.constant;
+    } else {
+      mintriple[i] = 0;
+      maxtriple[i] = CONSTINT_MAX;
+    }
+  }
+  TripleIndex::const_iterator it = dltpos.begin();
+  TripleIndex::const_iterator end = dltpos.end();
+  if (terms[1]->type == CONSTANT) {
+    it = dltpos.lower_bound(mintriple);
+    end = dltpos.upper_bound(maxtriple);
+  }
+  unsigned long count = 0;
+  for (; it != end; ++it) {
+    for (i = 0; i < 3; ++i) {
+      if (terms[i]->type == CONSTANT && it->at(i) != mintriple[i]) {
+        break;
+      }
+    }
+    if (i == 3) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+size_t count_atoms() {
+  size_t count = 0;
+  map<constint_t, Index>::const_iterator it = atoms.begin();
+  for (; it != atoms.end(); ++it) {
+    count += it->second.size();
+  }
+  return count;
+}
+
+// Semi-naive evaluation of rule number r.  Each slot of its body is in
+// turn matched against the triples derived on any rank since the rule was
+// last evaluated, with the rest of the body matched against all of the
+// data; slots that match nothing new anywhere in COMM_LOCAL are skipped.
+// The rule is evaluated over all of the data the first time, and when it
+// reads atoms and the atoms have changed since.  All of these decisions
+// are made on global counts because join is collective.
+void infer(size_t r, Rule &rule, TripleIndex &assertions,
+           TripleIndex &retractions) {
+  vector<pair<Term*, pair<Term, Term>*> > slots;
+  bool uses_atoms = false;
+  collect_slots(rule.condition, slots, uses_atoms);
+  size_t from = evaluated_upto[r];
+  evaluated_upto[r] = derived.size();
+  size_t natoms = count_atoms();
+  vector<unsigned long> counts(slots.size() + 1, 0);
+  if (from == NOT_EVALUATED || (uses_atoms && atoms_seen[r] != natoms)) {
+    counts[0] = 1;
+  } else {
+    dltpos.clear();
+    dltpos.insert(derived.begin() + from, derived.end());
+#if USE_INDEX_SPO
+    dltspo.clear();
+    dltspo.insert(derived.begin() + from, derived.end());
+#endif
+#if USE_INDEX_OSP
+    dltosp.clear();
+    dltosp.insert(derived.begin() + from, derived.end());
+#endif
+    size_t i;
+    for (i = 0; i < slots.size(); ++i) {
+      counts[i + 1] = count_delta(*slots[i].first, *slots[i].second);
+    }
+  }
+  atoms_seen[r] = natoms;
+  vector<unsigned long> global_counts(counts.size());
+  COMM_LOCAL.Allreduce(&counts[0], &global_counts[0], counts.size(),
+                       MPI::UNSIGNED_LONG, MPI::SUM);
+  if (global_counts[0] > 0) {
+    infer(rule, assertions, retractions);
+  } else {
+    size_t i;
+    for (i = 0; i < slots.size(); ++i) {
+      if (global_counts[i + 1] == 0) {
+        continue;
+      }
+      delta_slot = slots[i].second;
+      infer(rule, assertions, retractions);
+    }
+    delta_slot = NULL;
+  }
+  dltpos.clear();
+  dltspo.clear();
+  dltosp.clear();
+}
+
+// Forget the part of derived that every rule has already seen.
+void trim_derived() {
+  size_t low = derived.size();
+  vector<size_t>::const_iterator it = evaluated_upto.begin();
+  for (; it != evaluated_upto.end(); ++it) {
+    if (*it != NOT_EVALUATED) {
+      low = min(low, *it);
+    }
+  }
+  derived.erase(derived.begin(), derived.begin() + low);
+  vector<size_t>::iterator uit = evaluated_upto.begin();
+  for (; uit != evaluated_upto.end(); ++uit) {
+    if (*uit != NOT_EVALUATED) {
+      *uit -= low;
+    }
+  }
+}
+
 #define USE_OLD_WAY 0
 #if !USE_OLD_WAY
 void note_sizes(vector<size_t> &sizes) {
@@ -1922,6 +2265,10 @@ void infer(vector<Rule> &rules) {
   size_t cycle_count;
   vector<size_t> old_sizes;
   note_sizes(old_sizes);
+  if (SEMI_NAIVE && evaluated_upto.size() != rules.size()) {
+    evaluated_upto.assign(rules.size(), NOT_EVALUATED);
+    atoms_seen.assign(rules.size(), 0);
+  }
   for (cycle_count = 0; rules_since_change < rules.size(); ++cycle_count) {
     size_t rulecount;
     for (rulecount = 0; rulecount < rules.size() && rules_since_change < rules.size(); ++rulecount) {
@@ -1932,8 +2279,13 @@ void infer(vector<Rule> &rules) {
 
         TripleIndex assertions (Order(1, 2, 0));
         TripleIndex retractions (Order(1, 2, 0));
-        infer(rules[rulecount], assertions, retractions);
+        if (SEMI_NAIVE) {
+          infer(rulecount, rules[rulecount], assertions, retractions);
+        } else {
+          infer(rules[rulecount], assertions, retractions);
+        }
 
+        bool retracted = false;
         TripleIndex::iterator it = retractions.begin();
         for (; it != retractions.end(); ++it) {
           if (idxpos.erase(*it) > 0) {
@@ -1944,6 +2296,7 @@ void infer(vector<Rule> &rules) {
             idxosp.erase(*it);
 #endif
             changed = true;
+            retracted = true;
           }
         }
         it = assertions.begin();
@@ -1955,15 +2308,25 @@ void infer(vector<Rule> &rules) {
 #if USE_INDEX_OSP
             idxosp.insert(*it);
 #endif
+            if (SEMI_NAIVE) {
+              derived.push_back(*it);
+            }
             changed = true;
           }
         }
 
         vector<size_t> new_sizes;
         note_sizes(new_sizes);
-        bool self_change = changed || old_sizes != new_sizes;
+        bool self_change[2] = { changed || old_sizes != new_sizes, retracted };
+        bool any_change[2];
         old_sizes.swap(new_sizes);
-        COMM_LOCAL.Allreduce(&self_change, &changed, 1, MPI::BOOL, MPI::LOR);
+        COMM_LOCAL.Allreduce(self_change, any_change, 2, MPI::BOOL, MPI::LOR);
+        changed = any_change[0];
+        if (any_change[1] && SEMI_NAIVE) {
+          // Derivations may have been lost; start over with everything.
+          evaluated_upto.assign(rules.size(), NOT_EVALUATED);
+          replicated.clear();
+        }
       }
 
       if (app_count > 1) {
@@ -1973,6 +2336,9 @@ void infer(vector<Rule> &rules) {
       }
     }
   }
+  if (SEMI_NAIVE) {
+    trim_derived();
+  }
   int rank = MPI::COMM_WORLD.Get_rank();
   int inconsistent = atoms[CONST_RIF_ERROR].empty() ? 0 : 1; 
   if (inconsistent > 0) { 
@@ -2069,22 +2435,141 @@ void infer(vector<Rule> &rules) {
 
 ///// IO AND DISTRIBUTION /////
 
+#ifndef COMPRESSBLOCK
+#define COMPRESSBLOCK 256
+#endif
+// Worst case encoding of a block: ten varint bytes per component.
+#define COMPRESSBLOCK_BYTES (COMPRESSBLOCK * 3 * 10)
+
+size_t triple_msgsize() {
+  return COMPRESS ? COMPRESSBLOCK_BYTES : 3*sizeof(constint_t);
+}
+
+// With --compress, the triples a processor sends to each destination
+// are collected into blocks of up to COMPRESSBLOCK triples.  A block is
+// sorted and sent as varints: for each triple, zero for each leading
+// component shared with the previous triple, the difference at the
+// first component that changed, and the remaining components as is.
+class TripleBlocks {
+private:
+  vector<vector<Triple> > blocks;
+  size_t flushed;
+  void encode(vector<Triple> &block, DPtr<uint8_t> *&buffer, size_t &len)
+      throw(BadAllocException) {
+    if (buffer->size() < COMPRESSBLOCK_BYTES) {
+      buffer->drop();
+      try {
+        NEW(buffer, MPtr<uint8_t>, COMPRESSBLOCK_BYTES);
+      } RETHROW_BAD_ALLOC
+    }
+    sort(block.begin(), block.end());
+    uint8_t *write_to = buffer->dptr();
+    Triple prev(3, 0);
+    vector<Triple>::const_iterator it = block.begin();
+    for (; it != block.end(); ++it) {
+      size_t i;
+      for (i = 0; i < 2 && it->at(i) == prev[i]; ++i) {
+        // find first component that changed
+      }
+      size_t j;
+      for (j = 0; j < 3; ++j) {
+        constint_t val = it->at(j);
+        if (j < i) {
+          val = 0;
+        } else if (j == i) {
+          val -= prev[j];
+        }
+        while (val >= 0x80) {
+          *write_to = (uint8_t) ((val & 0x7F) | 0x80);
+          ++write_to;
+          val >>= 7;
+        }
+        *write_to = (uint8_t) val;
+        ++write_to;
+      }
+      prev = *it;
+    }
+    len = write_to - buffer->dptr();
+    block.clear();
+  }
+public:
+  TripleBlocks(const int nproc) : blocks(nproc), flushed(0) {}
+
+  // Adds triple to the block for send_to.  When the block fills, it is
+  // encoded into buffer and send_to is returned; otherwise -1.
+  int add(const int send_to, const Triple &triple, DPtr<uint8_t> *&buffer,
+          size_t &len) throw(BadAllocException) {
+    vector<Triple> &block = this->blocks[send_to];
+    block.push_back(triple);
+    if (block.size() < COMPRESSBLOCK) {
+      return -1;
+    }
+    this->encode(block, buffer, len);
+    return send_to;
+  }
+
+  // Encodes the next partial block into buffer and returns its
+  // destination, or returns -2 when all blocks have been sent.
+  int flush(DPtr<uint8_t> *&buffer, size_t &len) throw(BadAllocException) {
+    for (; this->flushed < this->blocks.size(); ++this->flushed) {
+      if (!this->blocks[this->flushed].empty()) {
+        this->encode(this->blocks[this->flushed], buffer, len);
+        return this->flushed;
+      }
+    }
+    return -2;
+  }
+
+  static void decode(const DPtr<uint8_t> *msg, TripleIndex &triples) {
+    const uint8_t *read_from = msg->dptr();
+    const uint8_t *end = read_from + msg->size();
+    Triple triple(3, 0);
+    size_t j = 0;
+    bool changed = false;
+    while (read_from != end) {
+      constint_t val = 0;
+      size_t shift = 0;
+      for (; (*read_from & 0x80) != 0; ++read_from, shift += 7) {
+        val |= ((constint_t) (*read_from & 0x7F)) << shift;
+      }
+      val |= ((constint_t) *read_from) << shift;
+      ++read_from;
+      if (!changed && (val != 0 || j == 2)) {
+        triple[j] += val;
+        changed = true;
+      } else if (changed) {
+        triple[j] = val;
+      }
+      if (++j == 3) {
+        triples.insert(triple);
+        j = 0;
+        changed = false;
+      }
+    }
+  }
+};
+
 class DistUniq : public DistComputation {
 private:
   int rank, nproc;
   TripleIndex::const_iterator it;
   TripleIndex::const_iterator end;
+  TripleBlocks *blocks;
 public:
   TripleIndex newindex;
   DistUniq(Distributor *dist) throw(BaseException<void*>)
       : DistComputation(dist), rank(MPI::COMM_WORLD.Get_rank()),
         nproc(MPI::COMM_WORLD.Get_size()), it(idxpos.begin()),
-        end(idxpos.end()),
+        end(idxpos.end()), blocks(NULL),
         newindex(TripleIndex(Order(1,2,0), allocator<Triple>())) {
-    // do nothing
+    if (COMPRESS) {
+      NEW(this->blocks, TripleBlocks, this->nproc);
+    }
   }
   virtual ~DistUniq() throw(DistException) {
-    // do nothing
+    if (this->blocks != NULL) {
+      DELETE(this->blocks);
+    }
   }
   void start() throw(TraceableException) {}
   void finish() throw(TraceableException) {}
@@ -2094,7 +2579,7 @@ public:
   int pickup(DPtr<uint8_t> *&buffer, size_t &len)
       throw(BadAllocException, TraceableException) {
     if (this->it == this->end) {
-      return -2;
+      return this->blocks == NULL ? -2 : this->blocks->flush(buffer, len);
     }
     uint32_t send_to = 0;
     size_t i;
@@ -2135,6 +2620,9 @@ public:
       this->newindex.insert(tuple);
       return -1;
     }
+    if (this->blocks != NULL) {
+      return this->blocks->add(send_to, tuple, buffer, len);
+    }
     len = (sizeof(constint_t) << 1) + sizeof(constint_t); // 3*sizeof(constint_t)
     if (buffer->size() < len) {
       buffer->drop();
@@ -2151,6 +2639,10 @@ public:
     return (int)send_to;
   }
   void dropoff(DPtr<uint8_t> *msg) throw(TraceableException) {
+    if (this->blocks != NULL) {
+      TripleBlocks::decode(msg, this->newindex);
+      return;
+    }
     Triple triple(3);
     const uint8_t *read_from = msg->dptr();
     memcpy(&triple[0], read_from, sizeof(constint_t));
@@ -2167,6 +2659,7 @@ private:
   int rank, nproc, repl_count;
   TripleIndex::const_iterator it;
   TripleIndex::const_iterator end;
+  TripleBlocks *blocks;
 public:
   TripleIndex newindex;
   TripleIndex replications;
@@ -2174,21 +2667,27 @@ public:
   Redistributor(Distributor *dist) throw(BaseException<void*>)
       : DistComputation(dist), rank(MPI::COMM_WORLD.Get_rank()),
         nproc(MPI::COMM_WORLD.Get_size()), it(idxpos.begin()),
-        end(idxpos.end()), repl_count(0), randomize(false),
+        end(idxpos.end()), repl_count(0), blocks(NULL), randomize(false),
         newindex(TripleIndex(Order(1,2,0), allocator<Triple>())),
         replications(TripleIndex(Order(1,2,0), allocator<Triple>())) {
-    // do nothing
+    if (COMPRESS) {
+      NEW(this->blocks, TripleBlocks, this->nproc);
+    }
   }
   Redistributor(Distributor *dist, int rank, int np, TripleIndex &trips) throw(BaseException<void*>)
       : DistComputation(dist), rank(rank), nproc(np),
         it(trips.begin()),
-        end(trips.end()), repl_count(0), randomize(false),
+        end(trips.end()), repl_count(0), blocks(NULL), randomize(false),
         newindex(TripleIndex(Order(1,2,0), allocator<Triple>())),
         replications(TripleIndex(Order(1,2,0), allocator<Triple>())) {
-    // do nothing
+    if (COMPRESS) {
+      NEW(this->blocks, TripleBlocks, this->nproc);
+    }
   }
   virtual ~Redistributor() throw(DistException) {
-    // do nothing
+    if (this->blocks != NULL) {
+      DELETE(this->blocks);
+    }
   }
   void start() throw(TraceableException) {
     if (!this->randomize) {
@@ -2203,21 +2702,24 @@ public:
   int pickup(DPtr<uint8_t> *&buffer, size_t &len) 
       throw(BadAllocException, TraceableException) {
     if (this->it == this->end) {
-      return -2;
-    }
-    len = (sizeof(constint_t) << 1) + sizeof(constint_t); // 3*sizeof(constint_t)
-    if (buffer->size() < len) {
-      buffer->drop();
-      try {
-        NEW(buffer, MPtr<uint8_t>, len);
-      } RETHROW_BAD_ALLOC
+      return this->blocks == NULL ? -2 : this->blocks->flush(buffer, len);
+    }
+    const Triple &triple = *this->it;
+    if (this->blocks == NULL) {
+      len = (sizeof(constint_t) << 1) + sizeof(constint_t); // 3*sizeof(constint_t)
+      if (buffer->size() < len) {
+        buffer->drop();
+        try {
+          NEW(buffer, MPtr<uint8_t>, len);
+        } RETHROW_BAD_ALLOC
+      }
+      uint8_t *write_to = buffer->dptr();
+      memcpy(write_to, &(triple[0]), sizeof(constint_t));
+      write_to += sizeof(constint_t);
+      memcpy(write_to, &(triple[1]), sizeof(constint_t));
+      write_to += sizeof(constint_t);
+      memcpy(write_to, &(triple[2]), sizeof(constint_t));
     }
-    uint8_t *write_to = buffer->dptr();
-    memcpy(write_to, &(it->at(0)), sizeof(constint_t));
-    write_to += sizeof(constint_t);
-    memcpy(write_to, &(it->at(1)), sizeof(constint_t));
-    write_to += sizeof(constint_t);
-    memcpy(write_to, &(it->at(2)), sizeof(constint_t));
     int send_to;
     if (this->randomize && this->repl_count <= 0 &&
         this->replications.count(*(this->it)) <= 0) {
@@ -2231,9 +2733,16 @@ public:
         this->repl_count = 0;
       }
     }
+    if (this->blocks != NULL) {
+      return this->blocks->add(send_to, triple, buffer, len);
+    }
     return send_to;
   }
   void dropoff(DPtr<uint8_t> *msg) throw(TraceableException) {
+    if (this->blocks != NULL) {
+      TripleBlocks::decode(msg, this->newindex);
+      return;
+    }
     Triple triple(3);
     const uint8_t *read_from = msg->dptr();
     memcpy(&triple[0], read_from, sizeof(constint_t));
@@ -2291,12 +2800,11 @@ void redistribute_data(const char *filename) {
   if (RANDOMIZE) {
     ZEROSAY("Performing randomization..." << endl);
     Distributor *dist;
-    NEW(dist, MPIPacketDistributor, MPI::COMM_WORLD, 3*sizeof(constint_t),
-        NUMREQUESTS, COORDEVERY, 382);
+    dist = new_distributor(MPI::COMM_WORLD, triple_msgsize(), 382);
     Redistributor *redist;
     NEW(redist, Redistributor, dist);
     redist->randomize = true;
-    redist->exec();
+    redist->exec(PIPELINE);
     idxpos.swap(redist->newindex);
     DELETE(redist);
   }
@@ -2333,6 +2841,14 @@ void redistribute_data(const char *filename) {
 
     ZEROSAY("Query out the data for replication." << endl);
     get_redist_data(replication_conditions, replication_conditions_len, repls);
+    if (SEMI_NAIVE) {
+      TripleIndex fresh (Order(1, 2, 0));
+      set_difference(repls.begin(), repls.end(), replicated.begin(),
+                     replicated.end(), inserter(fresh, fresh.end()),
+                     Order(1, 2, 0));
+      replicated.insert(fresh.begin(), fresh.end());
+      repls.swap(fresh);
+    }
 
 //    ZEROSAY("Destroying the aforementioned indexes." << endl);
 //    // now get rid of them because we need memory during redistribution
@@ -2395,9 +2911,11 @@ void redistribute_data(const char *filename) {
     free(bytes);
     if (local_rank == 0) {
       for (i = 0; i < repls_nproc; ++i) {
-        for (j = i; j < local_nproc; ++j) {
-          sizes[i] += sizes[j];
+        int node_size = 0;
+        for (j = 0; j < local_nproc; ++j) {
+          node_size += sizes[i*local_nproc + j];
         }
+        sizes[i] = node_size;
         displs[i] = displs[i*local_nproc];
       }
       COMM_REPLS.Allgatherv(recvbuf + displs[repls_rank], sizes[repls_rank], MPI::BYTE,
@@ -2421,15 +2939,30 @@ void redistribute_data(const char *filename) {
 
     ZEROSAY("Performing local randomization of replicated data..." << endl);
     Distributor *dist;
-    NEW(dist, MPIPacketDistributor, COMM_LOCAL, 3*sizeof(constint_t),
-        NUMREQUESTS, COORDEVERY, 382);
+    dist = new_distributor(COMM_LOCAL, triple_msgsize(), 382);
     Redistributor *redist;
     NEW(redist, Redistributor, dist, local_rank, local_nproc, repl_triples);
     redist->randomize = true;
-    redist->exec();
+    redist->exec(PIPELINE);
     repl_triples.clear();
-    idxpos.insert(redist->newindex.begin(),
-                  redist->newindex.end());
+    if (SEMI_NAIVE) {
+      TripleIndex::const_iterator it = redist->newindex.begin();
+      for (; it != redist->newindex.end(); ++it) {
+        replicated.insert(*it);
+        if (idxpos.insert(*it).second) {
+#if USE_INDEX_SPO
+          idxspo.insert(*it);
+#endif
+#if USE_INDEX_OSP
+          idxosp.insert(*it);
+#endif
+          derived.push_back(*it);
+        }
+      }
+    } else {
+      idxpos.insert(redist->newindex.begin(),
+                    redist->newindex.end());
+    }
     DELETE(redist);
   }
 }
@@ -2439,11 +2972,10 @@ void uniq() {
     return;
   }
   Distributor *dist;
-  NEW(dist, MPIPacketDistributor, MPI::COMM_WORLD, 3*sizeof(constint_t),
-      NUMREQUESTS, COORDEVERY, 382);
+  dist = new_distributor(MPI::COMM_WORLD, triple_msgsize(), 382);
   DistUniq *redist;
   NEW(redist, DistUniq, dist);
-  redist->exec();
+  redist->exec(PIPELINE);
   idxpos.swap(redist->newindex);
   DELETE(redist);
   // NOTE intentionally not modifying other indexes because I know this is
@@ -2639,6 +3171,10 @@ int main(int argc, char **argv) {
       stringstream ss(stringstream::in | stringstream::out);
       ss << argv[++i];
       ss >> PACKETSIZE; // currently unused
+    } else if (strcmp(argv[i], "--batch-size") == 0) {
+      stringstream ss(stringstream::in | stringstream::out);
+      ss << argv[++i];
+      ss >> BATCHSIZE;
     } else if (strcmp(argv[i], "--num-requests") == 0) {
       stringstream ss(stringstream::in | stringstream::out);
       ss << argv[++i];
@@ -2657,15 +3193,31 @@ int main(int argc, char **argv) {
       RANDOMIZE = true;
     } else if (strcmp(argv[i], "--complete") == 0) {
       COMPLETE = true;
+    } else if (strcmp(argv[i], "--alltoall") == 0) {
+      ALLTOALL = true;
+    } else if (strcmp(argv[i], "--pipeline") == 0) {
+      PIPELINE = true;
+    } else if (strcmp(argv[i], "--compress") == 0) {
+      COMPRESS = true;
+    } else if (strcmp(argv[i], "--semi-naive") == 0) {
+      SEMI_NAIVE = true;
+    } else if (strcmp(argv[i], "--skew-aware") == 0) {
+      SKEW_AWARE = true;
     }
   }
 
   ZEROSAY("[INFO] PACKETSIZE: " << PACKETSIZE << endl);
+  ZEROSAY("[INFO] BATCHSIZE: " << BATCHSIZE << endl);
+  ZEROSAY("[INFO] ALLTOALL: " << ALLTOALL << endl);
+  ZEROSAY("[INFO] PIPELINE: " << PIPELINE << endl);
+  ZEROSAY("[INFO] COMPRESS: " << COMPRESS << endl);
   ZEROSAY("[INFO] NUMREQUESTS: " << NUMREQUESTS << endl);
   ZEROSAY("[INFO] COORDEVERY: " << COORDEVERY << endl);
   ZEROSAY("[INFO] UNIQUIFY: " << uniquify << endl);
   ZEROSAY("[INFO] PAGESIZE: " << PAGESIZE << endl);
   ZEROSAY("[INFO] RANDOMIZE: " << RANDOMIZE << endl);
+  ZEROSAY("[INFO] SEMI_NAIVE: " << SEMI_NAIVE << endl);
+  ZEROSAY("[INFO] SKEW_AWARE: " << SKEW_AWARE << endl);
 
   TIME_T(ts_load_rules);
   TIMESET(ts_load_rules);
@@ -2714,7 +3266,20 @@ int main(int argc, char **argv) {
     infer(rules);
 
     another_iteration = false;
-    if (COMPLETE && argc > 4) {
+    if (COMPLETE && argc > 4 && SEMI_NAIVE) {
+      unsigned long before = derived.size();
+
+      ZEROSAY("[INFO] Redistributing new data for completeness." << endl);
+      RANDOMIZE = false;
+      redistribute_data(argv[4]);
+
+      unsigned long delta = derived.size() - before;
+      unsigned long total_delta;
+      MPI::COMM_WORLD.Allreduce(&delta, &total_delta, 1, MPI::UNSIGNED_LONG,
+                                MPI::SUM);
+      ZEROSAY("[INFO] " << total_delta << " new triples." << endl);
+      another_iteration = total_delta > 0 ? 1 : 0;
+    } else if (COMPLETE && argc > 4) {
       vector<size_t> before, after;
       note_sizes(before);
       
@@ -14,11 +14,13 @@
  */
 
 #include <algorithm>
+#include <climits>
 #include <cmath>
 #include <deque>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <list>
 #include <map>
 #include <mpi.h>
@@ -27,8 +29,11 @@
 #include <string>
 #include <utility>
 #include <vector>
+#include "main/Array.h"
 #include "main/encode.h"
+#include "par/BatchDistributor.h"
 #include "par/DistComputation.h"
+#include "par/MPIAlltoallDistributor.h"
 #include "par/MPIPacketDistributor.h"
 #include "ptr/DPtr.h"
 #include "ptr/MPtr.h"
@@ -36,10 +41,19 @@
 
 bool RANDOMIZE = false;
 bool COMPLETE = false;
+bool ALLTOALL = false;
+bool PIPELINE = false;
+bool COMPRESS = false;
+bool STEAL = false;
+bool SHARED_REPLICAS = false;
+const char *CHECKPOINT = NULL;
+int CHECKPOINTEVERY = 0;
 int PAGESIZE = 4*1024*1024;
 int NUMREQUESTS = 100;
 int COORDEVERY = 100;
 int PACKETSIZE = 128;
+int BATCHSIZE = 8192;
+int STEALCHUNK = 4096;
 
 #ifdef DEBUG
 #undef DEBUG
@@ -51,6 +65,37 @@ using namespace par;
 using namespace ptr;
 using namespace std;
 
+// Per-message MPI traffic is bound by message rate, so unless
+// --batch-size 0 is given, messages are coalesced per destination rank
+// into BATCHSIZE-byte batches.  Every caller knows all of its outgoing
+// triples up front, so with --alltoall the whole exchange is instead
+// done with one collective.  MPIPacketDistributor only carries
+// messages of exactly msgsize bytes, so the variable-sized blocks of
+// --compress always travel in batches, if need be one per batch.
+Distributor *new_distributor(MPI::Intracomm &comm, const size_t msgsize,
+                             const int tag) {
+  Distributor *dist;
+  if (ALLTOALL) {
+    NEW(dist, MPIAlltoallDistributor, comm, 1 << 30);
+    return dist;
+  }
+  size_t batchsize = BATCHSIZE <= 0 ? 0 : (size_t) BATCHSIZE;
+  if (batchsize < msgsize + (sizeof(uint32_t) << 1)) {
+    if (!COMPRESS) {
+      NEW(dist, MPIPacketDistributor, comm, msgsize, NUMREQUESTS, COORDEVERY,
+          tag);
+      return dist;
+    }
+    batchsize = msgsize + (sizeof(uint32_t) << 1);
+  }
+  Distributor *packets;
+  NEW(packets, MPIPacketDistributor, comm, batchsize, NUMREQUESTS,
+      COORDEVERY, tag);
+  NEW(dist, BatchDistributor, comm.Get_size(), batchsize, COORDEVERY,
+      packets);
+  return dist;
+}
+
 void *myalloc(size_t num_items, size_t item_size) {
 #ifdef USE_POSIX_MEMALIGN
   void *p = NULL;
@@ -769,102 +814,6 @@ void print_rules(vector<Rule> &rules) {
 #undef CONTAINER // Hacky way to force lists.
 #endif
 
-template<size_t N>
-class Array {
-private:
-  constint_t data[N];
-  size_t sz;
-  void safety_check(size_t s) {
-    if (s > N) {
-      stringstream ss(stringstream::in | stringstream::out);
-      ss << "[ERROR] You have requested size " << s << " but fixed to " << N << ".  You will probably see a segmentation fault or bus error soon hereafter." << endl;
-      cerr << ss.str();
-    }
-  }
-public:
-  typedef constint_t* iterator;
-  typedef const constint_t* const_iterator;
-  Array() : sz(0) {
-    fill_n(this->data, N, 0);
-  }
-  Array(size_t n)
-      : sz(n) {
-    safety_check(n);
-    fill_n(this->data, N, 0);
-  }
-  Array(size_t n, const constint_t &val)
-      : sz(n) {
-    safety_check(n);
-    fill_n(this->data, n, val);
-    fill_n(this->data + n, N - n, 0);
-  }
-  Array(const Array<N> &copy)
-      : sz(copy.sz) {
-    std::copy(copy.data, copy.data + N, this->data);
-  }
-  ~Array() {}
-  Array &operator=(const Array<N> &rhs) {
-    this->sz = rhs.sz;
-    copy(rhs.data, rhs.data + rhs.sz, this->data);
-    return *this;
-  }
-  iterator begin() { return this->data; }
-  const_iterator begin() const { return this->data; }
-  iterator end() { return this->data + this->sz; }
-  const_iterator end() const { return this->data + this->sz; }
-  size_t size() const { return this->sz; }
-  size_t max_size() const { return N; }
-  void resize(size_t n) {
-    safety_check(n);
-    if (n < this->sz) {
-      fill(this->data + n, this->data + this->sz, 0);
-    }
-    this->sz = n;
-  }
-  void resize(size_t n, constint_t val) {
-    safety_check(n);
-    if (this->sz < n) {
-      fill(this->data + this->sz, this->data + n, val);
-    } else if (n < this->sz) {
-      fill(this->data + n, this->data + this->sz, 0);
-    }
-    this->sz = n;
-  }
-  size_t capacity() const { return N; }
-  bool empty() const { return this->sz == 0; }
-  void reserve(size_t  n) {
-    safety_check(n);
-  }
-  constint_t &operator[](size_t i) { return this->data[i]; }
-  const constint_t &operator[](size_t i) const { return this->data[i]; }
-  constint_t &at(size_t i) { return this->data[i]; }
-  const constint_t &at(size_t i) const { return this->data[i]; }
-  constint_t &front() { return this->data[0]; }
-  const constint_t &front() const { return this->data[0]; }
-  constint_t &back() { return this->data[this->sz-1]; }
-  const constint_t &back() const { return this->data[this->sz-1]; }
-  void push_back(const constint_t &val) {
-    safety_check(this->sz + 1);
-    this->data[this->sz++] = val;
-  }
-  void pop_back() {
-    this->data[--this->sz] = 0;
-  }
-  void swap(Array<N> &t) {
-    size_t x = max(this->sz, t.sz);
-    swap_ranges(this->data, this->data + x, t.data);
-    std::swap(this->sz, t.sz);
-  }
-  void clear() {
-    fill_n(this->data, this->sz, 0);
-    this->sz = 0;
-  }
-  bool operator<(const Array<N> &t) const {
-    return lexicographical_compare(this->data, this->data + this->sz,
-                                   t.data, t.data + t.sz);
-  }
-};
-
 typedef Array<3> Triple;
 
 #ifdef TUPLE_SIZE
@@ -941,6 +890,22 @@ TripleIndex idxspo (Order(0, 1, 2));
 TripleIndex idxpos (Order(1, 2, 0));
 TripleIndex idxosp (Order(2, 0, 1));
 map<constint_t, Index> atoms;
+// Triples that redistribute_data replicated to every processor.
+TripleIndex replicas (Order(1, 2, 0));
+
+// With --shared-replicas, replicated triples are instead kept once per
+// node, sorted like idxpos, in an MPI-3 shared-memory window that every
+// processor on the node reads.  They are never also in idxpos.
+MPI_Comm COMM_LOCAL = MPI_COMM_NULL;
+MPI_Comm COMM_REPLS = MPI_COMM_NULL;
+MPI_Win shared_win = MPI_WIN_NULL;
+const Triple *shared_begin = NULL;
+const Triple *shared_end = NULL;
+
+bool is_shared(const Triple &triple) {
+  return shared_begin != shared_end &&
+         binary_search(shared_begin, shared_end, triple, Order(1, 2, 0));
+}
 
 void load_data(const char *filename) {
 //  ifstream fin(filename);
@@ -1334,6 +1299,59 @@ void scan_triples(Triple &triple_pattern, TripleIndex &results) {
       results.insert(*it);
     }    
   }
+  const Triple *sit = shared_begin;
+  for (; sit != shared_end; ++sit) {
+    size_t i;
+    for (i = 0; i < 3; ++i) {
+      if (triple_pattern[i] != 0 && triple_pattern[i] != sit->at(i)) {
+        break;
+      }
+    }
+    if (i == 3) {
+      results.insert(*sit);
+    }
+  }
+}
+
+// Binds the variables of a frame slot for every triple in [begin, end)
+// that matches its constants.
+template<typename Iter>
+void select_triples(Iter begin, Iter end, const Term &subj,
+                    const Term &pred, const Term &obj, varint_t maxvar,
+                    Relation &selection) {
+  for (; begin != end; ++begin) {
+    if ((subj.type == CONSTANT && begin->at(0) != subj.get.constant) ||
+        (pred.type == CONSTANT && begin->at(1) != pred.get.constant) ||
+        (obj.type == CONSTANT && begin->at(2) != obj.get.constant)) {
+      continue;
+    }
+    Tuple result(maxvar + 1);
+    if (subj.type == VARIABLE) {
+      result[subj.get.variable] = begin->at(0);
+    }
+    if (pred.type == VARIABLE) {
+      if (subj.type == VARIABLE && subj.get.variable == pred.get.variable) {
+        if (begin->at(0) != begin->at(1)) {
+          continue;
+        }
+      }
+      result[pred.get.variable] = begin->at(1);
+    }
+    if (obj.type == VARIABLE) {
+      if (subj.type == VARIABLE && subj.get.variable == obj.get.variable) {
+        if (begin->at(0) != begin->at(2)) {
+          continue;
+        }
+      }
+      if (pred.type == VARIABLE && pred.get.variable == obj.get.variable) {
+        if (begin->at(1) != begin->at(2)) {
+          continue;
+        }
+      }
+      result[obj.get.variable] = begin->at(2);
+    }
+    selection.push_back(result);
+  }
 }
 
 void query(Atomic &atom, set<varint_t> &allvars, Relation &results) {
@@ -1409,12 +1427,15 @@ void query(Atomic &atom, set<varint_t> &allvars, Relation &results) {
               ( obj.type == CONSTANT ? 0x1 : 0x0);
     TripleIndex::const_iterator begin, end;
     TripleIndex scanned (Order(1,2,0));
+    const Triple *shared_from = shared_begin;
+    const Triple *shared_to = shared_begin;
     switch (idx) {
       case 0x4:
       case 0x6: // SPO
 #if USE_INDEX_SPO
         begin = idxspo.lower_bound(mintriple);
         end = idxspo.upper_bound(maxtriple);
+        shared_to = shared_end;
 #else
         scan_triples(mintriple, scanned);
         begin = scanned.begin();
@@ -1424,18 +1445,24 @@ void query(Atomic &atom, set<varint_t> &allvars, Relation &results) {
       case 0x0:
         begin = idxpos.begin();
         end = idxpos.end();
+        shared_to = shared_end;
         break;
       case 0x2:
       case 0x3:
       case 0x7: // POS
         begin = idxpos.lower_bound(mintriple);
         end = idxpos.upper_bound(maxtriple);
+        shared_from = lower_bound(shared_begin, shared_end, mintriple,
+                                  Order(1, 2, 0));
+        shared_to = upper_bound(shared_from, shared_end, maxtriple,
+                                Order(1, 2, 0));
         break;
       case 0x1:
       case 0x5: // OSP
 #if USE_INDEX_OSP
         begin = idxosp.lower_bound(mintriple);
         end = idxosp.upper_bound(maxtriple);
+        shared_to = shared_end;
 #else
         scan_triples(mintriple, scanned);
         begin = scanned.begin();
@@ -1446,36 +1473,10 @@ void query(Atomic &atom, set<varint_t> &allvars, Relation &results) {
         cerr << "[ERROR] Unhandled case " << hex << idx << " at line " << dec << __LINE__ << endl;
         return;
     }
-    // TODO the following loop could probably be more efficient
     Relation selection;
-    for (; begin != end; ++begin) {
-      Tuple result(maxvar + 1);
-      if (subj.type == VARIABLE) {
-        result[subj.get.variable] = begin->at(0);
-      }
-      if (pred.type == VARIABLE) {
-        if (subj.type == VARIABLE && subj.get.variable == pred.get.variable) {
-          if (begin->at(0) != begin->at(1)) {
-            continue;
-          }
-        }
-        result[pred.get.variable] = begin->at(1);
-      }
-      if (obj.type == VARIABLE) {
-        if (subj.type == VARIABLE && subj.get.variable == obj.get.variable) {
-          if (begin->at(0) != begin->at(2)) {
-            continue;
-          }
-        }
-        if (pred.type == VARIABLE && pred.get.variable == obj.get.variable) {
-          if (begin->at(1) != begin->at(2)) {
-            continue;
-          }
-        }
-        result[obj.get.variable] = begin->at(2);
-      }
-      selection.push_back(result);
-    }
+    select_triples(begin, end, subj, pred, obj, maxvar, selection);
+    select_triples(shared_from, shared_to, subj, pred, obj, maxvar,
+                   selection);
     if (slot == atom.get.frame.slots.begin) {
       intermediate.swap(selection);
     } else {
@@ -1720,12 +1721,19 @@ void infer(Rule &rule, TripleIndex &assertions, TripleIndex &retractions) {
   act(rule.action_block, results, assertions, retractions);
 }
 
+// Inference rounds (one per completeness redistribution) and the
+// saturation cycles within them, for checkpoints.
+size_t round_count = 0;
+size_t cycle_start = 0;
+void write_checkpoint(const size_t round, const size_t cycle);
+
 #define USE_OLD_WAY 0
 #if !USE_OLD_WAY
 void note_sizes(vector<size_t> &sizes) {
   vector<size_t> sz;
   sz.reserve(1 + atoms.size());
   sz.push_back(idxpos.size());
+  sz.push_back(shared_end - shared_begin);
   map<constint_t, Index>::const_iterator it = atoms.begin();
   for (; it != atoms.end(); ++it) {
     sz.push_back(it->second.size());
@@ -1733,12 +1741,16 @@ void note_sizes(vector<size_t> &sizes) {
   sizes.swap(sz);
 }
 
-void infer(vector<Rule> &rules) {
+void saturate(vector<Rule> &rules, const bool checkpoint) {
   size_t rules_since_change = 0;
   size_t cycle_count;
   vector<size_t> old_sizes;
   note_sizes(old_sizes);
-  for (cycle_count = 0; rules_since_change < rules.size(); ++cycle_count) {
+  for (cycle_count = cycle_start; rules_since_change < rules.size(); ++cycle_count) {
+    if (checkpoint && CHECKPOINT != NULL && CHECKPOINTEVERY > 0 &&
+        cycle_count > cycle_start && cycle_count % CHECKPOINTEVERY == 0) {
+      write_checkpoint(round_count, cycle_count);
+    }
     size_t rulecount;
     for (rulecount = 0; rulecount < rules.size() && rules_since_change < rules.size(); ++rulecount) {
       bool changed = true;
@@ -1764,7 +1776,7 @@ void infer(vector<Rule> &rules) {
         }
         it = assertions.begin();
         for (; it != assertions.end(); ++it) {
-          if (idxpos.insert(*it).second) {
+          if (!is_shared(*it) && idxpos.insert(*it).second) {
 #if USE_INDEX_SPO
             idxspo.insert(*it);
 #endif
@@ -1788,24 +1800,10 @@ void infer(vector<Rule> &rules) {
       }
     }
   }
-  int rank = MPI::COMM_WORLD.Get_rank();
-  int inconsistent = atoms[CONST_RIF_ERROR].empty() ? 0 : 1; 
-  if (inconsistent > 0) { 
-    stringstream ss(stringstream::in | stringstream::out);
-    ss << "Processor " << rank << " is inconsistent." << endl;
-    cerr << ss.str() << flush;
-  }
-  int nproc_inconsistent;
-  MPI::COMM_WORLD.Reduce(&inconsistent, &nproc_inconsistent, 1, MPI::INT,
-                         MPI::SUM, 0);
-  if (rank == 0 && nproc_inconsistent > 0) { 
-    cerr << nproc_inconsistent << " processors were inconsistent." << endl;
-    cerr << "INCONSISTENT" << endl;  // MUST HAVE THIS LAST!
-  }
 }
 #else
 // infer until fixpoint, which may not be appropriate in the presence of retraction
-void infer(vector<Rule> &rules) {
+void saturate(vector<Rule> &rules, const bool checkpoint) {
   bool changed = true;
   map<constint_t, size_t> sizes;
   map<constint_t, Index>::const_iterator atomit = atoms.begin();
@@ -1843,7 +1841,7 @@ void infer(vector<Rule> &rules) {
     }
     it = assertions.begin();
     for (; it != assertions.end(); ++it) {
-      if (idxpos.insert(*it).second) {
+      if (!is_shared(*it) && idxpos.insert(*it).second) {
 #if USE_INDEX_SPO
         idxspo.insert(*it);
 #endif
@@ -1862,6 +1860,294 @@ void infer(vector<Rule> &rules) {
       sizes[atomit->first] = atomit->second.size();
     }
   }
+}
+#endif
+
+///// WORK STEALING /////
+
+// Local partitions rarely cost the same to saturate, so with --steal
+// the data a processor holds (less what was replicated everywhere) is
+// cut into tasks of STEALCHUNK consecutive triples of idxpos.  Each
+// task is saturated on its own against the closure of the replicated
+// data, and processors that run out of tasks take half of the
+// remaining tasks of another processor.  A task only sees part of its
+// owner's partition, so whoever saturates a task sends what it derived
+// back to the owner, and once every task is done, each owner
+// saturates its partition again together with everything its tasks
+// derived.  That last pass only has to join triples across tasks,
+// and gives exactly the closure of saturating the partition as a whole.
+
+#define TAG_STEAL_REQUEST 401
+#define TAG_STEAL_REPLY 402
+#define TAG_STEAL_RESULT 403
+
+struct Task {
+  int owner;
+  vector<Triple> triples;
+};
+
+typedef deque<Task> TaskQueue;
+
+void set_data(const TripleIndex &data) {
+  idxpos = data;
+#if USE_INDEX_SPO
+  idxspo.clear();
+  idxspo.insert(idxpos.begin(), idxpos.end());
+#endif
+#if USE_INDEX_OSP
+  idxosp.clear();
+  idxosp.insert(idxpos.begin(), idxpos.end());
+#endif
+}
+
+// Tasks travel as their owner, their number of triples, then the triples.
+void add_tasks(const constint_t *ints, const size_t nints, TaskQueue &tasks) {
+  size_t i = 0;
+  while (i < nints) {
+    tasks.push_back(Task());
+    tasks.back().owner = (int) ints[i++];
+    size_t ntriples = (size_t) ints[i++];
+    tasks.back().triples.reserve(ntriples);
+    for (; ntriples > 0; --ntriples) {
+      Triple triple(3);
+      size_t j;
+      for (j = 0; j < 3; ++j) {
+        triple[j] = ints[i++];
+      }
+      tasks.back().triples.push_back(triple);
+    }
+  }
+}
+
+// Answer every pending steal request with half of the remaining tasks
+// (the ones furthest from being started), or with nothing at all.
+void serve_steals(TaskQueue &tasks) {
+  MPI::Status status;
+  while (MPI::COMM_WORLD.Iprobe(MPI::ANY_SOURCE, TAG_STEAL_REQUEST, status)) {
+    int thief = status.Get_source();
+    MPI::COMM_WORLD.Recv(NULL, 0, MPI::BYTE, thief, TAG_STEAL_REQUEST);
+    vector<constint_t> give;
+    size_t ngive = tasks.size() >> 1;
+    size_t maxgive = INT_MAX / (sizeof(constint_t) * (3 * STEALCHUNK + 2));
+    ngive = min(ngive, maxgive);
+    for (; ngive > 0; --ngive) {
+      give.push_back((constint_t) tasks.back().owner);
+      give.push_back((constint_t) tasks.back().triples.size());
+      vector<Triple>::const_iterator it = tasks.back().triples.begin();
+      for (; it != tasks.back().triples.end(); ++it) {
+        give.push_back((*it)[0]);
+        give.push_back((*it)[1]);
+        give.push_back((*it)[2]);
+      }
+      tasks.pop_back();
+    }
+    MPI::COMM_WORLD.Send(give.empty() ? NULL : &give[0],
+                         give.size() * sizeof(constint_t), MPI::BYTE,
+                         thief, TAG_STEAL_REPLY);
+  }
+}
+
+// Ask every other processor in turn for tasks until one has some to
+// give.  Requests received meanwhile are answered since our own queue
+// is empty.
+bool steal(TaskQueue &tasks) {
+  int rank = MPI::COMM_WORLD.Get_rank();
+  int nproc = MPI::COMM_WORLD.Get_size();
+  int i;
+  for (i = 1; i < nproc; ++i) {
+    int victim = (rank + i) % nproc;
+    MPI::COMM_WORLD.Send(NULL, 0, MPI::BYTE, victim, TAG_STEAL_REQUEST);
+    MPI::Status status;
+    while (!MPI::COMM_WORLD.Iprobe(victim, TAG_STEAL_REPLY, status)) {
+      serve_steals(tasks);
+    }
+    int nbytes = status.Get_count(MPI::BYTE);
+    vector<constint_t> take(nbytes / sizeof(constint_t));
+    MPI::COMM_WORLD.Recv(take.empty() ? NULL : &take[0], nbytes, MPI::BYTE,
+                         victim, TAG_STEAL_REPLY);
+    if (!take.empty()) {
+      add_tasks(&take[0], take.size(), tasks);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Send the triples in idxpos back to the owner of a stolen task, in as
+// many messages as it takes.  The last value of each message says
+// whether it is the last one for the task.  Sends are non-blocking so
+// that the owner is never waited on while it waits on us for tasks.
+void return_result(const int owner, list<vector<constint_t> > &buffers,
+                   vector<MPI::Request> &requests) {
+  size_t maxtriples = (INT_MAX / sizeof(constint_t) - 1) / 3;
+  TripleIndex::const_iterator it = idxpos.begin();
+  do {
+    buffers.push_back(vector<constint_t>());
+    vector<constint_t> &ints = buffers.back();
+    size_t n;
+    for (n = 0; n < maxtriples && it != idxpos.end(); ++n, ++it) {
+      ints.push_back((*it)[0]);
+      ints.push_back((*it)[1]);
+      ints.push_back((*it)[2]);
+    }
+    ints.push_back(it == idxpos.end() ? 1 : 0);
+    requests.push_back(MPI::COMM_WORLD.Isend(&ints[0],
+        ints.size() * sizeof(constint_t), MPI::BYTE, owner, TAG_STEAL_RESULT));
+  } while (it != idxpos.end());
+}
+
+// Add what others derived from our tasks to the closure, and count
+// down the tasks still out.
+void collect_results(TripleIndex &closure, size_t &outstanding) {
+  MPI::Status status;
+  while (MPI::COMM_WORLD.Iprobe(MPI::ANY_SOURCE, TAG_STEAL_RESULT, status)) {
+    int nbytes = status.Get_count(MPI::BYTE);
+    vector<constint_t> ints(nbytes / sizeof(constint_t));
+    MPI::COMM_WORLD.Recv(&ints[0], nbytes, MPI::BYTE, status.Get_source(),
+                         TAG_STEAL_RESULT);
+    size_t nints = ints.size() - 1;
+    size_t i;
+    for (i = 0; i < nints; i += 3) {
+      Triple triple(3);
+      triple[0] = ints[i];
+      triple[1] = ints[i + 1];
+      triple[2] = ints[i + 2];
+      closure.insert(triple);
+    }
+    if (ints[nints] != 0) {
+      --outstanding;
+    }
+  }
+}
+
+void saturate_with_stealing(vector<Rule> &rules) {
+  int rank = MPI::COMM_WORLD.Get_rank();
+  TaskQueue tasks;
+  TripleIndex::const_iterator it = idxpos.begin();
+  for (; it != idxpos.end(); ++it) {
+    if (replicas.count(*it) > 0) {
+      continue;
+    }
+    if (tasks.empty() || tasks.back().triples.size() >= (size_t) STEALCHUNK) {
+      tasks.push_back(Task());
+      tasks.back().owner = rank;
+      tasks.back().triples.reserve(STEALCHUNK);
+    }
+    tasks.back().triples.push_back(*it);
+  }
+  size_t ntasks = tasks.size();
+  size_t outstanding = ntasks;
+  size_t nlocal = 0;
+
+  set_data(replicas);
+  saturate(rules, false);
+
+  // The closure of the replicated data is the same for every task, so
+  // instead of copying it into the indexes of each task, it stands in
+  // for the shared window (which it includes) until all tasks are done.
+  // The indexes of a task then hold only its triples and what they add.
+  vector<Triple> base;
+  base.reserve(idxpos.size() + (shared_end - shared_begin));
+  merge(idxpos.begin(), idxpos.end(), shared_begin, shared_end,
+        back_inserter(base), Order(1, 2, 0));
+  const Triple *window_begin = shared_begin;
+  const Triple *window_end = shared_end;
+  if (!base.empty()) {
+    shared_begin = &base[0];
+    shared_end = shared_begin + base.size();
+  }
+  TripleIndex closure (Order(1, 2, 0));
+  closure.swap(idxpos);
+  map<constint_t, Index> base_atoms = atoms;
+  map<constint_t, Index> closure_atoms = atoms;
+  list<vector<constint_t> > buffers;
+  vector<MPI::Request> requests;
+
+  // Stealing stops for good the first time nobody has tasks to give,
+  // but our own tasks may still be out with others.
+  bool stealing = true;
+  for (;;) {
+    serve_steals(tasks);
+    collect_results(closure, outstanding);
+    if (tasks.empty()) {
+      stealing = stealing && steal(tasks);
+      if (!stealing) {
+        if (outstanding == 0) {
+          break;
+        }
+        continue;
+      }
+    }
+    idxpos.clear();
+#if USE_INDEX_SPO
+    idxspo.clear();
+#endif
+#if USE_INDEX_OSP
+    idxosp.clear();
+#endif
+    atoms = base_atoms;
+    vector<Triple>::const_iterator tit = tasks.front().triples.begin();
+    for (; tit != tasks.front().triples.end(); ++tit) {
+      if (is_shared(*tit)) {
+        continue;
+      }
+      idxpos.insert(*tit);
+#if USE_INDEX_SPO
+      idxspo.insert(*tit);
+#endif
+#if USE_INDEX_OSP
+      idxosp.insert(*tit);
+#endif
+    }
+    int owner = tasks.front().owner;
+    tasks.pop_front();
+    saturate(rules, false);
+    if (owner != rank) {
+      // The owner derives the atoms again when it saturates the lot.
+      return_result(owner, buffers, requests);
+      continue;
+    }
+    --outstanding;
+    ++nlocal;
+    closure.insert(idxpos.begin(), idxpos.end());
+    map<constint_t, Index>::iterator ait = atoms.begin();
+    for (; ait != atoms.end(); ++ait) {
+      closure_atoms[ait->first].insert(ait->second.begin(),
+                                       ait->second.end());
+    }
+  }
+
+  // Out of tasks everywhere we asked, but keep answering requests until
+  // what we derived for others has arrived and every processor has
+  // stopped asking.
+  while (!requests.empty() &&
+         !MPI::Request::Testall(requests.size(), &requests[0])) {
+    serve_steals(tasks);
+  }
+  MPI_Request barrier;
+  MPI_Ibarrier(MPI_COMM_WORLD, &barrier);
+  int finished = 0;
+  while (!finished) {
+    serve_steals(tasks);
+    MPI_Test(&barrier, &finished, MPI_STATUS_IGNORE);
+  }
+
+  shared_begin = window_begin;
+  shared_end = window_end;
+  set_data(closure);
+  atoms.swap(closure_atoms);
+  if (ntasks > 1 || nlocal < ntasks) {
+    saturate(rules, false);
+  }
+}
+
+void infer(vector<Rule> &rules) {
+  if (STEAL && MPI::COMM_WORLD.Get_size() > 1) {
+    saturate_with_stealing(rules);
+  } else {
+    saturate(rules, true);
+  }
+  cycle_start = 0;
   int rank = MPI::COMM_WORLD.Get_rank();
   int inconsistent = atoms[CONST_RIF_ERROR].empty() ? 0 : 1; 
   if (inconsistent > 0) { 
@@ -1877,29 +2163,165 @@ void infer(vector<Rule> &rules) {
     cerr << "INCONSISTENT" << endl;  // MUST HAVE THIS LAST!
   }
 }
-#endif
 
 
 
 
 ///// IO AND DISTRIBUTION /////
 
+#ifndef COMPRESSBLOCK
+#define COMPRESSBLOCK 256
+#endif
+// Worst case encoding of a block: ten varint bytes per component.
+#define COMPRESSBLOCK_BYTES (COMPRESSBLOCK * 3 * 10)
+
+size_t triple_msgsize() {
+  return COMPRESS ? COMPRESSBLOCK_BYTES : 3*sizeof(constint_t);
+}
+
+void put_varint(uint8_t *&write_to, constint_t val) {
+  while (val >= 0x80) {
+    *write_to = (uint8_t) ((val & 0x7F) | 0x80);
+    ++write_to;
+    val >>= 7;
+  }
+  *write_to = (uint8_t) val;
+  ++write_to;
+}
+
+constint_t get_varint(const uint8_t *&read_from) {
+  constint_t val = 0;
+  size_t shift = 0;
+  for (; (*read_from & 0x80) != 0; ++read_from, shift += 7) {
+    val |= ((constint_t) (*read_from & 0x7F)) << shift;
+  }
+  val |= ((constint_t) *read_from) << shift;
+  ++read_from;
+  return val;
+}
+
+// Writes triple, which must not sort before prev: zero for each leading
+// component shared with prev, the difference at the first component
+// that changed, and the remaining components as is.
+void put_triple_delta(uint8_t *&write_to, const Triple &prev,
+                      const Triple &triple) {
+  size_t i;
+  for (i = 0; i < 2 && triple[i] == prev[i]; ++i) {
+    // find first component that changed
+  }
+  size_t j;
+  for (j = 0; j < 3; ++j) {
+    constint_t val = triple[j];
+    if (j < i) {
+      val = 0;
+    } else if (j == i) {
+      val -= prev[j];
+    }
+    put_varint(write_to, val);
+  }
+}
+
+// Reads into triple, which holds the previous triple read.
+void get_triple_delta(const uint8_t *&read_from, Triple &triple) {
+  bool changed = false;
+  size_t j;
+  for (j = 0; j < 3; ++j) {
+    constint_t val = get_varint(read_from);
+    if (changed) {
+      triple[j] = val;
+    } else if (val != 0 || j == 2) {
+      triple[j] += val;
+      changed = true;
+    }
+  }
+}
+
+// With --compress, the triples a processor sends to each destination
+// are collected into blocks of up to COMPRESSBLOCK triples.  A block is
+// sorted and sent with put_triple_delta.
+class TripleBlocks {
+private:
+  vector<vector<Triple> > blocks;
+  size_t flushed;
+  void encode(vector<Triple> &block, DPtr<uint8_t> *&buffer, size_t &len)
+      throw(BadAllocException) {
+    if (buffer->size() < COMPRESSBLOCK_BYTES) {
+      buffer->drop();
+      try {
+        NEW(buffer, MPtr<uint8_t>, COMPRESSBLOCK_BYTES);
+      } RETHROW_BAD_ALLOC
+    }
+    sort(block.begin(), block.end());
+    uint8_t *write_to = buffer->dptr();
+    Triple prev(3, 0);
+    vector<Triple>::const_iterator it = block.begin();
+    for (; it != block.end(); ++it) {
+      put_triple_delta(write_to, prev, *it);
+      prev = *it;
+    }
+    len = write_to - buffer->dptr();
+    block.clear();
+  }
+public:
+  TripleBlocks(const int nproc) : blocks(nproc), flushed(0) {}
+
+  // Adds triple to the block for send_to.  When the block fills, it is
+  // encoded into buffer and send_to is returned; otherwise -1.
+  int add(const int send_to, const Triple &triple, DPtr<uint8_t> *&buffer,
+          size_t &len) throw(BadAllocException) {
+    vector<Triple> &block = this->blocks[send_to];
+    block.push_back(triple);
+    if (block.size() < COMPRESSBLOCK) {
+      return -1;
+    }
+    this->encode(block, buffer, len);
+    return send_to;
+  }
+
+  // Encodes the next partial block into buffer and returns its
+  // destination, or returns -2 when all blocks have been sent.
+  int flush(DPtr<uint8_t> *&buffer, size_t &len) throw(BadAllocException) {
+    for (; this->flushed < this->blocks.size(); ++this->flushed) {
+      if (!this->blocks[this->flushed].empty()) {
+        this->encode(this->blocks[this->flushed], buffer, len);
+        return this->flushed;
+      }
+    }
+    return -2;
+  }
+
+  static void decode(const DPtr<uint8_t> *msg, TripleIndex &triples) {
+    const uint8_t *read_from = msg->dptr();
+    const uint8_t *end = read_from + msg->size();
+    Triple triple(3, 0);
+    while (read_from != end) {
+      get_triple_delta(read_from, triple);
+      triples.insert(triple);
+    }
+  }
+};
+
 class DistUniq : public DistComputation {
 private:
   int rank, nproc;
   TripleIndex::const_iterator it;
   TripleIndex::const_iterator end;
+  TripleBlocks *blocks;
 public:
   TripleIndex newindex;
   DistUniq(Distributor *dist) throw(BaseException<void*>)
       : DistComputation(dist), rank(MPI::COMM_WORLD.Get_rank()),
         nproc(MPI::COMM_WORLD.Get_size()), it(idxpos.begin()),
-        end(idxpos.end()),
+        end(idxpos.end()), blocks(NULL),
         newindex(TripleIndex(Order(1,2,0), allocator<Triple>())) {
-    // do nothing
+    if (COMPRESS) {
+      NEW(this->blocks, TripleBlocks, this->nproc);
+    }
   }
   virtual ~DistUniq() throw(DistException) {
-    // do nothing
+    if (this->blocks != NULL) {
+      DELETE(this->blocks);
+    }
   }
   void start() throw(TraceableException) {}
   void finish() throw(TraceableException) {}
@@ -1909,7 +2331,7 @@ public:
   int pickup(DPtr<uint8_t> *&buffer, size_t &len)
       throw(BadAllocException, TraceableException) {
     if (this->it == this->end) {
-      return -2;
+      return this->blocks == NULL ? -2 : this->blocks->flush(buffer, len);
     }
     uint32_t send_to = 0;
     size_t i;
@@ -1950,6 +2372,9 @@ public:
       this->newindex.insert(tuple);
       return -1;
     }
+    if (this->blocks != NULL) {
+      return this->blocks->add(send_to, tuple, buffer, len);
+    }
     len = (sizeof(constint_t) << 1) + sizeof(constint_t); // 3*sizeof(constint_t)
     if (buffer->size() < len) {
       buffer->drop();
@@ -1966,6 +2391,10 @@ public:
     return (int)send_to;
   }
   void dropoff(DPtr<uint8_t> *msg) throw(TraceableException) {
+    if (this->blocks != NULL) {
+      TripleBlocks::decode(msg, this->newindex);
+      return;
+    }
     Triple triple(3);
     const uint8_t *read_from = msg->dptr();
     memcpy(&triple[0], read_from, sizeof(constint_t));
@@ -1982,6 +2411,7 @@ private:
   int rank, nproc, repl_count;
   TripleIndex::const_iterator it;
   TripleIndex::const_iterator end;
+  TripleBlocks *blocks;
 public:
   TripleIndex newindex;
   TripleIndex replications;
@@ -1989,13 +2419,17 @@ public:
   Redistributor(Distributor *dist) throw(BaseException<void*>)
       : DistComputation(dist), rank(MPI::COMM_WORLD.Get_rank()),
         nproc(MPI::COMM_WORLD.Get_size()), it(idxpos.begin()),
-        end(idxpos.end()), repl_count(0),
+        end(idxpos.end()), repl_count(0), blocks(NULL),
         newindex(TripleIndex(Order(1,2,0), allocator<Triple>())),
         replications(TripleIndex(Order(1,2,0), allocator<Triple>())) {
-    // do nothing
+    if (COMPRESS) {
+      NEW(this->blocks, TripleBlocks, this->nproc);
+    }
   }
   virtual ~Redistributor() throw(DistException) {
-    // do nothing
+    if (this->blocks != NULL) {
+      DELETE(this->blocks);
+    }
   }
   void start() throw(TraceableException) {
     if (!this->randomize) {
@@ -2010,21 +2444,24 @@ public:
   int pickup(DPtr<uint8_t> *&buffer, size_t &len) 
       throw(BadAllocException, TraceableException) {
     if (this->it == this->end) {
-      return -2;
-    }
-    len = (sizeof(constint_t) << 1) + sizeof(constint_t); // 3*sizeof(constint_t)
-    if (buffer->size() < len) {
-      buffer->drop();
-      try {
-        NEW(buffer, MPtr<uint8_t>, len);
-      } RETHROW_BAD_ALLOC
+      return this->blocks == NULL ? -2 : this->blocks->flush(buffer, len);
+    }
+    const Triple &triple = *this->it;
+    if (this->blocks == NULL) {
+      len = (sizeof(constint_t) << 1) + sizeof(constint_t); // 3*sizeof(constint_t)
+      if (buffer->size() < len) {
+        buffer->drop();
+        try {
+          NEW(buffer, MPtr<uint8_t>, len);
+        } RETHROW_BAD_ALLOC
+      }
+      uint8_t *write_to = buffer->dptr();
+      memcpy(write_to, &(triple[0]), sizeof(constint_t));
+      write_to += sizeof(constint_t);
+      memcpy(write_to, &(triple[1]), sizeof(constint_t));
+      write_to += sizeof(constint_t);
+      memcpy(write_to, &(triple[2]), sizeof(constint_t));
     }
-    uint8_t *write_to = buffer->dptr();
-    memcpy(write_to, &(it->at(0)), sizeof(constint_t));
-    write_to += sizeof(constint_t);
-    memcpy(write_to, &(it->at(1)), sizeof(constint_t));
-    write_to += sizeof(constint_t);
-    memcpy(write_to, &(it->at(2)), sizeof(constint_t));
     int send_to;
     if (this->randomize && this->repl_count <= 0 &&
         this->replications.count(*(this->it)) <= 0) {
@@ -2038,9 +2475,16 @@ public:
         this->repl_count = 0;
       }
     }
+    if (this->blocks != NULL) {
+      return this->blocks->add(send_to, triple, buffer, len);
+    }
     return send_to;
   }
   void dropoff(DPtr<uint8_t> *msg) throw(TraceableException) {
+    if (this->blocks != NULL) {
+      TripleBlocks::decode(msg, this->newindex);
+      return;
+    }
     Triple triple(3);
     const uint8_t *read_from = msg->dptr();
     memcpy(&triple[0], read_from, sizeof(constint_t));
@@ -2087,6 +2531,161 @@ void get_redist_data(const uint8_t *bytes, size_t len, TripleIndex &repls) {
 }
 
 // Global variables... shame on you.
+///// SHARED REPLICAS /////
+
+void init_shared_replicas() {
+  int rank = MPI::COMM_WORLD.Get_rank();
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank,
+                      MPI_INFO_NULL, &COMM_LOCAL);
+  int local_rank;
+  MPI_Comm_rank(COMM_LOCAL, &local_rank);
+  MPI_Comm_split(MPI_COMM_WORLD, local_rank == 0 ? 0 : MPI_UNDEFINED, rank,
+                 &COMM_REPLS);
+}
+
+// Gathers the bytes (packed triples) of every processor onto the first
+// processor of each node, exchanges them between nodes, and publishes
+// the union with what was already shared in a new shared-memory window.
+void share_replicas(uint8_t *bytes, int size) {
+  int world_rank = MPI::COMM_WORLD.Get_rank();
+  int local_rank, local_nproc;
+  MPI_Comm_rank(COMM_LOCAL, &local_rank);
+  MPI_Comm_size(COMM_LOCAL, &local_nproc);
+
+  TripleIndex all (Order(1, 2, 0));
+  int *sizes = NULL;
+  int *displs = NULL;
+  uint8_t *recvbuf = NULL;
+  size_t recvbytes = 0;
+  int i;
+  if (local_rank == 0) {
+    sizes = (int*)myalloc(local_nproc, sizeof(int));
+    displs = (int*)myalloc(local_nproc, sizeof(int));
+    if (sizes == NULL || displs == NULL) {
+      cerr << "[ERROR] Processor " << world_rank
+           << " failed to allocate " << 2*local_nproc*sizeof(int)
+           << " bytes for gathering each processors data sizes." << endl;
+      MPI::COMM_WORLD.Abort(-2);
+    }
+  }
+  MPI_Gather(&size, 1, MPI_INT, sizes, 1, MPI_INT, 0, COMM_LOCAL);
+  if (local_rank == 0) {
+    displs[0] = 0;
+    for (i = 1; i < local_nproc; ++i) {
+      displs[i] = displs[i-1] + sizes[i-1];
+    }
+    recvbytes = displs[local_nproc-1] + sizes[local_nproc-1];
+    recvbuf = (uint8_t*)myalloc(recvbytes/sizeof(constint_t) + 1,
+                                sizeof(constint_t));
+    if (recvbuf == NULL) {
+      cerr << "[ERROR] Processor " << world_rank
+           << " failed to allocate " << recvbytes
+           << " bytes for gathering the node's replicated data." << endl;
+      MPI::COMM_WORLD.Abort(-2);
+    }
+  }
+  MPI_Gatherv(bytes, size, MPI_BYTE, recvbuf, sizes, displs, MPI_BYTE, 0,
+              COMM_LOCAL);
+  if (local_rank == 0) {
+    free(sizes);
+    free(displs);
+    int nnodes;
+    MPI_Comm_size(COMM_REPLS, &nnodes);
+    sizes = (int*)myalloc(nnodes, sizeof(int));
+    displs = (int*)myalloc(nnodes, sizeof(int));
+    if (sizes == NULL || displs == NULL) {
+      cerr << "[ERROR] Processor " << world_rank
+           << " failed to allocate " << 2*nnodes*sizeof(int)
+           << " bytes for gathering each node's data sizes." << endl;
+      MPI::COMM_WORLD.Abort(-2);
+    }
+    int node_size = (int) recvbytes;
+    MPI_Allgather(&node_size, 1, MPI_INT, sizes, 1, MPI_INT, COMM_REPLS);
+    displs[0] = 0;
+    for (i = 1; i < nnodes; ++i) {
+      displs[i] = displs[i-1] + sizes[i-1];
+    }
+    size_t allbytes = displs[nnodes-1] + sizes[nnodes-1];
+    uint8_t *allbuf = (uint8_t*)myalloc(allbytes/sizeof(constint_t) + 1,
+                                        sizeof(constint_t));
+    if (allbuf == NULL) {
+      cerr << "[ERROR] Processor " << world_rank
+           << " failed to allocate " << allbytes
+           << " bytes for gathering all the replicated data." << endl;
+      MPI::COMM_WORLD.Abort(-2);
+    }
+    MPI_Allgatherv(recvbuf, node_size, MPI_BYTE, allbuf, sizes, displs,
+                   MPI_BYTE, COMM_REPLS);
+    free(recvbuf);
+    free(sizes);
+    free(displs);
+
+    all.insert(shared_begin, shared_end);
+    size_t k;
+    for (k = 0; k < allbytes; k += 3*sizeof(constint_t)) {
+      Triple triple(3);
+      size_t j;
+      for (j = 0; j < 3; ++j) {
+        memcpy(&triple[j], allbuf + k + j*sizeof(constint_t), sizeof(constint_t));
+      }
+      all.insert(triple);
+    }
+    free(allbuf);
+  }
+
+  if (shared_win != MPI_WIN_NULL) {
+    MPI_Win_unlock_all(shared_win);
+    MPI_Win_free(&shared_win);
+  }
+  Triple *base;
+  MPI_Win_allocate_shared(all.size() * sizeof(Triple), sizeof(Triple),
+                          MPI_INFO_NULL, COMM_LOCAL, &base, &shared_win);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, shared_win);
+  if (local_rank == 0) {
+    uninitialized_copy(all.begin(), all.end(), base);
+    all.clear();
+  }
+  MPI_Win_sync(shared_win);
+  MPI_Barrier(COMM_LOCAL);
+  MPI_Win_sync(shared_win);
+  MPI_Aint segsize;
+  int dispunit;
+  MPI_Win_shared_query(shared_win, 0, &segsize, &dispunit, &base);
+  shared_begin = base;
+  shared_end = base + segsize / sizeof(Triple);
+
+  TripleIndex::iterator it = idxpos.begin();
+  while (it != idxpos.end()) {
+    if (is_shared(*it)) {
+#if USE_INDEX_SPO
+      idxspo.erase(*it);
+#endif
+#if USE_INDEX_OSP
+      idxosp.erase(*it);
+#endif
+      idxpos.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Gives the shared triples back to the first processor of each node so
+// that they are output, and releases the window.
+void unshare_replicas() {
+  if (shared_win == MPI_WIN_NULL) {
+    return;
+  }
+  int local_rank;
+  MPI_Comm_rank(COMM_LOCAL, &local_rank);
+  if (local_rank == 0) {
+    idxpos.insert(shared_begin, shared_end);
+  }
+  shared_begin = shared_end = NULL;
+  MPI_Win_unlock_all(shared_win);
+  MPI_Win_free(&shared_win);
+}
+
 bool already_read_replication_conditions = false;
 uint8_t *replication_conditions = NULL;
 size_t replication_conditions_len = 0;
@@ -2098,12 +2697,11 @@ void redistribute_data(const char *filename) {
   if (RANDOMIZE) {
     ZEROSAY("Performing randomization..." << endl);
     Distributor *dist;
-    NEW(dist, MPIPacketDistributor, MPI::COMM_WORLD, 3*sizeof(constint_t),
-        NUMREQUESTS, COORDEVERY, 382);
+    dist = new_distributor(MPI::COMM_WORLD, triple_msgsize(), 382);
     Redistributor *redist;
     NEW(redist, Redistributor, dist);
     redist->randomize = true;
-    redist->exec();
+    redist->exec(PIPELINE);
     idxpos.swap(redist->newindex);
     DELETE(redist);
   }
@@ -2131,6 +2729,16 @@ void redistribute_data(const char *filename) {
 
     ZEROSAY("Query out the data for replication." << endl);
     get_redist_data(replication_conditions, replication_conditions_len, repls);
+    if (SHARED_REPLICAS) {
+      TripleIndex::iterator it = repls.begin();
+      while (it != repls.end()) {
+        if (is_shared(*it)) {
+          repls.erase(it++);
+        } else {
+          ++it;
+        }
+      }
+    }
 
 //    ZEROSAY("Destroying the aforementioned indexes." << endl);
 //    // now get rid of them because we need memory during redistribution
@@ -2158,6 +2766,13 @@ void redistribute_data(const char *filename) {
       }
     }
 
+    if (SHARED_REPLICAS) {
+      ZEROSAY("Sharing replicated data per node." << endl);
+      share_replicas(bytes, size);
+      free(bytes);
+      return;
+    }
+
     ZEROSAY("Doing actual replication." << endl);
     int *sizes = (int*)myalloc(nproc, sizeof(int));
     int *displs = (int*)myalloc(nproc, sizeof(int));
@@ -2197,6 +2812,7 @@ void redistribute_data(const char *filename) {
         memcpy(&triple[j], recvbuf + i + j*sizeof(constint_t), sizeof(constint_t));
       }
       idxpos.insert(triple);
+      replicas.insert(triple);
     }
     free(recvbuf);
   }
@@ -2207,11 +2823,10 @@ void uniq() {
     return;
   }
   Distributor *dist;
-  NEW(dist, MPIPacketDistributor, MPI::COMM_WORLD, 3*sizeof(constint_t),
-      NUMREQUESTS, COORDEVERY, 382);
+  dist = new_distributor(MPI::COMM_WORLD, triple_msgsize(), 382);
   DistUniq *redist;
   NEW(redist, DistUniq, dist);
-  redist->exec();
+  redist->exec(PIPELINE);
   idxpos.swap(redist->newindex);
   DELETE(redist);
   // NOTE intentionally not modifying other indexes because I know this is
@@ -2289,6 +2904,200 @@ void write_data(const char *filename) {
   free(data);
 }
 
+///// CHECKPOINTS /////
+
+// With --checkpoint, every processor writes its state at round
+// boundaries and, given --checkpoint-every n, every n saturation cycles,
+// and --restart-from resumes from such files instead of the input data.
+// Each processor saturates on its own within a round, so the mid-round
+// checkpoints of processors may be from different cycles, but each is
+// a subset of the closure of its processor's data for the round, and
+// resuming from it gives the same result.  Processors must only agree
+// on the round.
+// A checkpoint holds the round and cycle, the local triples, the
+// replicated triples (which may only be in the shared window), and the
+// atoms.  Triples are written in idxpos order, rotated to (p, o, s) so
+// that put_triple_delta applies.  The file is written under a temporary
+// name and renamed so that a failure leaves the previous checkpoint.
+#define CHECKPOINT_MAGIC "RIFCKPT1"
+
+string rank_filename(const char *filename) {
+  string fnamestr(filename);
+  size_t hash = fnamestr.find('#');
+  if (hash != string::npos) {
+    stringstream ss (stringstream::in | stringstream::out);
+    ss << fnamestr.substr(0, hash) << MPI::COMM_WORLD.Get_rank()
+       << fnamestr.substr(hash + 1, fnamestr.size() - hash - 1);
+    fnamestr = ss.str();
+  }
+  return fnamestr;
+}
+
+class CheckpointWriter {
+private:
+  MPI::File file;
+  uint8_t *buffer;
+  uint8_t *write_to;
+  uint8_t *end;
+  Triple prev;
+public:
+  CheckpointWriter(const string &filename) : prev(3, 0) {
+    this->file = MPI::File::Open(MPI::COMM_SELF, filename.c_str(),
+        MPI::MODE_WRONLY | MPI::MODE_CREATE, MPI::INFO_NULL);
+    this->file.Set_size(0);
+    this->buffer = (uint8_t*)myalloc(1, PAGESIZE);
+    this->write_to = this->buffer;
+    // room for the largest thing written at once, a tuple
+    this->end = this->buffer + PAGESIZE - 10*(TUPLE_SIZE + 2);
+  }
+  ~CheckpointWriter() {
+    this->flush();
+    this->file.Close();
+    free(this->buffer);
+  }
+  void flush() {
+    if (this->write_to != this->buffer) {
+      this->file.Write(this->buffer, this->write_to - this->buffer,
+                       MPI::BYTE);
+      this->write_to = this->buffer;
+    }
+  }
+  void bytes(const char *str, const size_t len) {
+    memcpy(this->write_to, str, len);
+    this->write_to += len;
+  }
+  void varint(const constint_t val) {
+    put_varint(this->write_to, val);
+    if (this->write_to >= this->end) {
+      this->flush();
+    }
+  }
+  void triple(const Triple &triple) {
+    Triple rotated(3);
+    rotated[0] = triple[1];
+    rotated[1] = triple[2];
+    rotated[2] = triple[0];
+    put_triple_delta(this->write_to, this->prev, rotated);
+    this->prev = rotated;
+    if (this->write_to >= this->end) {
+      this->flush();
+    }
+  }
+  void restart_triples() {
+    this->prev = Triple(3, 0);
+  }
+};
+
+void write_checkpoint(const size_t round, const size_t cycle) {
+  string filename = rank_filename(CHECKPOINT);
+  string tempname = filename + ".tmp";
+  {
+    CheckpointWriter out(tempname);
+    out.bytes(CHECKPOINT_MAGIC, strlen(CHECKPOINT_MAGIC));
+    out.varint(round);
+    out.varint(cycle);
+
+    out.varint(idxpos.size());
+    TripleIndex::const_iterator it = idxpos.begin();
+    for (; it != idxpos.end(); ++it) {
+      out.triple(*it);
+    }
+
+    TripleIndex repls = replicas;
+    repls.insert(shared_begin, shared_end);
+    out.restart_triples();
+    out.varint(repls.size());
+    for (it = repls.begin(); it != repls.end(); ++it) {
+      out.triple(*it);
+    }
+
+    out.varint(atoms.size());
+    map<constint_t, Index>::const_iterator ait = atoms.begin();
+    for (; ait != atoms.end(); ++ait) {
+      out.varint(ait->first);
+      out.varint(ait->second.size());
+      Index::const_iterator tit = ait->second.begin();
+      for (; tit != ait->second.end(); ++tit) {
+        out.varint(tit->size());
+        size_t i;
+        for (i = 0; i < tit->size(); ++i) {
+          out.varint(tit->at(i));
+        }
+      }
+    }
+  }
+  if (rename(tempname.c_str(), filename.c_str()) != 0) {
+    cerr << "[ERROR] Processor " << MPI::COMM_WORLD.Get_rank()
+         << " could not move its checkpoint to " << filename << endl;
+  }
+}
+
+// Restores the state saved by write_checkpoint, less the shared window,
+// which the caller rebuilds from the returned replicated triples.
+void read_checkpoint(const char *filename, size_t &round, size_t &cycle,
+                     TripleIndex &repls) {
+  int rank = MPI::COMM_WORLD.Get_rank();
+  string fnamestr = rank_filename(filename);
+  MPI::File file = MPI::File::Open(MPI::COMM_SELF, fnamestr.c_str(),
+      MPI::MODE_RDONLY, MPI::INFO_NULL);
+  MPI::Offset filesize = file.Get_size();
+  uint8_t *buffer = (uint8_t*)myalloc(filesize + 1, 1);
+  MPI::Offset bytesread = 0;
+  while (bytesread < filesize) {
+    MPI::Status stat;
+    file.Read(buffer + bytesread, filesize - bytesread, MPI::BYTE, stat);
+    bytesread += stat.Get_count(MPI::BYTE);
+  }
+  file.Close();
+  size_t magiclen = strlen(CHECKPOINT_MAGIC);
+  if ((size_t) filesize < magiclen ||
+      memcmp(buffer, CHECKPOINT_MAGIC, magiclen) != 0) {
+    cerr << "[ERROR] Processor " << rank << " found no checkpoint in "
+         << fnamestr << endl;
+    MPI::COMM_WORLD.Abort(-3);
+  }
+  const uint8_t *read_from = buffer + magiclen;
+  round = get_varint(read_from);
+  cycle = get_varint(read_from);
+
+  size_t n = get_varint(read_from);
+  Triple rotated(3, 0);
+  Triple triple(3);
+  for (; n > 0; --n) {
+    get_triple_delta(read_from, rotated);
+    triple[0] = rotated[2];
+    triple[1] = rotated[0];
+    triple[2] = rotated[1];
+    idxpos.insert(idxpos.end(), triple);
+  }
+
+  n = get_varint(read_from);
+  rotated = Triple(3, 0);
+  for (; n > 0; --n) {
+    get_triple_delta(read_from, rotated);
+    triple[0] = rotated[2];
+    triple[1] = rotated[0];
+    triple[2] = rotated[1];
+    repls.insert(repls.end(), triple);
+  }
+
+  n = get_varint(read_from);
+  for (; n > 0; --n) {
+    constint_t pred = get_varint(read_from);
+    Index &index = atoms[pred];
+    size_t ntuples = get_varint(read_from);
+    for (; ntuples > 0; --ntuples) {
+      Tuple tuple(get_varint(read_from));
+      size_t i;
+      for (i = 0; i < tuple.size(); ++i) {
+        tuple[i] = get_varint(read_from);
+      }
+      index.insert(index.end(), tuple);
+    }
+  }
+  free(buffer);
+}
+
 #define FOR_HUMAN_EYES 0
 void print_data() {
   TripleIndex::iterator it = idxpos.begin();
@@ -2367,6 +3176,7 @@ int main(int argc, char **argv) {
   }
 
   bool uniquify = false;
+  const char *restart_from = NULL;
 
   srandom(MPI::COMM_WORLD.Get_rank());
   int i, j;
@@ -2376,6 +3186,10 @@ int main(int argc, char **argv) {
       stringstream ss(stringstream::in | stringstream::out);
       ss << argv[++i];
       ss >> PACKETSIZE; // currently unused
+    } else if (strcmp(argv[i], "--batch-size") == 0) {
+      stringstream ss(stringstream::in | stringstream::out);
+      ss << argv[++i];
+      ss >> BATCHSIZE;
     } else if (strcmp(argv[i], "--num-requests") == 0) {
       stringstream ss(stringstream::in | stringstream::out);
       ss << argv[++i];
@@ -2394,15 +3208,51 @@ int main(int argc, char **argv) {
       RANDOMIZE = true;
     } else if (strcmp(argv[i], "--complete") == 0) {
       COMPLETE = true;
+    } else if (strcmp(argv[i], "--alltoall") == 0) {
+      ALLTOALL = true;
+    } else if (strcmp(argv[i], "--pipeline") == 0) {
+      PIPELINE = true;
+    } else if (strcmp(argv[i], "--compress") == 0) {
+      COMPRESS = true;
+    } else if (strcmp(argv[i], "--shared-replicas") == 0) {
+      SHARED_REPLICAS = true;
+    } else if (strcmp(argv[i], "--steal") == 0) {
+      STEAL = true;
+    } else if (strcmp(argv[i], "--steal-chunk") == 0) {
+      stringstream ss(stringstream::in | stringstream::out);
+      ss << argv[++i];
+      ss >> STEALCHUNK;
+    } else if (strcmp(argv[i], "--checkpoint") == 0) {
+      CHECKPOINT = argv[++i];
+    } else if (strcmp(argv[i], "--checkpoint-every") == 0) {
+      stringstream ss(stringstream::in | stringstream::out);
+      ss << argv[++i];
+      ss >> CHECKPOINTEVERY;
+    } else if (strcmp(argv[i], "--restart-from") == 0) {
+      restart_from = argv[++i];
     }
   }
 
   ZEROSAY("[INFO] PACKETSIZE: " << PACKETSIZE << endl);
+  ZEROSAY("[INFO] BATCHSIZE: " << BATCHSIZE << endl);
+  ZEROSAY("[INFO] ALLTOALL: " << ALLTOALL << endl);
+  ZEROSAY("[INFO] PIPELINE: " << PIPELINE << endl);
+  ZEROSAY("[INFO] COMPRESS: " << COMPRESS << endl);
   ZEROSAY("[INFO] NUMREQUESTS: " << NUMREQUESTS << endl);
   ZEROSAY("[INFO] COORDEVERY: " << COORDEVERY << endl);
   ZEROSAY("[INFO] UNIQUIFY: " << uniquify << endl);
   ZEROSAY("[INFO] PAGESIZE: " << PAGESIZE << endl);
   ZEROSAY("[INFO] RANDOMIZE: " << RANDOMIZE << endl);
+  ZEROSAY("[INFO] SHARED_REPLICAS: " << SHARED_REPLICAS << endl);
+  ZEROSAY("[INFO] STEAL: " << STEAL << endl);
+  ZEROSAY("[INFO] STEALCHUNK: " << STEALCHUNK << endl);
+  ZEROSAY("[INFO] CHECKPOINT: " << (CHECKPOINT == NULL ? "(none)" : CHECKPOINT) << endl);
+  ZEROSAY("[INFO] CHECKPOINTEVERY: " << CHECKPOINTEVERY << endl);
+  ZEROSAY("[INFO] RESTART_FROM: " << (restart_from == NULL ? "(none)" : restart_from) << endl);
+
+  if (SHARED_REPLICAS) {
+    init_shared_replicas();
+  }
 
   TIME_T(ts_load_rules);
   TIMESET(ts_load_rules);
@@ -2417,13 +3267,50 @@ int main(int argc, char **argv) {
   TIME_T(ts_load_data);
   TIMESET(ts_load_data);
 
-  ZEROSAY("[INFO] Loading data from " << argv[2] << endl);
-  load_data(argv[2]);
+  if (restart_from != NULL) {
+    ZEROSAY("[INFO] Restarting from checkpoint " << restart_from << endl);
+    TripleIndex repls (Order(1, 2, 0));
+    read_checkpoint(restart_from, round_count, cycle_start, repls);
+    if (SHARED_REPLICAS) {
+      uint8_t *bytes = (uint8_t*)myalloc(3*repls.size(), sizeof(constint_t));
+      uint8_t *write_to = bytes;
+      TripleIndex::const_iterator it = repls.begin();
+      for (; it != repls.end(); ++it) {
+        size_t i;
+        for (i = 0; i < it->size(); ++i) {
+          memcpy(write_to, &it->at(i), sizeof(constint_t));
+          write_to += sizeof(constint_t);
+        }
+      }
+      share_replicas(bytes, repls.size() * 3 * sizeof(constint_t));
+      free(bytes);
+    } else {
+      idxpos.insert(repls.begin(), repls.end());
+      replicas.swap(repls);
+    }
+    // every processor must agree on the round the checkpoint was in
+    unsigned long local_round = round_count;
+    unsigned long min_round, max_round;
+    MPI::COMM_WORLD.Allreduce(&local_round, &min_round, 1,
+        MPI::UNSIGNED_LONG, MPI::MIN);
+    MPI::COMM_WORLD.Allreduce(&local_round, &max_round, 1,
+        MPI::UNSIGNED_LONG, MPI::MAX);
+    if (min_round != max_round) {
+      cerr << "[ERROR] Processor " << MPI::COMM_WORLD.Get_rank()
+           << " restarted from a checkpoint of round " << local_round
+           << ", but the checkpoints are from rounds " << min_round
+           << " through " << max_round << "." << endl;
+      MPI::COMM_WORLD.Abort(-3);
+    }
+  } else {
+    ZEROSAY("[INFO] Loading data from " << argv[2] << endl);
+    load_data(argv[2]);
+  }
 
   TIME_T(ts_randomize);
   TIMESET(ts_randomize);
 
-  if (RANDOMIZE || argc > 4) {
+  if (restart_from == NULL && (RANDOMIZE || argc > 4)) {
     ZEROSAY("[INFO] Redistributing data according to " << (argc <= 4 ? "(nothing)" : argv[4]) << endl);
     redistribute_data(argc > 4 ? argv[4] : NULL);
   }
@@ -2445,6 +3332,10 @@ int main(int argc, char **argv) {
   vector<size_t> old_sizes, new_sizes;
   note_sizes(new_sizes);
 
+  if (CHECKPOINT != NULL && restart_from == NULL) {
+    write_checkpoint(round_count, cycle_start);
+  }
+
   uint8_t another_iteration = 0;
   do {
     ZEROSAY("[INFO] Inferring..." << endl);
@@ -2464,7 +3355,14 @@ int main(int argc, char **argv) {
       MPI::COMM_WORLD.Allreduce(&local_need_another_iteration,
           &another_iteration, 1,  MPI::BYTE, MPI::BOR);
     }
+    if (another_iteration != 0) {
+      ++round_count;
+      if (CHECKPOINT != NULL) {
+        write_checkpoint(round_count, 0);
+      }
+    }
   } while (another_iteration != 0);
+  unshare_replicas();
 
   TIME_T(ts_destroy_index);
   TIMESET(ts_destroy_index);
@@ -2510,6 +3408,12 @@ int main(int argc, char **argv) {
   report_times("Overall", ts_very_beginning, ts_finish);
 #endif
 
+  if (COMM_REPLS != MPI_COMM_NULL) {
+    MPI_Comm_free(&COMM_REPLS);
+  }
+  if (COMM_LOCAL != MPI_COMM_NULL) {
+    MPI_Comm_free(&COMM_LOCAL);
+  }
   MPI::Finalize();
   return 0;
 }
@@ -14,17 +14,25 @@
  */
 
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <deque>
+#include <fcntl.h>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <list>
 #include <map>
+#include <pthread.h>
 #include <set>
 #include <sstream>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <utility>
 #include <vector>
+#include "main/Array.h"
 #include "main/encode.h"
 
 #ifdef DEBUG
@@ -719,8 +727,27 @@ void print_rules(vector<Rule> &rules) {
 
 ////// JOIN PROCESSING //////
 
+#ifndef TUPLE_SIZE
+#warning "Without -DTUPLE_SIZE=N, tuples will be stored in vectors, which are inefficient.  If you know the maximum number of variables N in any rule, compile with -DTUPLE_SIZE=N."
+#endif
+
+#ifndef CONTAINER
+#define CONTAINER deque
+#elif CONTAINER == 0
+#undef CONTAINER // Hacky way to force lists.
+#endif
+
+#ifdef TUPLE_SIZE
+typedef Array<TUPLE_SIZE> Tuple;
+#else
 typedef vector<constint_t> Tuple;
+#endif
+
+#ifdef CONTAINER
+typedef CONTAINER<Tuple> Relation;
+#else
 typedef list<Tuple> Relation;
+#endif
 
 class Order {
 private:
@@ -775,37 +802,543 @@ public:
 };
 
 typedef set<Tuple, Order> Index;
-Index idxspo (Order(0, 1, 2));
-Index idxpos (Order(1, 2, 0));
-Index idxosp (Order(2, 0, 1));
 map<constint_t, Index> atoms;
 
-void load_data(const char *filename) {
-  ifstream fin(filename);
+// Triples are stored as fixed-size records rather than as Tuples, so that
+// each triple index is one flat array instead of a tree of separately
+// allocated vectors.
+struct Triple {
+  constint_t spo[3];
+  Triple() {
+    spo[0] = spo[1] = spo[2] = 0;
+  }
+  Triple(constint_t s, constint_t p, constint_t o) {
+    spo[0] = s;
+    spo[1] = p;
+    spo[2] = o;
+  }
+  constint_t &operator[](size_t i) {
+    return spo[i];
+  }
+  const constint_t &operator[](size_t i) const {
+    return spo[i];
+  }
+  bool operator==(const Triple &t) const {
+    return spo[0] == t.spo[0] && spo[1] == t.spo[1] && spo[2] == t.spo[2];
+  }
+  bool operator<(const Triple &t) const {
+    if (spo[0] != t.spo[0]) {
+      return spo[0] < t.spo[0];
+    }
+    if (spo[1] != t.spo[1]) {
+      return spo[1] < t.spo[1];
+    }
+    return spo[2] < t.spo[2];
+  }
+};
+
+// Orders triples by positions I1, I2, then I3.
+template<size_t I1, size_t I2, size_t I3>
+struct TripleOrder {
+  bool operator()(const Triple &t1, const Triple &t2) const {
+    if (t1[I1] != t2[I1]) {
+      return t1[I1] < t2[I1];
+    }
+    if (t1[I2] != t2[I2]) {
+      return t1[I2] < t2[I2];
+    }
+    return t1[I3] < t2[I3];
+  }
+};
+
+typedef const Triple *TripleIter;
+
+// Remove from triples, keeping the order of the rest, those that are also
+// in sorted, which must be in SPO order.
+void remove_triples(vector<Triple> &triples, const vector<Triple> &sorted) {
+  if (sorted.empty()) {
+    return;
+  }
+  vector<Triple>::iterator out = triples.begin();
+  vector<Triple>::iterator it = triples.begin();
+  for (; it != triples.end(); ++it) {
+    if (!binary_search(sorted.begin(), sorted.end(), *it)) {
+      *out = *it;
+      ++out;
+    }
+  }
+  triples.erase(out, triples.end());
+}
+
+// A sorted array of triples in order I1, I2, I3.  Lookups are binary
+// searches, and triples are added and removed in batches, each batch
+// costing one pass over the array.  The array is either owned or part of
+// a snapshot mapped in memory (see map), which is copied only when the
+// index first changes.
+//
+// Batches can also be staged in a second, smaller sorted array of recent
+// triples, which lookups see right away but which is merged into the
+// main array only on flush.  This lets each rule of a cycle see what the
+// rules before it asserted without a pass over the whole index per rule.
+template<size_t I1, size_t I2, size_t I3>
+class TripleIndex {
+private:
+  vector<Triple> triples;
+  vector<Triple> recent;
+  TripleIter first;
+  TripleIter last;
+  bool mapped;
+  void update() {
+    this->first = this->triples.empty() ? NULL : &this->triples[0];
+    this->last = this->first + this->triples.size();
+    this->mapped = false;
+  }
+  void own() {
+    if (this->mapped) {
+      vector<Triple> copy (this->first, this->last);
+      this->triples.swap(copy);
+      this->update();
+    }
+  }
+public:
+  typedef TripleOrder<I1, I2, I3> Compare;
+  TripleIndex() : first(NULL), last(NULL), mapped(false) {
+    // do nothing
+  }
+  TripleIter begin() const {
+    return this->first;
+  }
+  TripleIter end() const {
+    return this->last;
+  }
+  size_t size() const {
+    return (this->last - this->first) + this->recent.size();
+  }
+  bool contains(const Triple &triple) const {
+    return binary_search(this->first, this->last, triple, Compare()) ||
+           binary_search(this->recent.begin(), this->recent.end(), triple,
+                         Compare());
+  }
+  // The triples from mintriple to maxtriple, inclusive, in the main array
+  // (ranges[0]) and among the staged triples (ranges[1]).
+  void range(const Triple &mintriple, const Triple &maxtriple,
+             pair<TripleIter, TripleIter> ranges[2]) const {
+    TripleIter lo = lower_bound(this->first, this->last, mintriple,
+                                Compare());
+    ranges[0] = make_pair(lo, upper_bound(lo, this->last, maxtriple,
+                                          Compare()));
+    TripleIter rfirst = this->recent.empty() ? NULL : &this->recent[0];
+    TripleIter rlast = rfirst + this->recent.size();
+    lo = lower_bound(rfirst, rlast, mintriple, Compare());
+    ranges[1] = make_pair(lo, upper_bound(lo, rlast, maxtriple, Compare()));
+  }
+  // Replace the contents with the distinct triples of batch.
+  void assign(const vector<Triple> &batch) {
+    vector<Triple> sorted (batch);
+    this->take(sorted);
+  }
+  // Like assign, but sorts batch in place and leaves it empty.
+  void take(vector<Triple> &batch) {
+    this->recent.clear();
+    sort(batch.begin(), batch.end(), Compare());
+    batch.erase(unique(batch.begin(), batch.end()), batch.end());
+    this->triples.swap(batch);
+    vector<Triple> empty;
+    batch.swap(empty);
+    this->update();
+  }
+  // Use the n triples at mem, which must be distinct and in this order,
+  // without copying them.  They must stay valid as long as the index.
+  void map(const Triple *mem, size_t n) {
+    vector<Triple> empty;
+    this->triples.swap(empty);
+    this->recent.clear();
+    this->first = mem;
+    this->last = mem + n;
+    this->mapped = true;
+  }
+  // Add the triples of batch, which must be distinct and not yet present.
+  void insert(const vector<Triple> &batch) {
+    if (batch.empty()) {
+      return;
+    }
+    this->own();
+    size_t n = this->triples.size();
+    this->triples.insert(this->triples.end(), batch.begin(), batch.end());
+    sort(this->triples.begin() + n, this->triples.end(), Compare());
+    inplace_merge(this->triples.begin(), this->triples.begin() + n,
+                  this->triples.end(), Compare());
+    this->update();
+  }
+  // Like insert, but only merges batch into the staged triples.
+  void stage(const vector<Triple> &batch) {
+    if (batch.empty()) {
+      return;
+    }
+    size_t n = this->recent.size();
+    this->recent.insert(this->recent.end(), batch.begin(), batch.end());
+    sort(this->recent.begin() + n, this->recent.end(), Compare());
+    inplace_merge(this->recent.begin(), this->recent.begin() + n,
+                  this->recent.end(), Compare());
+  }
+  // Merge the staged triples into the main array.
+  void flush() {
+    vector<Triple> batch;
+    batch.swap(this->recent);
+    this->insert(batch);
+  }
+  // Remove the triples of sorted, which must be in SPO order.
+  void erase(const vector<Triple> &sorted) {
+    if (sorted.empty()) {
+      return;
+    }
+    this->flush();
+    this->own();
+    remove_triples(this->triples, sorted);
+    this->update();
+  }
+};
+
+TripleIndex<0, 1, 2> idxspo;
+TripleIndex<1, 2, 0> idxpos;
+TripleIndex<2, 0, 1> idxosp;
+
+// Triples asserted during the previous cycle, used by --semi-naive.
+TripleIndex<0, 1, 2> dltspo;
+TripleIndex<1, 2, 0> dltpos;
+TripleIndex<2, 0, 1> dltosp;
+// The slot of the rule body currently matched against the delta
+// instead of the whole data set, or NULL for a full evaluation.  Each
+// thread evaluates its own rule, hence its own slot.
+__thread pair<Term, Term> *delta_slot = NULL;
+// With --split-scans, the current evaluation only scans part scan_part of
+// scan_parts of the first range of triples it selects.
+__thread size_t scan_part = 0;
+__thread size_t scan_parts = 1;
+bool SEMI_NAIVE = false;
+bool PLAN_JOINS = false;
+bool PRINT_PLANS = false;
+size_t NUM_THREADS = 1;
+bool SPLIT_SCANS = false;
+const char *SAVE_SNAPSHOT = NULL;
+const char *RESTORE_SNAPSHOT = NULL;
+const char *ADDED_DATA = NULL;
+const char *DELETED_DATA = NULL;
+const char *BASE_DATA = NULL;
+
+// Stop counting matching triples at this many when estimating the
+// cardinality of a triple pattern for --plan-joins.
+#ifndef PLAN_COUNT_LIMIT
+#define PLAN_COUNT_LIMIT 100000
+#endif
+
+void read_data(ifstream &fin, vector<Triple> &triples) {
   while (fin.good()) {
-    Tuple triple(3);
-    Tuple::iterator it = triple.begin();
-    for (; it != triple.end(); ++it) {
+    Triple triple;
+    size_t j;
+    for (j = 0; j < 3; ++j) {
       constint_t c = 0;
-      int i;
+      size_t i;
       for (i = 0; i < sizeof(constint_t); ++i) {
         int b = fin.get();
         if (fin.eof()) {
-          if (it != triple.begin() || c != 0) {
+          if (j != 0 || c != 0) {
             cerr << "[ERROR] Unexpected end of data file.  Only partial data read." << endl;
           }
           return;
         }
         c = (c << 8) | (b & 0xFF);
       }
-      *it = c;
+      triple[j] = c;
     }
-    idxspo.insert(triple);
-    idxpos.insert(triple);
-    idxosp.insert(triple);
+    triples.push_back(triple);
   }
 }
 
+// Decode n triples of big-endian integers from bytes.  The loop has no
+// branches so that the compiler can turn it into plain byte swaps.
+void decode_triples(const uint8_t *bytes, size_t n, Triple *triples) {
+  size_t i;
+  for (i = 0; i < n; ++i) {
+    size_t j;
+    for (j = 0; j < 3; ++j) {
+      const uint8_t *b = bytes + (i * 3 + j) * sizeof(constint_t);
+      constint_t c = 0;
+      size_t k;
+      for (k = 0; k < sizeof(constint_t); ++k) {
+        c = (c << 8) | b[k];
+      }
+      triples[i][j] = c;
+    }
+  }
+}
+
+// Map the data file into memory and decode it in one pass, falling back
+// to reading it as a stream if it cannot be mapped (e.g., a pipe).
+bool map_data(const char *filename, vector<Triple> &triples) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return false;
+  }
+  size_t len = st.st_size;
+  size_t n = len / (3 * sizeof(constint_t));
+  if (n * 3 * sizeof(constint_t) != len) {
+    cerr << "[ERROR] Unexpected end of data file.  Only partial data read." << endl;
+  }
+  if (n == 0) {
+    close(fd);
+    return true;
+  }
+  void *bytes = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (bytes == MAP_FAILED) {
+    return false;
+  }
+  madvise(bytes, len, MADV_SEQUENTIAL);
+  triples.resize(n);
+  decode_triples((const uint8_t*) bytes, n, &triples[0]);
+  munmap(bytes, len);
+  return true;
+}
+
+// Add to the indexes the triples of batch that are not already there,
+// leaving only those in batch, in SPO order.
+// With staged, the triples are only staged in the indexes (see
+// TripleIndex) until the next flush_triples.
+void assert_triples(vector<Triple> &batch, bool staged = false) {
+  sort(batch.begin(), batch.end());
+  batch.erase(unique(batch.begin(), batch.end()), batch.end());
+  vector<Triple>::iterator out = batch.begin();
+  vector<Triple>::iterator it = batch.begin();
+  for (; it != batch.end(); ++it) {
+    if (!idxspo.contains(*it)) {
+      *out = *it;
+      ++out;
+    }
+  }
+  batch.erase(out, batch.end());
+  if (!batch.empty() && staged) {
+    idxspo.stage(batch);
+    idxpos.stage(batch);
+    idxosp.stage(batch);
+  } else if (!batch.empty()) {
+    idxspo.insert(batch);
+    idxpos.insert(batch);
+    idxosp.insert(batch);
+  }
+}
+
+void flush_triples() {
+  idxspo.flush();
+  idxpos.flush();
+  idxosp.flush();
+}
+
+void read_triples(const char *filename, vector<Triple> &triples) {
+  if (!map_data(filename, triples)) {
+    ifstream fin(filename);
+    read_data(fin, triples);
+  }
+}
+
+// Add the triples of the data file to the indexes, building them with a
+// single sort each if they are still empty.
+void load_data(const char *filename) {
+  vector<Triple> triples;
+  read_triples(filename, triples);
+  if (idxspo.size() > 0) {
+    assert_triples(triples);
+    return;
+  }
+  idxpos.assign(triples);
+  idxosp.assign(triples);
+  idxspo.take(triples);
+}
+
+// Remove from the indexes the triples of batch, leaving in batch only
+// those that were there, in SPO order.
+void retract_triples(vector<Triple> &batch) {
+  sort(batch.begin(), batch.end());
+  batch.erase(unique(batch.begin(), batch.end()), batch.end());
+  vector<Triple>::iterator out = batch.begin();
+  vector<Triple>::iterator it = batch.begin();
+  for (; it != batch.end(); ++it) {
+    if (idxspo.contains(*it)) {
+      *out = *it;
+      ++out;
+    }
+  }
+  batch.erase(out, batch.end());
+  idxspo.erase(batch);
+  idxpos.erase(batch);
+  idxosp.erase(batch);
+}
+
+////// SNAPSHOTS //////
+
+// A snapshot holds the triple indexes just as they are in memory, so that
+// --restore-snapshot can map them back in and use them without sorting.
+// All words are in the byte order of the machine that wrote it:
+//   SNAPSHOT_MAGIC, SNAPSHOT_BYTE_ORDER, fingerprint of the rules,
+//     number of triples n, number of atom predicates
+//   n triples in SPO order, n in POS order, and n in OSP order
+//   for each atom predicate: the predicate, the number of atoms, and for
+//     each atom its number of arguments followed by the arguments
+#define SNAPSHOT_MAGIC 0x49524E4150534E31ULL
+#define SNAPSHOT_BYTE_ORDER 0x0102030405060708ULL
+#define SNAPSHOT_HEADER_WORDS 5
+
+// A closure only holds for the rules that inferred it, so snapshots are
+// tagged with an FNV-1a hash of the printed rules.
+uint64_t fingerprint(vector<Rule> &rules) {
+  stringstream ss (stringstream::in | stringstream::out);
+  vector<Rule>::iterator it = rules.begin();
+  for (; it != rules.end(); ++it) {
+    ss << *it << endl;
+  }
+  string str = ss.str();
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  string::const_iterator cit = str.begin();
+  for (; cit != str.end(); ++cit) {
+    hash ^= (uint8_t) *cit;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+template<typename T>
+void write_triples(ofstream &fout, const T &index) {
+  if (index.size() > 0) {
+    fout.write((const char*) index.begin(), index.size() * sizeof(Triple));
+  }
+}
+
+void write_word(ofstream &fout, uint64_t word) {
+  fout.write((const char*) &word, sizeof(uint64_t));
+}
+
+// Write to a temporary file renamed at the end, since the current
+// snapshot may be the one mapped in memory.
+bool save_snapshot(const char *filename, vector<Rule> &rules) {
+  string tmpname = string(filename) + ".tmp";
+  ofstream fout(tmpname.c_str(), ios::out | ios::binary | ios::trunc);
+  write_word(fout, SNAPSHOT_MAGIC);
+  write_word(fout, SNAPSHOT_BYTE_ORDER);
+  write_word(fout, fingerprint(rules));
+  write_word(fout, idxspo.size());
+  write_word(fout, atoms.size());
+  write_triples(fout, idxspo);
+  write_triples(fout, idxpos);
+  write_triples(fout, idxosp);
+  map<constint_t, Index>::const_iterator atomit = atoms.begin();
+  for (; atomit != atoms.end(); ++atomit) {
+    write_word(fout, atomit->first);
+    write_word(fout, atomit->second.size());
+    Index::const_iterator it = atomit->second.begin();
+    for (; it != atomit->second.end(); ++it) {
+      write_word(fout, it->size());
+      Tuple::const_iterator tit = it->begin();
+      for (; tit != it->end(); ++tit) {
+        write_word(fout, *tit);
+      }
+    }
+  }
+  fout.close();
+  if (fout.fail() || rename(tmpname.c_str(), filename) != 0) {
+    cerr << "[ERROR] Unable to write snapshot to " << filename << endl;
+    return false;
+  }
+  return true;
+}
+
+// Map the snapshot into memory for the triple indexes to use directly.
+// The mapping is kept until the program exits.
+bool restore_snapshot(const char *filename, vector<Rule> &rules) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    cerr << "[ERROR] Unable to open snapshot " << filename << endl;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0
+      || (size_t) st.st_size < SNAPSHOT_HEADER_WORDS * sizeof(uint64_t)) {
+    cerr << "[ERROR] " << filename << " is not a snapshot." << endl;
+    close(fd);
+    return false;
+  }
+  size_t len = st.st_size;
+  void *mem = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    cerr << "[ERROR] Unable to map snapshot " << filename << endl;
+    return false;
+  }
+  const uint64_t *words = (const uint64_t*) mem;
+  const uint64_t *end = words + len / sizeof(uint64_t);
+  if (words[0] != SNAPSHOT_MAGIC) {
+    cerr << "[ERROR] " << filename << " is not a snapshot." << endl;
+    munmap(mem, len);
+    return false;
+  }
+  if (words[1] != SNAPSHOT_BYTE_ORDER) {
+    cerr << "[ERROR] Snapshot " << filename << " was written on a machine of different byte order." << endl;
+    munmap(mem, len);
+    return false;
+  }
+  if (words[2] != fingerprint(rules)) {
+    cerr << "[ERROR] Snapshot " << filename << " was inferred with different rules." << endl;
+    munmap(mem, len);
+    return false;
+  }
+  uint64_t n = words[3];
+  uint64_t npreds = words[4];
+  const Triple *triples = (const Triple*) (words + SNAPSHOT_HEADER_WORDS);
+  size_t room = len - SNAPSHOT_HEADER_WORDS * sizeof(uint64_t);
+  if (n > room / (3 * sizeof(Triple))) {
+    cerr << "[ERROR] Snapshot " << filename << " is truncated." << endl;
+    munmap(mem, len);
+    return false;
+  }
+  words = (const uint64_t*) (triples + 3 * n);
+  idxspo.map(triples, n);
+  idxpos.map(triples + n, n);
+  idxosp.map(triples + 2 * n, n);
+  uint64_t p;
+  for (p = 0; p < npreds; ++p) {
+    if (words + 2 > end) {
+      cerr << "[ERROR] Snapshot " << filename << " is truncated." << endl;
+      return false;
+    }
+    Index &index = atoms[words[0]];
+    uint64_t count = words[1];
+    words += 2;
+    uint64_t i;
+    for (i = 0; i < count; ++i) {
+      if (words >= end || *words > (uint64_t) (end - words - 1)) {
+        cerr << "[ERROR] Snapshot " << filename << " is truncated." << endl;
+        return false;
+      }
+      size_t arity = *words;
+#ifdef TUPLE_SIZE
+      if (arity > TUPLE_SIZE) {
+        cerr << "[ERROR] Snapshot " << filename << " has an atom of " << arity << " arguments, but tuples are fixed to " << TUPLE_SIZE << "." << endl;
+        return false;
+      }
+#endif
+      Tuple tuple(arity);
+      copy(words + 1, words + 1 + arity, tuple.begin());
+      index.insert(tuple);
+      words += 1 + arity;
+    }
+  }
+  return true;
+}
+
 void minusrel(Relation &intermediate, Relation &negated, Relation &result) {
   cerr << "[ERROR] Negation on non-special formulas is currently unsupported." << endl;
 }
@@ -815,7 +1348,7 @@ bool join(Tuple &t1, const Tuple &t2, Tuple &r) {
     t1.resize(t2.size());
   }
   Tuple temp(t1.size());
-  int i;
+  size_t i;
   for (i = 0; i < t1.size(); ++i) {
     if (i >= t2.size() || t2[i] == 0) {
       temp[i] = t1[i];
@@ -837,8 +1370,13 @@ void join(Relation &lhs, Relation &rhs, vector<size_t> &vars, Relation &result)
   DEBUG("  RHS size = ", rhs.size());
   Relation temp;
   Order order(vars);
+#ifdef CONTAINER
+  sort(lhs.begin(), lhs.end(), order);
+  sort(rhs.begin(), rhs.end(), order);
+#else
   lhs.sort(order);
   rhs.sort(order);
+#endif
   Relation::iterator lit = lhs.begin();
   Relation::iterator rit = rhs.begin();
   while (lit != lhs.end() && rit != rhs.end()) {
@@ -864,6 +1402,96 @@ void join(Relation &lhs, Relation &rhs, vector<size_t> &vars, Relation &result)
   DEBUG("  Result size = ", result.size());
 }
 #else
+// A hash table over the tuples of a relation, keyed on the join
+// variables.  It uses open addressing on flat arrays: each slot holds the
+// first tuple with a distinct key, and the other tuples with that key are
+// chained through next, in the order of the relation.
+class JoinTable {
+private:
+  static const size_t NONE = (size_t) -1;
+  const vector<size_t> &vars;
+  vector<const Tuple*> tuples;
+  vector<size_t> next;
+  vector<size_t> slots;
+  vector<size_t> hashes;
+  size_t mask;
+
+  static constint_t value(const Tuple &t, size_t i) {
+    return i < t.size() ? t[i] : 0;
+  }
+  size_t hash(const Tuple &t) const {
+    uint64_t h = 0;
+    vector<size_t>::const_iterator it = this->vars.begin();
+    for (; it != this->vars.end(); ++it) {
+      h = (h ^ value(t, *it)) * 0x9E3779B97F4A7C15ULL;
+      h ^= h >> 29;
+    }
+    return (size_t) h;
+  }
+  bool same_key(const Tuple &t1, const Tuple &t2) const {
+    vector<size_t>::const_iterator it = this->vars.begin();
+    for (; it != this->vars.end(); ++it) {
+      if (value(t1, *it) != value(t2, *it)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  // The slot holding the key of t, or the empty slot where it would go.
+  size_t slot_for(const Tuple &t, size_t h) const {
+    size_t i = h & this->mask;
+    while (this->slots[i] != NONE &&
+           (this->hashes[i] != h ||
+            !this->same_key(*this->tuples[this->slots[i]], t))) {
+      i = (i + 1) & this->mask;
+    }
+    return i;
+  }
+public:
+  JoinTable(const Relation &rel, const vector<size_t> &vars)
+      : vars(vars), next(rel.size(), NONE) {
+    this->tuples.reserve(rel.size());
+    Relation::const_iterator it = rel.begin();
+    for (; it != rel.end(); ++it) {
+      this->tuples.push_back(&*it);
+    }
+    size_t nslots = 16;
+    while (nslots < (rel.size() << 1)) {
+      nslots <<= 1;
+    }
+    this->mask = nslots - 1;
+    this->slots.resize(nslots, NONE);
+    this->hashes.resize(nslots);
+    // backwards, so that prepending to chains keeps them in order
+    size_t i = this->tuples.size();
+    while (i > 0) {
+      --i;
+      size_t h = this->hash(*this->tuples[i]);
+      size_t s = this->slot_for(*this->tuples[i], h);
+      this->next[i] = this->slots[s];
+      this->slots[s] = i;
+      this->hashes[s] = h;
+    }
+  }
+  // The first tuple with the same key as t, or NONE.
+  size_t find(const Tuple &t) const {
+    return this->slots[this->slot_for(t, this->hash(t))];
+  }
+  // The tuple following i with the same key, or NONE.
+  size_t next_of(size_t i) const {
+    return this->next[i];
+  }
+  const Tuple &at(size_t i) const {
+    return *this->tuples[i];
+  }
+  static bool found(size_t i) {
+    return i != NONE;
+  }
+};
+const size_t JoinTable::NONE;
+
+// Hash join, building the table on the smaller relation and probing it
+// with each tuple of the larger.
 void join(Relation &lhs, Relation &rhs, vector<size_t> &vars, Relation &result) {
   Relation temp;
   Relation *l, *r;
@@ -874,23 +1502,21 @@ void join(Relation &lhs, Relation &rhs, vector<size_t> &vars, Relation &result)
     l = &rhs;
     r = &lhs;
   }
-  Order order(vars, false);
-  multiset<Tuple, Order> index (order);
-  Relation::iterator it = r->begin();
-  for (; it != r->end(); ++it) {
-    index.insert(*it);
-  }
-  for (it = l->begin(); it != l->end(); ++it) {
-    pair<multiset<Tuple, Order>::iterator,
-         multiset<Tuple, Order>::iterator> rng = index.equal_range(*it);
-    multiset<Tuple, Order>::iterator rit;
-    for (rit = rng.first; rit != rng.second; ++rit) {
-      Tuple res;
-      if (!join(*it, *rit, res)) {
+  if (r->empty()) {
+    result.swap(temp);
+    return;
+  }
+  JoinTable table (*r, vars);
+  Relation::iterator it = l->begin();
+  for (; it != l->end(); ++it) {
+    size_t i = table.find(*it);
+    for (; JoinTable::found(i); i = table.next_of(i)) {
+      temp.push_back(Tuple());
+      if (!join(*it, table.at(i), temp.back())) {
         cerr << "[ERROR] Two tuples that were expected to be compatible turned out not to be.  This indicates a flaw in the program logic." << endl;
+        temp.pop_back();
       }
-      temp.push_back(res);
-    }    
+    }
   }
   result.swap(temp);
 }
@@ -1072,9 +1698,16 @@ void query_atom(Atom &atom, set<varint_t> &allvars, Relation &results) {
     cerr << "[ERROR] Results are incorrect when the same variable occurs multiple times in an atom in the rule body." << endl;
     return;
   }
-  Index &base = atoms[atom.predicate];
+  // find, not operator[], since other threads may be reading atoms
+  map<constint_t, Index>::const_iterator found = atoms.find(atom.predicate);
+  if (found == atoms.end()) {
+    Relation empty;
+    results.swap(empty);
+    return;
+  }
+  const Index &base = found->second;
   Relation temp;
-  Index::iterator it = base.begin();
+  Index::const_iterator it = base.begin();
   term = atom.arguments.begin;
   size_t max = atom.arguments.end - atom.arguments.begin;
   for (; it != base.end(); ++it) {
@@ -1097,7 +1730,447 @@ void query_atom(Atom &atom, set<varint_t> &allvars, Relation &results) {
   results.swap(temp);
 }
 
-void query(Atomic &atom, set<varint_t> &allvars, Relation &results) {
+// Find the triples from mintriple to maxtriple in the index that is
+// ordered with the fixed positions idx (0x4 subject, 0x2 predicate, 0x1
+// object) first.  They are in two ranges; see TripleIndex::range.
+void find_range(int idx, bool from_delta, const Triple &mintriple,
+                const Triple &maxtriple,
+                pair<TripleIter, TripleIter> ranges[2]) {
+  switch (idx) {
+    case 0x2:
+    case 0x3: // POS
+      (from_delta ? dltpos : idxpos).range(mintriple, maxtriple, ranges);
+      return;
+    case 0x1:
+    case 0x5: // OSP
+      (from_delta ? dltosp : idxosp).range(mintriple, maxtriple, ranges);
+      return;
+    default: // SPO
+      (from_delta ? dltspo : idxspo).range(mintriple, maxtriple, ranges);
+      return;
+  }
+}
+
+// A triple pattern in a rule body: the object of the frame and one of its
+// slots.
+typedef pair<Term*, pair<Term, Term>*> SlotRef;
+
+// Count the triples matching the constants of a pattern, but stop
+// counting at limit.
+size_t count_matches(SlotRef ref, bool from_delta, size_t limit) {
+  Term *terms[3] = { ref.first, &ref.second->first, &ref.second->second };
+  Triple mintriple;
+  Triple maxtriple;
+  int idx = 0;
+  size_t i;
+  for (i = 0; i < 3; ++i) {
+    if (terms[i]->type == CONSTANT) {
+      mintriple[i] = maxtriple[i] = terms[i]->get.constant;
+      idx |= 0x4 >> i;
+    } else if (terms[i]->type == VARIABLE) {
+      mintriple[i] = 0;
+      maxtriple[i] = CONSTINT_MAX;
+    } else {
+      return 0; // lists and functions never match
+    }
+  }
+  if (idx == 0) {
+    return min(limit, (from_delta ? dltspo : idxspo).size());
+  }
+  pair<TripleIter, TripleIter> ranges[2];
+  find_range(idx, from_delta, mintriple, maxtriple, ranges);
+  return min(limit, (size_t) (ranges[0].second - ranges[0].first) +
+                    (size_t) (ranges[1].second - ranges[1].first));
+}
+
+// Scan the triples matching a pattern into selection.  The positions
+// that are fixed in the pattern are given by idx (0x4 subject, 0x2
+// predicate, 0x1 object) and must be set in both mintriple and
+// maxtriple; the free positions must be 0 and CONSTINT_MAX, respectively.
+void select_triples(Term &subj, Term &pred, Term &obj, int idx,
+                    const Triple &mintriple, const Triple &maxtriple,
+                    varint_t maxvar, bool from_delta, Relation &selection) {
+  pair<TripleIter, TripleIter> ranges[2];
+  find_range(idx, from_delta, mintriple, maxtriple, ranges);
+  size_t r;
+  for (r = 0; r < 2; ++r) {
+    TripleIter begin = ranges[r].first;
+    TripleIter end = ranges[r].second;
+    if (scan_parts > 1) {
+      size_t n = end - begin;
+      end = begin + n * (scan_part + 1) / scan_parts;
+      begin = begin + n * scan_part / scan_parts;
+    }
+    // TODO the following loop could probably be more efficient
+    for (; begin != end; ++begin) {
+      Tuple result(maxvar + 1);
+      if (subj.type == VARIABLE) {
+        result[subj.get.variable] = (*begin)[0];
+      }
+      if (pred.type == VARIABLE) {
+        if (subj.type == VARIABLE && subj.get.variable == pred.get.variable) {
+          if ((*begin)[0] != (*begin)[1]) {
+            continue;
+          }
+        }
+        result[pred.get.variable] = (*begin)[1];
+      }
+      if (obj.type == VARIABLE) {
+        if (subj.type == VARIABLE && subj.get.variable == obj.get.variable) {
+          if ((*begin)[0] != (*begin)[2]) {
+            continue;
+          }
+        }
+        if (pred.type == VARIABLE && pred.get.variable == obj.get.variable) {
+          if ((*begin)[1] != (*begin)[2]) {
+            continue;
+          }
+        }
+        result[obj.get.variable] = (*begin)[2];
+      }
+      selection.push_back(result);
+    }
+  }
+  scan_parts = 1;
+}
+
+// Like select_triples, but only scans the triples that can join with the
+// tuples in bound, by looking up each distinct binding of the pattern's
+// variables instead of scanning the whole range.  This is what keeps
+// delta-driven evaluation proportional to the delta.
+void select_joinable(Term &subj, Term &pred, Term &obj,
+                     const Triple &mintriple, const Triple &maxtriple,
+                     varint_t maxvar, Relation &bound, Relation &selection) {
+  Term *terms[3] = { &subj, &pred, &obj };
+  set<Triple> patterns;
+  Relation::const_iterator it = bound.begin();
+  for (; it != bound.end(); ++it) {
+    Triple pattern(mintriple);
+    size_t i;
+    for (i = 0; i < 3; ++i) {
+      if (terms[i]->type == VARIABLE && terms[i]->get.variable < it->size()) {
+        pattern[i] = it->at(terms[i]->get.variable);
+      }
+    }
+    if (pattern == mintriple) {
+      // Some tuple binds none of the variables, so every triple
+      // matching the constants is needed anyway.
+      patterns.clear();
+      patterns.insert(mintriple);
+      break;
+    }
+    patterns.insert(pattern);
+  }
+  set<Triple>::iterator pit = patterns.begin();
+  for (; pit != patterns.end(); ++pit) {
+    Triple lo(*pit);
+    Triple hi(*pit);
+    int idx = 0;
+    size_t i;
+    for (i = 0; i < 3; ++i) {
+      if (lo[i] == 0) {
+        hi[i] = maxtriple[i];
+      } else {
+        idx |= 0x4 >> i;
+      }
+    }
+    select_triples(subj, pred, obj, idx, lo, hi, maxvar, false, selection);
+  }
+}
+
+////// JOIN PLANNING //////
+
+void collect_vars(Term &term, set<varint_t> &vars) {
+  switch (term.type) {
+    case VARIABLE:
+      vars.insert(term.get.variable);
+      return;
+    case LIST: {
+      Term *t = term.get.termlist.begin;
+      for (; t != term.get.termlist.end; ++t) {
+        collect_vars(*t, vars);
+      }
+      return;
+    }
+    case FUNCTION: {
+      Term *t = term.get.function.arguments.begin;
+      for (; t != term.get.function.arguments.end; ++t) {
+        collect_vars(*t, vars);
+      }
+      return;
+    }
+    default:
+      return;
+  }
+}
+
+void collect_vars(range_of<Term> &terms, set<varint_t> &vars) {
+  Term *t = terms.begin;
+  for (; t != terms.end; ++t) {
+    collect_vars(*t, vars);
+  }
+}
+
+void collect_vars(Condition &condition, set<varint_t> &vars) {
+  if (condition.type != ATOMIC) {
+    Condition *subformula = condition.get.subformulas.begin;
+    for (; subformula != condition.get.subformulas.end; ++subformula) {
+      collect_vars(*subformula, vars);
+    }
+    return;
+  }
+  Atomic &atom = condition.get.atom;
+  switch (atom.type) {
+    case ATOM:
+      collect_vars(atom.get.atom.arguments, vars);
+      return;
+    case EXTERNAL:
+      collect_vars(atom.get.builtin.arguments, vars);
+      return;
+    case FRAME: {
+      collect_vars(atom.get.frame.object, vars);
+      pair<Term, Term> *slot = atom.get.frame.slots.begin;
+      for (; slot != atom.get.frame.slots.end; ++slot) {
+        collect_vars(slot->first, vars);
+        collect_vars(slot->second, vars);
+      }
+      return;
+    }
+    default:
+      collect_vars(atom.get.sides[0], vars);
+      collect_vars(atom.get.sides[1], vars);
+      return;
+  }
+}
+
+// Conditions that filter or extend the intermediate results rather than
+// query the data; see special.
+bool is_special(Condition &condition) {
+  return condition.type == ATOMIC &&
+         (condition.get.atom.type == EQUALITY ||
+          condition.get.atom.type == EXTERNAL);
+}
+
+// Number of triples matching the constants of each pattern seen in the
+// current cycle, for --plan-joins.  Patterns are keyed by their constants
+// with 0 for variables.
+map<Triple, size_t> cardinalities;
+pthread_mutex_t cardinalities_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+size_t cardinality(SlotRef ref) {
+  Triple key;
+  Term *terms[3] = { ref.first, &ref.second->first, &ref.second->second };
+  size_t i;
+  for (i = 0; i < 3; ++i) {
+    key[i] = terms[i]->type == CONSTANT ? terms[i]->get.constant : 0;
+  }
+  pthread_mutex_lock(&cardinalities_mutex);
+  map<Triple, size_t>::iterator it = cardinalities.find(key);
+  bool cached = it != cardinalities.end();
+  size_t count = cached ? it->second : 0;
+  pthread_mutex_unlock(&cardinalities_mutex);
+  if (cached) {
+    return count;
+  }
+  count = count_matches(ref, false, PLAN_COUNT_LIMIT);
+  pthread_mutex_lock(&cardinalities_mutex);
+  cardinalities[key] = count;
+  pthread_mutex_unlock(&cardinalities_mutex);
+  return count;
+}
+
+// Estimate the number of results of condition from the index
+// cardinalities of its constants, counting no further than limit.
+size_t estimate(Condition &condition, size_t limit) {
+  switch (condition.type) {
+    case ATOMIC: {
+      Atomic &atom = condition.get.atom;
+      if (atom.type == ATOM) {
+        map<constint_t, Index>::const_iterator it =
+            atoms.find(atom.get.atom.predicate);
+        return it == atoms.end() ? 0 : min(limit, it->second.size());
+      }
+      if (atom.type != FRAME) {
+        return 0; // no data for membership and subclass
+      }
+      size_t est = limit;
+      pair<Term, Term> *slot = atom.get.frame.slots.begin;
+      for (; slot != atom.get.frame.slots.end; ++slot) {
+        SlotRef ref (&atom.get.frame.object, slot);
+        est = min(est, slot == delta_slot ? count_matches(ref, true, est)
+                                          : cardinality(ref));
+      }
+      return est;
+    }
+    case CONJUNCTION: {
+      size_t est = limit;
+      Condition *subformula = condition.get.subformulas.begin;
+      for (; subformula != condition.get.subformulas.end; ++subformula) {
+        if (subformula->type != NEGATION && !is_special(*subformula)) {
+          est = min(est, estimate(*subformula, est));
+        }
+      }
+      return est;
+    }
+    case EXISTENTIAL: {
+      size_t est = 0;
+      Condition *subformula = condition.get.subformulas.begin;
+      for (; est < limit && subformula != condition.get.subformulas.end;
+           ++subformula) {
+        est += estimate(*subformula, limit - est);
+      }
+      return est;
+    }
+    default:
+      return limit;
+  }
+}
+
+template<typename T>
+bool less_estimate(const pair<size_t, T> &p1, const pair<size_t, T> &p2) {
+  return p1.first < p2.first;
+}
+
+void print_estimate(size_t est) {
+  if (est >= PLAN_COUNT_LIMIT) {
+    cerr << '>' << PLAN_COUNT_LIMIT;
+  } else {
+    cerr << '~' << est;
+  }
+}
+
+// Order the frame's slots by increasing number of matching triples.  The
+// slot bound to the delta, if first, stays first.
+void plan_slots(Frame &frame, vector<pair<Term, Term>*> &slots) {
+  vector<pair<Term, Term>*>::iterator begin = slots.begin();
+  if (begin != slots.end() && *begin == delta_slot) {
+    ++begin;
+  }
+  vector<pair<size_t, pair<Term, Term>*> > order;
+  vector<pair<Term, Term>*>::iterator it = begin;
+  for (; it != slots.end(); ++it) {
+    order.push_back(make_pair(cardinality(SlotRef(&frame.object, *it)), *it));
+  }
+  // stable so that ties keep the order of the rule
+  stable_sort(order.begin(), order.end(), less_estimate<pair<Term, Term>*>);
+  if (PRINT_PLANS) {
+    cerr << "[PLAN] slots";
+    if (begin != slots.begin()) {
+      cerr << " #" << (slots.front() - frame.slots.begin) << " delta";
+    }
+  }
+  vector<pair<Term, Term>*> planned(slots.begin(), begin);
+  vector<pair<size_t, pair<Term, Term>*> >::iterator oit = order.begin();
+  for (; oit != order.end(); ++oit) {
+    planned.push_back(oit->second);
+    if (PRINT_PLANS) {
+      cerr << " #" << (oit->second - frame.slots.begin) << ' ';
+      print_estimate(oit->first);
+    }
+  }
+  if (PRINT_PLANS) {
+    cerr << endl;
+  }
+  slots.swap(planned);
+}
+
+// Greedily order the subformulas of a conjunction: next is always the
+// subformula with the fewest estimated results among those that share a
+// variable with what is already bound (to avoid cross products), and
+// special conditions go as soon as all of their variables are bound.
+// Negations are left for last, since they are applied afterwards anyway.
+// If keep_first, the first subformula (bound to the delta) stays first.
+void plan_conjunction(Condition &condition, vector<Condition*> &subformulas,
+                      set<varint_t> boundvars, bool keep_first) {
+  vector<Condition*> planned;
+  vector<Condition*> specials;
+  vector<Condition*> negations;
+  vector<pair<size_t, Condition*> > candidates;
+  vector<Condition*>::iterator it = subformulas.begin();
+  if (keep_first && it != subformulas.end()) {
+    planned.push_back(*it);
+    collect_vars(**it, boundvars);
+    ++it;
+  }
+  for (; it != subformulas.end(); ++it) {
+    if ((*it)->type == NEGATION) {
+      negations.push_back(*it);
+    } else if (is_special(**it)) {
+      specials.push_back(*it);
+    } else {
+      candidates.push_back(make_pair(estimate(**it, PLAN_COUNT_LIMIT), *it));
+    }
+  }
+  vector<size_t> estimates(planned.size(), 0);
+  while (!candidates.empty() || !specials.empty()) {
+    bool placed = true;
+    while (placed) {
+      placed = false;
+      for (it = specials.begin(); it != specials.end(); ++it) {
+        set<varint_t> vars;
+        collect_vars(**it, vars);
+        if (!planned.empty() &&
+            includes(boundvars.begin(), boundvars.end(),
+                     vars.begin(), vars.end())) {
+          planned.push_back(*it);
+          estimates.push_back(0);
+          specials.erase(it);
+          placed = true;
+          break;
+        }
+      }
+    }
+    if (candidates.empty()) {
+      planned.insert(planned.end(), specials.begin(), specials.end());
+      estimates.resize(planned.size(), 0);
+      break;
+    }
+    vector<pair<size_t, Condition*> >::iterator best = candidates.end();
+    bool best_connected = false;
+    vector<pair<size_t, Condition*> >::iterator cit = candidates.begin();
+    for (; cit != candidates.end(); ++cit) {
+      set<varint_t> vars;
+      collect_vars(*cit->second, vars);
+      set<varint_t> shared;
+      set_intersection(boundvars.begin(), boundvars.end(),
+                       vars.begin(), vars.end(),
+                       inserter(shared, shared.begin()));
+      bool connected = !shared.empty();
+      if (best == candidates.end() ||
+          (connected && !best_connected) ||
+          (connected == best_connected && cit->first < best->first)) {
+        best = cit;
+        best_connected = connected;
+      }
+    }
+    planned.push_back(best->second);
+    estimates.push_back(best->first);
+    collect_vars(*best->second, boundvars);
+    candidates.erase(best);
+  }
+  planned.insert(planned.end(), negations.begin(), negations.end());
+  if (PRINT_PLANS) {
+    cerr << "[PLAN] conjunction";
+    size_t i;
+    for (i = 0; i < planned.size(); ++i) {
+      cerr << " #" << (planned[i] - condition.get.subformulas.begin) << ' ';
+      if (keep_first && i == 0) {
+        cerr << "delta";
+      } else if (planned[i]->type == NEGATION) {
+        cerr << "negated";
+      } else if (is_special(*planned[i])) {
+        cerr << "filter";
+      } else {
+        print_estimate(estimates[i]);
+      }
+    }
+    cerr << endl;
+  }
+  subformulas.swap(planned);
+}
+
+void query(Atomic &atom, set<varint_t> &allvars, Relation &results,
+           Relation *bound = NULL) {
   switch (atom.type) {
     case ATOM:
       query_atom(atom.get.atom, allvars, results);
@@ -1125,8 +2198,8 @@ void query(Atomic &atom, set<varint_t> &allvars, Relation &results) {
     return;
   }
   varint_t maxvar = 0;
-  Tuple mintriple(3);
-  Tuple maxtriple(3);
+  Triple mintriple;
+  Triple maxtriple;
   if (subj.type == CONSTANT) {
     mintriple[0] = maxtriple[0] = subj.get.constant;
   } else {
@@ -1134,8 +2207,26 @@ void query(Atomic &atom, set<varint_t> &allvars, Relation &results) {
     maxtriple[0] = CONSTINT_MAX;
     maxvar = subj.get.variable;
   }
+  // The slot bound to the delta, if any, is evaluated first so that
+  // the remaining slots only need to look at what joins with it.
+  vector<pair<Term, Term>*> slots;
   pair<Term, Term> *slot = atom.get.frame.slots.begin;
   for (; slot != atom.get.frame.slots.end; ++slot) {
+    if (slot == delta_slot) {
+      slots.insert(slots.begin(), slot);
+    } else {
+      slots.push_back(slot);
+    }
+  }
+  if (PLAN_JOINS) {
+    plan_slots(atom.get.frame, slots);
+  }
+  vector<pair<Term, Term>*>::iterator sit = slots.begin();
+  for (; sit != slots.end(); ++sit) {
+    if (sit != slots.begin() && intermediate.empty()) {
+      break; // nothing left to join with
+    }
+    slot = *sit;
     Term pred = slot->first;
     Term obj = slot->second;
     if (pred.type == LIST || obj.type == LIST) {
@@ -1170,60 +2261,16 @@ void query(Atomic &atom, set<varint_t> &allvars, Relation &results) {
     int idx = (subj.type == CONSTANT ? 0x4 : 0x0) |
               (pred.type == CONSTANT ? 0x2 : 0x0) |
               ( obj.type == CONSTANT ? 0x1 : 0x0);
-    Index::const_iterator begin, end;
-    switch (idx) {
-      case 0x0:
-      case 0x4:
-      case 0x6:
-      case 0x7: // SPO
-        begin = idxspo.lower_bound(mintriple);
-        end = idxspo.upper_bound(maxtriple);
-        break;
-      case 0x2:
-      case 0x3: // POS
-        begin = idxpos.lower_bound(mintriple);
-        end = idxpos.upper_bound(maxtriple);
-        break;
-      case 0x1:
-      case 0x5: // OSP
-        begin = idxosp.lower_bound(mintriple);
-        end = idxosp.upper_bound(maxtriple);
-        break;
-      default:
-        cerr << "[ERROR] Unhandled case " << hex << idx << " at line " << dec << __LINE__ << endl;
-        return;
-    }
-    // TODO the following loop could probably be more efficient
+    Relation *probe = sit == slots.begin() ? bound : &intermediate;
     Relation selection;
-    for (; begin != end; ++begin) {
-      Tuple result(maxvar + 1);
-      if (subj.type == VARIABLE) {
-        result[subj.get.variable] = begin->at(0);
-      }
-      if (pred.type == VARIABLE) {
-        if (subj.type == VARIABLE && subj.get.variable == pred.get.variable) {
-          if (begin->at(0) != begin->at(1)) {
-            continue;
-          }
-        }
-        result[pred.get.variable] = begin->at(1);
-      }
-      if (obj.type == VARIABLE) {
-        if (subj.type == VARIABLE && subj.get.variable == obj.get.variable) {
-          if (begin->at(0) != begin->at(2)) {
-            continue;
-          }
-        }
-        if (pred.type == VARIABLE && pred.get.variable == obj.get.variable) {
-          if (begin->at(1) != begin->at(2)) {
-            continue;
-          }
-        }
-        result[obj.get.variable] = begin->at(2);
-      }
-      selection.push_back(result);
+    if (delta_slot != NULL && slot != delta_slot && probe != NULL) {
+      select_joinable(subj, pred, obj, mintriple, maxtriple, maxvar, *probe,
+                      selection);
+    } else {
+      select_triples(subj, pred, obj, idx, mintriple, maxtriple, maxvar,
+                     slot == delta_slot, selection);
     }
-    if (slot == atom.get.frame.slots.begin) {
+    if (sit == slots.begin()) {
       intermediate.swap(selection);
     } else {
       vector<size_t> joinvars (allvars.size() + newvars.size());
@@ -1238,17 +2285,57 @@ void query(Atomic &atom, set<varint_t> &allvars, Relation &results) {
   DEBUG("Number selected = ", results.size());
 }
 
-void query(Condition &condition, set<varint_t> &allvars, Relation &results) {
+bool contains_slot(Condition &condition, pair<Term, Term> *slot) {
+  switch (condition.type) {
+    case ATOMIC:
+      return condition.get.atom.type == FRAME &&
+             condition.get.atom.get.frame.slots.begin <= slot &&
+             slot < condition.get.atom.get.frame.slots.end;
+    case CONJUNCTION:
+    case EXISTENTIAL: {
+      Condition *subformula = condition.get.subformulas.begin;
+      for (; subformula != condition.get.subformulas.end; ++subformula) {
+        if (contains_slot(*subformula, slot)) {
+          return true;
+        }
+      }
+      return false;
+    }
+    default:
+      return false;
+  }
+}
+
+void query(Condition &condition, set<varint_t> &allvars, Relation &results,
+           Relation *bound = NULL) {
   deque<void*> negated;
   Relation intermediate;
   switch (condition.type) {
     case ATOMIC: {
-      query(condition.get.atom, allvars, results);
+      query(condition.get.atom, allvars, results, bound);
       return;
     }
     case CONJUNCTION: {
+      // The subformula bound to the delta, if any, is evaluated first.
+      vector<Condition*> subformulas;
       Condition *subformula = condition.get.subformulas.begin;
       for (; subformula != condition.get.subformulas.end; ++subformula) {
+        if (delta_slot != NULL && contains_slot(*subformula, delta_slot)) {
+          subformulas.insert(subformulas.begin(), subformula);
+        } else {
+          subformulas.push_back(subformula);
+        }
+      }
+      if (PLAN_JOINS) {
+        plan_conjunction(condition, subformulas, allvars, delta_slot != NULL &&
+                         contains_slot(*subformulas.front(), delta_slot));
+      }
+      vector<Condition*>::iterator sit = subformulas.begin();
+      for (; sit != subformulas.end(); ++sit) {
+        subformula = *sit;
+        if (sit != subformulas.begin() && intermediate.empty()) {
+          break; // nothing left to join with
+        }
         if (subformula->type == NEGATION) {
           negated.push_back((void*)subformula->get.subformulas.begin);
           continue;
@@ -1258,14 +2345,15 @@ void query(Condition &condition, set<varint_t> &allvars, Relation &results) {
         // TODO vvv this won't work right if a non-special query
         // has not been performed first
         if (special(*subformula, intermediate, subresult)) {
-          if (subformula == condition.get.subformulas.begin) {
+          if (sit == subformulas.begin()) {
             cerr << "[ERROR] Must have non-special query at beginning of conjunction." << endl;
           }
           intermediate.swap(subresult);
           continue;
         }
-        query(*subformula, newvars, subresult);
-        if (subformula == condition.get.subformulas.begin) {
+        query(*subformula, newvars, subresult,
+              sit == subformulas.begin() ? bound : &intermediate);
+        if (sit == subformulas.begin()) {
           intermediate.swap(subresult);
         } else {
           vector<size_t> joinvars(allvars.size() + newvars.size());
@@ -1290,8 +2378,12 @@ void query(Condition &condition, set<varint_t> &allvars, Relation &results) {
           negated.push_back((void*)subformula->get.subformulas.begin);
         }
         Relation subresult;
-        query(*subformula, allvars, subresult);
+        query(*subformula, allvars, subresult, bound);
+#ifdef CONTAINER
+        intermediate.insert(intermediate.end(), subresult.begin(), subresult.end());
+#else
         intermediate.splice(intermediate.end(), subresult);
+#endif
       }
       break;
     }
@@ -1311,15 +2403,24 @@ void query(Condition &condition, set<varint_t> &allvars, Relation &results) {
     Relation negresult;
     Condition *cond = (Condition*) *it;
     if (special(*cond, intermediate, negresult)) {
+#ifdef CONTAINER
+      sort(intermediate.begin(), intermediate.end());
+      sort(negresult.begin(), negresult.end());
+#else
       intermediate.sort();
       negresult.sort();
+#endif
       Relation leftover(intermediate.size());
       Relation::iterator iit = set_difference(intermediate.begin(),
           intermediate.end(), negresult.begin(), negresult.end(),
           leftover.begin());
       Relation newinter;
+#ifdef CONTAINER
+      newinter.insert(newinter.end(), leftover.begin(), iit);
+#else
       newinter.splice(newinter.end(), leftover,
                       leftover.begin(), iit);
+#endif
       intermediate.swap(newinter);
       continue;
     }
@@ -1330,9 +2431,9 @@ void query(Condition &condition, set<varint_t> &allvars, Relation &results) {
   results.swap(intermediate);
 }
 
-void act(Atom &atom, Relation &results) {
+void act(Atom &atom, Relation &results, map<constint_t, Index> &newatoms) {
   DEBUG("Act: atom = ", atom);
-  Index &index = atoms[atom.predicate];
+  Index &index = newatoms[atom.predicate];
   Relation::iterator result = results.begin();
   size_t max = atom.arguments.end - atom.arguments.begin;
   for (; result != results.end(); ++result) {
@@ -1355,7 +2456,9 @@ void act(Atom &atom, Relation &results) {
   }
 }
 
-void act(ActionBlock &action_block, Relation &results, Index &assertions, Index &retractions) {
+void act(ActionBlock &action_block, Relation &results,
+         vector<Triple> &assertions, vector<Triple> &retractions,
+         map<constint_t, Index> &newatoms) {
   if (action_block.action_variables.begin != action_block.action_variables.end) {
     cerr << "[ERROR] Action variables are unsupported." << endl;
     return;
@@ -1370,7 +2473,7 @@ void act(ActionBlock &action_block, Relation &results, Index &assertions, Index
             cerr << "[ERROR] Retraction of atoms is currently unsupported." << endl;
             return;
           }
-          act(action->get.atom.get.atom, results);
+          act(action->get.atom.get.atom, results, newatoms);
           continue;
         }
         if (action->get.atom.type != FRAME) {
@@ -1378,7 +2481,7 @@ void act(ActionBlock &action_block, Relation &results, Index &assertions, Index
           return;
         }
         Frame frame = action->get.atom.get.frame;
-        Tuple triple(3);
+        Triple triple;
         if (frame.object.type == LIST || frame.object.type == FUNCTION) {
           cerr << "[ERROR] Not supporting lists or functions in action target." << endl;
           return;
@@ -1401,9 +2504,9 @@ void act(ActionBlock &action_block, Relation &results, Index &assertions, Index
           }
           if (!results.empty() && frame.object.type == CONSTANT && slot->first.type == CONSTANT && slot->second.type == CONSTANT) {
             if (action->type == ASSERT_FACT) {
-              assertions.insert(triple);
+              assertions.push_back(triple);
             } else {
-              retractions.insert(triple);
+              retractions.push_back(triple);
             }
             continue;
           }
@@ -1419,9 +2522,9 @@ void act(ActionBlock &action_block, Relation &results, Index &assertions, Index
               triple[2] = tuple->at(slot->second.get.variable);
             }
             if (action->type == ASSERT_FACT) {
-              assertions.insert(triple);
+              assertions.push_back(triple);
             } else {
-              retractions.insert(triple);
+              retractions.push_back(triple);
             }
           }
         }
@@ -1435,76 +2538,480 @@ void act(ActionBlock &action_block, Relation &results, Index &assertions, Index
   }
 }
 
+// Collect the non-negated triple patterns of condition into slots.  Sets
+// uses_atoms if condition also depends on non-triple atoms.
+void collect_slots(Condition &condition, vector<SlotRef> &slots,
+                   bool &uses_atoms) {
+  switch (condition.type) {
+    case ATOMIC: {
+      Atomic &atom = condition.get.atom;
+      if (atom.type == ATOM) {
+        uses_atoms = true;
+      } else if (atom.type == FRAME) {
+        pair<Term, Term> *slot = atom.get.frame.slots.begin;
+        for (; slot != atom.get.frame.slots.end; ++slot) {
+          slots.push_back(SlotRef(&atom.get.frame.object, slot));
+        }
+      }
+      return;
+    }
+    case CONJUNCTION:
+    case EXISTENTIAL: {
+      Condition *subformula = condition.get.subformulas.begin;
+      for (; subformula != condition.get.subformulas.end; ++subformula) {
+        collect_slots(*subformula, slots, uses_atoms);
+      }
+      return;
+    }
+    default:
+      return; // negation does not read data, disjunction is unsupported
+  }
+}
+
+// The number of variables that the tuples of rule must hold.
+size_t arity(Rule &rule) {
+  set<varint_t> vars;
+  collect_vars(rule.condition, vars);
+  return vars.empty() ? 0 : *vars.rbegin() + 1;
+}
+
+// Make sure that every rule fits in fixed-size tuples.
+bool check_arities(vector<Rule> &rules) {
+  bool ok = true;
+#ifdef TUPLE_SIZE
+  vector<Rule>::iterator rule = rules.begin();
+  for (; rule != rules.end(); ++rule) {
+    size_t n = arity(*rule);
+    if (n > TUPLE_SIZE) {
+      cerr << "[ERROR] Rule " << (rule - rules.begin()) + 1 << " needs tuples of size " << n << " but they are fixed to " << TUPLE_SIZE << ".  Compile with -DTUPLE_SIZE=" << n << " or more." << endl;
+      ok = false;
+    }
+  }
+#endif
+  return ok;
+}
+
+////// PARALLEL EVALUATION //////
+
+// One evaluation of a rule for --threads: over all the data if slot is
+// NULL, otherwise with slot matched against the delta.  With
+// --split-scans, part says which part of the first scan to evaluate.
+struct Task {
+  Rule *rule;
+  pair<Term, Term> *slot;
+  size_t part;
+};
+
+// A thread evaluating tasks, with its own buffers for the results.
+struct Worker {
+  vector<Task> *tasks;
+  size_t *next_task;
+  vector<Triple> assertions;
+  vector<Triple> retractions;
+  map<constint_t, Index> atoms;
+  pthread_t thread;
+  bool started;
+};
+
+pthread_mutex_t tasks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void add_tasks(vector<Task> &tasks, Rule &rule, pair<Term, Term> *slot) {
+  Task task;
+  task.rule = &rule;
+  task.slot = slot;
+  size_t nparts = SPLIT_SCANS ? NUM_THREADS : 1;
+  for (task.part = 0; task.part < nparts; ++task.part) {
+    tasks.push_back(task);
+  }
+}
+
+void *run_worker(void *arg) {
+  Worker *worker = (Worker*) arg;
+  for (;;) {
+    pthread_mutex_lock(&tasks_mutex);
+    size_t t = (*worker->next_task)++;
+    pthread_mutex_unlock(&tasks_mutex);
+    if (t >= worker->tasks->size()) {
+      return NULL;
+    }
+    Task &task = worker->tasks->at(t);
+    delta_slot = task.slot;
+    scan_part = task.part;
+    scan_parts = SPLIT_SCANS ? NUM_THREADS : 1;
+    Relation results;
+    set<varint_t> allvars;
+    query(task.rule->condition, allvars, results);
+    act(task.rule->action_block, results, worker->assertions,
+        worker->retractions, worker->atoms);
+    delta_slot = NULL;
+    scan_parts = 1;
+  }
+}
+
+// Evaluate the tasks on NUM_THREADS threads, all reading the same data,
+// and collect what they assert and retract.  Asserted atoms go straight
+// into atoms once all threads are done.
+void evaluate_in_parallel(vector<Task> &tasks, vector<Triple> &assertions,
+                          vector<Triple> &retractions) {
+  size_t next_task = 0;
+  vector<Worker> workers (NUM_THREADS);
+  vector<Worker>::iterator w = workers.begin();
+  for (; w != workers.end(); ++w) {
+    w->tasks = &tasks;
+    w->next_task = &next_task;
+    w->started = pthread_create(&w->thread, NULL, run_worker, &*w) == 0;
+    if (!w->started) {
+      cerr << "[ERROR] Unable to start thread; evaluating in the main thread instead." << endl;
+      run_worker(&*w);
+    }
+  }
+  for (w = workers.begin(); w != workers.end(); ++w) {
+    if (w->started) {
+      pthread_join(w->thread, NULL);
+    }
+    assertions.insert(assertions.end(), w->assertions.begin(),
+                      w->assertions.end());
+    retractions.insert(retractions.end(), w->retractions.begin(),
+                       w->retractions.end());
+    map<constint_t, Index>::const_iterator it = w->atoms.begin();
+    for (; it != w->atoms.end(); ++it) {
+      atoms[it->first].insert(it->second.begin(), it->second.end());
+    }
+  }
+}
+
+// Apply retractions and then assertions to the data, keeping the triples
+// newly asserted in delta.  Returns true if anything changed.
+bool apply(vector<Triple> &assertions, vector<Triple> &retractions,
+           vector<Triple> &delta, bool staged = false) {
+  retract_triples(retractions);
+  if (SEMI_NAIVE && !retractions.empty()) {
+    remove_triples(delta, retractions);
+    dltspo.erase(retractions);
+    dltpos.erase(retractions);
+    dltosp.erase(retractions);
+  }
+  cerr << "  " << retractions.size() << " retractions, ";
+  assert_triples(assertions, staged);
+  if (SEMI_NAIVE) {
+    delta.insert(delta.end(), assertions.begin(), assertions.end());
+  }
+  cerr << assertions.size() << " assertions." << endl;
+  return !retractions.empty() || !assertions.empty();
+}
+
+// Whether rule asserts atoms, which are not part of a closure read from
+// a data file.
+bool asserts_atoms(Rule &rule) {
+  Action *action = rule.action_block.actions.begin;
+  for (; action != rule.action_block.actions.end; ++action) {
+    if (action->type == ASSERT_FACT && action->get.atom.type == ATOM) {
+      return true;
+    }
+  }
+  return false;
+}
+
 // infer until fixpoint, which may not be appropriate in the presence of retraction
-void infer(vector<Rule> &rules) {
+//
+// With SEMI_NAIVE, only the first cycle evaluates the rules over all the
+// data.  Every later cycle evaluates each rule once per triple pattern in
+// its body, with that pattern matched against just the triples asserted
+// in the previous cycle, and skips patterns that match nothing new.  If
+// first_full is given, the data is already a closure of the rules and the
+// delta indexes hold what was added to it, so even the first cycle only
+// evaluates against them, except for the rules marked in first_full.
+//
+// With NUM_THREADS > 1, the rules of a cycle are evaluated in parallel,
+// all against the data as it was at the start of the cycle (as without
+// ANY_ORDER), and their conclusions are applied at the end of the cycle.
+void infer(vector<Rule> &rules, const vector<bool> *first_full = NULL) {
   bool changed = true;
+  bool atoms_changed = true;
   map<constint_t, size_t> sizes;
   map<constint_t, Index>::const_iterator atomit = atoms.begin();
   for (; atomit != atoms.end(); ++atomit) {
     sizes[atomit->first] = atomit->second.size();
   }
+  vector<vector<SlotRef> > slots(rules.size());
+  vector<bool> uses_atoms(rules.size(), false);
+  vector<bool> full_first(rules.size(), first_full == NULL);
+  if (first_full != NULL) {
+    full_first = *first_full;
+  }
+  if (SEMI_NAIVE) {
+    size_t i;
+    for (i = 0; i < rules.size(); ++i) {
+      bool uses = false;
+      collect_slots(rules[i].condition, slots[i], uses);
+      uses_atoms[i] = uses;
+    }
+  }
   size_t ncycles = 0;
   while (changed) {
     cerr << "  Cycle " << ++ncycles << "..." << endl;
     changed = false;
+    bool full = !SEMI_NAIVE;
+    cardinalities.clear();
+    vector<Triple> delta;
+    if (NUM_THREADS > 1) {
+      vector<Task> tasks;
+      size_t r;
+      for (r = 0; r < rules.size(); ++r) {
+        if (full || (uses_atoms[r] && atoms_changed) ||
+            (ncycles == 1 && full_first[r])) {
+          add_tasks(tasks, rules[r], NULL);
+          continue;
+        }
+        vector<SlotRef>::iterator slot = slots[r].begin();
+        for (; slot != slots[r].end(); ++slot) {
+          if (count_matches(*slot, true, 1) > 0) {
+            add_tasks(tasks, rules[r], slot->second);
+          }
+        }
+      }
+      cerr << "    " << tasks.size() << " tasks on " << NUM_THREADS << " threads..." << endl;
+      vector<Triple> assertions;
+      vector<Triple> retractions;
+      evaluate_in_parallel(tasks, assertions, retractions);
+      changed = apply(assertions, retractions, delta);
+    } else {
 #ifndef ANY_ORDER
-    Index assertions (Order(0, 1, 2));
-    Index retractions (Order(0, 1, 2));
+    vector<Triple> assertions;
+    vector<Triple> retractions;
 #endif
-    int rulecount = 0;
     vector<Rule>::iterator rule = rules.begin();
     for (; rule != rules.end(); ++rule) {
       cerr << "    Rule " << (rule - rules.begin()) + 1 << "..." << endl;
 #ifdef ANY_ORDER
-      Index assertions (Order(0, 1, 2));
-      Index retractions (Order(0, 1, 2));
+      vector<Triple> assertions;
+      vector<Triple> retractions;
 #endif
-      Relation results;
-      set<varint_t> allvars;
-      query(rule->condition, allvars, results);
-      act(rule->action_block, results, assertions, retractions);
+      size_t r = rule - rules.begin();
+      if (full || (uses_atoms[r] && atoms_changed) ||
+          (ncycles == 1 && full_first[r])) {
+        Relation results;
+        set<varint_t> allvars;
+        query(rule->condition, allvars, results);
+        act(rule->action_block, results, assertions, retractions, atoms);
+      } else {
+        vector<SlotRef>::iterator slot = slots[r].begin();
+        for (; slot != slots[r].end(); ++slot) {
+          if (count_matches(*slot, true, 1) == 0) {
+            continue;
+          }
+          delta_slot = slot->second;
+          Relation results;
+          set<varint_t> allvars;
+          query(rule->condition, allvars, results);
+          act(rule->action_block, results, assertions, retractions, atoms);
+        }
+        delta_slot = NULL;
+      }
 #ifndef ANY_ORDER
     }
 #endif
-    size_t nretractions = 0;
-    Index::iterator it = retractions.begin();
-    for (; it != retractions.end(); ++it) {
-      if (idxspo.erase(*it) > 0) {
-        idxpos.erase(*it);
-        idxosp.erase(*it);
-        changed = true;
-        ++nretractions;
-      }
-    }
-    cerr << "  " << nretractions << " retractions, ";
-    size_t nassertions = 0;
-    it = assertions.begin();
-    for (; it != assertions.end(); ++it) {
-      if (idxspo.insert(*it).second) {
-        idxpos.insert(*it);
-        idxosp.insert(*it);
-        changed = true;
-        ++nassertions;
-      }
-    }
-    cerr << nassertions << " assertions." << endl;
+    changed = apply(assertions, retractions, delta, true) || changed;
 #ifdef ANY_ORDER
     }
 #endif
+    flush_triples();
+    }
+    atoms_changed = false;
     atomit = atoms.begin();
     for (; atomit != atoms.end(); ++atomit) {
-      changed = changed || sizes[atomit->first] != atomit->second.size();
+      atoms_changed = atoms_changed || sizes[atomit->first] != atomit->second.size();
       sizes[atomit->first] = atomit->second.size();
     }
+    changed = changed || atoms_changed;
+    if (SEMI_NAIVE) {
+      dltspo.assign(delta);
+      dltpos.assign(delta);
+      dltosp.assign(delta);
+      cerr << "  " << dltspo.size() << " triples in delta." << endl;
+    }
+  }
+}
+
+////// DELETION //////
+
+// Whether rule might assert a triple with one of the predicates.
+bool may_assert(Rule &rule, const set<constint_t> &predicates) {
+  Action *action = rule.action_block.actions.begin;
+  for (; action != rule.action_block.actions.end; ++action) {
+    if (action->type != ASSERT_FACT || action->get.atom.type != FRAME) {
+      continue;
+    }
+    Frame &frame = action->get.atom.get.frame;
+    pair<Term, Term> *slot = frame.slots.begin;
+    for (; slot != frame.slots.end; ++slot) {
+      if (slot->first.type != CONSTANT ||
+          predicates.count(slot->first.get.constant) > 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+size_t count_atoms() {
+  size_t count = 0;
+  map<constint_t, Index>::const_iterator it = atoms.begin();
+  for (; it != atoms.end(); ++it) {
+    count += it->second.size();
+  }
+  return count;
+}
+
+// Derive the atoms of the data, which a closure read from a data file
+// does not hold, with the rules that assert them.
+void derive_atoms(vector<Rule> &rules) {
+  size_t count;
+  do {
+    count = count_atoms();
+    vector<Rule>::iterator rule = rules.begin();
+    for (; rule != rules.end(); ++rule) {
+      if (asserts_atoms(*rule)) {
+        Relation results;
+        set<varint_t> allvars;
+        vector<Triple> assertions;
+        vector<Triple> retractions;
+        query(rule->condition, allvars, results);
+        act(rule->action_block, results, assertions, retractions, atoms);
+      }
+    }
+  } while (count_atoms() != count);
+}
+
+// Keep in batch, in SPO order, the distinct triples that are in the data
+// but not in removed, which must be in SPO order.
+void keep_removable(vector<Triple> &batch, const vector<Triple> &removed) {
+  sort(batch.begin(), batch.end());
+  batch.erase(unique(batch.begin(), batch.end()), batch.end());
+  vector<Triple>::iterator out = batch.begin();
+  vector<Triple>::iterator it = batch.begin();
+  for (; it != batch.end(); ++it) {
+    if (idxspo.contains(*it) &&
+        !binary_search(removed.begin(), removed.end(), *it)) {
+      *out = *it;
+      ++out;
+    }
+  }
+  batch.erase(out, batch.end());
+}
+
+// Over-delete for --delete, as in DRed: remove from the data, a closure
+// of the rules, the deleted triples and every triple that might have been
+// derived from them, found by semi-naive evaluation over the data with
+// the delta starting at the deleted triples.  What is derived from atoms
+// cannot be traced back, so it is all removed.  Leaves the removed
+// triples in deleted, in SPO order, and no atoms, to be re-derived.
+void overdelete(vector<Rule> &rules, vector<Triple> &deleted) {
+  vector<vector<SlotRef> > slots(rules.size());
+  vector<bool> uses_atoms(rules.size(), false);
+  size_t r;
+  for (r = 0; r < rules.size(); ++r) {
+    bool uses = false;
+    collect_slots(rules[r].condition, slots[r], uses);
+    uses_atoms[r] = uses;
+  }
+  derive_atoms(rules);
+  vector<Triple> removed;
+  vector<Triple> delta (deleted);
+  for (r = 0; r < rules.size(); ++r) {
+    if (uses_atoms[r]) {
+      Relation results;
+      set<varint_t> allvars;
+      vector<Triple> retractions;
+      map<constint_t, Index> newatoms;
+      query(rules[r].condition, allvars, results);
+      act(rules[r].action_block, results, delta, retractions, newatoms);
+    }
+  }
+  keep_removable(delta, removed);
+  while (!delta.empty()) {
+    cerr << "  " << delta.size() << " triples to over-delete." << endl;
+    vector<Triple> merged (removed.size() + delta.size());
+    merge(removed.begin(), removed.end(), delta.begin(), delta.end(),
+          merged.begin());
+    removed.swap(merged);
+    dltspo.assign(delta);
+    dltpos.assign(delta);
+    dltosp.assign(delta);
+    vector<Triple> next;
+    for (r = 0; r < rules.size(); ++r) {
+      if (uses_atoms[r]) {
+        continue;
+      }
+      vector<SlotRef>::iterator slot = slots[r].begin();
+      for (; slot != slots[r].end(); ++slot) {
+        if (count_matches(*slot, true, 1) == 0) {
+          continue;
+        }
+        delta_slot = slot->second;
+        Relation results;
+        set<varint_t> allvars;
+        vector<Triple> retractions;
+        map<constint_t, Index> newatoms;
+        query(rules[r].condition, allvars, results);
+        act(rules[r].action_block, results, next, retractions, newatoms);
+      }
+      delta_slot = NULL;
+    }
+    keep_removable(next, removed);
+    delta.swap(next);
+  }
+  vector<Triple> empty;
+  dltspo.assign(empty);
+  dltpos.assign(empty);
+  dltosp.assign(empty);
+  atoms.clear();
+  retract_triples(removed);
+  deleted.swap(removed);
+}
+
+// Delete the triples of DELETED_DATA from the data, a closure of the
+// rules inferred from BASE_DATA, as in DRed.  After over-deleting, the
+// base triples that were over-deleted but not deleted go into added, to
+// be put back, and the rules that might re-derive the rest are marked in
+// first_full.
+void delete_data(vector<Rule> &rules, vector<bool> &first_full,
+                 vector<Triple> &added) {
+  vector<Triple> deleted;
+  read_triples(DELETED_DATA, deleted);
+  sort(deleted.begin(), deleted.end());
+  deleted.erase(unique(deleted.begin(), deleted.end()), deleted.end());
+  vector<Triple> removed (deleted);
+  SEMI_NAIVE = true;
+  overdelete(rules, removed);
+  vector<Triple> base;
+  read_triples(BASE_DATA, base);
+  size_t nrestored = 0;
+  vector<Triple>::const_iterator it = base.begin();
+  for (; it != base.end(); ++it) {
+    if (binary_search(removed.begin(), removed.end(), *it) &&
+        !binary_search(deleted.begin(), deleted.end(), *it)) {
+      added.push_back(*it);
+      ++nrestored;
+    }
+  }
+  cerr << "[INFO] " << removed.size() << " triples over-deleted, " << nrestored << " of them restored from the base data." << endl;
+  set<constint_t> predicates;
+  for (it = removed.begin(); it != removed.end(); ++it) {
+    predicates.insert((*it)[1]);
+  }
+  size_t r;
+  for (r = 0; r < rules.size(); ++r) {
+    first_full[r] = first_full[r] || may_assert(rules[r], predicates);
   }
 }
 
 #define FOR_HUMAN_EYES 0
 void print_data() {
-  Index::iterator it = idxspo.begin();
+  TripleIter it = idxspo.begin();
   for (; it != idxspo.end(); ++it) {
-    Tuple::const_iterator tit = it->begin();
-    for (; tit != it->end(); ++tit) {
+    const constint_t *tit = it->spo;
+    for (; tit != it->spo + 3; ++tit) {
 #if !FOR_HUMAN_EYES
       size_t i;
       for (i = 0; i < sizeof(constint_t); ++i) {
@@ -1536,11 +3043,81 @@ void print_data() {
 
 
 int main(int argc, char **argv) {
+  if (argc < 3) {
+    cerr << "[USAGE] " << argv[0] << " <encoded-rule-file> <encoded-data-file> [--semi-naive] [--plan-joins] [--print-plans] [--threads <n> [--split-scans]] [--restore-snapshot <file>] [--save-snapshot <file>] [--add <added-data-file>] [--delete <deleted-data-file> --base <base-data-file>]" << endl;
+    return 0;
+  }
+  int i;
+  for (i = 3; i < argc; ++i) {
+    if (strcmp(argv[i], "--semi-naive") == 0) {
+      SEMI_NAIVE = true;
+    } else if (strcmp(argv[i], "--plan-joins") == 0) {
+      PLAN_JOINS = true;
+    } else if (strcmp(argv[i], "--print-plans") == 0) {
+      PLAN_JOINS = true;
+      PRINT_PLANS = true;
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      NUM_THREADS = max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--split-scans") == 0) {
+      SPLIT_SCANS = true;
+    } else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+      SAVE_SNAPSHOT = argv[++i];
+    } else if (strcmp(argv[i], "--restore-snapshot") == 0 && i + 1 < argc) {
+      RESTORE_SNAPSHOT = argv[++i];
+    } else if (strcmp(argv[i], "--add") == 0 && i + 1 < argc) {
+      ADDED_DATA = argv[++i];
+    } else if (strcmp(argv[i], "--delete") == 0 && i + 1 < argc) {
+      DELETED_DATA = argv[++i];
+    } else if (strcmp(argv[i], "--base") == 0 && i + 1 < argc) {
+      BASE_DATA = argv[++i];
+    }
+  }
   vector<Rule> rules;
   load_rules(argv[1], rules);
   //print_rules(rules);
+  if (!check_arities(rules)) {
+    return 1;
+  }
+  // With a snapshot, the data file adds to what it holds.
+  if (RESTORE_SNAPSHOT != NULL && !restore_snapshot(RESTORE_SNAPSHOT, rules)) {
+    return 1;
+  }
   load_data(argv[2]);
-  infer(rules);
+  // Atoms are not part of the closure, so the rules asserting them must
+  // be evaluated in full, as well as, after deletions, those that might
+  // re-derive what was deleted.
+  vector<bool> first_full(rules.size(), false);
+  size_t r;
+  for (r = 0; r < rules.size(); ++r) {
+    first_full[r] = asserts_atoms(rules[r]);
+  }
+  vector<Triple> added;
+  if (DELETED_DATA != NULL) {
+    if (BASE_DATA == NULL) {
+      cerr << "[ERROR] --delete needs --base with the data that the closure was inferred from." << endl;
+      return 1;
+    }
+    delete_data(rules, first_full, added);
+  }
+  if (ADDED_DATA != NULL) {
+    read_triples(ADDED_DATA, added);
+  }
+  if (DELETED_DATA != NULL || ADDED_DATA != NULL) {
+    // The data so far is a closure of the rules, so only the
+    // consequences of what is new need inferring.
+    assert_triples(added);
+    cerr << "[INFO] " << added.size() << " new triples added." << endl;
+    SEMI_NAIVE = true;
+    dltspo.assign(added);
+    dltpos.assign(added);
+    dltosp.assign(added);
+    infer(rules, &first_full);
+  } else {
+    infer(rules);
+  }
+  if (SAVE_SNAPSHOT != NULL) {
+    save_snapshot(SAVE_SNAPSHOT, rules);
+  }
   print_data();
   return 0;
 }
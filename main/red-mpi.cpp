@@ -20,11 +20,20 @@
 //   3. Single output der.
 //   4. Single input nt.lzo with triples split across compressed blocks.
 
+// Encoding is dominated by dictionary lookups, so intern terms in a hash
+// table rather than keeping them in ordered maps.
+#ifndef RDFDICT_STORE
+#define RDFDICT_STORE RDFTermHashStore
+#endif
+
+#include <algorithm>
 #include <cmath>
 #include <deque>
+#include <map>
 #include <mpi.h>
 #include <sstream>
 #include <string>
+#include <vector>
 #include "io/BufferedInputStream.h"
 #include "io/BufferedOutputStream.h"
 #include "io/IFStream.h"
@@ -33,6 +42,8 @@
 #include "io/LZOOutputStream.h"
 #include "io/OFStream.h"
 #include "io/OutputStream.h"
+#include "par/DistRDFDictBulkDecode.h"
+#include "par/DistRDFDictBulkEncode.h"
 #include "par/DistRDFDictDecode.h"
 #include "par/DistRDFDictEncode.h"
 #include "par/MPIDelimFileInputStream.h"
@@ -43,6 +54,7 @@
 #include "rdf/RDFDictEncReader.h"
 #include "rdf/RDFDictEncWriter.h"
 #include "rdf/RDFDictionary.h"
+#include "rdf/RDFInlineEncoder.h"
 #include "rdf/NTriplesReader.h"
 #include "rdf/NTriplesWriter.h"
 #include "sys/endian.h"
@@ -70,6 +82,13 @@ using namespace util;
 #define NBYTES 8
 #endif
 
+// Pack small numeric, boolean and date literals into their identifiers
+// instead of giving them dictionary entries.  Data encoded with this
+// setting must also be decoded with it.
+#ifndef INLINE_LITERALS
+#define INLINE_LITERALS 1
+#endif
+
 #ifdef DEBUG
 #undef DEBUG
 #endif
@@ -99,7 +118,11 @@ public:
 
 RDFDictionary<ID> CustomRDFEncoder::dict = RDFDictionary<ID>();
 
+#if INLINE_LITERALS
+typedef RDFInlineEncoder<ID, CustomRDFEncoder> ENC;
+#else
 typedef CustomRDFEncoder ENC;
+#endif
 
 struct cmdargs_t {
   string input;
@@ -115,10 +138,16 @@ struct cmdargs_t {
   size_t packet_size;
   size_t num_requests;
   size_t check_every;
+  size_t cache_size;
+  size_t hot_terms;
+  size_t hot_sample;
+  size_t memory;
+  size_t batch_size;
   bool single_input;
   bool single_output;
   bool global_dict;
   bool read_only;
+  bool bulk;
   bool report_time;
 } cmdargs = {
   /* input          */  string(""),
@@ -134,10 +163,16 @@ struct cmdargs_t {
   /* packet_size    */  0,
   /* num_requests   */  0,
   /* check_every    */  0,
+  /* cache_size     */  (size_t) -1,
+  /* hot_terms      */  0,
+  /* hot_sample     */  0,
+  /* memory         */  0,
+  /* batch_size     */  0,
   /* single_input   */  false,
   /* single_output  */  false,
   /* global_dict    */  false,
   /* read_only      */  false,
+  /* bulk           */  false,
   /* report_times   */  false,
 };
 
@@ -214,10 +249,16 @@ bool parse_args(int argc, char **argv) {
     else CMDARG(argv[i], "--packet-size", "-pack", packet_size, 0, parse_size_t(argv[++i]))
     else CMDARG(argv[i], "--num-requests", "-nreq", num_requests, 0, parse_size_t(argv[++i]))
     else CMDARG(argv[i], "--check-every", "-check", check_every, 0, parse_size_t(argv[++i]))
+    else CMDARG(argv[i], "--cache-size", "-cache", cache_size, (size_t) -1, parse_size_t(argv[++i]))
+    else CMDARG(argv[i], "--hot-terms", "-hot", hot_terms, 0, parse_size_t(argv[++i]))
+    else CMDARG(argv[i], "--hot-sample", "-hs", hot_sample, 0, parse_size_t(argv[++i]))
+    else CMDARG(argv[i], "--memory", "-mem", memory, 0, parse_size_t(argv[++i]))
+    else CMDARG(argv[i], "--batch-size", "-batch", batch_size, 0, parse_size_t(argv[++i]))
     else CMDARG(argv[i], "--single-input", "-si", single_input, false, true)
     else CMDARG(argv[i], "--single-output", "-so", single_output, false, true)
     else CMDARG(argv[i], "--global-dict", "-gd", global_dict, false, true)
     else CMDARG(argv[i], "--read-only", "-r", read_only, false, true)
+    else CMDARG(argv[i], "--bulk", "-bulk", bulk, false, true)
     else CMDARG(argv[i], "--time", "-t", report_time, false, true)
     else if (strcmp(argv[i], "--force") == 0) {
       try {
@@ -251,6 +292,10 @@ bool parse_args(int argc, char **argv) {
   DEFAULTVAL(packet_size, 0, 1024)
   DEFAULTVAL(num_requests, 0, (size_t)(1.1f + log((float)commsize)/log(2.0f)));
   DEFAULTVAL(check_every, 0, 10000);
+  DEFAULTVAL(cache_size, (size_t) -1, ENCODE_CACHE_SIZE);
+  DEFAULTVAL(hot_sample, 0, 10000);
+  DEFAULTVAL(memory, 0, 256*1024*1024);
+  DEFAULTVAL(batch_size, 0, DECODE_BATCH_SIZE);
   return (insert_processor_rank(!cmdargs.single_input, cmdargs.input) &
           insert_processor_rank(!cmdargs.single_input, cmdargs.input_dict) &
           insert_processor_rank(!cmdargs.single_input, cmdargs.input_index) &
@@ -414,9 +459,38 @@ void write_replicated_dictionary(OutputStream *os) {
   RDFDictEncWriter<ID>::writeDictionary(os, &CustomRDFEncoder::dict, bitflip);
 }
 
+// Decodes by sorting lookups by identifier and streaming each dictionary
+// against them, so the dictionary is never loaded into memory.  Triples
+// are written in the order in which they were read.
+int bulk_dictionary_decode() {
+  int commrank = MPI::COMM_WORLD.Get_rank();
+  int commsize = MPI::COMM_WORLD.Get_size();
+  InputStream *ds = NULL;
+  NEW(ds, MPIPartialFileInputStream, MPI::COMM_SELF, cmdargs.input_dict.c_str(), MPI::MODE_RDONLY, MPI::INFO_NULL, cmdargs.page_size, 0, -1);
+  InputStream *is = NULL;
+  NEW(is, MPIPartialFileInputStream, MPI::COMM_SELF, cmdargs.input.c_str(), MPI::MODE_RDONLY, MPI::INFO_NULL, cmdargs.page_size, 0, -1);
+  RDFWriter *rw = makeRDFWriter(NULL, NULL);
+  Distributor *scatter = NULL;
+  NEW(scatter, MPIPacketDistributor, MPI::COMM_WORLD, cmdargs.packet_size, cmdargs.num_requests, cmdargs.check_every, 111);
+  NEW(scatter, StringDistributor, commrank, cmdargs.packet_size, scatter);
+  Distributor *resolve = NULL;
+  NEW(resolve, MPIPacketDistributor, MPI::COMM_WORLD, cmdargs.packet_size, cmdargs.num_requests, cmdargs.check_every, 112);
+  NEW(resolve, StringDistributor, commrank, cmdargs.packet_size, resolve);
+  DistRDFDictBulkDecode<NBYTES, ID, ENC> *bulk = NULL;
+  NEW(bulk, WHOLE(DistRDFDictBulkDecode<NBYTES, ID, ENC>), commrank, commsize, rw, scatter, resolve, is, ds, cmdargs.output + string(".spill"), cmdargs.memory, true);
+  DEBUG("Performing bulk dictionary decoding.")
+  bulk->exec();
+  DELETE(bulk);
+  return 0;
+}
+
 int dictionary_decode() {
   int commrank = MPI::COMM_WORLD.Get_rank();
   int commsize = MPI::COMM_WORLD.Get_size();
+  if (cmdargs.single_input && cmdargs.bulk) {
+    if (commrank == 0) cerr << "[ERROR] Bulk dictionary decoding does not work with single input." << endl;
+    return -1;
+  }
   if (!cmdargs.single_input) {
     if (cmdargs.single_output) {
       if (commrank == 0) cerr << "[ERROR] Dictionary decoding with global dictionary does not work with single output." << endl;
@@ -428,6 +502,9 @@ int dictionary_decode() {
     if (cmdargs.output_format == string("der") && cmdargs.output_dict.size() > 0) {
       if (commrank == 0) cerr << "[WARNING] No dictionary file will be produced for der output when dictionary decoding with global dictionary." << endl;
     }
+    if (cmdargs.bulk) {
+      return bulk_dictionary_decode();
+    }
     InputStream *is = NULL;
     NEW(is, MPIPartialFileInputStream, MPI::COMM_SELF, cmdargs.input_dict.c_str(), MPI::MODE_RDONLY, MPI::INFO_NULL, cmdargs.page_size, 0, -1);
     RDFDictionary<ID, ENC> *dict = RDFDictEncReader<ID, ENC>::readDictionary(is, NULL);
@@ -441,6 +518,7 @@ int dictionary_decode() {
     NEW(dist, StringDistributor, commrank, cmdargs.packet_size, dist);
     DistRDFDictDecode<NBYTES, ID, ENC> *distcomp = NULL;
     NEW(distcomp, WHOLE(DistRDFDictDecode<NBYTES, ID, ENC>), commrank, commsize, rw, dist, is, dict, true);
+    distcomp->setBatchSize(cmdargs.batch_size);
     distcomp->exec();
     DELETE(distcomp);
     return 0;
@@ -450,9 +528,164 @@ int dictionary_decode() {
   return -1;
 }
 
+bool hotter(const pair<unsigned long, RDFTerm> &p1,
+            const pair<unsigned long, RDFTerm> &p2) {
+  return p1.first > p2.first ||
+         (p1.first == p2.first && RDFTerm::cmplt0(p1.second, p2.second));
+}
+
+RDFTerm parse_term(const uint8_t *begin, const uint32_t len) {
+  DPtr<uint8_t> *p;
+  NEW(p, MPtr<uint8_t>, len);
+  memcpy(p->dptr(), begin, len);
+  RDFTerm term = RDFTerm::parse(p);
+  p->drop();
+  return term;
+}
+
+// Counts terms in the first hot_sample triples of each processor's input,
+// lets processor 0 pick the hot_terms most frequent overall and give them
+// identifiers, and sends those identifiers to every processor so that
+// nobody has to look them up during encoding.
+void preassign_hot_terms(DistRDFDictEncode<NBYTES, ID, ENC> *distcomp) {
+  int commrank = MPI::COMM_WORLD.Get_rank();
+  int commsize = MPI::COMM_WORLD.Get_size();
+  typedef map<RDFTerm, unsigned long,
+              bool(*)(const RDFTerm &, const RDFTerm &)> TermCounts;
+  TermCounts counts(RDFTerm::cmplt0);
+  ENC enc;
+  ID id;
+  RDFReader *rr = makeRDFReader();
+  RDFTriple triple;
+  size_t n;
+  for (n = 0; n < cmdargs.hot_sample && rr->read(triple); ++n) {
+    if (!enc(triple.getSubj(), id)) ++counts[triple.getSubj()];
+    if (!enc(triple.getPred(), id)) ++counts[triple.getPred()];
+    if (!enc(triple.getObj(), id)) ++counts[triple.getObj()];
+  }
+  rr->close();
+  DELETE(rr);
+
+  // Each processor nominates its own most frequent terms.
+  vector<pair<unsigned long, RDFTerm> > hot;
+  TermCounts::const_iterator cit = counts.begin();
+  for (; cit != counts.end(); ++cit) {
+    hot.push_back(pair<unsigned long, RDFTerm>(cit->second, cit->first));
+  }
+  counts.clear();
+  if (hot.size() > (cmdargs.hot_terms << 1)) {
+    partial_sort(hot.begin(), hot.begin() + (cmdargs.hot_terms << 1),
+                 hot.end(), hotter);
+    hot.resize(cmdargs.hot_terms << 1);
+  }
+  string sendbuf;
+  vector<pair<unsigned long, RDFTerm> >::const_iterator hit = hot.begin();
+  for (; hit != hot.end(); ++hit) {
+    DPtr<uint8_t> *str = hit->second.toUTF8String();
+    uint32_t len = str->size();
+    sendbuf.append((const char *) &hit->first, sizeof(unsigned long));
+    sendbuf.append((const char *) &len, sizeof(uint32_t));
+    sendbuf.append((const char *) str->dptr(), len);
+    str->drop();
+  }
+  hot.clear();
+  int sendlen = sendbuf.size();
+  vector<int> recvlens(commsize, 0);
+  vector<int> displs(commsize, 0);
+  MPI::COMM_WORLD.Gather(&sendlen, 1, MPI::INT, &recvlens[0], 1, MPI::INT, 0);
+  int i;
+  for (i = 1; i < commsize; ++i) {
+    displs[i] = displs[i - 1] + recvlens[i - 1];
+  }
+  vector<char> recvbuf(displs[commsize - 1] + recvlens[commsize - 1] + 1);
+  MPI::COMM_WORLD.Gatherv(sendbuf.data(), sendlen, MPI::CHAR, &recvbuf[0],
+                          &recvlens[0], &displs[0], MPI::CHAR, 0);
+  sendbuf.clear();
+
+  // Processor 0 sums the nominations and assigns identifiers.
+  if (commrank == 0) {
+    const uint8_t *mark = (const uint8_t *) &recvbuf[0];
+    const uint8_t *end = mark + displs[commsize - 1] + recvlens[commsize - 1];
+    while (mark != end) {
+      unsigned long count;
+      uint32_t len;
+      memcpy(&count, mark, sizeof(unsigned long));
+      mark += sizeof(unsigned long);
+      memcpy(&len, mark, sizeof(uint32_t));
+      mark += sizeof(uint32_t);
+      counts[parse_term(mark, len)] += count;
+      mark += len;
+    }
+    for (cit = counts.begin(); cit != counts.end(); ++cit) {
+      hot.push_back(pair<unsigned long, RDFTerm>(cit->second, cit->first));
+    }
+    counts.clear();
+    if (hot.size() > cmdargs.hot_terms) {
+      partial_sort(hot.begin(), hot.begin() + cmdargs.hot_terms, hot.end(),
+                   hotter);
+      hot.resize(cmdargs.hot_terms);
+    }
+    for (hit = hot.begin(); hit != hot.end(); ++hit) {
+      id = distcomp->preassign(hit->second);
+      RDFDictEncWriter<ID, ENC>::appendEntry(sendbuf, id, hit->second);
+    }
+    sendlen = sendbuf.size();
+  }
+  MPI::COMM_WORLD.Bcast(&sendlen, 1, MPI::INT, 0);
+  recvbuf.resize(sendlen + 1);
+  if (commrank == 0) {
+    memcpy(&recvbuf[0], sendbuf.data(), sendlen);
+  }
+  MPI::COMM_WORLD.Bcast(&recvbuf[0], sendlen, MPI::CHAR, 0);
+  if (commrank != 0) {
+    const uint8_t *mark = (const uint8_t *) &recvbuf[0];
+    const uint8_t *end = mark + sendlen;
+    while (mark != end) {
+      RDFTerm term;
+      mark = RDFDictEncReader<ID, ENC>::parseEntry(mark, end, id, term);
+      distcomp->preassign(term, id);
+    }
+  }
+}
+
+// Encodes by sorting instead of looking up terms one at a time, so that
+// memory use is bounded by cmdargs.memory no matter how many terms there
+// are.  Sorted runs are spilled next to the output file.
+int bulk_dictionary_encode() {
+  int commrank = MPI::COMM_WORLD.Get_rank();
+  int commsize = MPI::COMM_WORLD.Get_size();
+  RDFReader *rr = makeRDFReader();
+  OutputStream *os = NULL;
+  NEW(os, MPIDistPtrFileOutputStream, MPI::COMM_SELF, cmdargs.output.c_str(), MPI::MODE_WRONLY | MPI::MODE_CREATE | MPI::MODE_EXCL, MPI::INFO_NULL, cmdargs.page_size, false);
+  OutputStream *ds = NULL;
+  NEW(ds, MPIDistPtrFileOutputStream, MPI::COMM_SELF, cmdargs.output_dict.c_str(), MPI::MODE_WRONLY | MPI::MODE_CREATE | MPI::MODE_EXCL, MPI::INFO_NULL, cmdargs.page_size, false);
+  Distributor *scatter = NULL;
+  NEW(scatter, MPIPacketDistributor, MPI::COMM_WORLD, cmdargs.packet_size, cmdargs.num_requests, cmdargs.check_every, 111);
+  NEW(scatter, StringDistributor, commrank, cmdargs.packet_size, scatter);
+  Distributor *assign = NULL;
+  NEW(assign, MPIPacketDistributor, MPI::COMM_WORLD, cmdargs.packet_size, cmdargs.num_requests, cmdargs.check_every, 112);
+  NEW(assign, StringDistributor, commrank, cmdargs.packet_size, assign);
+  DistRDFDictBulkEncode<NBYTES, ID, ENC> *bulk = NULL;
+  NEW(bulk, WHOLE(DistRDFDictBulkEncode<NBYTES, ID, ENC>), commrank, commsize, rr, scatter, assign, os, ds, cmdargs.output + string(".spill"), cmdargs.memory);
+  DEBUG("Performing bulk dictionary encoding.")
+  bulk->exec();
+  DELETE(bulk);
+  write_replicated_dictionary(ds);
+  ds->close();
+  DELETE(ds);
+  return 0;
+}
+
 int dictionary_encode() {
   int commrank = MPI::COMM_WORLD.Get_rank();
   int commsize = MPI::COMM_WORLD.Get_size();
+  if (cmdargs.single_output && cmdargs.bulk) {
+    if (commrank == 0) cerr << "[ERROR] Bulk dictionary encoding does not work with single output." << endl;
+    return -1;
+  }
+  if (!cmdargs.single_output && cmdargs.bulk) {
+    return bulk_dictionary_encode();
+  }
   if (!cmdargs.single_output) {
     DEBUG("Making RDF reader.")
     RDFReader *rr = makeRDFReader();
@@ -466,6 +699,11 @@ int dictionary_encode() {
     DistRDFDictEncode<NBYTES, ID, ENC> *distcomp = NULL;
     DEBUG("Making distributed computation.")
     NEW(distcomp, WHOLE(DistRDFDictEncode<NBYTES, ID, ENC>), commrank, commsize, rr, dist, os);
+    distcomp->setCacheSize(cmdargs.cache_size);
+    if (cmdargs.hot_terms > 0) {
+      DEBUG("Preassigning identifiers to frequent terms.")
+      preassign_hot_terms(distcomp);
+    }
     DEBUG("Performing dictionary encoding.")
     distcomp->exec();
     DEBUG("Finished dictionary encoding.")
@@ -33,6 +33,15 @@ do
 	rulefile="$maindir/$rulefile"
 	datafile="$maindir/$datafile"
 	echo "[TEST] $rulefile $datafile"
+	if [ "$note" == "mpisteal" ]; then
+		./steal-test.sh $rulefile $datafile $mpiprocs
+		rc=$?
+		if [ $rc -ne 0 ]; then
+			inferfailures=`expr $inferfailures + 1`
+		fi
+		ntests=`expr $ntests + 1`
+		continue
+	fi
 	if [ "$CWM" != "" ] && [ "$note" != "cwmoff" ]; then
 		./cwm-test.sh $CWM $rulefile $datafile
 		rc=$?
@@ -0,0 +1,75 @@
+#!/bin/sh
+
+# Copyright 2012 Jesse Weaver
+# 
+#    Licensed under the Apache License, Version 2.0 (the "License");
+#    you may not use this file except in compliance with the License.
+#    You may obtain a copy of the License at
+# 
+#        http://www.apache.org/licenses/LICENSE-2.0
+# 
+#    Unless required by applicable law or agreed to in writing, software
+#    distributed under the License is distributed on an "AS IS" BASIS,
+#    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+#    implied. See the License for the specific language governing
+#    permissions and limitations under the License.
+
+# Work stealing must not change the closure infer-rules-mpi computes,
+# even for rules that are not safe to apply to each partition alone,
+# so this compares runs with and without --steal rather than against
+# the sequential closure.
+
+if [ $# -lt 3 ]; then
+	echo "[USAGE] $0 <rif-core-file> <ntriples-files> <num-mpi-procs> [infer-mpi.sh flags]"
+	exit -1
+fi
+
+rules=$1
+shift
+data=$1
+shift
+mpiprocs=$1
+shift
+
+cp $rules _rules
+cp $data _data
+cd ..; ./infer-mpi.sh $mpiprocs testsuite/_rules testsuite/_data $@ 2>&1 | tee testsuite/_out_mpi | grep INCONSISTENT > testsuite/_inc1; cd - 2>&1 > /dev/null
+grep '\[ERROR\]' _out_mpi > _err_mpi
+sort -u _data-closure-rank-*.nt > _closure_mpi
+rm _data-closure-rank-*.nt
+cd ..; ./infer-mpi.sh $mpiprocs testsuite/_rules testsuite/_data --steal --steal-chunk 16 $@ 2>&1 | tee testsuite/_out_steal | grep INCONSISTENT > testsuite/_inc3; cd - 2>&1 > /dev/null
+grep '\[ERROR\]' _out_steal > _err_steal
+sort -u _data-closure-rank-*.nt > _closure_steal
+rm _data-closure-rank-*.nt
+status=0
+
+delta=`diff _closure_mpi _closure_steal`
+if [ "$delta" != "" ]; then
+	echo "$delta"
+	status=`expr $status + 1`
+fi
+inc1=`wc -l _inc1 | awk '{ print $1 }'`
+inc3=`wc -l _inc3 | awk '{ print $1 }'`
+if [ $inc1 -gt 0 ] && [ $inc3 -le 0 ]; then
+	echo "infer-mpi.sh found inconsistency, but not with --steal."
+	status=`expr $status + 1`
+fi
+if [ $inc1 -le 0 ] && [ $inc3 -gt 0 ]; then
+	echo "infer-mpi.sh found inconsistency only with --steal."
+	status=`expr $status + 1`
+fi
+err1=`wc -l _err_mpi | awk '{ print $1 }'`
+err3=`wc -l _err_steal | awk '{ print $1 }'`
+if [ `expr $err1 + $err3` -ne 0 ]; then
+	cat _err_mpi _err_steal
+	echo "[ERROR] TOTAL OF `expr $err1 + $err3` ERRORS OCCURRED IN infer-mpi.sh."
+	status=`expr $status + 1`
+fi
+
+if [ $status -gt 0 ]; then
+	echo "FAILED STEAL $rules $data"
+else
+	echo "PASSED STEAL $rules $data"
+fi
+#rm _*
+exit $status
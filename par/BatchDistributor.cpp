@@ -0,0 +1,213 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#include "par/BatchDistributor.h"
+
+#include "ptr/MPtr.h"
+
+namespace par {
+
+BatchDistributor::BatchDistributor(const int num_ranks,
+                                   const size_t batch_size,
+                                   const size_t idle_limit,
+                                   Distributor *dist)
+    throw(BaseException<void*>, BaseException<size_t>)
+    : Distributor(), dist(dist), recv_batch(NULL), recv_offset(0),
+      recv_end(0), batch_size(batch_size), idle_limit(idle_limit),
+      idle_count(0), no_more_sends(false), really_no_more_sends(false) {
+  if (dist == NULL) {
+    THROW(BaseException<void*>, NULL, "dist must not be NULL.");
+  }
+  if (num_ranks <= 0) {
+    THROW(BaseException<size_t>, (size_t) num_ranks,
+          "Number of ranks must be positive.");
+  }
+  if (batch_size <= (sizeof(uint32_t) << 1) || batch_size > UINT32_MAX) {
+    THROW(BaseException<size_t>, batch_size,
+          "Specified batch size cannot hold a header and a message.");
+  }
+  this->batches.resize(num_ranks, NULL);
+  this->fill.resize(num_ranks, 0);
+}
+
+BatchDistributor::~BatchDistributor() throw(DistException) {
+  vector<DPtr<uint8_t>*>::iterator it = this->batches.begin();
+  for (; it != this->batches.end(); ++it) {
+    if (*it != NULL) {
+      (*it)->drop();
+    }
+  }
+  SendList::iterator sit = this->send_batches.begin();
+  for (; sit != this->send_batches.end(); ++sit) {
+    sit->second->drop();
+  }
+  if (this->recv_batch != NULL) {
+    this->recv_batch->drop();
+  }
+  DELETE(this->dist);
+}
+
+void BatchDistributor::init() throw(DistException, BadAllocException) {
+  try {
+    this->dist->init();
+  } JUST_RETHROW(DistException, "Couldn't init underlying Distributor.")
+    JUST_RETHROW(BadAllocException, "Couldn't init underlying Distributor.")
+}
+
+void BatchDistributor::enqueue(const int rank) throw(DistException) {
+  DPtr<uint8_t> *batch = this->batches[rank];
+  if (batch == NULL) {
+    return;
+  }
+  uint32_t used = (uint32_t) this->fill[rank];
+  memcpy(batch->dptr(), &used, sizeof(uint32_t));
+  this->send_batches.push_back(pair<int, DPtr<uint8_t>*>(rank, batch));
+  this->batches[rank] = NULL;
+  this->fill[rank] = 0;
+}
+
+void BatchDistributor::enqueueAll() throw(DistException) {
+  int rank;
+  for (rank = 0; rank < (int) this->batches.size(); ++rank) {
+    this->enqueue(rank);
+  }
+}
+
+bool BatchDistributor::flush() throw(DistException) {
+  while (!this->send_batches.empty() &&
+         this->dist->send(this->send_batches.front().first,
+                          this->send_batches.front().second)) {
+    this->send_batches.front().second->drop();
+    this->send_batches.pop_front();
+  }
+  return this->send_batches.empty();
+}
+
+bool BatchDistributor::send(const int rank, DPtr<uint8_t> *msg)
+    throw(DistException) {
+  if (this->no_more_sends) {
+    THROW(DistException, "You already said no more sends!");
+  }
+  if (msg == NULL) {
+    THROW(DistException, "msg must not be NULL.");
+  }
+  if (!msg->sizeKnown()) {
+    THROW(DistException, "Size of msg is unknown.");
+  }
+  if (msg->size() > this->batch_size - (sizeof(uint32_t) << 1)) {
+    THROW(DistException, "Message does not fit in a batch.");
+  }
+  if (rank < 0 || rank >= (int) this->batches.size()) {
+    THROW(DistException, "Destination rank is out of range.");
+  }
+  this->idle_count = 0;
+  bool flushed = this->flush();
+  size_t need = sizeof(uint32_t) + msg->size();
+  if (this->batches[rank] != NULL &&
+      this->fill[rank] + need > this->batch_size) {
+    if (!flushed) {
+      // Only one generation of full batches may wait on the underlying
+      // distributor; the caller must keep receiving until it drains.
+      return false;
+    }
+    this->enqueue(rank);
+    this->flush();
+  }
+  if (this->batches[rank] == NULL) {
+    try {
+      NEW(this->batches[rank], MPtr<uint8_t>,
+          this->batch_size * sizeof(uint8_t));
+    } catch (bad_alloc &e) {
+      RETHROW_AS(DistException, e);
+    } catch (BadAllocException &e) {
+      RETHROW_AS(DistException, e);
+    }
+    this->fill[rank] = sizeof(uint32_t);
+  }
+  uint8_t *write_to = this->batches[rank]->dptr() + this->fill[rank];
+  uint32_t len = (uint32_t) msg->size();
+  memcpy(write_to, &len, sizeof(uint32_t));
+  memcpy(write_to + sizeof(uint32_t), msg->dptr(), msg->size());
+  this->fill[rank] += need;
+  return true;
+}
+
+DPtr<uint8_t> *BatchDistributor::receive() throw(DistException) {
+  if (this->recv_batch == NULL) {
+    if (!this->really_no_more_sends) {
+      this->flush();
+    }
+    DPtr<uint8_t> *batch = this->dist->receive();
+    if (batch == NULL) {
+      if (!this->no_more_sends && ++this->idle_count >= this->idle_limit) {
+        this->idle_count = 0;
+        if (this->send_batches.empty()) {
+          this->enqueueAll();
+        }
+        this->flush();
+      }
+      return NULL;
+    }
+    uint32_t used;
+    memcpy(&used, batch->dptr(), sizeof(uint32_t));
+    if (used <= sizeof(uint32_t) || used > batch->size()) {
+      batch->drop();
+      THROW(DistException, "Received a malformed batch.");
+    }
+    this->recv_batch = batch;
+    this->recv_offset = sizeof(uint32_t);
+    this->recv_end = used;
+  }
+  uint32_t len;
+  memcpy(&len, this->recv_batch->dptr() + this->recv_offset,
+         sizeof(uint32_t));
+  this->recv_offset += sizeof(uint32_t);
+  if (len > this->recv_end - this->recv_offset) {
+    this->recv_batch->drop();
+    this->recv_batch = NULL;
+    THROW(DistException, "Received a malformed batch.");
+  }
+  DPtr<uint8_t> *msg = this->recv_batch->sub(this->recv_offset, len);
+  this->recv_offset += len;
+  if (this->recv_offset + sizeof(uint32_t) > this->recv_end) {
+    this->recv_batch->drop();
+    this->recv_batch = NULL;
+  }
+  return msg;
+}
+
+void BatchDistributor::noMoreSends() throw(DistException) {
+  if (this->no_more_sends) {
+    THROW(DistException, "Already called noMoreSends()!");
+  }
+  this->no_more_sends = true;
+  this->enqueueAll();
+  if (this->flush()) {
+    try {
+      this->dist->noMoreSends();
+      this->really_no_more_sends = true;
+    } JUST_RETHROW(DistException, "Underlying Distributor problem.")
+  }
+}
+
+bool BatchDistributor::done() throw(DistException) {
+  if (!this->really_no_more_sends && this->flush() && this->no_more_sends) {
+    this->dist->noMoreSends();
+    this->really_no_more_sends = true;
+  }
+  return this->dist->done() && this->recv_batch == NULL;
+}
+
+}
@@ -0,0 +1,77 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#ifndef __PAR__BATCHDISTRIBUTOR_H__
+#define __PAR__BATCHDISTRIBUTOR_H__
+
+#include <deque>
+#include <vector>
+#include "ex/BaseException.h"
+#include "par/Distributor.h"
+#include "sys/ints.h"
+
+namespace par {
+
+using namespace ex;
+using namespace ptr;
+using namespace std;
+
+/*
+ * Coalesces small messages into one batch per destination rank and
+ * hands whole batches to an underlying Distributor, which must accept
+ * messages of exactly batch_size bytes (e.g., MPIPacketDistributor with
+ * packet_size == batch_size).  A batch is sent when the next message
+ * for its rank does not fit, after idle_limit consecutive calls to
+ * receive() without a call to send(), and on noMoreSends().  Received
+ * batches are split back into the original messages, so this can be
+ * slipped under any DistComputation unchanged.
+ *
+ * Batch layout: uint32_t number of bytes used (including this header),
+ * followed by messages, each a uint32_t length and then the payload.
+ */
+class BatchDistributor : public Distributor {
+private:
+  typedef deque<pair<int, DPtr<uint8_t>*> > SendList;
+  vector<DPtr<uint8_t>*> batches;
+  vector<size_t> fill;
+  SendList send_batches;
+  Distributor *dist;
+  DPtr<uint8_t> *recv_batch;
+  size_t recv_offset;
+  size_t recv_end;
+  const size_t batch_size;
+  const size_t idle_limit;
+  size_t idle_count;
+  bool no_more_sends;
+  bool really_no_more_sends;
+  void enqueue(const int rank) throw(DistException);
+  void enqueueAll() throw(DistException);
+  bool flush() throw(DistException);
+public:
+  BatchDistributor(const int num_ranks, const size_t batch_size,
+                   const size_t idle_limit, Distributor *dist)
+      throw(BaseException<void*>, BaseException<size_t>);
+  virtual ~BatchDistributor() throw(DistException);
+
+  virtual void init() throw(DistException, BadAllocException);
+  virtual bool send(const int rank, DPtr<uint8_t> *msg) throw(DistException);
+  virtual DPtr<uint8_t> *receive() throw(DistException);
+  virtual void noMoreSends() throw(DistException);
+  virtual bool done() throw(DistException);
+};
+
+}
+
+#endif /* __PAR__BATCHDISTRIBUTOR_H__ */
@@ -15,8 +15,15 @@
 
 #include "par/DistComputation.h"
 
+#include <pthread.h>
+#include <sched.h>
+#include <string>
 #include "ptr/MPtr.h"
 
+#ifndef PIPELINE_DEPTH
+#define PIPELINE_DEPTH 1024
+#endif
+
 namespace par {
 
 using namespace ex;
@@ -36,6 +43,15 @@ DistComputation::~DistComputation() THROWS(DistException) {
 }
 TRACE(DistException, "Couldn't deconstruct.")
 
+void DistComputation::exec(const bool pipelined)
+    throw(DistException, BadAllocException, TraceableException) {
+  if (pipelined) {
+    this->execPipelined();
+    return;
+  }
+  this->exec();
+}
+
 void DistComputation::exec()
     throw(DistException, BadAllocException, TraceableException) {
   DPtr<uint8_t> *buffer = NULL;
@@ -133,4 +149,279 @@ void DistComputation::exec()
   }
 }
 
+// Single-producer single-consumer ring of messages between the thread
+// driving the Distributor and the one running pickup and dropoff.  Each
+// index is written by only one thread, so a full barrier before
+// publishing it is all the synchronization needed.
+class MessageRing {
+private:
+  DPtr<uint8_t> *msgs[PIPELINE_DEPTH];
+  size_t lens[PIPELINE_DEPTH];
+  int ranks[PIPELINE_DEPTH];
+  volatile size_t head;
+  volatile size_t tail;
+public:
+  MessageRing() throw() : head(0), tail(0) {}
+  bool full() const throw() {
+    return this->tail - this->head >= PIPELINE_DEPTH;
+  }
+  bool push(DPtr<uint8_t> *msg, const size_t len, const int rank) throw() {
+    if (this->full()) {
+      return false;
+    }
+    size_t i = this->tail % PIPELINE_DEPTH;
+    this->msgs[i] = msg;
+    this->lens[i] = len;
+    this->ranks[i] = rank;
+    __sync_synchronize();
+    ++this->tail;
+    return true;
+  }
+  bool pop(DPtr<uint8_t> *&msg, size_t &len, int &rank) throw() {
+    if (this->head == this->tail) {
+      return false;
+    }
+    __sync_synchronize();
+    size_t i = this->head % PIPELINE_DEPTH;
+    msg = this->msgs[i];
+    len = this->lens[i];
+    rank = this->ranks[i];
+    __sync_synchronize();
+    ++this->head;
+    return true;
+  }
+  void clear() throw() {
+    DPtr<uint8_t> *msg;
+    size_t len;
+    int rank;
+    while (this->pop(msg, len, rank)) {
+      if (msg != NULL) {
+        msg->drop();
+      }
+    }
+  }
+};
+
+// Picked up messages go out through outbox as (buffer, len, rank), and
+// a rank < -1 with a NULL buffer marks the end of pickups.  Received
+// messages come in through inbox, and a NULL message marks that the
+// Distributor is done.
+class DistComputation::Pipeline {
+public:
+  DistComputation *comp;
+  MessageRing outbox;
+  MessageRing inbox;
+  volatile bool stop;
+  volatile bool failed;
+  bool bad_alloc;
+  string error;
+  Pipeline(DistComputation *comp) throw()
+      : comp(comp), stop(false), failed(false), bad_alloc(false) {}
+};
+
+void *DistComputation::compute(void *pipeline) throw() {
+  Pipeline *pipe = (Pipeline*) pipeline;
+  DistComputation *comp = pipe->comp;
+  DPtr<uint8_t> *buffer = NULL;
+  DPtr<uint8_t> *recvd = NULL;
+  try {
+    size_t len = 1024;
+    NEW(buffer, MPtr<uint8_t>, len);
+    bool picking = true;
+    bool receiving = true;
+    while ((picking || receiving) && !pipe->stop) {
+      bool progress = false;
+      size_t recvd_len;
+      int from;
+      while (receiving && pipe->inbox.pop(recvd, recvd_len, from)) {
+        if (recvd == NULL) {
+          receiving = false;
+        } else {
+          comp->dropoff(recvd);
+          recvd->drop();
+          recvd = NULL;
+        }
+        progress = true;
+      }
+      if (picking && !pipe->outbox.full()) {
+        int send_to = comp->pickup(buffer, len);
+        if (send_to < -1) {
+          pipe->outbox.push(NULL, 0, send_to);
+          picking = false;
+          progress = true;
+        } else if (buffer == NULL) {
+          THROW(TraceableException,
+                "Call to pickup set buffer to NULL.");
+        } else if (!buffer->sizeKnown()) {
+          THROW(TraceableException,
+                "Call to pickup set buffer to unknown size.");
+        } else if (len > buffer->size()) {
+          THROW(TraceableException,
+                "Call to pickup return len longer than buffer.");
+        } else if (send_to >= 0) {
+          // Hand the whole buffer over and pick up into a fresh one.
+          size_t size = buffer->size();
+          pipe->outbox.push(buffer, len, send_to);
+          buffer = NULL;
+          NEW(buffer, MPtr<uint8_t>, size);
+          progress = true;
+        }
+      }
+      if (!progress) {
+        sched_yield();
+      }
+    }
+    buffer->drop();
+  } catch (bad_alloc &e) {
+    pipe->bad_alloc = true;
+  } catch (BadAllocException &e) {
+    pipe->bad_alloc = true;
+    pipe->error = e.what();
+  } catch (TraceableException &e) {
+    pipe->error = e.what();
+  }
+  if (pipe->bad_alloc || !pipe->error.empty()) {
+    if (buffer != NULL) buffer->drop();
+    if (recvd != NULL) recvd->drop();
+    __sync_synchronize();
+    pipe->failed = true;
+  }
+  return NULL;
+}
+
+void DistComputation::execPipelined()
+    throw(DistException, BadAllocException, TraceableException) {
+  Pipeline pipe(this);
+  DPtr<uint8_t> *buffer = NULL;
+  DPtr<uint8_t> *recvd = NULL;
+  DPtr<uint8_t> *msg = NULL;
+  pthread_t thread;
+  bool started = false;
+  try {
+    this->start();
+    this->dist->init();
+    if (pthread_create(&thread, NULL, DistComputation::compute, &pipe) != 0) {
+      THROW(TraceableException, "Unable to create computation thread.");
+    }
+    started = true;
+
+    int send_to = 0;
+    bool sending = true;
+    bool receiving = true;
+    while ((sending || receiving) && !pipe.failed) {
+      bool progress = false;
+      if (receiving) {
+        recvd = this->dist->receive();
+        if (recvd != NULL) {
+          if (!recvd->alone()) {
+            recvd = recvd->stand();
+          }
+          while (!pipe.inbox.push(recvd, 0, 0) && !pipe.failed) {
+            sched_yield();
+          }
+          recvd = NULL;
+          progress = true;
+        }
+      }
+      if (sending && msg == NULL) {
+        size_t len;
+        if (pipe.outbox.pop(buffer, len, send_to)) {
+          progress = true;
+          if (send_to < -1) {
+            this->dist->noMoreSends();
+            sending = false;
+          } else {
+            if (len < buffer->size()) {
+              msg = buffer->sub(0, len);
+              if (buffer->size() - len >= 1024 ||
+                  ((float)len) / ((float)buffer->size()) < 0.75f) {
+                msg = msg->stand();
+              }
+            } else {
+              msg = buffer;
+              msg->hold();
+            }
+            buffer->drop();
+            buffer = NULL;
+          }
+        }
+      }
+      if (msg != NULL &&
+          (this->dist->done() || this->dist->send(send_to, msg))) {
+        msg->drop();
+        msg = NULL;
+        progress = true;
+      }
+      if (!sending && receiving && this->dist->done()) {
+        while (!pipe.inbox.push(NULL, 0, 0) && !pipe.failed) {
+          sched_yield();
+        }
+        receiving = false;
+      }
+      if (!progress) {
+        sched_yield();
+      }
+    }
+    pthread_join(thread, NULL);
+    started = false;
+    if (pipe.failed) {
+      pipe.inbox.clear();
+      pipe.outbox.clear();
+      if (pipe.bad_alloc) {
+        THROWX(BadAllocException);
+      }
+      THROW(TraceableException, pipe.error.c_str());
+    }
+    this->finish();
+  } catch (bad_alloc &e) {
+    if (buffer != NULL) buffer->drop();
+    if (recvd != NULL) recvd->drop();
+    if (msg != NULL) msg->drop();
+    if (started) {
+      pipe.stop = true;
+      pthread_join(thread, NULL);
+      pipe.inbox.clear();
+      pipe.outbox.clear();
+    }
+    this->fail();
+    THROWX(BadAllocException);
+  } catch (BadAllocException &e) {
+    if (buffer != NULL) buffer->drop();
+    if (recvd != NULL) recvd->drop();
+    if (msg != NULL) msg->drop();
+    if (started) {
+      pipe.stop = true;
+      pthread_join(thread, NULL);
+      pipe.inbox.clear();
+      pipe.outbox.clear();
+    }
+    this->fail();
+    RETHROW(e, "(rethrow)");
+  } catch (DistException &e) {
+    if (buffer != NULL) buffer->drop();
+    if (recvd != NULL) recvd->drop();
+    if (msg != NULL) msg->drop();
+    if (started) {
+      pipe.stop = true;
+      pthread_join(thread, NULL);
+      pipe.inbox.clear();
+      pipe.outbox.clear();
+    }
+    this->fail();
+    RETHROW(e, "Problem with underlying Distributor.");
+  } catch (TraceableException &e) {
+    if (buffer != NULL) buffer->drop();
+    if (recvd != NULL) recvd->drop();
+    if (msg != NULL) msg->drop();
+    if (started) {
+      pipe.stop = true;
+      pthread_join(thread, NULL);
+      pipe.inbox.clear();
+      pipe.outbox.clear();
+    }
+    this->fail();
+    RETHROW(e, "Problem with computation.");
+  }
+}
+
 }
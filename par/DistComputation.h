@@ -32,7 +32,11 @@ using namespace std;
 
 class DistComputation {
 private:
+  class Pipeline;
   Distributor *dist;
+  static void *compute(void *pipeline) throw();
+  void execPipelined()
+      throw(DistException, BadAllocException, TraceableException);
 protected:
   DistComputation(Distributor *dist) throw(BaseException<void*>);
 
@@ -71,7 +75,15 @@ protected:
 public:
   virtual ~DistComputation() throw (DistException);
 
+  // When pipelined is true, pickup() and dropoff() run in a separate
+  // thread while the calling thread drives the Distributor, so that
+  // communication overlaps with computation.  start() and finish()
+  // still run in the calling thread, which is the only one to make
+  // calls on the Distributor.  Pickup and dropoff must therefore not
+  // share DPtrs with the rest of the program while exec() runs.
   void exec() throw(DistException, BadAllocException, TraceableException);
+  void exec(const bool pipelined)
+      throw(DistException, BadAllocException, TraceableException);
 };
 
 }
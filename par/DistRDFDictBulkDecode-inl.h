@@ -0,0 +1,452 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#include "par/DistRDFDictBulkDecode.h"
+
+#include <cstring>
+#include "ptr/MPtr.h"
+#include "sys/endian.h"
+
+namespace par {
+
+using namespace ptr;
+using namespace sys;
+
+template<size_t N, typename ID, typename ENC>
+inline
+bool DistRDFDictBulkDecode<N, ID, ENC>::request_order::operator()(
+    const uint8_t *a, const uint32_t alen,
+    const uint8_t *b, const uint32_t blen) const {
+  const size_t skip = sizeof(int) + sizeof(uint64_t);
+  return memcmp(a + skip, b + skip, N) < 0;
+}
+
+template<size_t N, typename ID, typename ENC>
+inline
+bool DistRDFDictBulkDecode<N, ID, ENC>::entry_order::operator()(
+    const uint8_t *a, const uint32_t alen,
+    const uint8_t *b, const uint32_t blen) const {
+  return memcmp(a, b, N) < 0;
+}
+
+template<size_t N, typename ID, typename ENC>
+inline
+bool DistRDFDictBulkDecode<N, ID, ENC>::position_order::operator()(
+    const uint8_t *a, const uint32_t alen,
+    const uint8_t *b, const uint32_t blen) const {
+  uint64_t apos, bpos;
+  memcpy(&apos, a, sizeof(uint64_t));
+  memcpy(&bpos, b, sizeof(uint64_t));
+  return apos < bpos;
+}
+
+// DistRDFDictBulkDecode
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkDecode<N, ID, ENC>::DistRDFDictBulkDecode(const int rank,
+    const int nproc, RDFWriter *writer, Distributor *scatter,
+    Distributor *resolve, InputStream *in, InputStream *dict,
+    const string &spill, const size_t memory, const bool discard_atypical)
+    throw(BaseException<void*>, TraceableException)
+    : requests(spill + ".requests.", memory / 3),
+      entries(spill + ".entries.", memory / 3),
+      terms(spill + ".terms.", memory / 3), input(in), dictin(dict),
+      writer(writer), scatter_dist(scatter), resolve_dist(resolve),
+      rank(rank), nproc(nproc), discard_atypical(discard_atypical) {
+  if (N <= sizeof(int)) {
+    THROW(TraceableException, "N must be > sizeof(int).");
+  }
+  if (writer == NULL) {
+    THROW(BaseException<void*>, NULL, "RDFWriter *writer must not be NULL.");
+  }
+  if (scatter == NULL || resolve == NULL) {
+    THROW(BaseException<void*>, NULL, "Distributors must not be NULL.");
+  }
+  if (in == NULL || dict == NULL) {
+    THROW(BaseException<void*>, NULL, "InputStreams must not be NULL.");
+  }
+}
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkDecode<N, ID, ENC>::DistRDFDictBulkDecode(const int rank,
+    const int nproc, RDFWriter *writer, Distributor *scatter,
+    Distributor *resolve, InputStream *in, InputStream *dict,
+    const string &spill, const size_t memory, const bool discard_atypical,
+    const ENC &enc) throw(BaseException<void*>, TraceableException)
+    : requests(spill + ".requests.", memory / 3),
+      entries(spill + ".entries.", memory / 3),
+      terms(spill + ".terms.", memory / 3), encoder(enc), input(in),
+      dictin(dict), writer(writer), scatter_dist(scatter),
+      resolve_dist(resolve), rank(rank), nproc(nproc),
+      discard_atypical(discard_atypical) {
+  if (N <= sizeof(int)) {
+    THROW(TraceableException, "N must be > sizeof(int).");
+  }
+  if (writer == NULL) {
+    THROW(BaseException<void*>, NULL, "RDFWriter *writer must not be NULL.");
+  }
+  if (scatter == NULL || resolve == NULL) {
+    THROW(BaseException<void*>, NULL, "Distributors must not be NULL.");
+  }
+  if (in == NULL || dict == NULL) {
+    THROW(BaseException<void*>, NULL, "InputStreams must not be NULL.");
+  }
+}
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkDecode<N, ID, ENC>::~DistRDFDictBulkDecode()
+    throw(DistException) {
+  DELETE(this->writer);
+  DELETE(this->input);
+  DELETE(this->dictin);
+  if (this->scatter_dist != NULL) {
+    DELETE(this->scatter_dist);
+  }
+  if (this->resolve_dist != NULL) {
+    DELETE(this->resolve_dist);
+  }
+}
+
+// Reads exactly len bytes, or returns NULL at the end of the stream.
+template<size_t N, typename ID, typename ENC>
+DPtr<uint8_t> *DistRDFDictBulkDecode<N, ID, ENC>::readNext(InputStream *is,
+    const size_t len) THROWS(BadAllocException, TraceableException) {
+  DPtr<uint8_t> *p = is->read(len);
+  if (p == NULL || p->size() == len) {
+    return p;
+  }
+  DPtr<uint8_t> *q;
+  try {
+    NEW(q, MPtr<uint8_t>, len);
+  } RETHROW_BAD_ALLOC
+  uint8_t *qp = q->dptr();
+  const uint8_t *qend = qp + q->size();
+  memcpy(qp, p->dptr(), p->size());
+  qp += p->size();
+  p->drop();
+  while (qp != qend) {
+    p = is->read(qend - qp);
+    if (p == NULL) {
+      q->drop();
+      THROW(TraceableException, "Unexpected end of stream.");
+    }
+    memcpy(qp, p->dptr(), p->size());
+    qp += p->size();
+    p->drop();
+  }
+  return q;
+}
+TRACE(TraceableException, "(trace)")
+
+// Gives entries for identifiers that the encoder assigned to the encoder,
+// as RDFDictEncReader::readDictionary does, and sorts the rest.
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkDecode<N, ID, ENC>::readDictionary()
+    THROWS(BadAllocException, TraceableException) {
+  DPtr<uint8_t> *p = readNext(this->dictin, N + sizeof(uint32_t));
+  vector<uint8_t> rec;
+  while (p != NULL) {
+    ID id;
+    uint32_t len;
+    memcpy(id.ptr(), p->dptr(), N);
+    memcpy(&len, p->dptr() + N, sizeof(uint32_t));
+    p->drop();
+    if (is_little_endian()) {
+      reverse_bytes(len);
+    }
+    p = readNext(this->dictin, len);
+    if (p == NULL) {
+      THROW(TraceableException, "Unexpected end of stream.");
+    }
+    ID myid = id;
+    if (myid((ID::size() << 3) - 1, false)) {
+      RDFTerm term = RDFTerm::parse(p);
+      p->drop();
+      if (!this->encoder(myid, term)) {
+        THROW(TraceableException, "Unable to map ID to term.");
+      }
+    } else {
+      rec.resize(N + len);
+      memcpy(&rec[0], id.ptr(), N);
+      memcpy(&rec[0] + N, p->dptr(), len);
+      p->drop();
+      this->entries.add(&rec[0], rec.size());
+    }
+    p = readNext(this->dictin, N + sizeof(uint32_t));
+  }
+  this->dictin->close();
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkDecode<N, ID, ENC>::addTerm(const uint64_t pos,
+    const RDFTerm &term) THROWS(TraceableException) {
+  DPtr<uint8_t> *termstr = term.toUTF8String();
+  vector<uint8_t> rec(sizeof(uint64_t) + termstr->size());
+  memcpy(&rec[0], &pos, sizeof(uint64_t));
+  memcpy(&rec[0] + sizeof(uint64_t), termstr->dptr(), termstr->size());
+  termstr->drop();
+  this->terms.add(&rec[0], rec.size());
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkDecode<N, ID, ENC>::writeTriples()
+    THROWS(TraceableException) {
+  this->terms.merge();
+  RDFTerm parts[3];
+  uint64_t expect = 0;
+  const uint8_t *rec;
+  uint32_t len;
+  while (this->terms.next(rec, len)) {
+    uint64_t pos;
+    memcpy(&pos, rec, sizeof(uint64_t));
+    if (pos != expect) {
+      THROW(TraceableException, "Lost track of a term while decoding.");
+    }
+    DPtr<uint8_t> *termstr;
+    try {
+      NEW(termstr, MPtr<uint8_t>, len - sizeof(uint64_t));
+    } RETHROW_BAD_ALLOC
+    memcpy(termstr->dptr(), rec + sizeof(uint64_t), termstr->size());
+    parts[pos % 3] = RDFTerm::parse(termstr);
+    termstr->drop();
+    ++expect;
+    if (pos % 3 != 2) {
+      continue;
+    }
+    if (parts[0].isLiteral() || parts[1].getType() != IRI) {
+      if (this->discard_atypical) {
+        continue;
+      }
+    }
+    try {
+      RDFTriple trip(parts[0], parts[1], parts[2]);
+      this->writer->write(trip);
+    } JUST_RETHROW(TraceableException, "(rethrow)")
+  }
+  if (expect % 3 != 0) {
+    THROW(TraceableException, "Lost track of a term while decoding.");
+  }
+  this->writer->close();
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkDecode<N, ID, ENC>::exec()
+    THROWS(DistException, BadAllocException, TraceableException) {
+  this->readDictionary();
+  Scatter *scatter;
+  NEW(scatter, Scatter, this, this->scatter_dist);
+  this->scatter_dist = NULL;
+  scatter->exec();
+  DELETE(scatter);
+  Resolve *resolve;
+  NEW(resolve, Resolve, this, this->resolve_dist);
+  this->resolve_dist = NULL;
+  resolve->exec();
+  DELETE(resolve);
+  this->writeTriples();
+}
+TRACE(TraceableException, "(trace)")
+
+// DistRDFDictBulkDecode::Scatter
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkDecode<N, ID, ENC>::Scatter::Scatter(
+    DistRDFDictBulkDecode<N, ID, ENC> *bulk, Distributor *dist)
+    throw(BaseException<void*>)
+    : DistComputation(dist), bulk(bulk), current(NULL), position(0),
+      curpos(3) {
+  // do nothing
+}
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkDecode<N, ID, ENC>::Scatter::~Scatter() throw(DistException) {
+  if (this->current != NULL) {
+    this->current->drop();
+  }
+}
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkDecode<N, ID, ENC>::Scatter::start()
+    throw(TraceableException) {
+  // do nothing
+}
+
+template<size_t N, typename ID, typename ENC>
+int DistRDFDictBulkDecode<N, ID, ENC>::Scatter::pickup(
+    DPtr<uint8_t> *&buffer, size_t &len)
+    THROWS(BadAllocException, TraceableException) {
+  if (this->curpos > 2) {
+    if (this->current != NULL) {
+      this->current->drop();
+    }
+    this->current = readNext(this->bulk->input, 3*N*sizeof(uint8_t));
+    if (this->current == NULL) {
+      return -2;
+    }
+    this->curpos = 0;
+  }
+  ID id;
+  memcpy(id.ptr(), this->current->dptr() + N*this->curpos, N);
+  ++this->curpos;
+  uint64_t pos = this->position++;
+  ID myid = id;
+  if (myid((ID::size() << 3) - 1, false)) {
+    RDFTerm term;
+    if (!this->bulk->encoder(myid, term)) {
+      THROW(TraceableException, "Cannot decode term!");
+    }
+    this->bulk->addTerm(pos, term);
+    return -1;
+  }
+  uint32_t top;
+  memcpy(&top, id.ptr(), sizeof(uint32_t));
+  if (is_little_endian()) {
+    reverse_bytes(top);
+  }
+  int send_to = (int) top;
+  if (send_to < 0 || send_to >= this->bulk->nproc) {
+    THROW(TraceableException, "Identifier does not belong to any processor.");
+  }
+  len = sizeof(int) + sizeof(uint64_t) + N;
+  if (buffer->size() < len) {
+    buffer->drop();
+    try {
+      NEW(buffer, MPtr<uint8_t>, len);
+    } RETHROW_BAD_ALLOC
+  }
+  uint8_t *write_to = buffer->dptr();
+  memcpy(write_to, &this->bulk->rank, sizeof(int));
+  write_to += sizeof(int);
+  memcpy(write_to, &pos, sizeof(uint64_t));
+  write_to += sizeof(uint64_t);
+  memcpy(write_to, id.ptr(), N);
+  return send_to;
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkDecode<N, ID, ENC>::Scatter::dropoff(DPtr<uint8_t> *msg)
+    THROWS(TraceableException) {
+  this->bulk->requests.add(msg->dptr(), msg->size());
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkDecode<N, ID, ENC>::Scatter::finish()
+    THROWS(TraceableException) {
+  this->bulk->input->close();
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkDecode<N, ID, ENC>::Scatter::fail() throw() {
+  try {
+    this->bulk->input->close();
+  } catch (TraceableException &e) {
+    // Give up cleaning up.
+  }
+}
+
+// DistRDFDictBulkDecode::Resolve
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkDecode<N, ID, ENC>::Resolve::Resolve(
+    DistRDFDictBulkDecode<N, ID, ENC> *bulk, Distributor *dist)
+    throw(BaseException<void*>)
+    : DistComputation(dist), bulk(bulk), more(false) {
+  // do nothing
+}
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkDecode<N, ID, ENC>::Resolve::~Resolve() throw(DistException) {
+  // do nothing
+}
+
+template<size_t N, typename ID, typename ENC>
+bool DistRDFDictBulkDecode<N, ID, ENC>::Resolve::advance()
+    THROWS(TraceableException) {
+  const uint8_t *rec;
+  uint32_t len;
+  this->more = this->bulk->entries.next(rec, len);
+  if (this->more) {
+    this->entry.assign(rec, rec + len);
+  }
+  return this->more;
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkDecode<N, ID, ENC>::Resolve::start()
+    THROWS(TraceableException) {
+  this->bulk->requests.merge();
+  this->bulk->entries.merge();
+  this->advance();
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+int DistRDFDictBulkDecode<N, ID, ENC>::Resolve::pickup(
+    DPtr<uint8_t> *&buffer, size_t &len)
+    THROWS(BadAllocException, TraceableException) {
+  const uint8_t *rec;
+  uint32_t reclen;
+  if (!this->bulk->requests.next(rec, reclen)) {
+    return -2;
+  }
+  const uint8_t *id = rec + sizeof(int) + sizeof(uint64_t);
+  while (this->more && memcmp(&this->entry[0], id, N) < 0) {
+    this->advance();
+  }
+  if (!this->more || memcmp(&this->entry[0], id, N) != 0) {
+    THROW(TraceableException, "Cannot decode term!");
+  }
+  int send_to;
+  memcpy(&send_to, rec, sizeof(int));
+  len = sizeof(uint64_t) + this->entry.size() - N;
+  if (buffer->size() < len) {
+    buffer->drop();
+    try {
+      NEW(buffer, MPtr<uint8_t>, len);
+    } RETHROW_BAD_ALLOC
+  }
+  memcpy(buffer->dptr(), rec + sizeof(int), sizeof(uint64_t));
+  memcpy(buffer->dptr() + sizeof(uint64_t), &this->entry[0] + N,
+         this->entry.size() - N);
+  return send_to;
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkDecode<N, ID, ENC>::Resolve::dropoff(DPtr<uint8_t> *msg)
+    THROWS(TraceableException) {
+  this->bulk->terms.add(msg->dptr(), msg->size());
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkDecode<N, ID, ENC>::Resolve::finish()
+    throw(TraceableException) {
+  // do nothing
+}
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkDecode<N, ID, ENC>::Resolve::fail() throw() {
+  // do nothing
+}
+
+}
@@ -0,0 +1,158 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#ifndef __PAR__DISTRDFDICTBULKDECODE_H__
+#define __PAR__DISTRDFDICTBULKDECODE_H__
+
+#include <string>
+#include <vector>
+#include "io/InputStream.h"
+#include "io/SpillSorter.h"
+#include "par/DistComputation.h"
+#include "rdf/RDFDictionary.h"
+#include "rdf/RDFTriple.h"
+#include "rdf/RDFWriter.h"
+
+namespace par {
+
+using namespace io;
+using namespace rdf;
+using namespace std;
+
+/*
+ * Dictionary decodes triples without loading the dictionary into memory,
+ * as an alternative to DistRDFDictDecode for inputs larger than aggregate
+ * RAM.  It is the reverse of DistRDFDictBulkEncode.
+ * 
+ * 1. Every identifier is sent, with the position at which it was read, to
+ *    the processor that assigned it, which sorts what it receives by
+ *    identifier.
+ * 2. Each owner sorts its dictionary entries by identifier and streams
+ *    them against the sorted requests, sending each term back to every
+ *    position at which its identifier occurred.
+ * 3. Every processor sorts the terms it gets back by position and writes
+ *    out the decoded triples in the order they were read.
+ * 
+ * Identifiers that the encoder assigned never leave the processor.  Before
+ * anything is sent, dictionary entries for them are given to the encoder,
+ * as RDFDictEncReader::readDictionary does.  Each of the three sorts holds
+ * at most about a third of the given memory and spills the rest to files
+ * whose names begin with the given prefix.  The dictionary is read in the
+ * format written by RDFDictEncWriter.
+ */
+template<size_t N, typename ID=RDFID<N>, typename ENC=RDFEncoder<ID> >
+class DistRDFDictBulkDecode {
+private:
+  // request records: int rank, uint64_t position, ID
+  struct request_order {
+    bool operator()(const uint8_t *a, const uint32_t alen,
+                    const uint8_t *b, const uint32_t blen) const;
+  };
+  // entry records: ID, term
+  struct entry_order {
+    bool operator()(const uint8_t *a, const uint32_t alen,
+                    const uint8_t *b, const uint32_t blen) const;
+  };
+  // term records: uint64_t position, term
+  struct position_order {
+    bool operator()(const uint8_t *a, const uint32_t alen,
+                    const uint8_t *b, const uint32_t blen) const;
+  };
+
+  // phase 1
+  class Scatter : public DistComputation {
+  private:
+    DistRDFDictBulkDecode<N, ID, ENC> *bulk;
+    DPtr<uint8_t> *current;
+    uint64_t position;
+    uint8_t curpos;
+  protected:
+    virtual void start() throw(TraceableException);
+    virtual int pickup(DPtr<uint8_t> *&buffer, size_t &len)
+        throw(BadAllocException, TraceableException);
+    virtual void dropoff(DPtr<uint8_t> *msg) throw(TraceableException);
+    virtual void finish() throw(TraceableException);
+    virtual void fail() throw();
+  public:
+    Scatter(DistRDFDictBulkDecode<N, ID, ENC> *bulk, Distributor *dist)
+        throw(BaseException<void*>);
+    virtual ~Scatter() throw(DistException);
+  };
+
+  // phase 2
+  class Resolve : public DistComputation {
+  private:
+    DistRDFDictBulkDecode<N, ID, ENC> *bulk;
+    vector<uint8_t> entry;
+    bool more;
+    bool advance() throw(TraceableException);
+  protected:
+    virtual void start() throw(TraceableException);
+    virtual int pickup(DPtr<uint8_t> *&buffer, size_t &len)
+        throw(BadAllocException, TraceableException);
+    virtual void dropoff(DPtr<uint8_t> *msg) throw(TraceableException);
+    virtual void finish() throw(TraceableException);
+    virtual void fail() throw();
+  public:
+    Resolve(DistRDFDictBulkDecode<N, ID, ENC> *bulk, Distributor *dist)
+        throw(BaseException<void*>);
+    virtual ~Resolve() throw(DistException);
+  };
+
+  friend class Scatter;
+  friend class Resolve;
+
+  SpillSorter<request_order> requests;
+  SpillSorter<entry_order> entries;
+  SpillSorter<position_order> terms;
+  ENC encoder;
+  InputStream *input;
+  InputStream *dictin;
+  RDFWriter *writer;
+  Distributor *scatter_dist;
+  Distributor *resolve_dist;
+  int rank;
+  int nproc;
+  bool discard_atypical;
+
+  static DPtr<uint8_t> *readNext(InputStream *is, const size_t len)
+      throw(BadAllocException, TraceableException);
+  void readDictionary() throw(BadAllocException, TraceableException);
+  void addTerm(const uint64_t pos, const RDFTerm &term)
+      throw(TraceableException);
+  void writeTriples() throw(TraceableException);
+public:
+  // Takes ownership of writer, both distributors, and both input streams.
+  // Each distributor is used for one phase, so they must not share tags.
+  DistRDFDictBulkDecode(const int rank, const int nproc, RDFWriter *writer,
+      Distributor *scatter, Distributor *resolve, InputStream *in,
+      InputStream *dict, const string &spill, const size_t memory,
+      const bool discard_atypical)
+      throw(BaseException<void*>, TraceableException);
+  DistRDFDictBulkDecode(const int rank, const int nproc, RDFWriter *writer,
+      Distributor *scatter, Distributor *resolve, InputStream *in,
+      InputStream *dict, const string &spill, const size_t memory,
+      const bool discard_atypical, const ENC &enc)
+      throw(BaseException<void*>, TraceableException);
+  ~DistRDFDictBulkDecode() throw(DistException);
+
+  void exec() throw(DistException, BadAllocException, TraceableException);
+};
+
+}
+
+#include "par/DistRDFDictBulkDecode-inl.h"
+
+#endif /* __PAR__DISTRDFDICTBULKDECODE_H__ */
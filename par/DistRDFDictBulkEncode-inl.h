@@ -0,0 +1,396 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#include "par/DistRDFDictBulkEncode.h"
+
+#include <cstring>
+#include "ptr/MPtr.h"
+#include "sys/char.h"
+#include "sys/endian.h"
+#include "util/funcs.h"
+#include "util/hash.h"
+
+namespace par {
+
+using namespace ptr;
+using namespace sys;
+using namespace util;
+
+template<size_t N, typename ID, typename ENC>
+inline
+bool DistRDFDictBulkEncode<N, ID, ENC>::term_order::operator()(
+    const uint8_t *a, const uint32_t alen,
+    const uint8_t *b, const uint32_t blen) const {
+  const size_t skip = sizeof(int) + sizeof(uint64_t);
+  int c = memcmp(a + skip, b + skip, min(alen, blen) - skip);
+  return c < 0 || (c == 0 && alen < blen);
+}
+
+template<size_t N, typename ID, typename ENC>
+inline
+bool DistRDFDictBulkEncode<N, ID, ENC>::position_order::operator()(
+    const uint8_t *a, const uint32_t alen,
+    const uint8_t *b, const uint32_t blen) const {
+  uint64_t apos, bpos;
+  memcpy(&apos, a, sizeof(uint64_t));
+  memcpy(&bpos, b, sizeof(uint64_t));
+  return apos < bpos;
+}
+
+// DistRDFDictBulkEncode
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkEncode<N, ID, ENC>::DistRDFDictBulkEncode(const int rank,
+    const int nproc, RDFReader *reader, Distributor *scatter,
+    Distributor *assign, OutputStream *out, OutputStream *dict,
+    const string &spill, const size_t memory)
+    throw(BaseException<void*>, TraceableException)
+    : terms(spill + ".terms.", memory >> 1),
+      positions(spill + ".positions.", memory >> 1), counter(ID(1)),
+      reader(reader), output(out), dictout(dict), scatter_dist(scatter),
+      assign_dist(assign), rank(rank), nproc(nproc) {
+  if (N <= sizeof(int)) {
+    THROW(TraceableException, "N must be > sizeof(int).");
+  }
+  if (reader == NULL) {
+    THROW(BaseException<void*>, NULL, "RDFReader *reader must not be NULL.");
+  }
+  if (scatter == NULL || assign == NULL) {
+    THROW(BaseException<void*>, NULL, "Distributors must not be NULL.");
+  }
+  if (out == NULL || dict == NULL) {
+    THROW(BaseException<void*>, NULL, "OutputStreams must not be NULL.");
+  }
+  int r = rank;
+  if (is_little_endian()) {
+    reverse_bytes(r);
+  }
+  memcpy(this->counter.ptr(), &r, sizeof(int));
+}
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkEncode<N, ID, ENC>::DistRDFDictBulkEncode(const int rank,
+    const int nproc, RDFReader *reader, Distributor *scatter,
+    Distributor *assign, OutputStream *out, OutputStream *dict,
+    const string &spill, const size_t memory, const ENC &enc)
+    throw(BaseException<void*>, TraceableException)
+    : terms(spill + ".terms.", memory >> 1),
+      positions(spill + ".positions.", memory >> 1), encoder(enc),
+      counter(ID(1)), reader(reader), output(out), dictout(dict),
+      scatter_dist(scatter), assign_dist(assign), rank(rank), nproc(nproc) {
+  if (N <= sizeof(int)) {
+    THROW(TraceableException, "N must be > sizeof(int).");
+  }
+  if (reader == NULL) {
+    THROW(BaseException<void*>, NULL, "RDFReader *reader must not be NULL.");
+  }
+  if (scatter == NULL || assign == NULL) {
+    THROW(BaseException<void*>, NULL, "Distributors must not be NULL.");
+  }
+  if (out == NULL || dict == NULL) {
+    THROW(BaseException<void*>, NULL, "OutputStreams must not be NULL.");
+  }
+  int r = rank;
+  if (is_little_endian()) {
+    reverse_bytes(r);
+  }
+  memcpy(this->counter.ptr(), &r, sizeof(int));
+}
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkEncode<N, ID, ENC>::~DistRDFDictBulkEncode()
+    throw(DistException) {
+  DELETE(this->reader);
+  DELETE(this->output);
+  if (this->scatter_dist != NULL) {
+    DELETE(this->scatter_dist);
+  }
+  if (this->assign_dist != NULL) {
+    DELETE(this->assign_dist);
+  }
+}
+
+template<size_t N, typename ID, typename ENC>
+bool DistRDFDictBulkEncode<N, ID, ENC>::nextID(ID &id) throw() {
+  int proc;
+  memcpy(&proc, this->counter.ptr(), sizeof(int));
+  if (is_little_endian()) {
+    reverse_bytes(proc);
+  }
+  if (proc != this->rank) {
+    return false;
+  }
+  id = this->counter;
+  ++this->counter;
+  return true;
+}
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkEncode<N, ID, ENC>::writeTriples()
+    THROWS(TraceableException) {
+  this->positions.merge();
+  DPtr<uint8_t> *buf;
+  try {
+    NEW(buf, MPtr<uint8_t>, 3*N*sizeof(uint8_t));
+  } RETHROW_BAD_ALLOC
+  uint64_t expect = 0;
+  const uint8_t *rec;
+  uint32_t len;
+  while (this->positions.next(rec, len)) {
+    uint64_t pos;
+    memcpy(&pos, rec, sizeof(uint64_t));
+    if (pos != expect) {
+      buf->drop();
+      THROW(TraceableException, "Lost track of a term while encoding.");
+    }
+    if (!buf->alone()) {
+      buf = buf->stand();
+    }
+    memcpy(buf->dptr() + (pos % 3)*N, rec + sizeof(uint64_t), N);
+    if (pos % 3 == 2) {
+      this->output->write(buf);
+    }
+    ++expect;
+  }
+  buf->drop();
+  if (expect % 3 != 0) {
+    THROW(TraceableException, "Lost track of a term while encoding.");
+  }
+  this->output->close();
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkEncode<N, ID, ENC>::exec()
+    THROWS(DistException, BadAllocException, TraceableException) {
+  Scatter *scatter;
+  NEW(scatter, Scatter, this, this->scatter_dist);
+  this->scatter_dist = NULL;
+  scatter->exec();
+  DELETE(scatter);
+  Assign *assign;
+  NEW(assign, Assign, this, this->assign_dist);
+  this->assign_dist = NULL;
+  assign->exec();
+  DELETE(assign);
+  this->writeTriples();
+}
+TRACE(TraceableException, "(trace)")
+
+// DistRDFDictBulkEncode::Scatter
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkEncode<N, ID, ENC>::Scatter::Scatter(
+    DistRDFDictBulkEncode<N, ID, ENC> *bulk, Distributor *dist)
+    throw(BaseException<void*>)
+    : DistComputation(dist), bulk(bulk), position(0), curpos(3) {
+  // do nothing
+}
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkEncode<N, ID, ENC>::Scatter::~Scatter() throw(DistException) {
+  // do nothing
+}
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkEncode<N, ID, ENC>::Scatter::start()
+    throw(TraceableException) {
+  // do nothing
+}
+
+template<size_t N, typename ID, typename ENC>
+int DistRDFDictBulkEncode<N, ID, ENC>::Scatter::pickup(
+    DPtr<uint8_t> *&buffer, size_t &len)
+    THROWS(BadAllocException, TraceableException) {
+  if (this->curpos > 2) {
+    if (!this->bulk->reader->read(this->current)) {
+      return -2;
+    }
+    this->curpos = 0;
+  }
+  RDFTerm term;
+  switch (this->curpos) {
+  case 0:
+    term = this->current.getSubj();
+    break;
+  case 1:
+    term = this->current.getPred();
+    break;
+  case 2:
+    term = this->current.getObj();
+    break;
+  }
+  ++this->curpos;
+  uint64_t pos = this->position++;
+  ID id;
+  if (this->bulk->encoder(term, id) && !id((ID::size() << 3) - 1, true)) {
+    uint8_t rec[sizeof(uint64_t) + N];
+    memcpy(rec, &pos, sizeof(uint64_t));
+    memcpy(rec + sizeof(uint64_t), id.ptr(), N);
+    this->bulk->positions.add(rec, sizeof(uint64_t) + N);
+    return -1;
+  }
+  DPtr<uint8_t> *termstr = term.toUTF8String();
+  len = sizeof(int) + sizeof(uint64_t) + termstr->size();
+  if (buffer->size() < len) {
+    buffer->drop();
+    try {
+      NEW(buffer, MPtr<uint8_t>, len);
+    } RETHROW_BAD_ALLOC
+  }
+  uint8_t *write_to = buffer->dptr();
+  memcpy(write_to, &this->bulk->rank, sizeof(int));
+  write_to += sizeof(int);
+  memcpy(write_to, &pos, sizeof(uint64_t));
+  write_to += sizeof(uint64_t);
+  memcpy(write_to, termstr->dptr(), termstr->size());
+  uint8_t *end = write_to + termstr->size();
+  termstr->drop();
+  if (term.getType() == LANG_LITERAL) {
+    // language tags are case-insensitive
+    uint8_t *mark = end;
+    while (*--mark != to_ascii('@')) {
+      *mark = (uint8_t) to_lower(*mark);
+    }
+  }
+  return (int) (hash_jenkins_one_at_a_time(write_to, end) %
+                this->bulk->nproc);
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkEncode<N, ID, ENC>::Scatter::dropoff(DPtr<uint8_t> *msg)
+    THROWS(TraceableException) {
+  this->bulk->terms.add(msg->dptr(), msg->size());
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkEncode<N, ID, ENC>::Scatter::finish()
+    THROWS(TraceableException) {
+  this->bulk->reader->close();
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkEncode<N, ID, ENC>::Scatter::fail() throw() {
+  try {
+    this->bulk->reader->close();
+  } catch (TraceableException &e) {
+    // Give up cleaning up.
+  }
+}
+
+// DistRDFDictBulkEncode::Assign
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkEncode<N, ID, ENC>::Assign::Assign(
+    DistRDFDictBulkEncode<N, ID, ENC> *bulk, Distributor *dist)
+    throw(BaseException<void*>)
+    : DistComputation(dist), bulk(bulk), entry(NULL), first(true) {
+  // do nothing
+}
+
+template<size_t N, typename ID, typename ENC>
+DistRDFDictBulkEncode<N, ID, ENC>::Assign::~Assign() throw(DistException) {
+  if (this->entry != NULL) {
+    this->entry->drop();
+  }
+}
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkEncode<N, ID, ENC>::Assign::start()
+    THROWS(TraceableException) {
+  this->bulk->terms.merge();
+  try {
+    NEW(this->entry, MPtr<uint8_t>, 1024);
+  } RETHROW_BAD_ALLOC
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+int DistRDFDictBulkEncode<N, ID, ENC>::Assign::pickup(
+    DPtr<uint8_t> *&buffer, size_t &len)
+    THROWS(BadAllocException, TraceableException) {
+  const uint8_t *rec;
+  uint32_t reclen;
+  if (!this->bulk->terms.next(rec, reclen)) {
+    return -2;
+  }
+  const size_t skip = sizeof(int) + sizeof(uint64_t);
+  const uint8_t *term = rec + skip;
+  uint32_t termlen = reclen - skip;
+  if (this->first || termlen != this->last.size() ||
+      memcmp(term, &this->last[0], termlen) != 0) {
+    this->first = false;
+    this->last.assign(term, term + termlen);
+    if (!this->bulk->nextID(this->id)) {
+      THROW(TraceableException, "Ran out of identifiers!");
+    }
+    size_t entrylen = ID::size() + sizeof(uint32_t) + termlen;
+    if (this->entry->size() < entrylen) {
+      this->entry->drop();
+      try {
+        NEW(this->entry, MPtr<uint8_t>, entrylen);
+      } RETHROW_BAD_ALLOC
+    } else if (!this->entry->alone()) {
+      this->entry = this->entry->stand(false);
+    }
+    memcpy(this->entry->dptr(), this->id.ptr(), ID::size());
+    uint32_t belen = termlen;
+    if (is_little_endian()) {
+      reverse_bytes(belen);
+    }
+    memcpy(this->entry->dptr() + ID::size(), &belen, sizeof(uint32_t));
+    memcpy(this->entry->dptr() + ID::size() + sizeof(uint32_t), term,
+           termlen);
+    DPtr<uint8_t> *subp = this->entry->sub(0, entrylen);
+    this->bulk->dictout->write(subp);
+    subp->drop();
+  }
+  int send_to;
+  memcpy(&send_to, rec, sizeof(int));
+  len = sizeof(uint64_t) + N;
+  if (buffer->size() < len) {
+    buffer->drop();
+    try {
+      NEW(buffer, MPtr<uint8_t>, len);
+    } RETHROW_BAD_ALLOC
+  }
+  memcpy(buffer->dptr(), rec + sizeof(int), sizeof(uint64_t));
+  memcpy(buffer->dptr() + sizeof(uint64_t), this->id.ptr(), N);
+  return send_to;
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkEncode<N, ID, ENC>::Assign::dropoff(DPtr<uint8_t> *msg)
+    THROWS(TraceableException) {
+  this->bulk->positions.add(msg->dptr(), msg->size());
+}
+TRACE(TraceableException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkEncode<N, ID, ENC>::Assign::finish()
+    throw(TraceableException) {
+  // do nothing
+}
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictBulkEncode<N, ID, ENC>::Assign::fail() throw() {
+  // do nothing
+}
+
+}
@@ -0,0 +1,144 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#ifndef __PAR__DISTRDFDICTBULKENCODE_H__
+#define __PAR__DISTRDFDICTBULKENCODE_H__
+
+#include <string>
+#include <vector>
+#include "io/OutputStream.h"
+#include "io/SpillSorter.h"
+#include "par/DistComputation.h"
+#include "rdf/RDFDictionary.h"
+#include "rdf/RDFReader.h"
+#include "rdf/RDFTriple.h"
+
+namespace par {
+
+using namespace io;
+using namespace rdf;
+using namespace std;
+
+/*
+ * Dictionary encodes triples without keeping any terms in memory, as an
+ * alternative to DistRDFDictEncode for inputs larger than aggregate RAM.
+ * 
+ * 1. Every term is sent, with the position at which it was read, to the
+ *    processor that owns it by hash, which sorts what it receives by term.
+ * 2. Each owner walks its terms in order, writes a dictionary entry for
+ *    each distinct one, and sends its identifier back to every position
+ *    at which it occurred.
+ * 3. Every processor sorts the identifiers it gets back by position and
+ *    writes out the encoded triples in the order they were read.
+ * 
+ * Terms that the encoder can handle never leave the processor.  Sorting
+ * uses SpillSorter, so each of the two sorts holds at most about half of
+ * the given memory and spills the rest to files whose names begin with
+ * the given prefix.  Identifiers are laid out as by DistRDFDictionary,
+ * and the dictionary entries are in the format of RDFDictEncWriter.
+ */
+template<size_t N, typename ID=RDFID<N>, typename ENC=RDFEncoder<ID> >
+class DistRDFDictBulkEncode {
+private:
+  // term records: int rank, uint64_t position, term
+  struct term_order {
+    bool operator()(const uint8_t *a, const uint32_t alen,
+                    const uint8_t *b, const uint32_t blen) const;
+  };
+  // position records: uint64_t position, ID
+  struct position_order {
+    bool operator()(const uint8_t *a, const uint32_t alen,
+                    const uint8_t *b, const uint32_t blen) const;
+  };
+
+  // phase 1
+  class Scatter : public DistComputation {
+  private:
+    DistRDFDictBulkEncode<N, ID, ENC> *bulk;
+    RDFTriple current;
+    uint64_t position;
+    uint8_t curpos;
+  protected:
+    virtual void start() throw(TraceableException);
+    virtual int pickup(DPtr<uint8_t> *&buffer, size_t &len)
+        throw(BadAllocException, TraceableException);
+    virtual void dropoff(DPtr<uint8_t> *msg) throw(TraceableException);
+    virtual void finish() throw(TraceableException);
+    virtual void fail() throw();
+  public:
+    Scatter(DistRDFDictBulkEncode<N, ID, ENC> *bulk, Distributor *dist)
+        throw(BaseException<void*>);
+    virtual ~Scatter() throw(DistException);
+  };
+
+  // phase 2
+  class Assign : public DistComputation {
+  private:
+    DistRDFDictBulkEncode<N, ID, ENC> *bulk;
+    vector<uint8_t> last;
+    ID id;
+    DPtr<uint8_t> *entry;
+    bool first;
+  protected:
+    virtual void start() throw(TraceableException);
+    virtual int pickup(DPtr<uint8_t> *&buffer, size_t &len)
+        throw(BadAllocException, TraceableException);
+    virtual void dropoff(DPtr<uint8_t> *msg) throw(TraceableException);
+    virtual void finish() throw(TraceableException);
+    virtual void fail() throw();
+  public:
+    Assign(DistRDFDictBulkEncode<N, ID, ENC> *bulk, Distributor *dist)
+        throw(BaseException<void*>);
+    virtual ~Assign() throw(DistException);
+  };
+
+  friend class Scatter;
+  friend class Assign;
+
+  SpillSorter<term_order> terms;
+  SpillSorter<position_order> positions;
+  ENC encoder;
+  ID counter;
+  RDFReader *reader;
+  OutputStream *output;
+  OutputStream *dictout;
+  Distributor *scatter_dist;
+  Distributor *assign_dist;
+  int rank;
+  int nproc;
+
+  bool nextID(ID &id) throw();
+  void writeTriples() throw(TraceableException);
+public:
+  // Takes ownership of reader, both distributors, and out, but not dict.
+  // Each distributor is used for one phase, so they must not share tags.
+  DistRDFDictBulkEncode(const int rank, const int nproc, RDFReader *reader,
+      Distributor *scatter, Distributor *assign, OutputStream *out,
+      OutputStream *dict, const string &spill, const size_t memory)
+      throw(BaseException<void*>, TraceableException);
+  DistRDFDictBulkEncode(const int rank, const int nproc, RDFReader *reader,
+      Distributor *scatter, Distributor *assign, OutputStream *out,
+      OutputStream *dict, const string &spill, const size_t memory,
+      const ENC &enc) throw(BaseException<void*>, TraceableException);
+  ~DistRDFDictBulkEncode() throw(DistException);
+
+  void exec() throw(DistException, BadAllocException, TraceableException);
+};
+
+}
+
+#include "par/DistRDFDictBulkEncode-inl.h"
+
+#endif /* __PAR__DISTRDFDICTBULKENCODE_H__ */
@@ -32,7 +32,8 @@ DistRDFDictDecode<N, ID, ENC>::DistRDFDictDecode(const int rank,
     : DistComputation(dist), dict(dict), gotten(false), count(0),
       nproc(nproc), rank(rank), discard_atypical(discard_atypical),
       curpos(3), writer(writer), input(in), nprocdone(0), ndonesent(0),
-      current(NULL), ndonerecv(0) {
+      current(NULL), ndonerecv(0), batches(nproc),
+      batch_size(DECODE_BATCH_SIZE), nflushed(0) {
   if (writer == NULL) {
     THROW(BaseException<void*>, NULL, "RDFWriter *writer must not be NULL.");
   }
@@ -49,7 +50,8 @@ DistRDFDictDecode<N, ID, ENC>::DistRDFDictDecode(const int rank,
     : DistComputation(dist, enc), dict(dict), gotten(false), count(0),
       nproc(nproc), rank(rank), discard_atypical(discard_atypical),
       curpos(3), writer(writer), input(in), nprocdone(0), ndonesent(0),
-      current(NULL), ndonerecv(0) {
+      current(NULL), ndonerecv(0), batches(nproc),
+      batch_size(DECODE_BATCH_SIZE), nflushed(0) {
   if (writer == NULL) {
     THROW(BaseException<void*>, NULL, "RDFWriter *writer must not be NULL.");
   }
@@ -78,6 +80,72 @@ DistRDFDictionary<N, ID, ENC> *DistRDFDictDecode<N, ID, ENC>::getDictionary()
   return this->dict;
 }
 
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictDecode<N, ID, ENC>::setBatchSize(const size_t size) throw() {
+  this->batch_size = size > 0 ? size : 1;
+}
+
+template<size_t N, typename ID, typename ENC>
+int DistRDFDictDecode<N, ID, ENC>::sendBatch(const int send_to,
+    DPtr<uint8_t> *&buffer, size_t &len) THROWS(BadAllocException) {
+  vector<uint8_t> &batch = this->batches[send_to];
+  len = sizeof(int) + batch.size();
+  if (buffer->size() < len) {
+    buffer->drop();
+    try {
+      NEW(buffer, MPtr<uint8_t>, len);
+    } RETHROW_BAD_ALLOC
+  }
+  memcpy(buffer->dptr(), &this->rank, sizeof(int));
+  memcpy(buffer->dptr() + sizeof(int), &batch[0], batch.size());
+  batch.clear();
+#if DIST_RDF_DICT_DECODE_DEBUG
+  ++DEBUG_SENT;
+#endif
+  return send_to;
+}
+TRACE(BadAllocException, "(trace)")
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictDecode<N, ID, ENC>::resolve(const uint32_t n, RDFTerm &term)
+    THROWS(TraceableException) {
+  pair<typename multimap<uint32_t, pending_position>::iterator,
+       typename multimap<uint32_t, pending_position>::iterator> range =
+          this->pending_positions.equal_range(n);
+  typename multimap<uint32_t, pending_position>::iterator it;
+  for (it = range.first; it != range.second; ++it) {
+    it->second.triple->parts[it->second.pos] = term;
+    if (--it->second.triple->need <= 0) {
+      if (it->second.triple->parts[0].isLiteral() ||
+          it->second.triple->parts[1].getType() != IRI) {
+        if (this->discard_atypical) {
+          this->pending_triples.erase(it->second.triple);
+          continue;
+        }
+      }
+      try {
+        RDFTriple trip(it->second.triple->parts[0],
+                       it->second.triple->parts[1],
+                       it->second.triple->parts[2]);
+        this->pending_triples.erase(it->second.triple);
+#if DIST_RDF_DICT_DECODE_DEBUG
+        ++DEBUG_WRIT;
+#endif
+        this->writer->write(trip);
+      } JUST_RETHROW(TraceableException, "(rethrow)")
+
+    }
+  }
+  this->pending_positions.erase(range.first, range.second);
+  typename I2TermMap::iterator i2t = this->pending_i2term.find(n);
+#if CACHE_LOOKUPS
+  this->dict->force(i2t->second, term);
+#endif
+  this->pending_term2i.erase(i2t->second);
+  this->pending_i2term.erase(i2t);
+}
+TRACE(TraceableException, "(trace)")
+
 template<size_t N, typename ID, typename ENC>
 void DistRDFDictDecode<N, ID, ENC>::start() throw(TraceableException) {
   // do nothing
@@ -87,9 +155,8 @@ template<size_t N, typename ID, typename ENC>
 int DistRDFDictDecode<N, ID, ENC>::pickup(DPtr<uint8_t> *&buffer, size_t &len)
     THROWS(BadAllocException, TraceableException) {
   if (!this->pending_responses.empty()) {
-    const pending_response resp = this->pending_responses.front();
-    DPtr<uint8_t> *p = resp.term.toUTF8String();
-    len = p->size() + sizeof(uint32_t) + sizeof(int);
+    const pending_response &resp = this->pending_responses.front();
+    len = sizeof(int) + resp.reply.size();
     if (buffer->size() < len) {
       buffer->drop();
       try {
@@ -98,24 +165,20 @@ int DistRDFDictDecode<N, ID, ENC>::pickup(DPtr<uint8_t> *&buffer, size_t &len)
     }
 
 #if DIST_RDF_DICT_DECODE_DEBUG
-    _debugss << "send_to=" << resp.send_to << " n=" << resp.n << " astr=" << resp.term << " 4. RESPONDING " << this->rank << endl;
+    _debugss << "send_to=" << resp.send_to << " bytes=" << resp.reply.size() << " 4. RESPONDING " << this->rank << endl;
     cerr << _debugss.str();
     _debugss.str(string(""));
 #endif
 
-    uint8_t *write_to = buffer->dptr();
     int neg = -(this->rank) - 1;
-    memcpy(write_to, &neg, sizeof(int));
-    write_to += sizeof(int);
-    memcpy(write_to, &resp.n, sizeof(uint32_t));
-    write_to += sizeof(uint32_t);
-    memcpy(write_to, p->dptr(), p->size());
-    p->drop();
+    memcpy(buffer->dptr(), &neg, sizeof(int));
+    memcpy(buffer->dptr() + sizeof(int), &resp.reply[0], resp.reply.size());
+    int send_to = resp.send_to;
     this->pending_responses.pop_front();
 #if DIST_RDF_DICT_DECODE_DEBUG
     ++DEBUG_SENT;
 #endif
-    return resp.send_to;
+    return send_to;
   }
   if (this->curpos > 2) {
     if (this->current != NULL) {
@@ -123,6 +186,14 @@ int DistRDFDictDecode<N, ID, ENC>::pickup(DPtr<uint8_t> *&buffer, size_t &len)
     }
     this->current = this->input->read(3*N*sizeof(uint8_t));
     if (this->current == NULL) {
+      // send whatever lookups are left before saying we are done
+      while (this->nflushed < this->nproc &&
+             this->batches[this->nflushed].empty()) {
+        ++this->nflushed;
+      }
+      if (this->nflushed < this->nproc) {
+        return this->sendBatch(this->nflushed++, buffer, len);
+      }
       if (this->ndonesent < this->nproc) {
         len = 1;
 #if DIST_RDF_DICT_DECODE_DEBUG
@@ -195,13 +266,6 @@ int DistRDFDictDecode<N, ID, ENC>::pickup(DPtr<uint8_t> *&buffer, size_t &len)
     reverse_bytes(top);
   }
   int send_to = (int) top;
-  len = ID::size() + sizeof(uint32_t) + sizeof(int);
-  if (buffer->size() < len) {
-    buffer->drop();
-    try {
-      NEW(buffer, MPtr<uint8_t>, len);
-    } RETHROW_BAD_ALLOC
-  }
 
 #if DIST_RDF_DICT_DECODE_DEBUG
   _debugss << "send_to=" << send_to << " n=" << this->count << " id=" << hex;
@@ -224,18 +288,17 @@ int DistRDFDictDecode<N, ID, ENC>::pickup(DPtr<uint8_t> *&buffer, size_t &len)
 
   this->pending_term2i.insert(pair<ID, uint32_t>(id, this->count));
   this->pending_i2term.insert(pair<uint32_t, ID>(this->count, id));
-  uint8_t *write_to = buffer->dptr();
-  memcpy(write_to, &this->rank, sizeof(int));
-  write_to += sizeof(int);
-  memcpy(write_to, &this->count, sizeof(uint32_t));
+  vector<uint8_t> &batch = this->batches[send_to];
+  size_t off = batch.size();
+  batch.resize(off + sizeof(uint32_t) + ID::size());
+  memcpy(&batch[off], &this->count, sizeof(uint32_t));
+  memcpy(&batch[off] + sizeof(uint32_t), id.ptr(), ID::size());
   ++this->count;
-  write_to += sizeof(uint32_t);
-  memcpy(write_to, id.ptr(), ID::size());
   ++this->curpos;
-#if DIST_RDF_DICT_DECODE_DEBUG
-  ++DEBUG_SENT;
-#endif
-  return send_to;
+  if (batch.size() >= this->batch_size*(sizeof(uint32_t) + ID::size())) {
+    return this->sendBatch(send_to, buffer, len);
+  }
+  return -1;
 }
 TRACE(TraceableException, "(trace)")
 
@@ -249,87 +312,70 @@ void DistRDFDictDecode<N, ID, ENC>::dropoff(DPtr<uint8_t> *msg)
     ++this->nprocdone;
     return;
   }
-  pending_response resp;
-  const uint8_t *read_from = msg->dptr();
-  memcpy(&resp.send_to, read_from, sizeof(int));
-  read_from += sizeof(int);
-  memcpy(&resp.n, read_from, sizeof(uint32_t));
-  // non-negative "send_to" means this is a lookup request
-  if (resp.send_to >= 0) {
-    read_from += sizeof(uint32_t);
-    ID id;
-    memcpy(id.ptr(), read_from, ID::size());
-
-#if DIST_RDF_DICT_DECODE_DEBUG
-    _debugss << "send_to=" << resp.send_to << " n=" << resp.n << " id=" << hex;
-    _debugss << setfill('0');
-    const uint8_t *b = id.ptr();
-    const uint8_t *e = b + ID::size();
-    for (; b != e; ++b) {
-      _debugss << setw(2) << (const int)*b << ":";
-    }
-    _debugss << dec << " 2. RECEIVED LOOKUP REQUEST " << this->rank << endl;
-    cerr << _debugss.str();
-    _debugss.str(string(""));
-#endif
-
-    resp.term = this->dict->decode(id);
+  int from;
+  memcpy(&from, msg->dptr(), sizeof(int));
+  const uint8_t *read_from = msg->dptr() + sizeof(int);
+  const uint8_t *end = msg->dptr() + msg->size();
+  // non-negative "from" means this is a batch of lookup requests
+  if (from >= 0) {
+    pending_response resp;
+    resp.send_to = from;
     this->pending_responses.push_back(resp);
+    vector<uint8_t> &reply = this->pending_responses.back().reply;
+    while (read_from != end) {
+      uint32_t n;
+      memcpy(&n, read_from, sizeof(uint32_t));
+      read_from += sizeof(uint32_t);
+      ID id;
+      memcpy(id.ptr(), read_from, ID::size());
+      read_from += ID::size();
 
 #if DIST_RDF_DICT_DECODE_DEBUG
-    _debugss << "send_to=" << resp.send_to << " n=" << resp.n << " astr=" << resp.term << " 3. PENDING RESPONSE " << this->rank << endl;
-    cerr << _debugss.str();
-    _debugss.str(string(""));
+      _debugss << "send_to=" << from << " n=" << n << " id=" << hex;
+      _debugss << setfill('0');
+      const uint8_t *b = id.ptr();
+      const uint8_t *e = b + ID::size();
+      for (; b != e; ++b) {
+        _debugss << setw(2) << (const int)*b << ":";
+      }
+      _debugss << dec << " 2. RECEIVED LOOKUP REQUEST " << this->rank << endl;
+      cerr << _debugss.str();
+      _debugss.str(string(""));
 #endif
 
+      DPtr<uint8_t> *p = this->dict->decode(id).toUTF8String();
+      uint32_t plen = p->size();
+      size_t off = reply.size();
+      reply.resize(off + (sizeof(uint32_t) << 1) + plen);
+      memcpy(&reply[off], &n, sizeof(uint32_t));
+      off += sizeof(uint32_t);
+      memcpy(&reply[off], &plen, sizeof(uint32_t));
+      off += sizeof(uint32_t);
+      memcpy(&reply[off], p->dptr(), plen);
+      p->drop();
+    }
     return;
   }
-  // otherwise, negative "send_to" means it is a response
-  DPtr<uint8_t> *termstr = msg->sub(sizeof(int) + sizeof(uint32_t),
-      msg->size() - sizeof(int) - sizeof(uint32_t));
-  resp.term = RDFTerm::parse(termstr);
-  termstr->drop();
+  // otherwise, negative "from" means it is a batch of responses
+  while (read_from != end) {
+    uint32_t n, termlen;
+    memcpy(&n, read_from, sizeof(uint32_t));
+    read_from += sizeof(uint32_t);
+    memcpy(&termlen, read_from, sizeof(uint32_t));
+    read_from += sizeof(uint32_t);
+    DPtr<uint8_t> *termstr = msg->sub(read_from - msg->dptr(), termlen);
+    read_from += termlen;
+    RDFTerm term = RDFTerm::parse(termstr);
+    termstr->drop();
 
 #if DIST_RDF_DICT_DECODE_DEBUG
-  _debugss << "send_to=" << this->rank << " n=" << resp.n << " astr=" << resp.term << " 5. RECEIVED RESPONSE " << this->rank << endl;
-  cerr << _debugss.str();
-  _debugss.str(string(""));
-#endif
-
-  pair<typename multimap<uint32_t, pending_position>::iterator,
-       typename multimap<uint32_t, pending_position>::iterator> range =
-          this->pending_positions.equal_range(resp.n);
-  typename multimap<uint32_t, pending_position>::iterator it;
-  for (it = range.first; it != range.second; ++it) {
-    it->second.triple->parts[it->second.pos] = resp.term;
-    if (--it->second.triple->need <= 0) {
-      if (it->second.triple->parts[0].isLiteral() ||
-          it->second.triple->parts[1].getType() != IRI) {
-        if (this->discard_atypical) {
-          this->pending_triples.erase(it->second.triple);
-          continue;
-        }
-      }
-      try {
-        RDFTriple trip(it->second.triple->parts[0],
-                       it->second.triple->parts[1],
-                       it->second.triple->parts[2]);
-        this->pending_triples.erase(it->second.triple);
-#if DIST_RDF_DICT_DECODE_DEBUG
-        ++DEBUG_WRIT;
+    _debugss << "send_to=" << this->rank << " n=" << n << " astr=" << term << " 5. RECEIVED RESPONSE " << this->rank << endl;
+    cerr << _debugss.str();
+    _debugss.str(string(""));
 #endif
-        this->writer->write(trip);
-      } JUST_RETHROW(TraceableException, "(rethrow)")
 
-    }
+    this->resolve(n, term);
   }
-  this->pending_positions.erase(range.first, range.second);
-  typename I2TermMap::iterator i2t = this->pending_i2term.find(resp.n);
-#if CACHE_LOOKUPS
-  this->dict->force(i2t->second, resp.term);
-#endif
-  this->pending_term2i.erase(i2t->second);
-  this->pending_i2term.erase(i2t);
 }
 TRACE(TraceableException, "(trace)")
 
@@ -33,6 +33,20 @@ using namespace rdf;
 using namespace std;
 using namespace util;
 
+// Maximum number of lookups sent to one processor in a single message.
+#ifndef DECODE_BATCH_SIZE
+#define DECODE_BATCH_SIZE 256
+#endif
+
+/*
+ * Decodes triples against a dictionary distributed as by DistRDFDictEncode.
+ * Identifiers that are not in the local dictionary are looked up at the
+ * processor that assigned them.  Lookups are batched per processor: each
+ * request message carries up to DECODE_BATCH_SIZE identifiers, and each is
+ * answered by a single message carrying all the terms.  An identifier is
+ * requested only once while it is outstanding, so batches never contain
+ * duplicates.
+ */
 template<size_t N, typename ID=RDFID<N>, typename ENC=RDFEncoder<ID> >
 class DistRDFDictDecode : public DistComputation {
 private:
@@ -46,9 +60,9 @@ private:
     typename list<pending_triple>::iterator triple;
     uint8_t pos;
   };
+  // reply is a sequence of uint32_t n, uint32_t length, term
   struct pending_response {
-    RDFTerm term;
-    uint32_t n;
+    vector<uint8_t> reply;
     int send_to;
   };
   list<pending_response> pending_responses;
@@ -56,6 +70,10 @@ private:
   multimap<uint32_t, pending_position> pending_positions;
   Term2IMap pending_term2i;
   I2TermMap pending_i2term;
+  // per processor, a sequence of uint32_t n, ID not yet requested
+  vector<vector<uint8_t> > batches;
+  size_t batch_size;
+  int nflushed;
   DPtr<uint8_t> *current;
   typename list<pending_triple>::iterator curpend;
   RDFWriter *writer;
@@ -70,6 +88,10 @@ private:
   uint8_t curpos;
   bool gotten;
   bool discard_atypical;
+
+  int sendBatch(const int send_to, DPtr<uint8_t> *&buffer, size_t &len)
+      throw(BadAllocException);
+  void resolve(const uint32_t n, RDFTerm &term) throw(TraceableException);
 protected:
   virtual void start() throw(TraceableException);
   virtual int pickup(DPtr<uint8_t> *&buffer, size_t &len)
@@ -87,6 +109,7 @@ public:
       RDFDictionary<ID, ENC> *dict, const bool discard_atypical)
       throw(BaseException<void*>, BadAllocException);
   virtual ~DistRDFDictDecode() throw(DistException);
+  void setBatchSize(const size_t size) throw();
   DistRDFDictionary<N, ID, ENC> *getDictionary() throw();
 };
 
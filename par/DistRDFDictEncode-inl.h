@@ -86,8 +86,7 @@ bool DistRDFDictionary<N, ID, ENC>::nextID(ID &id) {
 
 template<size_t N, typename ID, typename ENC>
 void DistRDFDictionary<N, ID, ENC>::set(const RDFTerm &term, const ID &id) {
-  this->term2id[term] = id;
-  this->id2term[id] = term;
+  this->terms.set(term, id);
 }
 
 template<size_t N, typename ID, typename ENC>
@@ -119,7 +118,9 @@ DistRDFDictEncode<N, ID, ENC>::DistRDFDictEncode(const int rank,
     : DistComputation(dist), dict(NULL), gotten(false), count(0),
       nproc(nproc), pending_term2i(Term2IMap(RDFTerm::cmplt0)),
       curpos(3), reader(reader), output(out), nprocdone(0), ndonesent(0),
-      ndonerecv(0) {
+      ndonerecv(0), cache_index(Term2SlotMap(RDFTerm::cmplt0)),
+      cache_size(ENCODE_CACHE_SIZE), cache_hand(0),
+      preassigned(Term2IDMap(RDFTerm::cmplt0)) {
   try {
     NEW(dict, WHOLE(DistRDFDictionary<N, ID, ENC>), rank);
   } RETHROW_BAD_ALLOC
@@ -142,7 +143,9 @@ DistRDFDictEncode<N, ID, ENC>::DistRDFDictEncode(const int rank,
     : DistComputation(dist, enc), dict(NULL), gotten(false), count(0),
       nproc(nproc), pending_term2i(Term2IMap(RDFTerm::cmplt0)),
       curpos(3), reader(reader), output(out), nprocdone(0), ndonesent(0),
-      ndonerecv(0) {
+      ndonerecv(0), cache_index(Term2SlotMap(RDFTerm::cmplt0)),
+      cache_size(ENCODE_CACHE_SIZE), cache_hand(0),
+      preassigned(Term2IDMap(RDFTerm::cmplt0)) {
   try {
     NEW(dict, WHOLE(DistRDFDictionary<N, ID, ENC>), rank);
   } RETHROW_BAD_ALLOC
@@ -174,6 +177,97 @@ DistRDFDictionary<N, ID, ENC> *DistRDFDictEncode<N, ID, ENC>::getDictionary()
   return this->dict;
 }
 
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictEncode<N, ID, ENC>::setCacheSize(const size_t n) throw() {
+  this->cache_size = n;
+  if (this->cache.size() > n) {
+    typename vector<cache_slot>::iterator it = this->cache.begin() + n;
+    for (; it != this->cache.end(); ++it) {
+      this->cache_index.erase(it->term);
+    }
+    this->cache.resize(n);
+    this->cache_hand = 0;
+  }
+}
+
+template<size_t N, typename ID, typename ENC>
+ID DistRDFDictEncode<N, ID, ENC>::preassign(const RDFTerm &term) {
+  try {
+    return this->dict->locallyEncode(term);
+  } JUST_RETHROW(TraceableException, "Couldn't preassign identifier.")
+}
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictEncode<N, ID, ENC>::preassign(const RDFTerm &term,
+    const ID &id) {
+  this->preassigned[term] = id;
+}
+
+template<size_t N, typename ID, typename ENC>
+bool DistRDFDictEncode<N, ID, ENC>::recall(const RDFTerm &term, ID &id) {
+  typename Term2SlotMap::const_iterator it = this->cache_index.find(term);
+  if (it == this->cache_index.end()) {
+    return false;
+  }
+  cache_slot &slot = this->cache[it->second];
+  slot.referenced = true;
+  id = slot.id;
+  return true;
+}
+
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictEncode<N, ID, ENC>::remember(const RDFTerm &term,
+    const ID &id) {
+  if (this->cache_size == 0) {
+    return;
+  }
+  cache_slot slot;
+  slot.term = term;
+  slot.id = id;
+  slot.referenced = false;
+  if (this->cache.size() < this->cache_size) {
+    this->cache_index.insert(
+        pair<RDFTerm, size_t>(term, this->cache.size()));
+    this->cache.push_back(slot);
+    return;
+  }
+  while (this->cache[this->cache_hand].referenced) {
+    this->cache[this->cache_hand].referenced = false;
+    this->cache_hand = (this->cache_hand + 1) % this->cache_size;
+  }
+  this->cache_index.erase(this->cache[this->cache_hand].term);
+  this->cache_index.insert(pair<RDFTerm, size_t>(term, this->cache_hand));
+  this->cache[this->cache_hand] = slot;
+  this->cache_hand = (this->cache_hand + 1) % this->cache_size;
+}
+
+// Fills in one part of a pending triple and writes the triple out once
+// all three parts are known.
+template<size_t N, typename ID, typename ENC>
+void DistRDFDictEncode<N, ID, ENC>::resolve(
+    typename list<pending_triple>::iterator triple, const uint8_t pos,
+    const ID &id) {
+  triple->parts[pos] = id;
+  if (--triple->need > 0) {
+    return;
+  }
+  pending_triple pend = *triple;
+  this->pending_triples.erase(triple);
+  if (!this->outbuf->alone()) {
+    this->outbuf = this->outbuf->stand();
+  }
+  uint8_t *write_to = this->outbuf->dptr();
+  memcpy(write_to, pend.parts[0].ptr(), N*sizeof(uint8_t));
+  write_to += N*sizeof(uint8_t);
+  memcpy(write_to, pend.parts[1].ptr(), N*sizeof(uint8_t));
+  write_to += N*sizeof(uint8_t);
+  memcpy(write_to, pend.parts[2].ptr(), N*sizeof(uint8_t));
+#if DIST_RDF_DICT_ENCODE_DEBUG
+  ++DEBUG_WRIT;
+#endif
+  this->output->write(this->outbuf);
+}
+
 template<size_t N, typename ID, typename ENC>
 void DistRDFDictEncode<N, ID, ENC>::start() throw(TraceableException) {
   // do nothing
@@ -271,26 +365,14 @@ int DistRDFDictEncode<N, ID, ENC>::pickup(DPtr<uint8_t> *&buffer, size_t &len)
     return -1;
   }
   ID id;
-  if (this->dict->lookup(term, id)) {
-    this->curpend->parts[this->curpos] = id;
-    --this->curpend->need;
-    if (this->curpend->need <= 0) {
-      pending_triple pend = *this->curpend;
-      this->pending_triples.erase(this->curpend);
-      if (!this->outbuf->alone()) {
-        this->outbuf = this->outbuf->stand();
-      }
-      uint8_t *write_to = this->outbuf->dptr();
-      memcpy(write_to, pend.parts[0].ptr(), N*sizeof(uint8_t));
-      write_to += N*sizeof(uint8_t);
-      memcpy(write_to, pend.parts[1].ptr(), N*sizeof(uint8_t));
-      write_to += N*sizeof(uint8_t);
-      memcpy(write_to, pend.parts[2].ptr(), N*sizeof(uint8_t));
-#if DIST_RDF_DICT_ENCODE_DEBUG
-      ++DEBUG_WRIT;
-#endif
-      this->output->write(this->outbuf);
-    }
+  typename Term2IDMap::const_iterator pre = this->preassigned.find(term);
+  if (pre != this->preassigned.end()) {
+    this->resolve(this->curpend, this->curpos, pre->second);
+    ++this->curpos;
+    return -1;
+  }
+  if (this->dict->lookup(term, id) || this->recall(term, id)) {
+    this->resolve(this->curpend, this->curpos, id);
     ++this->curpos;
     return -1;
   }
@@ -402,29 +484,14 @@ void DistRDFDictEncode<N, ID, ENC>::dropoff(DPtr<uint8_t> *msg)
           this->pending_positions.equal_range(resp.n);
   typename multimap<uint32_t, pending_position>::iterator it;
   for (it = range.first; it != range.second; ++it) {
-    it->second.triple->parts[it->second.pos] = resp.id;
-    if (--it->second.triple->need <= 0) {
-      pending_triple pend_trip = *(it->second.triple);
-      this->pending_triples.erase(it->second.triple);
-      if (!this->outbuf->alone()) {
-        this->outbuf = this->outbuf->stand();
-      }
-      uint8_t *write_to = this->outbuf->dptr();
-      memcpy(write_to, pend_trip.parts[0].ptr(), N);
-      write_to += N;
-      memcpy(write_to, pend_trip.parts[1].ptr(), N);
-      write_to += N;
-      memcpy(write_to, pend_trip.parts[2].ptr(), N);
-#if DIST_RDF_DICT_ENCODE_DEBUG
-      ++DEBUG_WRIT;
-#endif
-      this->output->write(this->outbuf);
-    }
+    this->resolve(it->second.triple, it->second.pos, resp.id);
   }
   this->pending_positions.erase(range.first, range.second);
   I2TermMap::iterator i2t = this->pending_i2term.find(resp.n);
 #if CACHE_LOOKUPS
   this->dict->set(i2t->second, resp.id);
+#else
+  this->remember(i2t->second, resp.id);
 #endif
   this->pending_term2i.erase(i2t->second);
   this->pending_i2term.erase(i2t);
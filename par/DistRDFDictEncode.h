@@ -29,6 +29,11 @@
 #define CACHE_LOOKUPS 0
 #endif
 
+// Default number of remotely owned terms that DistRDFDictEncode remembers.
+#ifndef ENCODE_CACHE_SIZE
+#define ENCODE_CACHE_SIZE 65536
+#endif
+
 namespace par {
 
 using namespace io;
@@ -65,6 +70,12 @@ private:
   typedef map<RDFTerm, uint32_t,
               bool(*)(const RDFTerm&, const RDFTerm&)>
           Term2IMap;
+  typedef map<RDFTerm, size_t,
+              bool(*)(const RDFTerm&, const RDFTerm&)>
+          Term2SlotMap;
+  typedef map<RDFTerm, ID,
+              bool(*)(const RDFTerm&, const RDFTerm&)>
+          Term2IDMap;
   struct pending_triple {
     ID parts[3];
     uint8_t need;
@@ -78,6 +89,19 @@ private:
     uint32_t n;
     int send_to;
   };
+  // Recently resolved terms owned by other processors, evicted by the
+  // CLOCK (second chance) policy once cache_size of them are held.
+  struct cache_slot {
+    RDFTerm term;
+    ID id;
+    bool referenced;
+  };
+  // Terms preassigned identifiers by another processor.
+  Term2IDMap preassigned;
+  vector<cache_slot> cache;
+  Term2SlotMap cache_index;
+  size_t cache_size;
+  size_t cache_hand;
   list<pending_response> pending_responses;
   list<pending_triple> pending_triples;
   multimap<uint32_t, pending_position> pending_positions;
@@ -96,6 +120,11 @@ private:
   uint32_t count;
   uint8_t curpos;
   bool gotten;
+
+  bool recall(const RDFTerm &term, ID &id);
+  void remember(const RDFTerm &term, const ID &id);
+  void resolve(typename list<pending_triple>::iterator triple,
+               const uint8_t pos, const ID &id);
 protected:
   virtual void start() throw(TraceableException);
   virtual int pickup(DPtr<uint8_t> *&buffer, size_t &len)
@@ -112,6 +141,18 @@ public:
       throw(BaseException<void*>, BadAllocException);
   virtual ~DistRDFDictEncode() throw(DistException);
   DistRDFDictionary<N, ID, ENC> *getDictionary() throw();
+
+  // Number of remotely owned terms to remember (zero disables caching).
+  void setCacheSize(const size_t n) throw();
+
+  // Before exec, terms known to be frequent can be given the same
+  // identifier on every processor so that they are never looked up.
+  // One processor allocates the identifier with the first form and
+  // passes it to the others, which record it with the second.  Only the
+  // processor that allocated an identifier keeps it in its dictionary,
+  // so each preassigned term is written out once.
+  ID preassign(const RDFTerm &term);
+  void preassign(const RDFTerm &term, const ID &id);
 };
 
 }
@@ -0,0 +1,217 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#include "par/MPIAlltoallDistributor.h"
+
+#include <algorithm>
+#include <climits>
+#include "ptr/MPtr.h"
+
+namespace par {
+
+MPIAlltoallDistributor::MPIAlltoallDistributor(MPI::Intracomm &comm,
+                                               const size_t max_chunk)
+    throw(BadAllocException)
+    : Distributor(), comm(comm), max_chunk(max_chunk), recv_rank(0),
+      recv_offset(0), no_more_sends(false) {
+  if (this->max_chunk > (size_t) INT_MAX) {
+    this->max_chunk = (size_t) INT_MAX;
+  }
+}
+
+MPIAlltoallDistributor::~MPIAlltoallDistributor() throw(DistException) {
+  vector<DPtr<uint8_t>*>::iterator it = this->recv_bufs.begin();
+  for (; it != this->recv_bufs.end(); ++it) {
+    if (*it != NULL) {
+      (*it)->drop();
+    }
+  }
+}
+
+void MPIAlltoallDistributor::init() throw(DistException, BadAllocException) {
+  int nproc = this->comm.Get_size();
+  try {
+    this->send_bufs.clear();
+    this->send_bufs.resize(nproc);
+    this->recv_bufs.resize(nproc, NULL);
+  } catch (bad_alloc &e) {
+    THROW(BadAllocException, nproc*sizeof(vector<uint8_t>));
+  }
+  this->recv_rank = 0;
+  this->recv_offset = 0;
+  this->no_more_sends = false;
+}
+
+bool MPIAlltoallDistributor::send(const int rank, DPtr<uint8_t> *msg)
+    throw(DistException) {
+  if (this->no_more_sends) {
+    THROW(DistException, "You said there were no more sends!");
+  }
+  if (msg == NULL) {
+    THROW(DistException, "Tried to send NULL message.");
+  }
+  if (!msg->sizeKnown()) {
+    THROW(DistException, "Size of message is unknown.");
+  }
+  if (msg->size() > UINT32_MAX) {
+    THROW(DistException, "Message is too long.");
+  }
+  if (rank < 0 || rank >= (int) this->send_bufs.size()) {
+    THROW(DistException, "Destination rank is out of range.");
+  }
+  vector<uint8_t> &buf = this->send_bufs[rank];
+  uint32_t len = (uint32_t) msg->size();
+  try {
+    const uint8_t *lenp = (const uint8_t *) &len;
+    buf.insert(buf.end(), lenp, lenp + sizeof(uint32_t));
+    buf.insert(buf.end(), msg->dptr(), msg->dptr() + msg->size());
+  } catch (bad_alloc &e) {
+    THROW(DistException, "Ran out of memory buffering message.");
+  }
+  return true;
+}
+
+void MPIAlltoallDistributor::exchange() throw(DistException) {
+  int nproc = this->comm.Get_size();
+  vector<uint64_t> send_totals(nproc);
+  vector<uint64_t> recv_totals(nproc);
+  int i;
+  for (i = 0; i < nproc; ++i) {
+    send_totals[i] = this->send_bufs[i].size();
+  }
+  this->comm.Alltoall(&send_totals[0], sizeof(uint64_t), MPI::BYTE,
+                      &recv_totals[0], sizeof(uint64_t), MPI::BYTE);
+  for (i = 0; i < nproc; ++i) {
+    if (recv_totals[i] == 0) {
+      continue;
+    }
+    try {
+      NEW(this->recv_bufs[i], MPtr<uint8_t>, recv_totals[i]);
+    } catch (bad_alloc &e) {
+      RETHROW_AS(DistException, e);
+    } catch (BadAllocException &e) {
+      RETHROW_AS(DistException, e);
+    }
+  }
+
+  // Each pair moves at most per_pair bytes per round, so neither side
+  // ever has more than max_chunk bytes in flight in one Alltoallv.
+  uint64_t per_pair = max((size_t) 1, this->max_chunk / nproc);
+  unsigned long rounds = 0;
+  for (i = 0; i < nproc; ++i) {
+    uint64_t most = max(send_totals[i], recv_totals[i]);
+    rounds = max(rounds, (unsigned long) ((most + per_pair - 1) / per_pair));
+  }
+  unsigned long all_rounds;
+  this->comm.Allreduce(&rounds, &all_rounds, 1, MPI::UNSIGNED_LONG, MPI::MAX);
+
+  vector<int> send_counts(nproc), send_displs(nproc);
+  vector<int> recv_counts(nproc), recv_displs(nproc);
+  vector<uint8_t> send_stage, recv_stage;
+  unsigned long r;
+  for (r = 0; r < all_rounds; ++r) {
+    uint64_t offset = r * per_pair;
+    int send_len = 0;
+    int recv_len = 0;
+    for (i = 0; i < nproc; ++i) {
+      send_counts[i] = send_totals[i] <= offset ? 0 :
+                       (int) min(per_pair, send_totals[i] - offset);
+      send_displs[i] = send_len;
+      send_len += send_counts[i];
+      recv_counts[i] = recv_totals[i] <= offset ? 0 :
+                       (int) min(per_pair, recv_totals[i] - offset);
+      recv_displs[i] = recv_len;
+      recv_len += recv_counts[i];
+    }
+    try {
+      send_stage.resize(max(send_len, 1));
+      recv_stage.resize(max(recv_len, 1));
+    } catch (bad_alloc &e) {
+      THROW(DistException, "Ran out of memory staging exchange.");
+    }
+    for (i = 0; i < nproc; ++i) {
+      if (send_counts[i] > 0) {
+        memcpy(&send_stage[send_displs[i]], &this->send_bufs[i][offset],
+               send_counts[i]);
+      }
+    }
+    this->comm.Alltoallv(&send_stage[0], &send_counts[0], &send_displs[0],
+                         MPI::BYTE, &recv_stage[0], &recv_counts[0],
+                         &recv_displs[0], MPI::BYTE);
+    for (i = 0; i < nproc; ++i) {
+      if (recv_counts[i] > 0) {
+        memcpy(this->recv_bufs[i]->dptr() + offset,
+               &recv_stage[recv_displs[i]], recv_counts[i]);
+      }
+    }
+  }
+  for (i = 0; i < nproc; ++i) {
+    vector<uint8_t>().swap(this->send_bufs[i]);
+  }
+}
+
+bool MPIAlltoallDistributor::drained() throw() {
+  int nproc = (int) this->recv_bufs.size();
+  while (this->recv_rank < nproc &&
+         (this->recv_bufs[this->recv_rank] == NULL ||
+          this->recv_offset >= this->recv_bufs[this->recv_rank]->size())) {
+    if (this->recv_bufs[this->recv_rank] != NULL) {
+      this->recv_bufs[this->recv_rank]->drop();
+      this->recv_bufs[this->recv_rank] = NULL;
+    }
+    ++this->recv_rank;
+    this->recv_offset = 0;
+  }
+  return this->recv_rank >= nproc;
+}
+
+DPtr<uint8_t> *MPIAlltoallDistributor::receive() throw(DistException) {
+  if (!this->no_more_sends) {
+    return NULL;
+  }
+  if (this->drained()) {
+    return NULL;
+  }
+  DPtr<uint8_t> *buf = this->recv_bufs[this->recv_rank];
+  uint32_t len;
+  if (this->recv_offset + sizeof(uint32_t) > buf->size()) {
+    THROW(DistException, "Received a truncated message.");
+  }
+  memcpy(&len, buf->dptr() + this->recv_offset, sizeof(uint32_t));
+  this->recv_offset += sizeof(uint32_t);
+  if (len > buf->size() - this->recv_offset) {
+    THROW(DistException, "Received a truncated message.");
+  }
+  DPtr<uint8_t> *msg = buf->sub(this->recv_offset, len);
+  this->recv_offset += len;
+  return msg;
+}
+
+void MPIAlltoallDistributor::noMoreSends() throw(DistException) {
+  if (this->no_more_sends) {
+    THROW(DistException, "You already said no more sends!");
+  }
+  this->exchange();
+  this->no_more_sends = true;
+}
+
+bool MPIAlltoallDistributor::done() throw(DistException) {
+  if (!this->no_more_sends) {
+    return false;
+  }
+  return this->drained();
+}
+
+}
@@ -0,0 +1,64 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#ifndef __PAR__MPIALLTOALLDISTRIBUTOR_H__
+#define __PAR__MPIALLTOALLDISTRIBUTOR_H__
+
+#include <mpi.h>
+#include <vector>
+#include "par/Distributor.h"
+#include "sys/ints.h"
+
+namespace par {
+
+using namespace std;
+
+/*
+ * Distributor for computations that know all of their outgoing data
+ * before they need any incoming data (shuffles, hash partitioning,
+ * duplicate elimination).  send() only appends the message to a local
+ * buffer for the destination rank.  noMoreSends() is collective: it
+ * exchanges per-destination byte counts and moves all buffers with
+ * MPI_Alltoallv, in rounds of at most max_chunk bytes per rank so that
+ * counts and displacements fit in an int.  After that, receive() hands
+ * out the messages one by one and done() is true once all of them
+ * have been received.
+ */
+class MPIAlltoallDistributor : public Distributor {
+private:
+  MPI::Intracomm &comm;
+  vector<vector<uint8_t> > send_bufs;
+  vector<DPtr<uint8_t>*> recv_bufs;
+  size_t max_chunk;
+  int recv_rank;
+  size_t recv_offset;
+  bool no_more_sends;
+  void exchange() throw(DistException);
+  bool drained() throw();
+public:
+  MPIAlltoallDistributor(MPI::Intracomm &comm, const size_t max_chunk)
+      throw(BadAllocException);
+  virtual ~MPIAlltoallDistributor() throw(DistException);
+
+  virtual void init() throw(DistException, BadAllocException);
+  virtual bool send(const int rank, DPtr<uint8_t> *msg) throw(DistException);
+  virtual DPtr<uint8_t> *receive() throw(DistException);
+  virtual void noMoreSends() throw(DistException);
+  virtual bool done() throw(DistException);
+};
+
+}
+
+#endif /* __PAR__MPIALLTOALLDISTRIBUTOR_H__ */
@@ -30,8 +30,8 @@ MPIPacketDistributor::MPIPacketDistributor(MPI::Intracomm &comm,
       last_send_checked(num_requests - 1), last_recv_checked(num_requests - 1),
       packet_size(packet_size), num_requests(num_requests),
       no_more_sends(false), send_requests(NULL), recv_requests(NULL),
-      send_buffers(NULL), recv_buffers(NULL), tag(tag),
-      check_every(check_every), check_count(0), declared_done(false) {
+      send_buffers(NULL), recv_buffers(NULL), tag(tag), declared_done(false),
+      count_request(MPI_REQUEST_NULL), count_local(0), count_global(0) {
   try {
     NEW_ARRAY(this->send_requests, MPI::Request, num_requests);
     NEW_ARRAY(this->recv_requests, MPI::Request, num_requests);
@@ -211,17 +211,27 @@ void MPIPacketDistributor::noMoreSends() throw(DistException) {
   --this->net_send_recv;
 }
 
+// Once every processor has said no more sends, the sum of sends less
+// receives only goes down, so the first sum that reaches zero means that
+// every message has been received.  The sums are computed with
+// MPI_Iallreduce so that processors keep receiving while they wait, and
+// a new one starts as soon as the previous one comes back non-zero.
 bool MPIPacketDistributor::done() throw(DistException) {
   if (this->declared_done) {
     return true;
   }
-  if (++this->check_count < this->check_every) {
+  if (!this->no_more_sends) {
     return false;
   }
-  this->check_count = 0;
-  int net;
-  this->comm.Allreduce(&this->net_send_recv, &net, 1, MPI::INT, MPI::SUM);
-  if (net != 0) {
+  if (this->count_request == MPI_REQUEST_NULL) {
+    this->count_local = this->net_send_recv;
+    MPI_Iallreduce(&this->count_local, &this->count_global, 1, MPI_INT,
+                   MPI_SUM, (MPI_Comm) this->comm, &this->count_request);
+    return false;
+  }
+  int finished;
+  MPI_Test(&this->count_request, &finished, MPI_STATUS_IGNORE);
+  if (!finished || this->count_global != 0) {
     return false;
   }
   this->declared_done = true;
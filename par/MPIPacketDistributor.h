@@ -37,12 +37,16 @@ private:
   size_t last_recv_checked;
   const size_t packet_size;
   const size_t num_requests;
-  const size_t check_every;
-  size_t check_count;
   int tag;
   bool no_more_sends;
   bool declared_done;
+  MPI_Request count_request;
+  int count_local;
+  int count_global;
 public:
+  // Termination is detected by repeated non-blocking sums of sends less
+  // receives, started once this processor has no more sends, so
+  // check_every is ignored and is accepted only for compatibility.
   MPIPacketDistributor(MPI::Intracomm &comm, const size_t packet_size,
                        const size_t num_requests, const size_t check_every,
                        int tag)
@@ -0,0 +1,128 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#ifndef __PAR__TESTS__RDF4MPI_H__
+#define __PAR__TESTS__RDF4MPI_H__
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "io/InputStream.h"
+#include "io/OutputStream.h"
+#include "par/Distributor.h"
+#include "par/MPIDelimFileInputStream.h"
+#include "par/MPIPacketDistributor.h"
+#include "par/StringDistributor.h"
+#include "par/__tests__/unit4mpi.h"
+#include "ptr/MPtr.h"
+#include "rdf/NTriplesReader.h"
+#include "rdf/RDFReader.h"
+#include "sys/char.h"
+
+// Helpers shared by the tests of distributed dictionary encoding and
+// decoding.  Tests may override the following before including this.
+
+#ifndef COORDEVERY
+#define COORDEVERY 100000
+#endif
+
+#ifndef NUMREQUESTS
+#define NUMREQUESTS 4
+#endif
+
+#ifndef PACKETBYTES
+#define PACKETBYTES 128
+#endif
+
+#ifndef PAGEBYTES
+#define PAGEBYTES 1
+#endif
+
+using namespace io;
+using namespace par;
+using namespace ptr;
+using namespace rdf;
+using namespace std;
+using namespace sys;
+
+// Keeps everything written to it in a vector.
+class Collector : public OutputStream {
+private:
+  vector<uint8_t> *bytes;
+public:
+  Collector(vector<uint8_t> &v) : bytes(&v) {}
+  ~Collector() throw(IOException) {}
+  void close() throw(IOException) {}
+  void flush() throw(IOException) {}
+  void write(DPtr<uint8_t> *buf, size_t &nwritten)
+      throw(IOException, SizeUnknownException, BaseException<void*>) {
+    this->bytes->insert(this->bytes->end(), buf->dptr(),
+                        buf->dptr() + buf->size());
+    nwritten = buf->size();
+  }
+};
+
+// Reads back what a Collector wrote, a few bytes at a time.
+class Source : public InputStream {
+private:
+  const vector<uint8_t> *bytes;
+  size_t offset;
+public:
+  Source(const vector<uint8_t> &v) : bytes(&v), offset(0) {}
+  ~Source() throw(IOException) {}
+  void close() throw(IOException) {}
+  DPtr<uint8_t> *read(const int64_t amount)
+      throw(IOException, BadAllocException) {
+    if (this->offset >= this->bytes->size()) {
+      return NULL;
+    }
+    size_t n = min((size_t) min(amount, (int64_t) 7),
+                   this->bytes->size() - this->offset);
+    DPtr<uint8_t> *p;
+    NEW(p, MPtr<uint8_t>, n);
+    memcpy(p->dptr(), &(*this->bytes)[this->offset], n);
+    this->offset += n;
+    return p;
+  }
+};
+
+// Reads this processor's part of an N-Triples file.
+RDFReader *reader(const char *filename) {
+  InputStream *is;
+  NEW(is, MPIDelimFileInputStream, MPI::COMM_WORLD, filename,
+      MPI::MODE_RDONLY, MPI::INFO_NULL, PAGEBYTES, to_ascii('\n'));
+  RDFReader *rr;
+  NEW(rr, NTriplesReader, is);
+  return rr;
+}
+
+Distributor *distributor(const int tag) {
+  Distributor *dist;
+  NEW(dist, MPIPacketDistributor, MPI::COMM_WORLD, PACKETBYTES,
+      NUMREQUESTS, COORDEVERY, tag);
+  NEW(dist, StringDistributor, COMMRANK, PACKETBYTES, dist);
+  return dist;
+}
+
+// Prefix for this processor's spill files.
+string spill(const char *name) {
+  stringstream ss (stringstream::in | stringstream::out);
+  ss << name << "-" << COMMRANK;
+  return ss.str();
+}
+
+#endif /* __PAR__TESTS__RDF4MPI_H__ */
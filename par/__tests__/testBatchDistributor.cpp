@@ -0,0 +1,110 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+
+#include "par/__tests__/unit4mpi.h"
+#include "par/BatchDistributor.h"
+#include "par/MPIPacketDistributor.h"
+
+#include <cstdlib>
+#include "ptr/MPtr.h"
+
+using namespace par;
+using namespace ptr;
+using namespace std;
+
+bool test1(size_t batch_size, size_t idle_limit) {
+  int commsize = MPI::COMM_WORLD.Get_size();
+  int rank = MPI::COMM_WORLD.Get_rank();
+  int max_packets = 100000;
+
+  Distributor *packets;
+  NEW(packets, MPIPacketDistributor, MPI::COMM_WORLD, batch_size,
+      commsize, 100, 0);
+  BatchDistributor dist(commsize, batch_size, idle_limit, packets);
+  srand(rank);
+  int num_packets = rand() % max_packets;
+  DPtr<uint8_t> *packet;
+  NEW(packet, MPtr<uint8_t>, 3*sizeof(int));
+  dist.init();
+  // Messages vary in length (one to three ints) and each int is its own
+  // checksum contribution, so lost, duplicated or garbled messages show.
+  int num_received = 0;
+  int sum_sent = 0;
+  int sum_received = 0;
+  int i = 0;
+  for (; i < num_packets; ++i) {
+    int send_to = rand() % commsize;
+    int nints = 1 + rand() % 3;
+    int j;
+    for (j = 0; j < nints; ++j) {
+      int msg = rand() % 1000;
+      sum_sent += msg;
+      memcpy(packet->dptr() + j*sizeof(int), &msg, sizeof(int));
+    }
+    DPtr<uint8_t> *msg = packet->sub(0, nints*sizeof(int));
+    do {
+      DPtr<uint8_t> *recv_packet = dist.receive();
+      if (recv_packet != NULL) {
+        ++num_received;
+        const uint8_t *p = recv_packet->dptr();
+        const uint8_t *end = p + recv_packet->size();
+        for (; p != end; p += sizeof(int)) {
+          int val;
+          memcpy(&val, p, sizeof(int));
+          sum_received += val;
+        }
+        recv_packet->drop();
+      }
+    } while(!dist.done() && !dist.send(send_to, msg));
+    msg->drop();
+  }
+  packet->drop();
+  dist.noMoreSends();
+  do {
+    DPtr<uint8_t> *recv_packet = dist.receive();
+    if (recv_packet != NULL) {
+      ++num_received;
+      const uint8_t *p = recv_packet->dptr();
+      const uint8_t *end = p + recv_packet->size();
+      for (; p != end; p += sizeof(int)) {
+        int val;
+        memcpy(&val, p, sizeof(int));
+        sum_received += val;
+      }
+      recv_packet->drop();
+    }
+  } while (!dist.done());
+  int total_sends = 0;
+  int total_recvs = 0;
+  int total_sum_sent = 0;
+  int total_sum_received = 0;
+  MPI::COMM_WORLD.Allreduce(&num_packets, &total_sends, 1, MPI::INT, MPI::SUM);
+  MPI::COMM_WORLD.Allreduce(&num_received, &total_recvs, 1, MPI::INT, MPI::SUM);
+  MPI::COMM_WORLD.Allreduce(&sum_sent, &total_sum_sent, 1, MPI::INT, MPI::SUM);
+  MPI::COMM_WORLD.Allreduce(&sum_received, &total_sum_received, 1, MPI::INT,
+                            MPI::SUM);
+  PROG(total_sends == total_recvs);
+  PROG(total_sum_sent == total_sum_received);
+  PASS;
+}
+
+int main(int argc, char **argv) {
+  INIT(argc, argv);
+  TEST(test1, 20, 0);
+  TEST(test1, 4096, 10);
+  TEST(test1, 65536, 1000);
+  FINAL;
+}
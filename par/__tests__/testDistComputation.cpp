@@ -0,0 +1,139 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#include "par/__tests__/unit4mpi.h"
+#include "par/DistComputation.h"
+
+#include <cstring>
+#include "par/Distributor.h"
+#include "par/MPIPacketDistributor.h"
+#include "ptr/MPtr.h"
+
+#ifndef COORDEVERY
+#define COORDEVERY 100000
+#endif
+
+#ifndef NUMREQUESTS
+#define NUMREQUESTS 4
+#endif
+
+#ifndef PACKETBYTES
+#define PACKETBYTES 128
+#endif
+
+// more messages than the pipeline holds, so that it fills up
+#ifndef NUMMSGS
+#define NUMMSGS 5000
+#endif
+
+using namespace par;
+using namespace ptr;
+using namespace std;
+
+// Every processor sends NUMMSGS numbers round-robin to all processors,
+// one per packet, and sums the numbers it receives.
+class Exchange : public DistComputation {
+private:
+  int rank;
+  int nproc;
+  uint64_t sent;
+  bool waited;
+public:
+  uint64_t nrecvd;
+  uint64_t sum;
+  bool started;
+  bool finished;
+  bool failed;
+
+  Exchange(const int rank, const int nproc, Distributor *dist)
+      throw(BaseException<void*>)
+      : DistComputation(dist), rank(rank), nproc(nproc), sent(0),
+        waited(false), nrecvd(0), sum(0), started(false), finished(false),
+        failed(false) {
+    // do nothing
+  }
+
+  void start() throw(TraceableException) {
+    this->started = true;
+  }
+
+  int pickup(DPtr<uint8_t> *&buffer, size_t &len)
+      throw(BadAllocException, TraceableException) {
+    if (this->sent >= NUMMSGS) {
+      return -2;
+    }
+    // now and then there is nothing to pick up yet
+    if (this->sent % 7 == 3 && !this->waited) {
+      this->waited = true;
+      return -1;
+    }
+    this->waited = false;
+    uint64_t value = this->rank * NUMMSGS + this->sent;
+    len = PACKETBYTES;
+    if (buffer->size() < len) {
+      buffer->drop();
+      NEW(buffer, MPtr<uint8_t>, len);
+    }
+    memcpy(buffer->dptr(), &value, sizeof(uint64_t));
+    memset(buffer->dptr() + sizeof(uint64_t), 0xFF, len - sizeof(uint64_t));
+    return this->sent++ % this->nproc;
+  }
+
+  void dropoff(DPtr<uint8_t> *msg) throw(TraceableException) {
+    uint64_t value;
+    memcpy(&value, msg->dptr(), sizeof(uint64_t));
+    this->sum += value;
+    ++this->nrecvd;
+  }
+
+  void finish() throw(TraceableException) {
+    this->finished = true;
+  }
+
+  void fail() throw() {
+    this->failed = true;
+  }
+};
+
+bool test(const bool pipelined) {
+  try {
+    Distributor *dist;
+    NEW(dist, MPIPacketDistributor, MPI::COMM_WORLD, PACKETBYTES,
+        NUMREQUESTS, COORDEVERY, pipelined ? 8 : 7);
+    Exchange *exchange;
+    NEW(exchange, Exchange, COMMRANK, COMMSIZE, dist);
+    exchange->exec(pipelined);
+    PROG(exchange->started && exchange->finished && !exchange->failed);
+
+    unsigned long local[2] = { exchange->nrecvd, exchange->sum };
+    unsigned long total[2];
+    MPI::COMM_WORLD.Allreduce(local, total, 2, MPI::UNSIGNED_LONG, MPI::SUM);
+    unsigned long n = COMMSIZE * NUMMSGS;
+    PROG(total[0] == n);
+    PROG(total[1] == n * (n - 1) / 2);
+    DELETE(exchange);
+  } catch(TraceableException &e) {
+    cerr << e.what() << endl;
+    FAIL;
+  }
+  PASS;
+}
+
+int main (int argc, char **argv) {
+  INIT(argc, argv);
+  TEST(test, false);
+  TEST(test, true);
+  FINAL;
+}
@@ -0,0 +1,145 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#include "par/__tests__/unit4mpi.h"
+#include "par/DistRDFDictBulkEncode.h"
+
+#include <vector>
+#include "io/OutputStream.h"
+#include "par/__tests__/rdf4mpi.h"
+#include "rdf/RDFDictEncReader.h"
+#include "rdf/RDFDictionary.h"
+#include "rdf/RDFReader.h"
+#include "rdf/RDFTriple.h"
+
+#ifndef TESTFILE
+#define TESTFILE "foaf_50.nt"
+#endif
+
+#ifndef IDBYTES
+#define IDBYTES 8
+#endif
+
+// small enough that both sorts spill several runs
+#ifndef MEMORYBYTES
+#define MEMORYBYTES 1024
+#endif
+
+using namespace io;
+using namespace par;
+using namespace rdf;
+using namespace std;
+using namespace sys;
+
+typedef RDFID<IDBYTES> ID;
+typedef RDFDictionary<ID> Dict;
+
+// Puts the dictionary entries written by every processor into dict.
+void gather(const vector<uint8_t> &entries, Dict &dict) {
+  int size = COMMSIZE;
+  int sendlen = entries.size();
+  vector<int> recvlens(size);
+  vector<int> displs(size, 0);
+  MPI::COMM_WORLD.Allgather(&sendlen, 1, MPI::INT, &recvlens[0], 1, MPI::INT);
+  int i;
+  for (i = 1; i < size; ++i) {
+    displs[i] = displs[i - 1] + recvlens[i - 1];
+  }
+  int total = displs[size - 1] + recvlens[size - 1];
+  vector<uint8_t> recvbuf(total + 1);
+  MPI::COMM_WORLD.Allgatherv(entries.empty() ? NULL : &entries[0], sendlen,
+                             MPI::BYTE, &recvbuf[0], &recvlens[0], &displs[0],
+                             MPI::BYTE);
+  const uint8_t *mark = &recvbuf[0];
+  const uint8_t *end = mark + total;
+  while (mark != end) {
+    ID id;
+    RDFTerm term;
+    mark = RDFDictEncReader<ID>::parseEntry(mark, end, id, term);
+    dict.force(id, term);
+  }
+}
+
+bool test() {
+  try {
+    vector<RDFTriple> triples;
+    RDFReader *rr = reader(TESTFILE);
+    RDFTriple triple;
+    while (rr->read(triple)) {
+      triples.push_back(triple);
+    }
+    rr->close();
+    DELETE(rr);
+
+    vector<uint8_t> encoded;
+    vector<uint8_t> entries;
+    OutputStream *out;
+    NEW(out, Collector, encoded);
+    OutputStream *dictout;
+    NEW(dictout, Collector, entries);
+    DistRDFDictBulkEncode<IDBYTES> *bulk;
+    NEW(bulk, DistRDFDictBulkEncode<IDBYTES>, COMMRANK, COMMSIZE,
+        reader(TESTFILE), distributor(7), distributor(8), out, dictout,
+        spill("testDistRDFDictBulkEncode"), MEMORYBYTES);
+    bulk->exec();
+    DELETE(bulk);
+    DELETE(dictout);
+
+    // triples come out in the order in which they were read
+    PROG(encoded.size() == triples.size()*3*IDBYTES);
+    Dict dict;
+    gather(entries, dict);
+    size_t i;
+    bool passing = true;
+    for (i = 0; passing && i < triples.size(); ++i) {
+      ID parts[3];
+      memcpy(parts[0].ptr(), &encoded[(3*i)*IDBYTES], IDBYTES);
+      memcpy(parts[1].ptr(), &encoded[(3*i + 1)*IDBYTES], IDBYTES);
+      memcpy(parts[2].ptr(), &encoded[(3*i + 2)*IDBYTES], IDBYTES);
+      RDFTriple t (dict.decode(parts[0]), dict.decode(parts[1]),
+                   dict.decode(parts[2]));
+      passing = t.equals(triples[i]);
+    }
+    PROG(passing);
+
+    // each term has exactly one identifier
+    unsigned long sz = entries.size();
+    unsigned long total;
+    MPI::COMM_WORLD.Allreduce(&sz, &total, 1, MPI::UNSIGNED_LONG, MPI::SUM);
+    unsigned long nterms = 0;
+    Dict::const_iterator it = dict.begin();
+    for (; it != dict.end(); ++it) {
+      DPtr<uint8_t> *str = it->second.toUTF8String();
+      nterms += ID::size() + sizeof(uint32_t) + str->size();
+      str->drop();
+      ID id;
+      PROG(dict.lookup(it->second, id) && id == it->first);
+    }
+    PROG(total == nterms);
+  } catch(TraceableException &e) {
+    cerr << e.what() << endl;
+    FAIL;
+  }
+  PASS;
+}
+
+int main (int argc, char **argv) {
+  INIT(argc, argv);
+  if (COMMRANK == 0) {
+    cerr << "[INFO] TESTFILE is " << TESTFILE << endl;
+  }
+  TEST(test);
+  FINAL;
+}
@@ -0,0 +1,256 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#include "par/__tests__/unit4mpi.h"
+#include "par/DistRDFDictDecode.h"
+#include "par/DistRDFDictBulkDecode.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "io/BufferedInputStream.h"
+#include "io/InputStream.h"
+#include "io/OutputStream.h"
+#include "par/DistRDFDictBulkEncode.h"
+#include "par/__tests__/rdf4mpi.h"
+#include "ptr/MPtr.h"
+#include "rdf/RDFDictEncReader.h"
+#include "rdf/RDFDictEncWriter.h"
+#include "rdf/RDFDictionary.h"
+#include "rdf/RDFReader.h"
+#include "rdf/RDFTriple.h"
+#include "rdf/RDFWriter.h"
+#include "sys/char.h"
+
+#ifndef TESTFILE
+#define TESTFILE "foaf_50.nt"
+#endif
+
+#ifndef IDBYTES
+#define IDBYTES 8
+#endif
+
+// small enough that lookups go out in several batches
+#ifndef BATCHSIZE
+#define BATCHSIZE 3
+#endif
+
+// small enough that every sort spills several runs
+#ifndef MEMORYBYTES
+#define MEMORYBYTES 1024
+#endif
+
+using namespace io;
+using namespace par;
+using namespace rdf;
+using namespace std;
+using namespace sys;
+
+typedef RDFID<IDBYTES> ID;
+typedef RDFDictionary<ID> Dict;
+
+// Encodes only the terms forced into its dictionary, as red-mpi --force
+// does.  Encoding and decoding use different SIDEs, so that decoding has
+// to learn the forced terms from the dictionary that encoding wrote.
+template<int SIDE>
+class Replicated {
+public:
+  static Dict dict;
+  bool operator()(const RDFTerm &term, ID &id) {
+    return dict.lookup(term, id);
+  }
+  bool operator()(const ID &id, RDFTerm &term) {
+    if (dict.lookup(id, term)) {
+      return true;
+    }
+    return dict.force(id, term);
+  }
+};
+
+template<int SIDE>
+Dict Replicated<SIDE>::dict = Dict();
+
+class TripleCollector : public RDFWriter {
+private:
+  vector<RDFTriple> *triples;
+public:
+  TripleCollector(vector<RDFTriple> &v) : triples(&v) {}
+  void write(const RDFTriple &triple) {
+    this->triples->push_back(triple);
+  }
+  void close() {}
+};
+
+// Reads the local partition and encodes it into encoded and entries.
+template<typename ENC>
+void encode(vector<RDFTriple> &triples, vector<uint8_t> &encoded,
+            vector<uint8_t> &entries) {
+  RDFReader *rr = reader(TESTFILE);
+  RDFTriple triple;
+  while (rr->read(triple)) {
+    triples.push_back(triple);
+  }
+  rr->close();
+  DELETE(rr);
+  OutputStream *out;
+  NEW(out, Collector, encoded);
+  OutputStream *dictout;
+  NEW(dictout, Collector, entries);
+  DistRDFDictBulkEncode<IDBYTES, ID, ENC> *bulk;
+  NEW(bulk, WHOLE(DistRDFDictBulkEncode<IDBYTES, ID, ENC>), COMMRANK,
+      COMMSIZE, reader(TESTFILE), distributor(7), distributor(8), out,
+      dictout, spill("testDistRDFDictDecode-encode"), 1 << 20);
+  bulk->exec();
+  DELETE(bulk);
+  // every dictionary gets the forced terms, as in red-mpi
+  ID bitflip(0);
+  bitflip((ID::size() << 3) - 1, true);
+  RDFDictEncWriter<ID>::writeDictionary(dictout, &Replicated<0>::dict,
+                                        bitflip);
+  DELETE(dictout);
+}
+
+bool testBatched() {
+  try {
+    vector<RDFTriple> triples;
+    vector<uint8_t> encoded;
+    vector<uint8_t> entries;
+    encode<RDFEncoder<ID> >(triples, encoded, entries);
+    InputStream *is;
+    NEW(is, Source, entries);
+    Dict *dict = RDFDictEncReader<ID>::readDictionary(is, NULL);
+    DELETE(is);
+    NEW(is, Source, encoded);
+    NEW(is, BufferedInputStream, is, 3*IDBYTES);
+    vector<RDFTriple> decoded;
+    RDFWriter *rw;
+    NEW(rw, TripleCollector, decoded);
+    DistRDFDictDecode<IDBYTES> *distcomp;
+    NEW(distcomp, DistRDFDictDecode<IDBYTES>, COMMRANK, COMMSIZE, rw,
+        distributor(9), is, dict, false);
+    distcomp->setBatchSize(BATCHSIZE);
+    distcomp->exec();
+    DELETE(distcomp);
+
+    // triples come out in whatever order their lookups finish
+    PROG(decoded.size() == triples.size());
+    sort(triples.begin(), triples.end(), RDFTriple::cmplt0);
+    sort(decoded.begin(), decoded.end(), RDFTriple::cmplt0);
+    size_t i;
+    bool passing = true;
+    for (i = 0; passing && i < triples.size(); ++i) {
+      passing = decoded[i].equals(triples[i]);
+    }
+    PROG(passing);
+  } catch(TraceableException &e) {
+    cerr << e.what() << endl;
+    FAIL;
+  }
+  PASS;
+}
+
+bool testBulk() {
+  try {
+    vector<RDFTriple> triples;
+    vector<uint8_t> encoded;
+    vector<uint8_t> entries;
+    encode<RDFEncoder<ID> >(triples, encoded, entries);
+    InputStream *in;
+    NEW(in, Source, encoded);
+    InputStream *dictin;
+    NEW(dictin, Source, entries);
+    vector<RDFTriple> decoded;
+    RDFWriter *rw;
+    NEW(rw, TripleCollector, decoded);
+    DistRDFDictBulkDecode<IDBYTES> *bulk;
+    NEW(bulk, DistRDFDictBulkDecode<IDBYTES>, COMMRANK, COMMSIZE, rw,
+        distributor(10), distributor(11), in, dictin,
+        spill("testDistRDFDictDecode-decode"), MEMORYBYTES, false);
+    bulk->exec();
+    DELETE(bulk);
+
+    // triples come out in the order in which they were read
+    PROG(decoded.size() == triples.size());
+    size_t i;
+    bool passing = true;
+    for (i = 0; passing && i < triples.size(); ++i) {
+      passing = decoded[i].equals(triples[i]);
+    }
+    PROG(passing);
+  } catch(TraceableException &e) {
+    cerr << e.what() << endl;
+    FAIL;
+  }
+  PASS;
+}
+
+bool testBulkForced() {
+  try {
+    const char *forcedstr =
+        "<http://www.w3.org/1999/02/22-rdf-syntax-ns#type>";
+    DPtr<uint8_t> *p;
+    NEW(p, MPtr<uint8_t>, strlen(forcedstr));
+    ascii_strcpy(p->dptr(), forcedstr);
+    RDFTerm forced = RDFTerm::parse(p);
+    p->drop();
+    Replicated<0>::dict.encode(forced);
+    vector<RDFTriple> triples;
+    vector<uint8_t> encoded;
+    vector<uint8_t> entries;
+    encode<Replicated<0> >(triples, encoded, entries);
+    InputStream *in;
+    NEW(in, Source, encoded);
+    InputStream *dictin;
+    NEW(dictin, Source, entries);
+    vector<RDFTriple> decoded;
+    RDFWriter *rw;
+    NEW(rw, TripleCollector, decoded);
+    DistRDFDictBulkDecode<IDBYTES, ID, Replicated<1> > *bulk;
+    NEW(bulk, WHOLE(DistRDFDictBulkDecode<IDBYTES, ID, Replicated<1> >),
+        COMMRANK, COMMSIZE, rw, distributor(10), distributor(11), in, dictin,
+        spill("testDistRDFDictDecode-forced"), MEMORYBYTES, false);
+    bulk->exec();
+    DELETE(bulk);
+
+    // the forced term was learned from the dictionary
+    ID id;
+    PROG(Replicated<1>::dict.lookup(forced, id));
+    PROG(decoded.size() == triples.size());
+    size_t i;
+    bool passing = true;
+    for (i = 0; passing && i < triples.size(); ++i) {
+      passing = decoded[i].equals(triples[i]);
+    }
+    PROG(passing);
+    Replicated<0>::dict.clear();
+    Replicated<1>::dict.clear();
+  } catch(TraceableException &e) {
+    cerr << e.what() << endl;
+    FAIL;
+  }
+  PASS;
+}
+
+int main (int argc, char **argv) {
+  INIT(argc, argv);
+  if (COMMRANK == 0) {
+    cerr << "[INFO] TESTFILE is " << TESTFILE << endl;
+  }
+  TEST(testBatched);
+  TEST(testBulk);
+  TEST(testBulkForced);
+  FINAL;
+}
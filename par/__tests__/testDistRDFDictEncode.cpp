@@ -16,19 +16,21 @@
 #include "par/__tests__/unit4mpi.h"
 #include "par/DistRDFDictEncode.h"
 
+#include <cstring>
 #include <deque>
 #include <set>
-#include "io/InputStream.h"
+#include <string>
+#include <vector>
 #include "io/OutputStream.h"
 #include "par/DistComputation.h"
-#include "par/Distributor.h"
-#include "par/MPIDelimFileInputStream.h"
-#include "par/MPIPacketDistributor.h"
-#include "par/StringDistributor.h"
-#include "rdf/NTriplesReader.h"
+#include "par/__tests__/rdf4mpi.h"
+#include "ptr/MPtr.h"
+#include "rdf/RDFDictEncReader.h"
+#include "rdf/RDFDictEncWriter.h"
 #include "rdf/RDFDictionary.h"
 #include "rdf/RDFReader.h"
 #include "rdf/RDFTriple.h"
+#include "sys/char.h"
 
 #ifdef TESTFILE
 #ifndef NUMLINES
@@ -47,26 +49,14 @@
 #define NUMLINES 50
 #endif
 
-#ifndef COORDEVERY
-#define COORDEVERY 100000
-#endif
-
-#ifndef NUMREQUESTS
-#define NUMREQUESTS 4
-#endif
-
-#ifndef PACKETBYTES
-#define PACKETBYTES 128
-#endif
-
-#ifndef PAGEBYTES
-#define PAGEBYTES 1
-#endif
-
 #ifndef IDBYTES
 #define IDBYTES 8
 #endif
 
+#ifndef CACHESIZE
+#define CACHESIZE 4
+#endif
+
 #define STORAGE set
 #define RDFSTORAGE set<RDFTriple, bool(*)(const RDFTriple &, const RDFTriple &)>
 #define DECLARE_RDFSTORAGE(s) RDFSTORAGE s(RDFTriple::cmplt0)
@@ -77,6 +67,7 @@ using namespace io;
 using namespace par;
 using namespace rdf;
 using namespace std;
+using namespace sys;
 
 typedef RDFID<IDBYTES> ID;
 typedef RDFDictionary<ID> Dict;
@@ -113,11 +104,7 @@ public:
 };
 
 void load(const char *filename, RDFSTORAGE &store) {
-  InputStream *is;
-  NEW(is, MPIDelimFileInputStream, MPI::COMM_WORLD, filename,
-      MPI::MODE_RDONLY, MPI::INFO_NULL, PAGEBYTES, to_ascii('\n'));
-  RDFReader *rr;
-  NEW(rr, NTriplesReader, is);
+  RDFReader *rr = reader(filename);
   RDFTriple triple;
   while (rr->read(triple)) {
     INSERT(store, triple);
@@ -126,68 +113,185 @@ void load(const char *filename, RDFSTORAGE &store) {
   DELETE(rr);
 }
 
-Dict *load(const char *filename, STORAGE<IDTrip> &store) {
-  InputStream *is;
-  int rank = MPI::COMM_WORLD.Get_rank();
-  int size = MPI::COMM_WORLD.Get_size();
-  NEW(is, MPIDelimFileInputStream, MPI::COMM_WORLD, filename,
-      MPI::MODE_RDONLY, MPI::INFO_NULL, PAGEBYTES, to_ascii('\n'));
-  RDFReader *rr;
-  NEW(rr, NTriplesReader, is);
-  Distributor *dist;
-  NEW(dist, MPIPacketDistributor, MPI::COMM_WORLD, PACKETBYTES,
-      NUMREQUESTS, COORDEVERY, 7);
-  NEW(dist, StringDistributor, rank, PACKETBYTES, dist);
+// Frequent terms in the test files.
+const char *HOT_TERMS[] = {
+  "<http://xmlns.com/foaf/0.1/knows>",
+  "<http://www.w3.org/1999/02/22-rdf-syntax-ns#type>",
+  "<http://xmlns.com/foaf/0.1/Person>",
+  NULL
+};
+
+RDFTerm hot_term(const size_t i) {
+  DPtr<uint8_t> *p;
+  NEW(p, MPtr<uint8_t>, strlen(HOT_TERMS[i]));
+  ascii_strcpy(p->dptr(), HOT_TERMS[i]);
+  RDFTerm term = RDFTerm::parse(p);
+  p->drop();
+  return term;
+}
+
+// Processor 0 gives the hot terms identifiers and sends them to the others.
+void preassign(DistRDFDictEncode<IDBYTES> *distcomp, vector<ID> &ids) {
+  size_t n;
+  for (n = 0; HOT_TERMS[n] != NULL; ++n) {
+    // count them
+  }
+  ids.resize(n);
+  size_t i;
+  if (MPI::COMM_WORLD.Get_rank() == 0) {
+    for (i = 0; i < n; ++i) {
+      ids[i] = distcomp->preassign(hot_term(i));
+    }
+  }
+  MPI::COMM_WORLD.Bcast(&ids[0], n*ID::size(), MPI::BYTE, 0);
+  if (MPI::COMM_WORLD.Get_rank() != 0) {
+    for (i = 0; i < n; ++i) {
+      distcomp->preassign(hot_term(i), ids[i]);
+    }
+  }
+}
+
+Dict *load(const char *filename, STORAGE<IDTrip> &store, vector<ID> *hot) {
   DistRDFDictEncode<IDBYTES> *distcomp;
   OutputStream *out;
   NEW(out, SetLoader, store);
-  NEW(distcomp, DistRDFDictEncode<IDBYTES>, rank, size, rr, dist, out);
+  NEW(distcomp, DistRDFDictEncode<IDBYTES>, COMMRANK, COMMSIZE,
+      reader(filename), distributor(7), out);
+  distcomp->setCacheSize(CACHESIZE);
+  if (hot != NULL) {
+    preassign(distcomp, *hot);
+  }
   distcomp->exec();
   Dict *dict = distcomp->getDictionary();
   DELETE(distcomp);
   return dict;
 }
 
+// Without CACHE_LOOKUPS, each processor only knows the terms it owns,
+// so give every processor every other processor's terms.
+void gather(Dict *dict) {
+  string sendbuf;
+  Dict::const_iterator it = dict->begin();
+  for (; it != dict->end(); ++it) {
+    RDFDictEncWriter<ID>::appendEntry(sendbuf, it->first, it->second);
+  }
+  int size = MPI::COMM_WORLD.Get_size();
+  int sendlen = sendbuf.size();
+  vector<int> recvlens(size);
+  vector<int> displs(size, 0);
+  MPI::COMM_WORLD.Allgather(&sendlen, 1, MPI::INT, &recvlens[0], 1, MPI::INT);
+  int i;
+  for (i = 1; i < size; ++i) {
+    displs[i] = displs[i - 1] + recvlens[i - 1];
+  }
+  int total = displs[size - 1] + recvlens[size - 1];
+  vector<char> recvbuf(total + 1);
+  MPI::COMM_WORLD.Allgatherv(sendbuf.data(), sendlen, MPI::CHAR, &recvbuf[0],
+                             &recvlens[0], &displs[0], MPI::CHAR);
+  const uint8_t *mark = (const uint8_t *) &recvbuf[0];
+  const uint8_t *end = mark + total;
+  while (mark != end) {
+    ID id;
+    RDFTerm term;
+    mark = RDFDictEncReader<ID>::parseEntry(mark, end, id, term);
+    dict->force(id, term);
+  }
+}
+
+unsigned long count(Dict *dict) {
+  unsigned long n = 0;
+  Dict::const_iterator it = dict->begin();
+  for (; it != dict->end(); ++it) {
+    ++n;
+  }
+  return n;
+}
+
+// Checks that the encoded triples are exactly the triples read.
+bool matches(RDFSTORAGE &triples, STORAGE<IDTrip> &trips, Dict *dict) {
+  STORAGE<IDTrip>::iterator it = trips.begin();
+  bool passing = true;
+  for (; passing && it != trips.end(); ++it) {
+    RDFTriple t (dict->decode(it->subj), dict->decode(it->pred), dict->decode(it->obj));
+    passing = CONTAINS(triples, t);
+  }
+  RDFSTORAGE::iterator tit = triples.begin();
+  for (; passing && tit != triples.end(); ++tit) {
+    IDTrip t;
+    if (!dict->lookup(tit->getSubj(), t.subj) ||
+        !dict->lookup(tit->getPred(), t.pred) ||
+        !dict->lookup(tit->getObj(), t.obj)) {
+      passing = false;
+    } else {
+      passing = CONTAINS(trips, t);
+    }
+  }
+  return passing;
+}
+
 bool test() {
+  try {
+    DECLARE_RDFSTORAGE(triples);
+    STORAGE<IDTrip> trips;
+    load(TESTFILE, triples);
+    Dict *dict = load(TESTFILE, trips, NULL);
 #if !CACHE_LOOKUPS
-#warning "ARBITRARILY PASSING TEST BECAUSE CACHE_LOOKUPS IS NOT DEFINED, BUT IT MEANS NOTHING!  COME BACK AND PUT IN A REAL TEST CASE!"
+    gather(dict);
+#endif
+    PROG(matches(triples, trips, dict));
+    unsigned long sz = trips.size();
+    unsigned long total_size;
+    MPI::COMM_WORLD.Allreduce(&sz, &total_size, 1, MPI::UNSIGNED_LONG,
+                              MPI::SUM);
+    PROG(total_size == NUMLINES);
+    DELETE(dict);
+  } catch(TraceableException &e) {
+    cerr << e.what() << endl;
+    FAIL;
+  }
   PASS;
-#else
+}
+
+bool testPreassign() {
   try {
     DECLARE_RDFSTORAGE(triples);
     STORAGE<IDTrip> trips;
     load(TESTFILE, triples);
-    Dict *dict = load(TESTFILE, trips);
-    STORAGE<IDTrip>::iterator it = trips.begin();
-    bool passing = true;
-    for (; passing && it != trips.end(); ++it) {
-      RDFTriple t (dict->decode(it->subj), dict->decode(it->pred), dict->decode(it->obj));
-      passing = CONTAINS(triples, t);
-    }
-    PROG(passing);
-    RDFSTORAGE::iterator tit = triples.begin();
-    for (; passing && tit != triples.end(); ++tit) {
-      IDTrip t;
-      if (!dict->lookup(tit->getSubj(), t.subj) ||
-          !dict->lookup(tit->getPred(), t.pred) ||
-          !dict->lookup(tit->getObj(), t.obj)) {
-        passing = false;
+    vector<ID> hot;
+    Dict *dict = load(TESTFILE, trips, &hot);
+
+    // only processor 0 has the hot terms in its dictionary, so nobody
+    // looked them up and each will be written out once
+    size_t i;
+    for (i = 0; i < hot.size(); ++i) {
+      ID id;
+      if (MPI::COMM_WORLD.Get_rank() == 0) {
+        PROG(dict->lookup(hot_term(i), id) && id == hot[i]);
       } else {
-        passing = CONTAINS(trips, t);
+        PROG(!dict->lookup(hot_term(i), id));
       }
     }
-    PROG(passing);
-    unsigned long sz = trips.size();
+    unsigned long sz = count(dict);
     unsigned long total_size;
-    MPI::COMM_WORLD.Allreduce(&sz, &total_size, 1, MPI::INT, MPI::SUM);
-    PROG(total_size == NUMLINES);
+    MPI::COMM_WORLD.Allreduce(&sz, &total_size, 1, MPI::UNSIGNED_LONG,
+                              MPI::SUM);
+#if !CACHE_LOOKUPS
+    gather(dict);
+    PROG(count(dict) == total_size);
+#endif
+
+    // every processor encoded the hot terms the same way
+    for (i = 0; i < hot.size(); ++i) {
+      ID id;
+      PROG(dict->lookup(hot_term(i), id) && id == hot[i]);
+    }
+    PROG(matches(triples, trips, dict));
     DELETE(dict);
   } catch(TraceableException &e) {
     cerr << e.what() << endl;
     FAIL;
   }
   PASS;
-#endif
 }
 
 int main (int argc, char **argv) {
@@ -196,5 +300,6 @@ int main (int argc, char **argv) {
     cerr << "[INFO] TESTFILE is " << TESTFILE << "; expecting " << NUMLINES << " lines." << endl;
   }
   TEST(test);
+  TEST(testPreassign);
   FINAL;
 }
@@ -16,8 +16,25 @@
 #include "ptr/alloc.h"
 
 #ifdef PTR_MEMDEBUG
+#include <pthread.h>
+
 namespace ptr {
 std::set<void*> __PTRS;
 unsigned long __persist_ptrs = 0;
+static pthread_mutex_t __ptrs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+bool __record(void *p) throw() {
+  pthread_mutex_lock(&__ptrs_lock);
+  bool recorded = __PTRS.insert(p).second;
+  pthread_mutex_unlock(&__ptrs_lock);
+  return recorded;
+}
+
+bool __forget(void *p) throw() {
+  pthread_mutex_lock(&__ptrs_lock);
+  bool forgotten = __PTRS.erase(p) == 1;
+  pthread_mutex_unlock(&__ptrs_lock);
+  return forgotten;
+}
 }
 #endif
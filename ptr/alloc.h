@@ -42,25 +42,30 @@
 namespace ptr {
 extern std::set<void*> __PTRS;
 extern unsigned long __persist_ptrs;
+// Add or remove a record of allocation in __PTRS while holding a lock,
+// so that threads may allocate concurrently.  Each returns false if
+// there was already (or, respectively, not) a record for p.
+bool __record(void *p) throw();
+bool __forget(void *p) throw();
 }
 #define NEW(i, c, ...) \
   i = new c(__VA_ARGS__); \
   PTR_PRINTA(i); \
-  if (ptr::__persist_ptrs == 0 && !ptr::__PTRS.insert((void*)i).second) \
+  if (ptr::__persist_ptrs == 0 && !ptr::__record((void*)i)) \
     std::cerr << "[PTR_MEMDEBUG] " << __FILE__ << ":" << __LINE__ << ": Unexpected allocation to " << #i << "=" << (void*) i << ", which means whatever was previously allocated to that address was not deallocated using alloc.h.\n\t" __FILE__ ":" << __LINE__ << ": " #i " = new " #c "(" #__VA_ARGS__ ");" << std::endl
 #define DELETE(i) \
   PTR_PRINTD(i); \
-  if (ptr::__PTRS.erase((void*)i) != 1 && ptr::__persist_ptrs == 0) \
+  if (!ptr::__forget((void*)i) && ptr::__persist_ptrs == 0) \
     std::cerr << "[PTR_MEMDEBUG] " << __FILE__ << ":" << __LINE__ << ": Call to delete something at " << #i << "=" << (void*) i << " for which there is no record of allocation.\n\t" __FILE__ ":" << __LINE__ << ": delete " #i ";" << std::endl; \
   delete i
 #define NEW_ARRAY(i, c, s) \
   i = new c[s]; \
   PTR_PRINTA(i); \
-  if (ptr::__persist_ptrs == 0 && !ptr::__PTRS.insert((void*)i).second) \
+  if (ptr::__persist_ptrs == 0 && !ptr::__record((void*)i)) \
     std::cerr << "[PTR_MEMDEBUG] " << __FILE__ << ":" << __LINE__ << ": Unexpected allocation to " << #i << "=" << (void*) i << ", which means whatever was previously allocated to that address was not deallocated using alloc.h.\n\t" __FILE__ ":" << __LINE__ << ": " #i " = new " #c "[" #s "];" << std::endl
 #define DELETE_ARRAY(i) \
   PTR_PRINTD(i); \
-  if (ptr::__PTRS.erase((void*)i) != 1 && ptr::__persist_ptrs == 0) \
+  if (!ptr::__forget((void*)i) && ptr::__persist_ptrs == 0) \
     std::cerr << "[PTR_MEMDEBUG] " << __FILE__ << ":" << __LINE__ << ": Call to delete something at " << #i << "=" << (void*) i << " for which there is no record of allocation.\n\t" __FILE__ ":" << __LINE__ << ": delete[] " #i ";" << std::endl; \
   delete[] i
 #define PERSIST_PTRS(b) \
@@ -83,6 +83,33 @@ DPtr<uint8_t> *RDFDictEncReader<ID, ENC>::readNext(InputStream *is,
   return q;
 }
 
+template<typename ID, typename ENC>
+const uint8_t *RDFDictEncReader<ID, ENC>::parseEntry(const uint8_t *begin,
+    const uint8_t *end, ID &id, RDFTerm &term) {
+  uint32_t len;
+  if ((size_t) (end - begin) < ID::size() + sizeof(uint32_t)) {
+    THROW(TraceableException, "Truncated dictionary entry.");
+  }
+  memcpy(id.ptr(), begin, ID::size());
+  begin += ID::size();
+  memcpy(&len, begin, sizeof(uint32_t));
+  begin += sizeof(uint32_t);
+  if (is_little_endian()) {
+    reverse_bytes(len);
+  }
+  if ((size_t) (end - begin) < len) {
+    THROW(TraceableException, "Truncated dictionary entry.");
+  }
+  DPtr<uint8_t> *p;
+  try {
+    NEW(p, MPtr<uint8_t>, len);
+  } RETHROW_BAD_ALLOC
+  memcpy(p->dptr(), begin, len);
+  term = RDFTerm::parse(p);
+  p->drop();
+  return begin + len;
+}
+
 template<typename ID, typename ENC>
 RDFDictionary<ID, ENC> *RDFDictEncReader<ID, ENC>::readDictionary(InputStream *is,
     RDFDictionary<ID, ENC> *dict) {
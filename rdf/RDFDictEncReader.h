@@ -44,6 +44,10 @@ public:
 
   static RDFDictionary<ID, ENC> *readDictionary(InputStream *is,
       RDFDictionary<ID, ENC> *dict);
+  // Parses the entry that begins at begin, in the format that readDictionary
+  // reads, and returns where the next one begins.
+  static const uint8_t *parseEntry(const uint8_t *begin, const uint8_t *end,
+                                   ID &id, RDFTerm &term);
   
   bool read(RDFTriple &triple);
   void close();
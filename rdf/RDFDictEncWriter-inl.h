@@ -51,6 +51,25 @@ RDFDictEncWriter<ID, ENC>::~RDFDictEncWriter() THROWS(IOException) {
 }
 TRACE(IOException, "Trouble deconstructing RDFDictEncWriter.")
 
+template<typename ID, typename ENC>
+void RDFDictEncWriter<ID, ENC>::appendEntry(string &buf, const ID &id,
+    const RDFTerm &term) {
+  DPtr<uint8_t> *str = term.toUTF8String();
+  if (str->size() > (size_t) UINT32_MAX) {
+    str->drop();
+    THROW(TraceableException,
+          "RDFTerm too long to write in dictionary file.");
+  }
+  uint32_t len = (uint32_t) str->size();
+  if (is_little_endian()) {
+    reverse_bytes(len);
+  }
+  buf.append((const char *) id.ptr(), ID::size());
+  buf.append((const char *) &len, sizeof(uint32_t));
+  buf.append((const char *) str->dptr(), str->size());
+  str->drop();
+}
+
 template<typename ID, typename ENC>
 void RDFDictEncWriter<ID, ENC>::writeDictionary(OutputStream *os,
     RDFDictionary<ID, ENC> *dict) {
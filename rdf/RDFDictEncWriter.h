@@ -16,6 +16,7 @@
 #ifndef __RDF__RDFDICTENCWRITER_H__
 #define __RDF__RDFDICTENCWRITER_H__
 
+#include <string>
 #include "ex/BaseException.h"
 #include "io/IOException.h"
 #include "ptr/BadAllocException.h"
@@ -28,6 +29,7 @@ namespace rdf {
 using namespace ex;
 using namespace io;
 using namespace ptr;
+using namespace std;
 
 template<typename ID=RDFID<8>, typename ENC=RDFEncoder<ID> >
 class RDFDictEncWriter : public RDFWriter {
@@ -45,6 +47,8 @@ public:
   static void writeDictionary(OutputStream *os, RDFDictionary<ID, ENC> *dict);
   static void writeDictionary(OutputStream *os, RDFDictionary<ID, ENC> *dict,
                               const ID &bitflip);
+  // Appends one entry to buf in the format that writeDictionary uses.
+  static void appendEntry(string &buf, const ID &id, const RDFTerm &term);
 
   void write(const RDFTriple &triple);
   void close();
@@ -23,38 +23,37 @@ namespace rdf {
 using namespace ex;
 using namespace std;
 
-template<typename ID, typename ENC>
-RDFDictionary<ID, ENC>::RDFDictionary() throw()
-    : term2id(Term2IDMap(RDFTerm::cmplt0)), counter(ID(1)) {
+template<typename ID, typename ENC, typename STORE>
+RDFDictionary<ID, ENC, STORE>::RDFDictionary() throw()
+    : counter(ID(1)) {
   // do nothing
 }
 
-template<typename ID, typename ENC>
-RDFDictionary<ID, ENC>::RDFDictionary(const ID &init) throw()
-    : term2id(Term2IDMap(RDFTerm::cmplt0)), counter(init) {
+template<typename ID, typename ENC, typename STORE>
+RDFDictionary<ID, ENC, STORE>::RDFDictionary(const ID &init) throw()
+    : counter(init) {
   // do nothing
 }
 
-template<typename ID, typename ENC>
-RDFDictionary<ID, ENC>::RDFDictionary(const ENC &enc) throw()
-    : term2id(Term2IDMap(RDFTerm::cmplt0)), counter(ID(1)),
-      encoder(enc) {
+template<typename ID, typename ENC, typename STORE>
+RDFDictionary<ID, ENC, STORE>::RDFDictionary(const ENC &enc) throw()
+    : counter(ID(1)), encoder(enc) {
   // do nothing
 }
 
-template<typename ID, typename ENC>
-RDFDictionary<ID, ENC>::RDFDictionary(const ID &init, const ENC &enc) throw()
-    : term2id(Term2IDMap(RDFTerm::cmplt0)), counter(init), encoder(enc) {
+template<typename ID, typename ENC, typename STORE>
+RDFDictionary<ID, ENC, STORE>::RDFDictionary(const ID &init, const ENC &enc)
+    throw() : counter(init), encoder(enc) {
   // do nothing
 }
 
-template<typename ID, typename ENC>
-RDFDictionary<ID, ENC>::~RDFDictionary() throw() {
+template<typename ID, typename ENC, typename STORE>
+RDFDictionary<ID, ENC, STORE>::~RDFDictionary() throw() {
   // do nothing
 }
 
-template<typename ID, typename ENC>
-bool RDFDictionary<ID, ENC>::nextID(ID &id) {
+template<typename ID, typename ENC, typename STORE>
+bool RDFDictionary<ID, ENC, STORE>::nextID(ID &id) {
   if (this->counter[(ID::size() << 3) - 1]) {
     return false;
   }
@@ -63,37 +62,24 @@ bool RDFDictionary<ID, ENC>::nextID(ID &id) {
   return true;
 }
 
-template<typename ID, typename ENC>
-ID RDFDictionary<ID, ENC>::encode(const RDFTerm &term) {
+template<typename ID, typename ENC, typename STORE>
+ID RDFDictionary<ID, ENC, STORE>::encode(const RDFTerm &term) {
   ID id;
   if (this->encoder(term, id) && !id((ID::size() << 3) - 1, true)) {
     return id;
   }
-  pair<typename Term2IDMap::iterator, typename Term2IDMap::iterator> range =
-      this->term2id.equal_range(term);
-  if (range.first != range.second) {
-    return range.first->second;
+  if (this->terms.find(term, id)) {
+    return id;
   }
   if (!this->nextID(id)) {
     THROW(TraceableException, "Ran out of identifiers!");
   }
-  if (range.first != this->term2id.begin()) {
-    --range.first;
-  }
-
-  this->term2id.insert(range.first, pair<RDFTerm, ID>(term, id));
-
-  typename ID2TermMap::iterator it = this->id2term.end();
-  if (it != this->id2term.begin()) {
-    --it;
-  }
-  this->id2term.insert(it, pair<ID, RDFTerm>(id, term));
-
+  this->terms.insert(term, id);
   return id;
 }
 
-template<typename ID, typename ENC>
-RDFTerm RDFDictionary<ID, ENC>::decode(const ID &id) {
+template<typename ID, typename ENC, typename STORE>
+RDFTerm RDFDictionary<ID, ENC, STORE>::decode(const ID &id) {
   RDFTerm term;
   if (this->lookup(id, term)) {
     return term;
@@ -101,57 +87,46 @@ RDFTerm RDFDictionary<ID, ENC>::decode(const ID &id) {
   THROW(TraceableException, "Cannot decode term!");
 }
 
-template<typename ID, typename ENC>
-bool RDFDictionary<ID, ENC>::lookup(const RDFTerm &term) {
+template<typename ID, typename ENC, typename STORE>
+bool RDFDictionary<ID, ENC, STORE>::lookup(const RDFTerm &term) {
   ID id;
   return this->lookup(term, id);
 }
 
-template<typename ID, typename ENC>
-bool RDFDictionary<ID, ENC>::lookup(const RDFTerm &term, ID &id) {
+template<typename ID, typename ENC, typename STORE>
+bool RDFDictionary<ID, ENC, STORE>::lookup(const RDFTerm &term, ID &id) {
   if (this->encoder(term, id) && !id((ID::size() << 3) - 1, true)) {
     return true;
   }
-  typename Term2IDMap::const_iterator it = this->term2id.find(term);
-  if (it != this->term2id.end()) {
-    id = it->second;
-    return true;
-  }
-  return false;
+  return this->terms.find(term, id);
 }
 
-template<typename ID, typename ENC>
-bool RDFDictionary<ID, ENC>::lookup(const ID &id) {
+template<typename ID, typename ENC, typename STORE>
+bool RDFDictionary<ID, ENC, STORE>::lookup(const ID &id) {
   RDFTerm term;
   return this->lookup(id, term);
 }
 
-template<typename ID, typename ENC>
-bool RDFDictionary<ID, ENC>::lookup(const ID &id, RDFTerm &term) {
+template<typename ID, typename ENC, typename STORE>
+bool RDFDictionary<ID, ENC, STORE>::lookup(const ID &id, RDFTerm &term) {
   ID myid = id;
   if (myid((ID::size() << 3) - 1, false)) {
     return this->encoder(myid, term);
   }
-  typename ID2TermMap::const_iterator it = this->id2term.find(id);
-  if (it != this->id2term.end()) {
-    term = it->second;
-    return true;
-  }
-  return false;
+  return this->terms.find(id, term);
 }
 
-template<typename ID, typename ENC>
-bool RDFDictionary<ID, ENC>::force(const ID &id, RDFTerm &term) {
+template<typename ID, typename ENC, typename STORE>
+bool RDFDictionary<ID, ENC, STORE>::force(const ID &id, RDFTerm &term) {
   ID myid = id;
   if (myid((ID::size() << 3) - 1, false)) {
     return this->encoder(myid, term);
   }
-  typename ID2TermMap::const_iterator it = this->id2term.find(id);
-  if (it != this->id2term.end()) {
-    return term.equals(it->second);
+  RDFTerm existing;
+  if (this->terms.find(id, existing)) {
+    return term.equals(existing);
   }
-  this->id2term.insert(pair<ID, RDFTerm>(id, term));
-  this->term2id.insert(pair<RDFTerm, ID>(term, id));
+  this->terms.insert(term, id);
   if (this->counter <= id) {
     this->counter = id;
     ++this->counter;
@@ -159,28 +134,27 @@ bool RDFDictionary<ID, ENC>::force(const ID &id, RDFTerm &term) {
   return true;
 }
 
-template<typename ID, typename ENC>
+template<typename ID, typename ENC, typename STORE>
 inline
-typename RDFDictionary<ID, ENC>::const_iterator RDFDictionary<ID, ENC>::begin() {
-  return this->id2term.begin();
+typename RDFDictionary<ID, ENC, STORE>::const_iterator
+RDFDictionary<ID, ENC, STORE>::begin() {
+  return this->terms.begin();
 }
 
-template<typename ID, typename ENC>
+template<typename ID, typename ENC, typename STORE>
 inline
-typename RDFDictionary<ID, ENC>::const_iterator RDFDictionary<ID, ENC>::end() {
-  return this->id2term.end();
+typename RDFDictionary<ID, ENC, STORE>::const_iterator
+RDFDictionary<ID, ENC, STORE>::end() {
+  return this->terms.end();
 }
 
-template<typename ID, typename ENC>
+template<typename ID, typename ENC, typename STORE>
 inline
-void RDFDictionary<ID, ENC>::clear() {
-  if (!this->id2term.empty()) {
-    this->counter = this->id2term.begin()->first;
+void RDFDictionary<ID, ENC, STORE>::clear() {
+  if (!this->terms.empty()) {
+    this->counter = this->terms.begin()->first;
   }
-  Term2IDMap newt2i(RDFTerm::cmplt0);
-  ID2TermMap newi2t;
-  this->term2id.swap(newt2i);
-  this->id2term.swap(newi2t);
+  this->terms.clear();
 }
 
 }
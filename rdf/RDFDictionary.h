@@ -16,24 +16,26 @@
 #ifndef __RDF__RDFDICTIONARY_H__
 #define __RDF__RDFDICTIONARY_H__
 
-#include <map>
 #include "rdf/RDFEncoder.h"
 #include "rdf/RDFTerm.h"
+#include "rdf/RDFTermStore.h"
 #include "sys/ints.h"
 
+// The storage policy of RDFDictionary<ID, ENC> when none is given;
+// RDFTermMapStore or RDFTermHashStore.
+#ifndef RDFDICT_STORE
+#define RDFDICT_STORE RDFTermMapStore
+#endif
+
 namespace rdf {
 
 using namespace std;
 
-template<typename ID=RDFID<8>, typename ENC=RDFEncoder<ID> >
+template<typename ID=RDFID<8>, typename ENC=RDFEncoder<ID>,
+         typename STORE=RDFDICT_STORE<ID> >
 class RDFDictionary {
-public:
-  typedef map<ID, RDFTerm> ID2TermMap;
 protected:
-  typedef map<RDFTerm, ID, bool(*)(const RDFTerm &, const RDFTerm &)>
-      Term2IDMap;
-  Term2IDMap term2id;
-  ID2TermMap id2term;
+  STORE terms;
   ID counter;
   ENC encoder;
   virtual bool nextID(ID &id);
@@ -52,7 +54,7 @@ public:
   virtual bool lookup(const ID &id, RDFTerm &term);
   virtual bool force(const ID &id, RDFTerm &term);
 
-  typedef typename ID2TermMap::const_iterator const_iterator;
+  typedef typename STORE::const_iterator const_iterator;
 
   const_iterator begin();
   const_iterator end();
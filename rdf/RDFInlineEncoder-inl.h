@@ -0,0 +1,384 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#include "rdf/RDFInlineEncoder.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "iri/IRIRef.h"
+#include "ptr/MPtr.h"
+#include "sys/char.h"
+
+namespace rdf {
+
+using namespace iri;
+using namespace ptr;
+using namespace std;
+using namespace sys;
+
+#define RDFINLINE_XSD "http://www.w3.org/2001/XMLSchema#"
+#define RDFINLINE_BOOLEAN 0
+#define RDFINLINE_DECIMAL 1
+#define RDFINLINE_INTEGER 2
+#define RDFINLINE_LONG 3
+#define RDFINLINE_INT 4
+#define RDFINLINE_SHORT 5
+#define RDFINLINE_DATE 6
+#define RDFINLINE_DATETIME 7
+#define RDFINLINE_NTYPES 8
+#define RDFINLINE_DATE_BITS 36
+#define RDFINLINE_DATETIME_BITS 53
+
+static const char *RDFINLINE_DATATYPES[RDFINLINE_NTYPES] = {
+  "boolean", "decimal", "integer", "long", "int", "short", "date", "dateTime"
+};
+
+// Reads exactly n decimal digits.
+inline bool rdfinline_digits(const uint8_t *&p, const uint8_t *end,
+                             const size_t n, uint64_t &value) {
+  if ((size_t) (end - p) < n) {
+    return false;
+  }
+  value = 0;
+  size_t i;
+  for (i = 0; i < n; ++i, ++p) {
+    if (*p < to_ascii('0') || *p > to_ascii('9')) {
+      return false;
+    }
+    value = value * 10 + (*p - to_ascii('0'));
+  }
+  return true;
+}
+
+inline bool rdfinline_char(const uint8_t *&p, const uint8_t *end,
+                           const char c) {
+  if (p == end || *p != to_ascii(c)) {
+    return false;
+  }
+  ++p;
+  return true;
+}
+
+// Reads an unsigned integer without superfluous leading zeros.
+inline bool rdfinline_natural(const uint8_t *&p, const uint8_t *end,
+                              uint64_t &value) {
+  const uint8_t *begin = p;
+  value = 0;
+  for (; p != end && *p >= to_ascii('0') && *p <= to_ascii('9'); ++p) {
+    if (p - begin >= 18) {
+      return false;
+    }
+    value = value * 10 + (*p - to_ascii('0'));
+  }
+  return p != begin && (*begin != to_ascii('0') || p - begin == 1);
+}
+
+template<typename ID, typename ENC>
+inline
+size_t RDFInlineEncoder<ID, ENC>::tagBit() {
+  return (ID::size() << 3) - 2;
+}
+
+template<typename ID, typename ENC>
+inline
+size_t RDFInlineEncoder<ID, ENC>::valueBits() {
+  size_t bits = (ID::size() << 3) - 5;
+  return bits > 64 ? 64 : bits;
+}
+
+template<typename ID, typename ENC>
+int RDFInlineEncoder<ID, ENC>::datatypeOf(const RDFTerm &term) {
+  if (term.getType() != TYPED_LITERAL) {
+    return -1;
+  }
+  DPtr<uint8_t> *dtstr = term.getDatatype().getUTF8String();
+  size_t nslen = strlen(RDFINLINE_XSD);
+  int type = -1;
+  if (dtstr->size() > nslen &&
+      ascii_strncmp(dtstr->dptr(), RDFINLINE_XSD, nslen) == 0) {
+    const uint8_t *local = dtstr->dptr() + nslen;
+    size_t len = dtstr->size() - nslen;
+    int i;
+    for (i = 0; i < RDFINLINE_NTYPES; ++i) {
+      if (strlen(RDFINLINE_DATATYPES[i]) == len &&
+          ascii_strncmp(local, RDFINLINE_DATATYPES[i], len) == 0) {
+        type = i;
+        break;
+      }
+    }
+  }
+  dtstr->drop();
+  return type;
+}
+
+template<typename ID, typename ENC>
+bool RDFInlineEncoder<ID, ENC>::parse(const int type, const uint8_t *begin,
+    const uint8_t *end, uint64_t &value) {
+  size_t bits = valueBits();
+  const uint8_t *p = begin;
+  switch (type) {
+  case RDFINLINE_BOOLEAN: {
+    if (end - begin == 4 && ascii_strncmp(begin, "true", 4) == 0) {
+      value = 1;
+      return true;
+    }
+    if (end - begin == 5 && ascii_strncmp(begin, "false", 5) == 0) {
+      value = 0;
+      return true;
+    }
+    return false;
+  }
+  case RDFINLINE_DECIMAL: {
+    bool negative = rdfinline_char(p, end, '-');
+    uint64_t magnitude;
+    if (!rdfinline_natural(p, end, magnitude)) {
+      return false;
+    }
+    size_t intdigits = p - begin - (negative ? 1 : 0);
+    bool dot = rdfinline_char(p, end, '.');
+    size_t nfrac = end - p;
+    if ((!dot && nfrac > 0) || nfrac > 15 || intdigits + nfrac > 18) {
+      return false;
+    }
+    uint64_t frac;
+    if (!rdfinline_digits(p, end, nfrac, frac)) {
+      return false;
+    }
+    size_t i;
+    for (i = 0; i < nfrac; ++i) {
+      magnitude *= 10;
+    }
+    magnitude += frac;
+    if ((magnitude >> (bits - 6)) != 0) {
+      return false;
+    }
+    value = (magnitude << 6) | (nfrac << 2) | (dot ? 2 : 0) |
+            (negative ? 1 : 0);
+    return true;
+  }
+  case RDFINLINE_INTEGER:
+  case RDFINLINE_LONG:
+  case RDFINLINE_INT:
+  case RDFINLINE_SHORT: {
+    bool negative = rdfinline_char(p, end, '-');
+    uint64_t magnitude;
+    if (!rdfinline_natural(p, end, magnitude) || p != end ||
+        (negative && magnitude == 0)) {
+      return false;
+    }
+    if (bits < 64 && magnitude > (UINT64_C(1) << (bits - 1)) -
+                                 (negative ? 0 : 1)) {
+      return false;
+    }
+    value = negative ? (uint64_t) -(int64_t) magnitude : magnitude;
+    if (bits < 64) {
+      value &= (UINT64_C(1) << bits) - 1;
+    }
+    return true;
+  }
+  case RDFINLINE_DATE:
+  case RDFINLINE_DATETIME: {
+    if (bits < (type == RDFINLINE_DATE ? RDFINLINE_DATE_BITS
+                                        : RDFINLINE_DATETIME_BITS)) {
+      return false;
+    }
+    uint64_t year, month, day, hour, minute, second;
+    if (!rdfinline_digits(p, end, 4, year) || !rdfinline_char(p, end, '-') ||
+        !rdfinline_digits(p, end, 2, month) || !rdfinline_char(p, end, '-') ||
+        !rdfinline_digits(p, end, 2, day) ||
+        month < 1 || month > 12 || day < 1 || day > 31) {
+      return false;
+    }
+    value = (((year << 4) | month) << 5) | day;
+    if (type == RDFINLINE_DATETIME) {
+      if (!rdfinline_char(p, end, 'T') ||
+          !rdfinline_digits(p, end, 2, hour) ||
+          !rdfinline_char(p, end, ':') ||
+          !rdfinline_digits(p, end, 2, minute) ||
+          !rdfinline_char(p, end, ':') ||
+          !rdfinline_digits(p, end, 2, second) ||
+          hour > 23 || minute > 59 || second > 59) {
+        return false;
+      }
+      value = (((((value << 5) | hour) << 6) | minute) << 6) | second;
+    }
+    // time zone: none, Z, +hh:mm or -hh:mm
+    uint64_t tzkind = 0, tzhour = 0, tzminute = 0;
+    if (rdfinline_char(p, end, 'Z')) {
+      tzkind = 1;
+    } else if (p != end) {
+      tzkind = rdfinline_char(p, end, '+') ? 2 :
+               (rdfinline_char(p, end, '-') ? 3 : 0);
+      if (tzkind == 0 || !rdfinline_digits(p, end, 2, tzhour) ||
+          !rdfinline_char(p, end, ':') ||
+          !rdfinline_digits(p, end, 2, tzminute) ||
+          tzhour > 14 || tzminute > 59) {
+        return false;
+      }
+    }
+    if (p != end) {
+      return false;
+    }
+    value = (((((value << 2) | tzkind) << 5) | tzhour) << 6) | tzminute;
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+// Writes the lexical form of value into str, which must have room for
+// at least 32 characters, and returns its length.
+template<typename ID, typename ENC>
+size_t RDFInlineEncoder<ID, ENC>::render(const int type, const uint64_t value,
+    char *str) {
+  size_t bits = valueBits();
+  switch (type) {
+  case RDFINLINE_BOOLEAN:
+    return sprintf(str, "%s", value == 0 ? "false" : "true");
+  case RDFINLINE_DECIMAL: {
+    bool negative = (value & 1) != 0;
+    bool dot = (value & 2) != 0;
+    int nfrac = (int) ((value >> 2) & 0xF);
+    uint64_t magnitude = value >> 6;
+    uint64_t scale = 1;
+    int i;
+    for (i = 0; i < nfrac; ++i) {
+      scale *= 10;
+    }
+    int len = sprintf(str, "%s%llu%s", negative ? "-" : "",
+                      (unsigned long long) (magnitude / scale),
+                      dot ? "." : "");
+    if (nfrac > 0) {
+      len += sprintf(str + len, "%0*llu", nfrac,
+                     (unsigned long long) (magnitude % scale));
+    }
+    return len;
+  }
+  case RDFINLINE_INTEGER:
+  case RDFINLINE_LONG:
+  case RDFINLINE_INT:
+  case RDFINLINE_SHORT: {
+    int64_t signedvalue = (int64_t) value;
+    if (bits < 64 && ((value >> (bits - 1)) & 1) != 0) {
+      signedvalue = (int64_t) (value | ~((UINT64_C(1) << bits) - 1));
+    }
+    return sprintf(str, "%lld", (long long) signedvalue);
+  }
+  case RDFINLINE_DATE:
+  case RDFINLINE_DATETIME: {
+    unsigned tzminute = (unsigned) (value & 0x3F);
+    unsigned tzhour = (unsigned) ((value >> 6) & 0x1F);
+    unsigned tzkind = (unsigned) ((value >> 11) & 0x3);
+    uint64_t rest = value >> 13;
+    int len = 0;
+    if (type == RDFINLINE_DATETIME) {
+      unsigned second = (unsigned) (rest & 0x3F);
+      unsigned minute = (unsigned) ((rest >> 6) & 0x3F);
+      unsigned hour = (unsigned) ((rest >> 12) & 0x1F);
+      rest >>= 17;
+      len = sprintf(str, "%04u-%02u-%02uT%02u:%02u:%02u",
+                    (unsigned) (rest >> 9), (unsigned) ((rest >> 5) & 0xF),
+                    (unsigned) (rest & 0x1F), hour, minute, second);
+    } else {
+      len = sprintf(str, "%04u-%02u-%02u", (unsigned) (rest >> 9),
+                    (unsigned) ((rest >> 5) & 0xF), (unsigned) (rest & 0x1F));
+    }
+    if (tzkind == 1) {
+      len += sprintf(str + len, "Z");
+    } else if (tzkind > 1) {
+      len += sprintf(str + len, "%c%02u:%02u", tzkind == 2 ? '+' : '-',
+                     tzhour, tzminute);
+    }
+    return len;
+  }
+  default:
+    return 0;
+  }
+}
+
+template<typename ID, typename ENC>
+bool RDFInlineEncoder<ID, ENC>::operator()(const RDFTerm &term, ID &id) {
+  if (this->base(term, id)) {
+    return !id[tagBit()];
+  }
+  int type = datatypeOf(term);
+  if (type >= 0) {
+    DPtr<uint8_t> *lex = term.getLexForm();
+    uint64_t value;
+    bool packed = parse(type, lex->dptr(), lex->dptr() + lex->size(), value);
+    lex->drop();
+    if (packed) {
+      id = ID::zero();
+      size_t bits = valueBits();
+      size_t i;
+      for (i = 0; i < bits; ++i) {
+        id(i, ((value >> i) & 1) != 0);
+      }
+      for (i = 0; i < 3; ++i) {
+        id(bits + i, ((type >> i) & 1) != 0);
+      }
+      id(tagBit(), true);
+      return true;
+    }
+  }
+  return false;
+}
+
+template<typename ID, typename ENC>
+bool RDFInlineEncoder<ID, ENC>::operator()(const ID &id, RDFTerm &term) {
+  if (!id[tagBit()]) {
+    return this->base(id, term);
+  }
+  size_t bits = valueBits();
+  uint64_t value = 0;
+  size_t i;
+  for (i = 0; i < bits; ++i) {
+    if (id[i]) {
+      value |= UINT64_C(1) << i;
+    }
+  }
+  int type = 0;
+  for (i = 0; i < 3; ++i) {
+    if (id[bits + i]) {
+      type |= 1 << i;
+    }
+  }
+  char lexstr[32];
+  size_t len = render(type, value, lexstr);
+  string dtstr = string(RDFINLINE_XSD) + RDFINLINE_DATATYPES[type];
+  DPtr<uint8_t> *lex;
+  DPtr<uint8_t> *dt;
+  try {
+    NEW(lex, MPtr<uint8_t>, len);
+  } RETHROW_BAD_ALLOC
+  memcpy(lex->dptr(), lexstr, len);
+  try {
+    NEW(dt, MPtr<uint8_t>, dtstr.size());
+  } catch (bad_alloc &e) {
+    lex->drop();
+    THROWX(BadAllocException);
+  }
+  ascii_strcpy(dt->dptr(), dtstr.c_str());
+  // both strings are known to be well-formed
+  IRIRef datatype(dt);
+  dt->drop();
+  term = RDFTerm(lex, datatype);
+  lex->drop();
+  return true;
+}
+
+}
@@ -0,0 +1,68 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#ifndef __RDF__RDFINLINEENCODER_H__
+#define __RDF__RDFINLINEENCODER_H__
+
+#include "rdf/RDFEncoder.h"
+#include "rdf/RDFTerm.h"
+#include "sys/ints.h"
+
+namespace rdf {
+
+using namespace std;
+
+// Packs small typed literals directly into identifiers so that they
+// never need a dictionary entry, and delegates everything else to ENC.
+// ENC is consulted first, so a literal that ENC already encodes (e.g.,
+// one forced into its dictionary) keeps the identifier ENC gives it and
+// is encoded the same way whether or not literals are inlined.
+//
+// RDFDictionary reserves the most significant bit of an identifier for
+// encoder-produced identifiers.  Of the remaining bits, the next most
+// significant marks an inline literal, the three after that give its
+// datatype, and the rest hold its value.  Only literals whose lexical
+// form can be reproduced exactly from the value are packed:
+//   xsd:boolean          true, false
+//   xsd:decimal          -?(0|[1-9][0-9]*)(\.[0-9]{0,15})?
+//   xsd:integer, long,   -?(0|[1-9][0-9]*), but not -0
+//   int, short
+//   xsd:date             YYYY-MM-DD with optional Z or (+|-)hh:mm
+//   xsd:dateTime         YYYY-MM-DDThh:mm:ss with optional Z or (+|-)hh:mm
+// and only if the value fits in the bits available (dates need 36 bits,
+// date-times 53, so neither is inlined for identifiers under 8 bytes).
+// ENC must never set the inline bit in identifiers that it produces.
+template<typename ID, typename ENC=RDFEncoder<ID> >
+class RDFInlineEncoder {
+private:
+  ENC base;
+  static size_t tagBit();
+  static size_t valueBits();
+  static int datatypeOf(const RDFTerm &term);
+  static bool parse(const int type, const uint8_t *begin,
+                    const uint8_t *end, uint64_t &value);
+  static size_t render(const int type, const uint64_t value, char *str);
+public:
+  RDFInlineEncoder() {}
+  RDFInlineEncoder(const ENC &base) : base(base) {}
+  bool operator()(const RDFTerm &term, ID &id);
+  bool operator()(const ID &id, RDFTerm &term);
+};
+
+}
+
+#include "rdf/RDFInlineEncoder-inl.h"
+
+#endif /* __RDF__RDFINLINEENCODER_H__ */
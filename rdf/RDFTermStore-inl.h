@@ -0,0 +1,390 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#include "rdf/RDFTermStore.h"
+
+#include <algorithm>
+#include <cstring>
+#include "ex/TraceableException.h"
+#include "ptr/MPtr.h"
+#include "sys/char.h"
+#include "util/hash.h"
+
+namespace rdf {
+
+using namespace ex;
+using namespace ptr;
+using namespace std;
+using namespace sys;
+using namespace util;
+
+// RDFTermMapStore
+
+template<typename ID>
+RDFTermMapStore<ID>::RDFTermMapStore() throw()
+    : term2id(Term2IDMap(RDFTerm::cmplt0)) {
+  // do nothing
+}
+
+template<typename ID>
+RDFTermMapStore<ID>::~RDFTermMapStore() throw() {
+  // do nothing
+}
+
+template<typename ID>
+bool RDFTermMapStore<ID>::find(const RDFTerm &term, ID &id) {
+  typename Term2IDMap::const_iterator it = this->term2id.find(term);
+  if (it != this->term2id.end()) {
+    id = it->second;
+    return true;
+  }
+  return false;
+}
+
+template<typename ID>
+bool RDFTermMapStore<ID>::find(const ID &id, RDFTerm &term) {
+  typename ID2TermMap::const_iterator it = this->id2term.find(id);
+  if (it != this->id2term.end()) {
+    term = it->second;
+    return true;
+  }
+  return false;
+}
+
+template<typename ID>
+void RDFTermMapStore<ID>::insert(const RDFTerm &term, const ID &id) {
+  this->term2id.insert(pair<RDFTerm, ID>(term, id));
+  typename ID2TermMap::iterator it = this->id2term.end();
+  if (it != this->id2term.begin()) {
+    --it;
+  }
+  this->id2term.insert(it, pair<ID, RDFTerm>(id, term));
+}
+
+template<typename ID>
+void RDFTermMapStore<ID>::set(const RDFTerm &term, const ID &id) {
+  this->term2id[term] = id;
+  this->id2term[id] = term;
+}
+
+template<typename ID>
+inline
+bool RDFTermMapStore<ID>::empty() const throw() {
+  return this->id2term.empty();
+}
+
+template<typename ID>
+inline
+typename RDFTermMapStore<ID>::const_iterator RDFTermMapStore<ID>::begin() {
+  return this->id2term.begin();
+}
+
+template<typename ID>
+inline
+typename RDFTermMapStore<ID>::const_iterator RDFTermMapStore<ID>::end() {
+  return this->id2term.end();
+}
+
+template<typename ID>
+void RDFTermMapStore<ID>::clear() {
+  Term2IDMap newt2i(RDFTerm::cmplt0);
+  ID2TermMap newi2t;
+  this->term2id.swap(newt2i);
+  this->id2term.swap(newi2t);
+}
+
+// RDFTermHashStore
+
+#define RDFTERMHASHSTORE_INIT_SLOTS 1024
+
+template<typename ID>
+RDFTermHashStore<ID>::RDFTermHashStore() throw()
+    : arena_size(0), slots(RDFTERMHASHSTORE_INIT_SLOTS, 0), nsorted(0) {
+  // do nothing
+}
+
+template<typename ID>
+RDFTermHashStore<ID>::~RDFTermHashStore() throw() {
+  // do nothing
+}
+
+// Writes the serialization of term just past the end of the arena
+// without claiming it, and gives its length, the offset at which its
+// language tag begins (or its length, if it has none), and its hash
+// with the language tag in lowercase.
+template<typename ID>
+void RDFTermHashStore<ID>::serialize(const RDFTerm &term, uint32_t &length,
+    uint32_t &tag, uint32_t &hash) {
+  DPtr<uint8_t> *str = term.toUTF8String();
+  if (str->size() > (size_t) UINT32_MAX) {
+    str->drop();
+    THROW(TraceableException, "RDFTerm too long to store in dictionary.");
+  }
+  length = (uint32_t) str->size();
+  // room for a copy in which to lowercase the language tag for hashing
+  size_t room = term.getType() == LANG_LITERAL ? length << 1 : length;
+  if (this->arena.size() < this->arena_size + room) {
+    this->arena.resize(max(this->arena_size + room,
+                           this->arena.size() << 1));
+  }
+  uint8_t *begin = &this->arena[0] + this->arena_size;
+  uint8_t *end = begin + length;
+  memcpy(begin, str->dptr(), length * sizeof(uint8_t));
+  str->drop();
+  tag = length;
+  if (term.getType() != LANG_LITERAL) {
+    hash = hash_jenkins_one_at_a_time(begin, end);
+    return;
+  }
+  while (begin[tag - 1] != to_ascii('@')) {
+    --tag;
+  }
+  uint8_t *lower = end;
+  memcpy(lower, begin, length * sizeof(uint8_t));
+  uint8_t *mark;
+  for (mark = lower + tag; mark != lower + length; ++mark) {
+    *mark = (uint8_t) to_lower(*mark);
+  }
+  hash = hash_jenkins_one_at_a_time(lower, lower + length);
+}
+
+// Returns the slot that holds the term serialized at the end of the
+// arena or, failing that, the empty slot at which it belongs.
+template<typename ID>
+size_t RDFTermHashStore<ID>::probe(const uint32_t length, const uint32_t tag,
+    const uint32_t hash) const throw() {
+  const uint8_t *key = &this->arena[0] + this->arena_size;
+  size_t mask = this->slots.size() - 1;
+  size_t i = hash & mask;
+  for (;; i = (i + 1) & mask) {
+    size_t slot = this->slots[i];
+    if (slot == 0) {
+      return i;
+    }
+    const entry &e = this->entries[slot - 1];
+    if (e.hash != hash || e.length != length) {
+      continue;
+    }
+    const uint8_t *stored = &this->arena[0] + e.offset;
+    if (memcmp(stored, key, tag) != 0) {
+      continue;
+    }
+    uint32_t j;
+    for (j = tag; j < length &&
+         to_lower(stored[j]) == to_lower(key[j]); ++j) {
+      // do nothing
+    }
+    if (j == length) {
+      return i;
+    }
+  }
+}
+
+// Claims the term serialized at the end of the arena for id, and points
+// slot i (as returned by probe) at it unless the term is already there.
+template<typename ID>
+void RDFTermHashStore<ID>::add(const ID &id, const uint32_t length,
+    const uint32_t hash, const size_t i) {
+  entry e;
+  e.id = id;
+  e.offset = this->arena_size;
+  e.length = length;
+  e.hash = hash;
+  this->entries.push_back(e);
+  if (this->slots[i] == 0) {
+    this->slots[i] = this->entries.size();
+  }
+  this->arena_size += length;
+  if (this->nsorted == this->byid.size() && (this->byid.empty() ||
+      this->entries[this->byid.back()].id < id)) {
+    ++this->nsorted;
+  }
+  this->byid.push_back(this->entries.size() - 1);
+}
+
+template<typename ID>
+void RDFTermHashStore<ID>::rehash(const size_t nslots) {
+  vector<size_t> newslots(nslots, 0);
+  size_t mask = nslots - 1;
+  size_t n;
+  for (n = 0; n < this->entries.size(); ++n) {
+    size_t i = this->entries[n].hash & mask;
+    while (newslots[i] != 0) {
+      i = (i + 1) & mask;
+    }
+    newslots[i] = n + 1;
+  }
+  this->slots.swap(newslots);
+}
+
+template<typename ID>
+void RDFTermHashStore<ID>::sort() {
+  if (this->nsorted >= this->byid.size()) {
+    return;
+  }
+  id_order order(&this->entries);
+  vector<size_t>::iterator middle = this->byid.begin() + this->nsorted;
+  std::sort(middle, this->byid.end(), order);
+  inplace_merge(this->byid.begin(), middle, this->byid.end(), order);
+  this->nsorted = this->byid.size();
+}
+
+template<typename ID>
+RDFTerm RDFTermHashStore<ID>::termAt(const size_t index) const {
+  const entry &ent = this->entries[index];
+  DPtr<uint8_t> *p;
+  try {
+    NEW(p, MPtr<uint8_t>, ent.length);
+  } RETHROW_BAD_ALLOC
+  memcpy(p->dptr(), &this->arena[0] + ent.offset,
+         ent.length * sizeof(uint8_t));
+  try {
+    RDFTerm term = RDFTerm::parse(p);
+    p->drop();
+    return term;
+  } catch (BaseException<void*> &e) {
+    p->drop();
+    RETHROW(e, "Corrupt term in dictionary.");
+  } catch (TraceableException &e) {
+    p->drop();
+    RETHROW(e, "Corrupt term in dictionary.");
+  }
+}
+
+template<typename ID>
+bool RDFTermHashStore<ID>::find(const RDFTerm &term, ID &id) {
+  uint32_t length, tag, hash;
+  this->serialize(term, length, tag, hash);
+  size_t slot = this->slots[this->probe(length, tag, hash)];
+  if (slot == 0) {
+    return false;
+  }
+  id = this->entries[slot - 1].id;
+  return true;
+}
+
+template<typename ID>
+bool RDFTermHashStore<ID>::find(const ID &id, RDFTerm &term) {
+  this->sort();
+  size_t low = 0;
+  size_t high = this->byid.size();
+  while (low < high) {
+    size_t mid = low + ((high - low) >> 1);
+    if (this->entries[this->byid[mid]].id < id) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == this->byid.size() || this->entries[this->byid[low]].id != id) {
+    return false;
+  }
+  term = this->termAt(this->byid[low]);
+  return true;
+}
+
+// If term is already in the store, it keeps its identifier, but id also
+// maps to it (as with RDFTermMapStore).
+template<typename ID>
+void RDFTermHashStore<ID>::insert(const RDFTerm &term, const ID &id) {
+  uint32_t length, tag, hash;
+  this->serialize(term, length, tag, hash);
+  if ((this->entries.size() + 1) << 1 > this->slots.size()) {
+    this->rehash(this->slots.size() << 1);
+  }
+  this->add(id, length, hash, this->probe(length, tag, hash));
+}
+
+template<typename ID>
+void RDFTermHashStore<ID>::set(const RDFTerm &term, const ID &id) {
+  uint32_t length, tag, hash;
+  this->serialize(term, length, tag, hash);
+  if ((this->entries.size() + 1) << 1 > this->slots.size()) {
+    this->rehash(this->slots.size() << 1);
+  }
+  size_t i = this->probe(length, tag, hash);
+  size_t slot = this->slots[i];
+  if (slot == 0) {
+    this->add(id, length, hash, i);
+  } else if (this->entries[slot - 1].id != id) {
+    this->entries[slot - 1].id = id;
+    this->nsorted = 0;
+  }
+}
+
+template<typename ID>
+inline
+bool RDFTermHashStore<ID>::empty() const throw() {
+  return this->entries.empty();
+}
+
+template<typename ID>
+typename RDFTermHashStore<ID>::const_iterator RDFTermHashStore<ID>::begin() {
+  this->sort();
+  return const_iterator(this, 0);
+}
+
+template<typename ID>
+typename RDFTermHashStore<ID>::const_iterator RDFTermHashStore<ID>::end() {
+  return const_iterator(this, this->byid.size());
+}
+
+template<typename ID>
+void RDFTermHashStore<ID>::clear() {
+  vector<uint8_t> newarena;
+  vector<entry> newentries;
+  vector<size_t> newslots(RDFTERMHASHSTORE_INIT_SLOTS, 0);
+  vector<size_t> newbyid;
+  this->arena.swap(newarena);
+  this->entries.swap(newentries);
+  this->slots.swap(newslots);
+  this->byid.swap(newbyid);
+  this->arena_size = 0;
+  this->nsorted = 0;
+}
+
+template<typename ID>
+void RDFTermHashStore<ID>::const_iterator::load() const {
+  if (!this->loaded) {
+    size_t index = this->store->byid[this->pos];
+    this->current.first = this->store->entries[index].id;
+    this->current.second = this->store->termAt(index);
+    this->loaded = true;
+  }
+}
+
+template<typename ID>
+const pair<ID, RDFTerm> &RDFTermHashStore<ID>::const_iterator::operator*()
+    const {
+  this->load();
+  return this->current;
+}
+
+template<typename ID>
+const pair<ID, RDFTerm> *RDFTermHashStore<ID>::const_iterator::operator->()
+    const {
+  this->load();
+  return &this->current;
+}
+
+template<typename ID>
+typename RDFTermHashStore<ID>::const_iterator &
+RDFTermHashStore<ID>::const_iterator::operator++() {
+  ++this->pos;
+  this->loaded = false;
+  return *this;
+}
+
+}
@@ -0,0 +1,137 @@
+/* Copyright 2012 Jesse Weaver
+ * 
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ * 
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ *    implied. See the License for the specific language governing
+ *    permissions and limitations under the License.
+ */
+
+#ifndef __RDF__RDFTERMSTORE_H__
+#define __RDF__RDFTERMSTORE_H__
+
+#include <map>
+#include <utility>
+#include <vector>
+#include "rdf/RDFTerm.h"
+#include "sys/ints.h"
+
+namespace rdf {
+
+using namespace std;
+
+// Storage policies for RDFDictionary.  A store maps terms to identifiers
+// and back, and iterates over (ID, RDFTerm) pairs in identifier order.
+
+// Keeps terms in a pair of maps ordered by RDFTerm::cmp and by ID.
+template<typename ID>
+class RDFTermMapStore {
+private:
+  typedef map<RDFTerm, ID, bool(*)(const RDFTerm &, const RDFTerm &)>
+      Term2IDMap;
+  typedef map<ID, RDFTerm> ID2TermMap;
+  Term2IDMap term2id;
+  ID2TermMap id2term;
+public:
+  typedef typename ID2TermMap::const_iterator const_iterator;
+
+  RDFTermMapStore() throw();
+  ~RDFTermMapStore() throw();
+
+  bool find(const RDFTerm &term, ID &id);
+  bool find(const ID &id, RDFTerm &term);
+  void insert(const RDFTerm &term, const ID &id);
+  void set(const RDFTerm &term, const ID &id);
+  bool empty() const throw();
+  const_iterator begin();
+  const_iterator end();
+  void clear();
+};
+
+// Interns the UTF-8 serialization of each term into one contiguous arena
+// and indexes it with an open-addressing hash table.  Language tags are
+// hashed and compared without regard to case, as RDFTerm::cmp does, but
+// are stored as given.  Identifier order is kept in an array of
+// entry indexes that is sorted lazily, because identifiers are almost
+// always handed out in increasing order.  Terms are parsed back out of
+// the arena when looked up by identifier or iterated over.
+template<typename ID>
+class RDFTermHashStore {
+private:
+  struct entry {
+    ID id;
+    size_t offset;
+    uint32_t length;
+    uint32_t hash;
+  };
+  struct id_order {
+    const vector<entry> *entries;
+    id_order(const vector<entry> *entries) : entries(entries) {}
+    bool operator()(const size_t a, const size_t b) const {
+      return (*entries)[a].id < (*entries)[b].id;
+    }
+  };
+  vector<uint8_t> arena;
+  size_t arena_size;
+  vector<entry> entries;
+  vector<size_t> slots;
+  vector<size_t> byid;
+  size_t nsorted;
+
+  void serialize(const RDFTerm &term, uint32_t &length, uint32_t &tag,
+                 uint32_t &hash);
+  size_t probe(const uint32_t length, const uint32_t tag,
+               const uint32_t hash) const throw();
+  void add(const ID &id, const uint32_t length, const uint32_t hash,
+           const size_t i);
+  void rehash(const size_t nslots);
+  void sort();
+  RDFTerm termAt(const size_t index) const;
+public:
+  class const_iterator {
+  private:
+    const RDFTermHashStore<ID> *store;
+    size_t pos;
+    mutable pair<ID, RDFTerm> current;
+    mutable bool loaded;
+    void load() const;
+  public:
+    const_iterator() : store(NULL), pos(0), loaded(false) {}
+    const_iterator(const RDFTermHashStore<ID> *store, const size_t pos)
+        : store(store), pos(pos), loaded(false) {}
+    const pair<ID, RDFTerm> &operator*() const;
+    const pair<ID, RDFTerm> *operator->() const;
+    const_iterator &operator++();
+    bool operator==(const const_iterator &rhs) const {
+      return this->pos == rhs.pos && this->store == rhs.store;
+    }
+    bool operator!=(const const_iterator &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+  friend class const_iterator;
+
+  RDFTermHashStore() throw();
+  ~RDFTermHashStore() throw();
+
+  bool find(const RDFTerm &term, ID &id);
+  bool find(const ID &id, RDFTerm &term);
+  void insert(const RDFTerm &term, const ID &id);
+  void set(const RDFTerm &term, const ID &id);
+  bool empty() const throw();
+  const_iterator begin();
+  const_iterator end();
+  void clear();
+};
+
+}
+
+#include "rdf/RDFTermStore-inl.h"
+
+#endif /* __RDF__RDFTERMSTORE_H__ */
@@ -15,7 +15,9 @@
 
 #include "test/unit.h"
 #include "rdf/RDFDictionary.h"
+#include "rdf/RDFInlineEncoder.h"
 
+#include <sstream>
 #include "ptr/DPtr.h"
 #include "rdf/RDFTerm.h"
 
@@ -132,12 +134,213 @@ bool test8() {
   PASS;
 }
 
+bool testHashStore() {
+  RDFDictionary<RDFID<8>, RDFEncoder<RDFID<8> >,
+                RDFTermHashStore<RDFID<8> > > dict;
+  const char *strs[] = {
+    "<tag:jrweave@gmail.com,2012:test>",
+    "_:blank",
+    "\"literal\"",
+    "\"literal\"@en-US",
+    "\"literal\"^^<http://www.w3.org/2001/XMLSchema#string>",
+    NULL
+  };
+  RDFID<8> ids[5];
+  size_t i;
+  for (i = 0; strs[i] != NULL; ++i) {
+    RDFTerm *term = s2t(strs[i]);
+    ids[i] = dict.encode(*term);
+    PROG(dict.encode(*term) == ids[i]);
+    DELETE(term);
+  }
+  for (i = 0; strs[i] != NULL; ++i) {
+    RDFTerm *term = s2t(strs[i]);
+    RDFID<8> id;
+    PROG(dict.lookup(*term, id));
+    PROG(id == ids[i]);
+    RDFTerm term2;
+    PROG(dict.lookup(id, term2));
+    PROG(term->equals(term2));
+    DELETE(term);
+  }
+
+  // language tags are case-insensitive
+  RDFTerm *term = s2t("\"literal\"@EN-us");
+  RDFID<8> id;
+  PROG(dict.lookup(*term, id));
+  PROG(id == ids[3]);
+  DELETE(term);
+
+  // but are kept as given
+  RDFTerm tagged;
+  PROG(dict.lookup(ids[3], tagged));
+  DPtr<uint8_t> *str = tagged.toUTF8String();
+  PROG(str->size() == strlen(strs[3]) &&
+       memcmp(str->dptr(), strs[3], str->size()) == 0);
+  str->drop();
+
+  term = s2t("\"unknown\"");
+  PROG(!dict.lookup(*term));
+  DELETE(term);
+
+  // enough terms to grow the arena and the hash table
+  for (i = 0; i < 5000; ++i) {
+    stringstream ss (stringstream::in | stringstream::out);
+    ss << "<tag:jrweave@gmail.com,2012:" << i << ">";
+    term = s2t(ss.str().c_str());
+    dict.encode(*term);
+    DELETE(term);
+  }
+  for (i = 0; i < 5000; i += 7) {
+    stringstream ss (stringstream::in | stringstream::out);
+    ss << "<tag:jrweave@gmail.com,2012:" << i << ">";
+    term = s2t(ss.str().c_str());
+    PROG(dict.lookup(*term, id));
+    RDFTerm term2;
+    PROG(dict.lookup(id, term2));
+    PROG(term->equals(term2));
+    DELETE(term);
+  }
+
+  // forced identifiers out of order are iterated in order
+  RDFID<8> forced = ids[0];
+  forced <<= 40;
+  term = s2t("<tag:jrweave@gmail.com,2012:forced>");
+  PROG(dict.force(forced, *term));
+  PROG(!dict.force(ids[0], *term));
+  DELETE(term);
+  RDFDictionary<RDFID<8>, RDFEncoder<RDFID<8> >,
+                RDFTermHashStore<RDFID<8> > >::const_iterator it =
+      dict.begin();
+  RDFID<8> prev = it->first;
+  size_t n = 1;
+  for (++it; it != dict.end(); ++it) {
+    PROG(prev < it->first);
+    prev = it->first;
+    ++n;
+  }
+  PROG(n == 5006);
+  PROG(prev == forced);
+
+  dict.clear();
+  PROG(dict.begin() == dict.end());
+  PASS;
+}
+
+// Encodes only the terms forced into its dictionary, as der does.
+class ForcedEncoder {
+public:
+  static RDFDictionary<RDFID<8> > dict;
+  bool operator()(const RDFTerm &term, RDFID<8> &id) {
+    return dict.lookup(term, id);
+  }
+  bool operator()(const RDFID<8> &id, RDFTerm &term) {
+    return dict.lookup(id, term);
+  }
+};
+
+RDFDictionary<RDFID<8> > ForcedEncoder::dict = RDFDictionary<RDFID<8> >();
+
+bool testInlineEncoder() {
+  typedef RDFInlineEncoder<RDFID<8> > Enc;
+  RDFDictionary<RDFID<8>, Enc> dict;
+  const char *inlined[] = {
+    "\"true\"^^<http://www.w3.org/2001/XMLSchema#boolean>",
+    "\"false\"^^<http://www.w3.org/2001/XMLSchema#boolean>",
+    "\"0\"^^<http://www.w3.org/2001/XMLSchema#integer>",
+    "\"-42\"^^<http://www.w3.org/2001/XMLSchema#integer>",
+    "\"123456789012345678\"^^<http://www.w3.org/2001/XMLSchema#long>",
+    "\"-32768\"^^<http://www.w3.org/2001/XMLSchema#short>",
+    "\"7\"^^<http://www.w3.org/2001/XMLSchema#int>",
+    "\"3.14\"^^<http://www.w3.org/2001/XMLSchema#decimal>",
+    "\"-0.050\"^^<http://www.w3.org/2001/XMLSchema#decimal>",
+    "\"12.\"^^<http://www.w3.org/2001/XMLSchema#decimal>",
+    "\"-0\"^^<http://www.w3.org/2001/XMLSchema#decimal>",
+    "\"2012-02-29\"^^<http://www.w3.org/2001/XMLSchema#date>",
+    "\"2012-02-29-05:00\"^^<http://www.w3.org/2001/XMLSchema#date>",
+    "\"1999-12-31T23:59:59\"^^<http://www.w3.org/2001/XMLSchema#dateTime>",
+    "\"1999-12-31T23:59:59Z\"^^<http://www.w3.org/2001/XMLSchema#dateTime>",
+    "\"1999-12-31T23:59:59+14:00\"^^<http://www.w3.org/2001/XMLSchema#dateTime>",
+    NULL
+  };
+  const char *notinlined[] = {
+    "\"1\"^^<http://www.w3.org/2001/XMLSchema#boolean>",
+    "\"007\"^^<http://www.w3.org/2001/XMLSchema#integer>",
+    "\"+7\"^^<http://www.w3.org/2001/XMLSchema#integer>",
+    "\"-0\"^^<http://www.w3.org/2001/XMLSchema#integer>",
+    "\"1234567890123456789012\"^^<http://www.w3.org/2001/XMLSchema#integer>",
+    "\".5\"^^<http://www.w3.org/2001/XMLSchema#decimal>",
+    "\"1.5e3\"^^<http://www.w3.org/2001/XMLSchema#double>",
+    "\"1999-12-31T23:59:59.5\"^^<http://www.w3.org/2001/XMLSchema#dateTime>",
+    "\"1999-13-31\"^^<http://www.w3.org/2001/XMLSchema#date>",
+    "\"42\"",
+    "<http://www.w3.org/2001/XMLSchema#integer>",
+    NULL
+  };
+  Enc enc;
+  size_t i;
+  for (i = 0; inlined[i] != NULL; ++i) {
+    RDFTerm *term = s2t(inlined[i]);
+    RDFID<8> id;
+    PROG(enc(*term, id));
+    RDFID<8> id2 = dict.encode(*term);
+    PROG(dict.begin() == dict.end());
+    RDFTerm term2;
+    PROG(dict.lookup(id2, term2));
+    PROG(term->equals(term2));
+    DELETE(term);
+  }
+  for (i = 0; notinlined[i] != NULL; ++i) {
+    RDFTerm *term = s2t(notinlined[i]);
+    RDFID<8> id;
+    PROG(!enc(*term, id));
+    RDFID<8> id2 = dict.encode(*term);
+    RDFTerm term2;
+    PROG(dict.lookup(id2, term2));
+    PROG(term->equals(term2));
+    DELETE(term);
+  }
+
+  // dates do not fit in smaller identifiers
+  RDFInlineEncoder<RDFID<4> > enc4;
+  RDFTerm *term = s2t(inlined[3]);
+  RDFID<4> id4;
+  PROG(enc4(*term, id4));
+  DELETE(term);
+  term = s2t(inlined[11]);
+  PROG(!enc4(*term, id4));
+  DELETE(term);
+
+  // forced terms keep their identifiers instead of being inlined
+  term = s2t(inlined[0]);
+  ForcedEncoder::dict.encode(*term);
+  RDFDictionary<RDFID<8>, ForcedEncoder> plain;
+  RDFDictionary<RDFID<8>, RDFInlineEncoder<RDFID<8>, ForcedEncoder> > mixed;
+  RDFID<8> id = mixed.encode(*term);
+  PROG(id == plain.encode(*term));
+  RDFTerm term2;
+  PROG(mixed.lookup(id, term2));
+  PROG(term->equals(term2));
+  DELETE(term);
+  term = s2t(inlined[1]);
+  id = mixed.encode(*term);
+  PROG(id != plain.encode(*term));
+  PROG(mixed.lookup(id, term2));
+  PROG(term->equals(term2));
+  PROG(mixed.begin() == mixed.end());
+  DELETE(term);
+  ForcedEncoder::dict.clear();
+  PASS;
+}
+
 int main(int argc, char **argv) {
   INIT;
 
   TEST(test8);
   TEST(testN<12>);
   TEST(testRDFID);
+  TEST(testHashStore);
+  TEST(testInlineEncoder);
 
   FINAL;
 }